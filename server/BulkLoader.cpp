@@ -0,0 +1,606 @@
+#include <stdexcept>
+#include <cstring>
+#include "BulkLoader.hpp"
+
+using namespace std;
+
+namespace MonQueue {
+
+template<typename T>
+static bool
+getLE( const char *& a_pos, const char * a_end, T & a_value ) {
+    if ( a_end - a_pos < (ptrdiff_t)sizeof( a_value )) {
+        return false;
+    }
+
+    a_value = 0;
+
+    for ( size_t i = 0; i < sizeof( a_value ); i++ ) {
+        a_value |= (T)(uint8_t)a_pos[i] << ( 8 * i );
+    }
+
+    a_pos += sizeof( a_value );
+
+    return true;
+}
+
+static bool
+getString( const char *& a_pos, const char * a_end, std::string & a_value ) {
+    uint32_t len;
+
+    if ( !getLE( a_pos, a_end, len ) || (uint64_t)( a_end - a_pos ) < len ) {
+        return false;
+    }
+
+    a_value.assign( a_pos, len );
+    a_pos += len;
+
+    return true;
+}
+
+static void
+skipSpace( const char *& a_pos, const char * a_end ) {
+    while ( a_pos < a_end && ( *a_pos == ' ' || *a_pos == '\t' || *a_pos == '\r' || *a_pos == '\n' )) {
+        a_pos++;
+    }
+}
+
+static void
+expect( const char *& a_pos, const char * a_end, char a_char ) {
+    if ( a_pos == a_end || *a_pos != a_char ) {
+        throw runtime_error( string( "Expected '" ) + a_char + "'" );
+    }
+
+    a_pos++;
+}
+
+static uint32_t
+parseHex4( const char *& a_pos, const char * a_end ) {
+    uint32_t code = 0;
+
+    if ( a_end - a_pos < 4 ) {
+        throw runtime_error( "Invalid unicode escape" );
+    }
+
+    for ( const char * end = a_pos + 4; a_pos < end; a_pos++ ) {
+        code <<= 4;
+
+        if ( *a_pos >= '0' && *a_pos <= '9' ) {
+            code |= *a_pos - '0';
+        } else if ( *a_pos >= 'a' && *a_pos <= 'f' ) {
+            code |= *a_pos - 'a' + 10;
+        } else if ( *a_pos >= 'A' && *a_pos <= 'F' ) {
+            code |= *a_pos - 'A' + 10;
+        } else {
+            throw runtime_error( "Invalid unicode escape" );
+        }
+    }
+
+    return code;
+}
+
+static void
+appendUtf8( std::string & a_value, uint32_t a_code ) {
+    if ( a_code < 0x80 ) {
+        a_value += (char)a_code;
+    } else if ( a_code < 0x800 ) {
+        a_value += (char)( 0xC0 | ( a_code >> 6 ));
+        a_value += (char)( 0x80 | ( a_code & 0x3F ));
+    } else if ( a_code < 0x10000 ) {
+        a_value += (char)( 0xE0 | ( a_code >> 12 ));
+        a_value += (char)( 0x80 | (( a_code >> 6 ) & 0x3F ));
+        a_value += (char)( 0x80 | ( a_code & 0x3F ));
+    } else {
+        a_value += (char)( 0xF0 | ( a_code >> 18 ));
+        a_value += (char)( 0x80 | (( a_code >> 12 ) & 0x3F ));
+        a_value += (char)( 0x80 | (( a_code >> 6 ) & 0x3F ));
+        a_value += (char)( 0x80 | ( a_code & 0x3F ));
+    }
+}
+
+/** @brief Construct loader for a_queue
+ */
+BulkLoader::BulkLoader( Queue & a_queue, size_t a_batch_size ) :
+    m_queue( a_queue ),
+    m_batch_size( a_batch_size ? a_batch_size : 1 ),
+    m_batch_count( 0 ),
+    m_records( 0 ),
+    m_pushed( 0 ),
+    m_skipped( 0 )
+{
+}
+
+/** @brief Load all records from a_in into the queue
+ *
+ * Reads until end of stream. Throws runtime_error if a record is invalid,
+ * cannot be pushed, or the stream cannot be read; the pushed and skipped
+ * counts then cover the records before the failing one.
+ */
+void
+BulkLoader::load( std::istream & a_in ) {
+    string buf;
+    size_t start = 0, consumed;
+    bool detected = false, binary = false, eof = false;
+
+    m_batch.resize( m_batch_size );
+    m_batch_count = 0;
+    m_records = 0;
+    m_pushed = 0;
+    m_skipped = 0;
+
+    try {
+        while ( !eof ) {
+            // Keep the unparsed tail of the previous block (a partial record)
+            buf.erase( 0, start );
+            start = 0;
+
+            size_t size = buf.size();
+
+            buf.resize( size + READ_BLOCK );
+            a_in.read( &buf[size], READ_BLOCK );
+            buf.resize( size + a_in.gcount() );
+
+            if ( a_in.bad() ) {
+                throw runtime_error( "Failed to read load stream" );
+            }
+
+            eof = !a_in;
+
+            if ( !detected ) {
+                uint32_t magic = 0, version = 0;
+                const char * pos = buf.data();
+
+                detected = true;
+
+                if ( getLE( pos, buf.data() + buf.size(), magic ) && magic == BINARY_MAGIC ) {
+                    if ( !getLE( pos, buf.data() + buf.size(), version ) || version != BINARY_VERSION ) {
+                        throw runtime_error( "Unsupported binary load format version" );
+                    }
+
+                    binary = true;
+                    start = BINARY_HEADER_SIZE;
+                }
+            }
+
+            if ( binary ) {
+                consumed = parseBinary( buf.data() + start, buf.data() + buf.size() );
+            } else {
+                consumed = parseText( buf.data() + start, buf.data() + buf.size(), eof );
+            }
+
+            start += consumed;
+
+            if ( buf.size() - start > MAX_RECORD ) {
+                m_records++;
+                throw runtime_error( "Record too large" );
+            }
+        }
+
+        if ( start != buf.size() ) {
+            m_records++;
+            throw runtime_error( "Truncated record" );
+        }
+
+        flush();
+    } catch ( exception & e ) {
+        string msg = recordError( e.what() );
+
+        // Records parsed before the failing one are still pushed
+        try {
+            flush();
+        } catch ( exception & f ) {
+            msg = recordError( f.what() );
+        }
+
+        throw runtime_error( msg );
+    }
+}
+
+/** @brief Get number of messages pushed by last load
+ */
+size_t
+BulkLoader::getPushed() const {
+    return m_pushed;
+}
+
+/** @brief Get number of messages skipped by last load (ID already queued)
+ */
+size_t
+BulkLoader::getSkipped() const {
+    return m_skipped;
+}
+
+/** @brief Parse complete lines in buffer, returns number of bytes consumed
+ *
+ * A final line without a newline is parsed only at end of stream.
+ */
+size_t
+BulkLoader::parseText( const char * a_pos, const char * a_end, bool a_final ) {
+    const char * start = a_pos;
+
+    while ( a_pos < a_end ) {
+        const char * nl = (const char *)memchr( a_pos, '\n', a_end - a_pos );
+
+        if ( !nl ) {
+            if ( !a_final ) {
+                break;
+            }
+
+            nl = a_end;
+        }
+
+        skipSpace( a_pos, nl );
+
+        if ( a_pos < nl ) {
+            m_records++;
+            parseLine( a_pos, nl, nextMsg() );
+            m_batch_count++;
+        }
+
+        a_pos = nl == a_end ? a_end : nl + 1;
+    }
+
+    return a_pos - start;
+}
+
+/** @brief Parse complete binary records in buffer, returns number of bytes consumed
+ */
+size_t
+BulkLoader::parseBinary( const char * a_pos, const char * a_end ) {
+    const char * start = a_pos;
+    uint32_t len, count;
+    uint8_t priority, max_retries;
+    uint32_t delay, ack_timeout, due, ttl;
+
+    while ( a_end - a_pos >= 4 ) {
+        const char * pos = a_pos;
+
+        getLE( pos, a_end, len );
+
+        if ( len > MAX_RECORD ) {
+            m_records++;
+            throw runtime_error( "Record too large" );
+        }
+
+        if ( (size_t)( a_end - pos ) < len ) {
+            break;
+        }
+
+        const char * end = pos + len;
+        Queue::PushMsg_t & msg = nextMsg();
+
+        m_records++;
+
+        if ( !getLE( pos, end, priority ) || !getLE( pos, end, max_retries ) || !getLE( pos, end, delay ) ||
+            !getLE( pos, end, ack_timeout ) || !getLE( pos, end, due ) || !getLE( pos, end, ttl ) ||
+            !getString( pos, end, msg.id ) || !getString( pos, end, msg.opts.msg_class ) ||
+            !getString( pos, end, msg.opts.tenant ) || !getString( pos, end, msg.opts.group ) ||
+            !getString( pos, end, msg.opts.affinity ) || !getString( pos, end, msg.opts.batch ) ||
+            !getLE( pos, end, count ) || count > Queue::MAX_DEPENDS ) {
+            throw runtime_error( "Invalid binary record" );
+        }
+
+        msg.priority = priority;
+        msg.delay = delay;
+        msg.opts.ack_timeout = ack_timeout;
+        msg.opts.max_retries = max_retries;
+        msg.opts.due = due;
+        msg.opts.ttl = ttl;
+        msg.opts.depends.resize( count );
+
+        for ( uint32_t d = 0; d < count; d++ ) {
+            if ( !getString( pos, end, msg.opts.depends[d] )) {
+                throw runtime_error( "Invalid binary record" );
+            }
+        }
+
+        if ( pos != end ) {
+            throw runtime_error( "Invalid binary record" );
+        }
+
+        m_batch_count++;
+        a_pos = end;
+    }
+
+    return a_pos - start;
+}
+
+/** @brief Parse one text record (flat JSON object) into a_msg
+ */
+void
+BulkLoader::parseLine( const char * a_pos, const char * a_end, Queue::PushMsg_t & a_msg ) {
+    bool has_id = false, has_pri = false;
+
+    expect( a_pos, a_end, '{' );
+    skipSpace( a_pos, a_end );
+
+    if ( a_pos < a_end && *a_pos == '}' ) {
+        a_pos++;
+    } else {
+        while ( true ) {
+            parseString( a_pos, a_end, m_key );
+            skipSpace( a_pos, a_end );
+            expect( a_pos, a_end, ':' );
+            skipSpace( a_pos, a_end );
+
+            if ( m_key == "id" ) {
+                parseString( a_pos, a_end, a_msg.id );
+                has_id = true;
+            } else if ( m_key == "pri" ) {
+                size_t priority = parseNumber( a_pos, a_end );
+
+                if ( priority > UINT8_MAX ) {
+                    throw runtime_error( "Invalid queue priority" );
+                }
+
+                a_msg.priority = (uint8_t)priority;
+                has_pri = true;
+            } else if ( m_key == "del" ) {
+                a_msg.delay = parseNumber( a_pos, a_end );
+            } else if ( m_key == "tmo" ) {
+                a_msg.opts.ack_timeout = parseNumber( a_pos, a_end );
+            } else if ( m_key == "ret" ) {
+                a_msg.opts.max_retries = parseNumber( a_pos, a_end );
+            } else if ( m_key == "due" ) {
+                a_msg.opts.due = parseNumber( a_pos, a_end );
+            } else if ( m_key == "ttl" ) {
+                a_msg.opts.ttl = parseNumber( a_pos, a_end );
+            } else if ( m_key == "cls" ) {
+                parseString( a_pos, a_end, a_msg.opts.msg_class );
+            } else if ( m_key == "tnt" ) {
+                parseString( a_pos, a_end, a_msg.opts.tenant );
+            } else if ( m_key == "grp" ) {
+                parseString( a_pos, a_end, a_msg.opts.group );
+            } else if ( m_key == "aff" ) {
+                parseString( a_pos, a_end, a_msg.opts.affinity );
+            } else if ( m_key == "bat" ) {
+                parseString( a_pos, a_end, a_msg.opts.batch );
+            } else if ( m_key == "dep" ) {
+                expect( a_pos, a_end, '[' );
+                skipSpace( a_pos, a_end );
+
+                if ( a_pos < a_end && *a_pos == ']' ) {
+                    a_pos++;
+                } else {
+                    while ( true ) {
+                        a_msg.opts.depends.push_back( string() );
+                        parseString( a_pos, a_end, a_msg.opts.depends.back() );
+                        skipSpace( a_pos, a_end );
+
+                        if ( a_pos < a_end && *a_pos == ',' ) {
+                            a_pos++;
+                            skipSpace( a_pos, a_end );
+                            continue;
+                        }
+
+                        expect( a_pos, a_end, ']' );
+                        break;
+                    }
+                }
+            } else {
+                skipValue( a_pos, a_end );
+            }
+
+            skipSpace( a_pos, a_end );
+
+            if ( a_pos < a_end && *a_pos == ',' ) {
+                a_pos++;
+                skipSpace( a_pos, a_end );
+                continue;
+            }
+
+            expect( a_pos, a_end, '}' );
+            break;
+        }
+    }
+
+    skipSpace( a_pos, a_end );
+
+    if ( a_pos != a_end ) {
+        throw runtime_error( "Unexpected data after object" );
+    }
+
+    if ( !has_id || !has_pri ) {
+        throw runtime_error( "Missing id or pri" );
+    }
+}
+
+/** @brief Parse JSON string at a_pos into a_value
+ */
+void
+BulkLoader::parseString( const char *& a_pos, const char * a_end, std::string & a_value ) {
+    if ( a_pos == a_end || *a_pos != '"' ) {
+        throw runtime_error( "Expected string" );
+    }
+
+    a_pos++;
+    a_value.clear();
+
+    while ( true ) {
+        const char * start = a_pos;
+
+        while ( a_pos < a_end && *a_pos != '"' && *a_pos != '\\' && (uint8_t)*a_pos >= 0x20 ) {
+            a_pos++;
+        }
+
+        a_value.append( start, a_pos - start );
+
+        if ( a_pos == a_end ) {
+            throw runtime_error( "Unterminated string" );
+        }
+
+        if ( *a_pos == '"' ) {
+            a_pos++;
+            return;
+        }
+
+        if ( *a_pos != '\\' || ++a_pos == a_end ) {
+            throw runtime_error( "Invalid string" );
+        }
+
+        switch ( *a_pos++ ) {
+        case '"': a_value += '"'; break;
+        case '\\': a_value += '\\'; break;
+        case '/': a_value += '/'; break;
+        case 'b': a_value += '\b'; break;
+        case 'f': a_value += '\f'; break;
+        case 'n': a_value += '\n'; break;
+        case 'r': a_value += '\r'; break;
+        case 't': a_value += '\t'; break;
+        case 'u': {
+            uint32_t code = parseHex4( a_pos, a_end );
+
+            // Surrogate pair
+            if ( code >= 0xD800 && code < 0xDC00 ) {
+                uint32_t low;
+
+                if ( a_end - a_pos < 2 || a_pos[0] != '\\' || a_pos[1] != 'u' ) {
+                    throw runtime_error( "Invalid unicode escape" );
+                }
+
+                a_pos += 2;
+                low = parseHex4( a_pos, a_end );
+
+                if ( low < 0xDC00 || low > 0xDFFF ) {
+                    throw runtime_error( "Invalid unicode escape" );
+                }
+
+                code = 0x10000 + (( code - 0xD800 ) << 10 ) + ( low - 0xDC00 );
+            } else if ( code >= 0xDC00 && code <= 0xDFFF ) {
+                throw runtime_error( "Invalid unicode escape" );
+            }
+
+            appendUtf8( a_value, code );
+            break;
+        }
+        default:
+            throw runtime_error( "Invalid string escape" );
+        }
+    }
+}
+
+/** @brief Parse unsigned integer at a_pos
+ */
+size_t
+BulkLoader::parseNumber( const char *& a_pos, const char * a_end ) {
+    size_t value = 0;
+    const char * start = a_pos;
+
+    while ( a_pos < a_end && *a_pos >= '0' && *a_pos <= '9' ) {
+        size_t digit = *a_pos++ - '0';
+
+        if ( value > ( SIZE_MAX - digit ) / 10 ) {
+            throw runtime_error( "Number out of range" );
+        }
+
+        value = value * 10 + digit;
+    }
+
+    if ( a_pos == start || ( a_pos < a_end && ( *a_pos == '.' || *a_pos == 'e' || *a_pos == 'E' ))) {
+        throw runtime_error( "Expected unsigned integer" );
+    }
+
+    return value;
+}
+
+/** @brief Skip value of an unrecognized field (string, number or literal)
+ */
+void
+BulkLoader::skipValue( const char *& a_pos, const char * a_end ) {
+    static const char * literals[] = { "true", "false", "null" };
+
+    if ( a_pos < a_end && *a_pos == '"' ) {
+        parseString( a_pos, a_end, m_key );
+        return;
+    }
+
+    const char * start = a_pos;
+
+    while ( a_pos < a_end && ( strchr( "+-.eE", *a_pos ) || ( *a_pos >= '0' && *a_pos <= '9' ))) {
+        a_pos++;
+    }
+
+    if ( a_pos != start ) {
+        return;
+    }
+
+    for ( size_t i = 0; i < 3; i++ ) {
+        size_t len = strlen( literals[i] );
+
+        if ( (size_t)( a_end - a_pos ) >= len && memcmp( a_pos, literals[i], len ) == 0 ) {
+            a_pos += len;
+            return;
+        }
+    }
+
+    throw runtime_error( "Unsupported field value" );
+}
+
+/** @brief Get cleared push request for next record, pushing a full batch first
+ */
+Queue::PushMsg_t &
+BulkLoader::nextMsg() {
+    if ( m_batch_count == m_batch.size() ) {
+        flush();
+    }
+
+    Queue::PushMsg_t & msg = m_batch[m_batch_count];
+
+    // Cleared rather than reassigned to reuse string buffers
+    msg.id.clear();
+    msg.priority = 0;
+    msg.delay = 0;
+    msg.opts.ack_timeout = 0;
+    msg.opts.max_retries = 0;
+    msg.opts.due = 0;
+    msg.opts.ttl = 0;
+    msg.opts.msg_class.clear();
+    msg.opts.tenant.clear();
+    msg.opts.group.clear();
+    msg.opts.affinity.clear();
+    msg.opts.batch.clear();
+    msg.opts.depends.clear();
+
+    return msg;
+}
+
+/** @brief Push parsed requests of current batch
+ *
+ * On a push error, the messages before the failing one are counted and the
+ * failing message becomes the current record.
+ */
+void
+BulkLoader::flush() {
+    size_t pushed = 0, skipped = 0;
+
+    if ( !m_batch_count ) {
+        return;
+    }
+
+    // Only a final (or failed) batch is partial
+    m_batch.resize( m_batch_count );
+    m_batch_count = 0;
+
+    try {
+        m_queue.pushBatch( m_batch, pushed, skipped );
+    } catch ( exception & e ) {
+        m_pushed += pushed;
+        m_skipped += skipped;
+        m_records = m_pushed + m_skipped + 1;
+
+        throw;
+    }
+
+    m_pushed += pushed;
+    m_skipped += skipped;
+    m_batch.resize( m_batch_size );
+}
+
+/** @brief Format error for the current record
+ */
+std::string
+BulkLoader::recordError( const std::string & a_msg ) const {
+    return "Record " + to_string( m_records ) + ": " + a_msg;
+}
+
+} // MonQueue namespace
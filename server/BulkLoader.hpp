@@ -0,0 +1,71 @@
+#ifndef BULKLOADER_HPP
+#define BULKLOADER_HPP
+
+#include <cstdint>
+#include <string>
+#include <istream>
+#include "Queue.hpp"
+
+namespace MonQueue {
+
+/** @brief Streaming bulk loader for (re)populating a queue
+ *
+ * Reads push records from a stream in large blocks, parses them in place
+ * into a reused batch of push requests, and pushes each full batch with a
+ * single Queue::pushBatch call, so that neither a document tree nor a lock
+ * round per message is needed. Messages whose ID is already in the queue
+ * are skipped. Two record formats are accepted, detected from the first
+ * bytes of the stream:
+ *
+ * - Text: one JSON object per line, with the fields of a /push entry (see
+ *   QueueServer). Objects must be flat; dep is an array of strings, numeric
+ *   fields are unsigned integers, and blank lines are ignored.
+ * - Binary: an 8-byte header (u32 magic "MQBL", u32 version 1), then one
+ *   record per message: u32 payload length, u8 priority, u8 max retries,
+ *   u32 delay, ACK timeout, due and TTL (msec), u32-prefixed ID, class,
+ *   tenant, group, affinity and batch strings, and a u32 count of
+ *   u32-prefixed prerequisite IDs. Integers are little-endian.
+ *
+ * Loading stops at the first invalid record or push error, with an exception
+ * giving the record number; records before it remain pushed.
+ */
+class BulkLoader {
+public:
+    BulkLoader( Queue & a_queue, size_t a_batch_size = DEFAULT_BATCH );
+
+    void            load( std::istream & a_in );
+    size_t          getPushed() const;
+    size_t          getSkipped() const;
+
+    static const size_t     DEFAULT_BATCH = 10000;  ///< Messages pushed per lock acquisition
+    static const uint32_t   BINARY_MAGIC = 0x4c42514d;///< Binary stream magic ("MQBL")
+    static const uint32_t   BINARY_VERSION = 1;     ///< Binary format version
+
+private:
+    static const size_t     READ_BLOCK = 1048576;   ///< Bytes read from stream per block
+    static const size_t     BINARY_HEADER_SIZE = 8; ///< Magic and version
+    static const size_t     MAX_RECORD = 16777216;  ///< Max binary record or text line size
+
+    size_t          parseText( const char * a_pos, const char * a_end, bool a_final );
+    size_t          parseBinary( const char * a_pos, const char * a_end );
+    void            parseLine( const char * a_pos, const char * a_end, Queue::PushMsg_t & a_msg );
+    static void     parseString( const char *& a_pos, const char * a_end, std::string & a_value );
+    static size_t   parseNumber( const char *& a_pos, const char * a_end );
+    void            skipValue( const char *& a_pos, const char * a_end );
+    Queue::PushMsg_t & nextMsg();
+    void            flush();
+    std::string     recordError( const std::string & a_msg ) const;
+
+    Queue                     & m_queue;        ///< Queue being loaded
+    size_t                      m_batch_size;   ///< Messages pushed per batch
+    Queue::PushMsgList_t        m_batch;        ///< Reused push requests
+    size_t                      m_batch_count;  ///< Requests filled in current batch
+    size_t                      m_records;      ///< Records parsed
+    size_t                      m_pushed;       ///< Messages pushed
+    size_t                      m_skipped;      ///< Messages skipped (ID already queued)
+    std::string                 m_key;          ///< Field name being parsed
+};
+
+} // MonQueue namespace
+
+#endif
@@ -0,0 +1,260 @@
+#include <stdexcept>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "DeadLetterFile.hpp"
+
+using namespace std;
+
+namespace MonQueue {
+
+/** @brief Open (or create) dead-letter file at a_path
+ *
+ * Throws if the files cannot be opened or the index is not a valid
+ * dead-letter index.
+ */
+DeadLetterFile::DeadLetterFile( const std::string & a_path ) :
+    m_data_fd( -1 ),
+    m_index_fd( -1 ),
+    m_data_size( 0 ),
+    m_capacity( 0 ),
+    m_header( 0 ),
+    m_entries( 0 )
+{
+    struct stat st;
+
+    m_data_fd = open( a_path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644 );
+    if ( m_data_fd < 0 ) {
+        throw runtime_error( string( "Failed to open dead-letter file: " ) + strerror( errno ));
+    }
+
+    m_index_fd = open(( a_path + ".idx" ).c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644 );
+    if ( m_index_fd < 0 || fstat( m_index_fd, &st ) < 0 ) {
+        int err = errno;
+        close( m_data_fd );
+        if ( m_index_fd >= 0 ) {
+            close( m_index_fd );
+        }
+        throw runtime_error( string( "Failed to open dead-letter index: " ) + strerror( err ));
+    }
+
+    try {
+        bool created = st.st_size == 0;
+
+        if ( !created && ( (size_t)st.st_size < sizeof( Header_t ) || ( st.st_size - sizeof( Header_t )) % sizeof( IndexEntry_t ))) {
+            throw runtime_error( "Invalid dead-letter index size" );
+        }
+
+        mapIndex( created ? INDEX_GROWTH : ( st.st_size - sizeof( Header_t )) / sizeof( IndexEntry_t ));
+
+        if ( created ) {
+            m_header->magic = MAGIC;
+            m_header->version = VERSION;
+            m_header->count = 0;
+        } else if ( m_header->magic != MAGIC || m_header->version != VERSION || m_header->count > m_capacity ) {
+            throw runtime_error( "Invalid dead-letter index header" );
+        }
+
+        // Discard any partially appended record after last indexed record
+        if ( m_header->count ) {
+            uint32_t len;
+            uint64_t offset = m_entries[m_header->count - 1].offset;
+
+            if ( pread( m_data_fd, &len, sizeof( len ), offset ) != sizeof( len )) {
+                throw runtime_error( "Dead-letter data file truncated" );
+            }
+
+            m_data_size = offset + sizeof( len ) + len;
+        }
+
+        if ( ftruncate( m_data_fd, m_data_size ) < 0 ) {
+            throw runtime_error( string( "Failed to truncate dead-letter file: " ) + strerror( errno ));
+        }
+    } catch ( ... ) {
+        if ( m_header ) {
+            munmap( m_header, sizeof( Header_t ) + m_capacity * sizeof( IndexEntry_t ));
+        }
+        close( m_data_fd );
+        close( m_index_fd );
+        throw;
+    }
+}
+
+DeadLetterFile::~DeadLetterFile() {
+    munmap( m_header, sizeof( Header_t ) + m_capacity * sizeof( IndexEntry_t ));
+    close( m_data_fd );
+    close( m_index_fd );
+}
+
+/** @brief Append record (sequence number must exceed that of last record)
+ *
+ * Data is written before the index entry and count, so a record is only
+ * visible once fully written.
+ */
+void
+DeadLetterFile::append( const Record_t & a_record ) {
+    if ( m_header->count && a_record.seq <= m_entries[m_header->count - 1].seq ) {
+        throw logic_error( "Dead-letter records out of order" );
+    }
+
+    if ( a_record.id.size() > UINT16_MAX || a_record.checkpoint.size() > UINT32_MAX - RECORD_HEADER_SIZE - UINT16_MAX ) {
+        throw length_error( "Dead-letter record too large" );
+    }
+
+    uint16_t id_len = (uint16_t)a_record.id.size();
+    uint32_t chk_len = (uint32_t)a_record.checkpoint.size();
+    uint32_t len = RECORD_HEADER_SIZE - sizeof( len ) + id_len + chk_len;
+    string buf( sizeof( len ) + len, '\0' );
+    char * p = &buf[0];
+
+    memcpy( p, &len, sizeof( len ));                    p += sizeof( len );
+    memcpy( p, &a_record.seq, sizeof( a_record.seq ));  p += sizeof( a_record.seq );
+    *p++ = (char)a_record.priority;
+    *p++ = (char)a_record.fail_count;
+    memcpy( p, &id_len, sizeof( id_len ));              p += sizeof( id_len );
+    memcpy( p, &chk_len, sizeof( chk_len ));            p += sizeof( chk_len );
+    memcpy( p, a_record.id.data(), id_len );            p += id_len;
+    memcpy( p, a_record.checkpoint.data(), chk_len );
+
+    if ( pwrite( m_data_fd, buf.data(), buf.size(), m_data_size ) != (ssize_t)buf.size() ) {
+        throw runtime_error( string( "Failed to write dead-letter file: " ) + strerror( errno ));
+    }
+
+    if ( m_header->count == m_capacity ) {
+        mapIndex( m_capacity + INDEX_GROWTH );
+    }
+
+    m_entries[m_header->count].seq = a_record.seq;
+    m_entries[m_header->count].offset = m_data_size;
+    m_header->count++;
+
+    m_data_size += buf.size();
+}
+
+/// Number of records
+size_t
+DeadLetterFile::size() const {
+    return m_header->count;
+}
+
+/// Sequence number of last record (0 if none)
+uint64_t
+DeadLetterFile::lastSeq() const {
+    return m_header->count ? m_entries[m_header->count - 1].seq : 0;
+}
+
+/// Returns true if there are records with sequence number greater than a_seq
+bool
+DeadLetterFile::hasAfter( uint64_t a_seq ) const {
+    return m_header->count && m_entries[m_header->count - 1].seq > a_seq;
+}
+
+/** @brief Read IDs of up to a_limit records following a_cursor
+ *
+ * Appends the IDs of records with sequence number greater than a_cursor to
+ * a_ids, in order, and sets a_cursor to the sequence number of the last
+ * record read.
+ */
+void
+DeadLetterFile::readIds( uint64_t & a_cursor, size_t a_limit, std::vector<std::string> & a_ids ) const {
+    Record_t rec;
+
+    for ( size_t i = lowerBound( a_cursor + 1 ); i < m_header->count && a_limit; i++, a_limit-- ) {
+        if ( !read( i, rec )) {
+            throw runtime_error( "Failed to read dead-letter file" );
+        }
+
+        a_ids.push_back( rec.id );
+        a_cursor = rec.seq;
+    }
+}
+
+/** @brief Read record by position (0 = oldest)
+ *
+ * Returns false if a_index is out of range or the record cannot be read.
+ */
+bool
+DeadLetterFile::read( size_t a_index, Record_t & a_record ) const {
+    if ( a_index >= m_header->count ) {
+        return false;
+    }
+
+    uint64_t offset = m_entries[a_index].offset;
+    char head[RECORD_HEADER_SIZE];
+    uint32_t len, chk_len;
+    uint16_t id_len;
+
+    if ( pread( m_data_fd, head, sizeof( head ), offset ) != (ssize_t)sizeof( head )) {
+        return false;
+    }
+
+    memcpy( &len, head, sizeof( len ));
+    memcpy( &a_record.seq, head + 4, sizeof( a_record.seq ));
+    a_record.priority = (uint8_t)head[12];
+    a_record.fail_count = (uint8_t)head[13];
+    memcpy( &id_len, head + 14, sizeof( id_len ));
+    memcpy( &chk_len, head + 16, sizeof( chk_len ));
+
+    if ( len != RECORD_HEADER_SIZE - sizeof( len ) + id_len + chk_len ) {
+        return false;
+    }
+
+    string body( id_len + chk_len, '\0' );
+
+    if ( body.size() && pread( m_data_fd, &body[0], body.size(), offset + sizeof( head )) != (ssize_t)body.size() ) {
+        return false;
+    }
+
+    a_record.id.assign( body, 0, id_len );
+    a_record.checkpoint.assign( body, id_len, chk_len );
+
+    return true;
+}
+
+/** @brief Extend index file (if needed) and map a_capacity entries
+ */
+void
+DeadLetterFile::mapIndex( size_t a_capacity ) {
+    size_t size = sizeof( Header_t ) + a_capacity * sizeof( IndexEntry_t );
+    struct stat st;
+
+    if ( fstat( m_index_fd, &st ) < 0 || ( (size_t)st.st_size < size && ftruncate( m_index_fd, size ) < 0 )) {
+        throw runtime_error( string( "Failed to extend dead-letter index: " ) + strerror( errno ));
+    }
+
+    void * addr = mmap( 0, size, PROT_READ | PROT_WRITE, MAP_SHARED, m_index_fd, 0 );
+
+    if ( addr == MAP_FAILED ) {
+        throw runtime_error( string( "Failed to map dead-letter index: " ) + strerror( errno ));
+    }
+
+    if ( m_header ) {
+        munmap( m_header, sizeof( Header_t ) + m_capacity * sizeof( IndexEntry_t ));
+    }
+
+    m_header = (Header_t *)addr;
+    m_entries = (IndexEntry_t *)( (char *)addr + sizeof( Header_t ));
+    m_capacity = a_capacity;
+}
+
+/// Position of first record with sequence number not less than a_seq
+size_t
+DeadLetterFile::lowerBound( uint64_t a_seq ) const {
+    size_t lo = 0, hi = m_header->count, mid;
+
+    while ( lo < hi ) {
+        mid = lo + ( hi - lo ) / 2;
+        if ( m_entries[mid].seq < a_seq ) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    return lo;
+}
+
+} // MonQueue namespace
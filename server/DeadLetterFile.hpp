@@ -0,0 +1,78 @@
+#ifndef DEADLETTERFILE_HPP
+#define DEADLETTERFILE_HPP
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace MonQueue {
+
+/** @brief Append-only dead-letter file for spilled failed messages
+ *
+ * Records are appended to a data file in a compact binary format (length-
+ * prefixed, with fixed-size header fields followed by the message ID and
+ * checkpoint data), and a fixed-size entry (failure sequence number and data
+ * offset) is appended to a separate index file, which is memory-mapped so
+ * that records can be located by sequence number with a binary search and
+ * listed in pages without reading the data file sequentially. The index file
+ * ("<path>.idx") begins with a small header holding the record count, which
+ * is updated after each record is written; on open, any data beyond the last
+ * indexed record (e.g. from a crash mid-append) is discarded. Records must be
+ * appended in increasing sequence order. Not thread-safe.
+ */
+class DeadLetterFile {
+public:
+    /// @brief Dead-letter record
+    struct Record_t {
+        Record_t() : seq( 0 ), priority( 0 ), fail_count( 0 ) {}
+
+        uint64_t        seq;            ///< Failure sequence number
+        std::string     id;             ///< Message ID
+        uint8_t         priority;       ///< Message priority
+        uint8_t         fail_count;     ///< Number of failed attempts
+        std::string     checkpoint;     ///< Last saved progress checkpoint
+    };
+
+    DeadLetterFile( const std::string & a_path );
+    ~DeadLetterFile();
+
+    void            append( const Record_t & a_record );
+    size_t          size() const;
+    uint64_t        lastSeq() const;
+    bool            hasAfter( uint64_t a_seq ) const;
+    void            readIds( uint64_t & a_cursor, size_t a_limit, std::vector<std::string> & a_ids ) const;
+    bool            read( size_t a_index, Record_t & a_record ) const;
+
+private:
+    /// Index file header
+    struct Header_t {
+        uint32_t        magic;          ///< File type identifier
+        uint32_t        version;        ///< Format version
+        uint64_t        count;          ///< Number of records
+    };
+
+    /// Index file entry
+    struct IndexEntry_t {
+        uint64_t        seq;            ///< Failure sequence number
+        uint64_t        offset;         ///< Record offset in data file
+    };
+
+    static const uint32_t   MAGIC = 0x4C44514D;     ///< "MQDL"
+    static const uint32_t   VERSION = 1;
+    static const size_t     INDEX_GROWTH = 65536;   ///< Index entries added per file extension
+    static const size_t     RECORD_HEADER_SIZE = 20;///< Length, seq, priority, fail count, ID and checkpoint lengths
+
+    void            mapIndex( size_t a_capacity );
+    size_t          lowerBound( uint64_t a_seq ) const;
+
+    int                     m_data_fd;      ///< Data file descriptor
+    int                     m_index_fd;     ///< Index file descriptor
+    uint64_t                m_data_size;    ///< Data file size (next record offset)
+    size_t                  m_capacity;     ///< Index entries that fit in mapping
+    Header_t              * m_header;       ///< Mapped index header
+    IndexEntry_t          * m_entries;      ///< Mapped index entries
+};
+
+} // MonQueue namespace
+
+#endif
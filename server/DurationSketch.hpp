@@ -0,0 +1,114 @@
+#ifndef DURATIONSKETCH_HPP
+#define DURATIONSKETCH_HPP
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+
+namespace MonQueue {
+
+/** @brief Streaming quantile sketch for durations
+ *
+ * DurationSketch records durations (in msec) into a fixed set of log-linear
+ * buckets (16 linear sub-buckets per power of two, so quantile estimates are
+ * within ~6% of the true value) and answers quantile queries without storing
+ * samples. To track recent behavior, all bucket counts are halved whenever
+ * the total reaches twice the configured window size, so older samples decay
+ * geometrically. Recording is constant-time; quantile queries are linear in
+ * the (fixed) number of buckets. Not thread-safe.
+ */
+class DurationSketch {
+public:
+    DurationSketch( uint32_t a_window = 1000 ) : m_window( a_window ? a_window : 1 ), m_count( 0 ) {
+        memset( m_buckets, 0, sizeof( m_buckets ));
+    }
+
+    /// Record a duration
+    void add( uint64_t a_msec ) {
+        m_buckets[bucketIndex( a_msec )]++;
+
+        if ( ++m_count >= 2 * m_window ) {
+            decay();
+        }
+    }
+
+    /// Current (decayed) number of samples
+    uint32_t count() const {
+        return m_count;
+    }
+
+    /// Estimate the a_q quantile (0.0 to 1.0); returns bucket upper bound, or 0 if empty
+    uint64_t quantile( double a_q ) const {
+        if ( !m_count ) {
+            return 0;
+        }
+
+        uint64_t rank = (uint64_t)( a_q * m_count );
+        uint64_t sum = 0;
+
+        if ( rank >= m_count ) {
+            rank = m_count - 1;
+        }
+
+        for ( size_t i = 0; i < BUCKET_COUNT; i++ ) {
+            sum += m_buckets[i];
+            if ( sum > rank ) {
+                return bucketLimit( i );
+            }
+        }
+
+        return bucketLimit( BUCKET_COUNT - 1 );
+    }
+
+    void clear() {
+        memset( m_buckets, 0, sizeof( m_buckets ));
+        m_count = 0;
+    }
+
+private:
+    static const unsigned SUB_BITS = 4;                         ///< log2 of sub-buckets per power of two
+    static const unsigned SUB_COUNT = 1 << SUB_BITS;            ///< Sub-buckets per power of two
+    static const unsigned MAX_EXP = 47;                         ///< Largest tracked power of two (larger values clamp)
+    static const size_t BUCKET_COUNT = SUB_COUNT * ( MAX_EXP - SUB_BITS + 2 );
+
+    static size_t bucketIndex( uint64_t a_value ) {
+        if ( a_value < SUB_COUNT ) {
+            return (size_t)a_value;
+        }
+
+        unsigned e = 63 - __builtin_clzll( a_value );
+
+        if ( e > MAX_EXP ) {
+            return BUCKET_COUNT - 1;
+        }
+
+        return SUB_COUNT * ( e - SUB_BITS + 1 ) + (( a_value >> ( e - SUB_BITS )) & ( SUB_COUNT - 1 ));
+    }
+
+    static uint64_t bucketLimit( size_t a_index ) {
+        if ( a_index < SUB_COUNT ) {
+            return a_index;
+        }
+
+        unsigned e = a_index / SUB_COUNT + SUB_BITS - 1;
+        uint64_t sub = a_index % SUB_COUNT;
+
+        return (( SUB_COUNT + sub + 1 ) << ( e - SUB_BITS )) - 1;
+    }
+
+    void decay() {
+        m_count = 0;
+        for ( size_t i = 0; i < BUCKET_COUNT; i++ ) {
+            m_buckets[i] >>= 1;
+            m_count += m_buckets[i];
+        }
+    }
+
+    uint32_t    m_window;                   ///< Approximate number of recent samples retained
+    uint32_t    m_count;                    ///< Total of bucket counts
+    uint32_t    m_buckets[BUCKET_COUNT];    ///< Log-linear bucket counts
+};
+
+} // MonQueue namespace
+
+#endif
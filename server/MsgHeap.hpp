@@ -0,0 +1,154 @@
+#ifndef MSGHEAP_HPP
+#define MSGHEAP_HPP
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+namespace MonQueue {
+
+/** @brief Indexed d-ary min-heap of elements ordered by (key, seq)
+ *
+ * Sort keys are stored inline with element pointers so that sifting compares
+ * contiguous nodes without dereferencing elements, and the 4-ary layout keeps
+ * a node's children in one or two cache lines while halving tree depth
+ * compared to a binary heap. Each element records its current heap index in
+ * the member specified by the Pos template parameter (NPOS when not in the
+ * heap), which allows removal of arbitrary elements in O(log n). The heap
+ * does not own its elements. Not thread-safe.
+ */
+template<typename T, size_t T::*Pos, unsigned D = 4>
+class IndexedHeap {
+public:
+    static const size_t NPOS = (size_t)-1;
+
+    bool        empty() const { return m_nodes.empty(); }
+    size_t      size() const { return m_nodes.size(); }
+    T *         top() const { return m_nodes.front().elem; }
+    uint64_t    topKey() const { return m_nodes.front().key; }
+
+    /// Count elements with key less than a_key (visits only those elements and their children)
+    size_t countBelow( uint64_t a_key ) const {
+        std::vector<size_t> stack;
+        size_t count = 0, i, c, end;
+
+        if ( m_nodes.size() && m_nodes[0].key < a_key ) {
+            stack.push_back( 0 );
+        }
+
+        while ( stack.size() ) {
+            i = stack.back();
+            stack.pop_back();
+            count++;
+
+            end = i * D + 1 + D < m_nodes.size() ? i * D + 1 + D : m_nodes.size();
+            for ( c = i * D + 1; c < end; c++ ) {
+                if ( m_nodes[c].key < a_key ) {
+                    stack.push_back( c );
+                }
+            }
+        }
+
+        return count;
+    }
+
+    /// Returns true if element is in a heap (of this type)
+    static bool contains( const T * a_elem ) {
+        return a_elem->*Pos != NPOS;
+    }
+
+    void push( T * a_elem, uint64_t a_key, uint64_t a_seq ) {
+        m_nodes.push_back( Node{ a_key, a_seq, a_elem } );
+        siftUp( m_nodes.size() - 1 );
+    }
+
+    T * pop() {
+        T * elem = m_nodes.front().elem;
+        remove( elem );
+        return elem;
+    }
+
+    /// Remove element (must be a member of this heap)
+    void remove( T * a_elem ) {
+        size_t i = a_elem->*Pos;
+
+        a_elem->*Pos = NPOS;
+
+        if ( i + 1 == m_nodes.size() ) {
+            m_nodes.pop_back();
+            return;
+        }
+
+        m_nodes[i] = m_nodes.back();
+        m_nodes.pop_back();
+
+        if ( i && less( m_nodes[i], m_nodes[( i - 1 ) / D] )) {
+            siftUp( i );
+        } else {
+            siftDown( i );
+        }
+    }
+
+private:
+    struct Node {
+        uint64_t    key;    ///< Primary sort key
+        uint64_t    seq;    ///< Secondary sort key (tie-break)
+        T *         elem;   ///< Element
+    };
+
+    static bool less( const Node & a, const Node & b ) {
+        return a.key < b.key || ( a.key == b.key && a.seq < b.seq );
+    }
+
+    void siftUp( size_t i ) {
+        Node node = m_nodes[i];
+        size_t parent;
+
+        while ( i ) {
+            parent = ( i - 1 ) / D;
+            if ( !less( node, m_nodes[parent] )) {
+                break;
+            }
+            place( i, m_nodes[parent] );
+            i = parent;
+        }
+
+        place( i, node );
+    }
+
+    void siftDown( size_t i ) {
+        Node node = m_nodes[i];
+        size_t n = m_nodes.size(), child, c, end, best;
+
+        while (( child = i * D + 1 ) < n ) {
+            best = child;
+            end = child + D < n ? child + D : n;
+
+            for ( c = child + 1; c < end; c++ ) {
+                if ( less( m_nodes[c], m_nodes[best] )) {
+                    best = c;
+                }
+            }
+
+            if ( !less( m_nodes[best], node )) {
+                break;
+            }
+
+            place( i, m_nodes[best] );
+            i = best;
+        }
+
+        place( i, node );
+    }
+
+    void place( size_t i, const Node & a_node ) {
+        m_nodes[i] = a_node;
+        a_node.elem->*Pos = i;
+    }
+
+    std::vector<Node>   m_nodes;
+};
+
+} // MonQueue namespace
+
+#endif
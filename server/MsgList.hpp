@@ -0,0 +1,133 @@
+#ifndef MSGLIST_HPP
+#define MSGLIST_HPP
+
+#include <cstddef>
+
+namespace MonQueue {
+
+/** @brief Link record embedded in elements of an IntrusiveList
+ *
+ * An element may be a member of one list per embedded link. The owner field
+ * identifies the list an element is currently linked into (or null), which
+ * allows constant-time removal without the caller tracking list membership.
+ */
+template<typename T>
+struct ListLink {
+    ListLink() : prev( 0 ), next( 0 ), owner( 0 ) {}
+
+    T *         prev;   ///< Previous element (toward front)
+    T *         next;   ///< Next element (toward back)
+    void *      owner;  ///< List element is linked into (null if unlinked)
+};
+
+/** @brief Doubly-linked list threaded through elements
+ *
+ * IntrusiveList links elements via a ListLink member (specified by the L
+ * template parameter) so that insertion and removal at any position are
+ * constant-time and allocation-free. The list does not own its elements.
+ * Since elements refer back to their owning list, lists may only be copied
+ * (e.g. when resizing a container of lists) while empty. Not thread-safe.
+ */
+template<typename T, ListLink<T> T::*L>
+class IntrusiveList {
+public:
+    IntrusiveList() : m_front( 0 ), m_back( 0 ), m_size( 0 ) {}
+
+    bool        empty() const { return m_size == 0; }
+    size_t      size() const { return m_size; }
+    T *         front() const { return m_front; }
+    T *         back() const { return m_back; }
+
+    static T *  next( const T * a_elem ) { return (a_elem->*L).next; }
+    static T *  prev( const T * a_elem ) { return (a_elem->*L).prev; }
+    static bool linked( const T * a_elem ) { return (a_elem->*L).owner != 0; }
+
+    /// Returns true if element is linked into this list
+    bool contains( const T * a_elem ) const {
+        return (a_elem->*L).owner == this;
+    }
+
+    void push_front( T * a_elem ) {
+        ListLink<T> & link = a_elem->*L;
+
+        link.prev = 0;
+        link.next = m_front;
+        link.owner = this;
+
+        if ( m_front ) {
+            (m_front->*L).prev = a_elem;
+        } else {
+            m_back = a_elem;
+        }
+
+        m_front = a_elem;
+        m_size++;
+    }
+
+    void push_back( T * a_elem ) {
+        ListLink<T> & link = a_elem->*L;
+
+        link.prev = m_back;
+        link.next = 0;
+        link.owner = this;
+
+        if ( m_back ) {
+            (m_back->*L).next = a_elem;
+        } else {
+            m_front = a_elem;
+        }
+
+        m_back = a_elem;
+        m_size++;
+    }
+
+    /// Unlink element (must be a member of this list)
+    void remove( T * a_elem ) {
+        ListLink<T> & link = a_elem->*L;
+
+        if ( link.prev ) {
+            (link.prev->*L).next = link.next;
+        } else {
+            m_front = link.next;
+        }
+
+        if ( link.next ) {
+            (link.next->*L).prev = link.prev;
+        } else {
+            m_back = link.prev;
+        }
+
+        link.prev = 0;
+        link.next = 0;
+        link.owner = 0;
+        m_size--;
+    }
+
+    T * pop_front() {
+        T * elem = m_front;
+        remove( elem );
+        return elem;
+    }
+
+    T * pop_back() {
+        T * elem = m_back;
+        remove( elem );
+        return elem;
+    }
+
+    /// Unlink element from whichever list (of this type) it is linked into
+    static void unlink( T * a_elem ) {
+        if ( (a_elem->*L).owner ) {
+            static_cast<IntrusiveList*>( (a_elem->*L).owner )->remove( a_elem );
+        }
+    }
+
+private:
+    T *         m_front;
+    T *         m_back;
+    size_t      m_size;
+};
+
+} // MonQueue namespace
+
+#endif
@@ -0,0 +1,248 @@
+#include <stdexcept>
+#include <algorithm>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include "OverflowLog.hpp"
+
+using namespace std;
+
+namespace MonQueue {
+
+// Record layout: u32 length of remainder, u64 ready, u64 due, u64 expiry,
+// u32 ACK timeout, u8 max retries, then ID, class, tenant, affinity and batch
+// strings, each prefixed by a u16 length (host byte order).
+static const size_t RECORD_FIXED_SIZE = 33;
+static const size_t RECORD_STRINGS = 5;
+
+template<typename T>
+static void
+put( std::string & a_buf, T a_value ) {
+    a_buf.append( (const char *)&a_value, sizeof( a_value ));
+}
+
+template<typename T>
+static T
+get( const char *& a_pos ) {
+    T value;
+
+    memcpy( &value, a_pos, sizeof( value ));
+    a_pos += sizeof( value );
+
+    return value;
+}
+
+static void
+getString( const char *& a_pos, std::string & a_value ) {
+    uint16_t len = get<uint16_t>( a_pos );
+
+    a_value.assign( a_pos, len );
+    a_pos += len;
+}
+
+/** @brief Create overflow log with segment files named from a_prefix
+ *
+ * Throws if the first segment file cannot be created.
+ */
+OverflowLog::OverflowLog( const std::string & a_prefix, size_t a_segment_size ) :
+    m_prefix( a_prefix ),
+    m_segment_size( a_segment_size ),
+    m_count( 0 ),
+    m_next_number( 0 ),
+    m_read_offset( 0 )
+{
+    openSegment();
+}
+
+OverflowLog::~OverflowLog() {
+    for ( deque<Segment_t>::iterator s = m_segments.begin(); s != m_segments.end(); s++ ) {
+        close( s->fd );
+        unlink( segmentPath( s->number ).c_str() );
+    }
+}
+
+/** @brief Append record to tail of log
+ *
+ * Starts a new segment if the record would not fit in the current one.
+ * Throws length_error if a string field exceeds 65535 bytes, or
+ * runtime_error on write errors.
+ */
+void
+OverflowLog::append( const Record_t & a_record ) {
+    const std::string * strings[RECORD_STRINGS] = { &a_record.id, &a_record.msg_class, &a_record.tenant, &a_record.affinity, &a_record.batch };
+    size_t len = RECORD_FIXED_SIZE;
+
+    for ( size_t i = 0; i < RECORD_STRINGS; i++ ) {
+        if ( strings[i]->size() > UINT16_MAX ) {
+            throw length_error( "Overflow record too large" );
+        }
+        len += sizeof( uint16_t ) + strings[i]->size();
+    }
+
+    Segment_t & tail = m_segments.back();
+
+    if ( tail.size + m_write_buf.size() && tail.size + m_write_buf.size() + len > m_segment_size ) {
+        flush();
+        openSegment();
+    }
+
+    put<uint32_t>( m_write_buf, (uint32_t)( len - sizeof( uint32_t )));
+    put<uint64_t>( m_write_buf, a_record.ready_ms );
+    put<uint64_t>( m_write_buf, a_record.due_ms );
+    put<uint64_t>( m_write_buf, a_record.expiry_ms );
+    put<uint32_t>( m_write_buf, a_record.ack_timeout );
+    put<uint8_t>( m_write_buf, a_record.max_retries );
+
+    for ( size_t i = 0; i < RECORD_STRINGS; i++ ) {
+        put<uint16_t>( m_write_buf, (uint16_t)strings[i]->size() );
+        m_write_buf += *strings[i];
+    }
+
+    m_count++;
+
+    if ( m_write_buf.size() >= WRITE_CHUNK ) {
+        flush();
+    }
+}
+
+/** @brief Read up to a_limit records from head of log
+ *
+ * Records are appended to a_records, and removed from the log. Returns the
+ * number of records read. Throws runtime_error on read errors.
+ */
+size_t
+OverflowLog::read( size_t a_limit, std::vector<Record_t> & a_records ) {
+    size_t count = 0;
+
+    while ( count < a_limit && m_count ) {
+        // Buffered records must be written before the tail can be read
+        if ( m_segments.size() == 1 ) {
+            flush();
+        }
+
+        Segment_t & head = m_segments.front();
+
+        if ( m_read_offset == head.size ) {
+            close( head.fd );
+            unlink( segmentPath( head.number ).c_str() );
+            m_segments.pop_front();
+            m_read_offset = 0;
+            continue;
+        }
+
+        size_t len = min<uint64_t>( READ_CHUNK, head.size - m_read_offset );
+
+        m_read_buf.resize( len );
+
+        if ( pread( head.fd, &m_read_buf[0], len, m_read_offset ) != (ssize_t)len ) {
+            throw runtime_error( string( "Failed to read overflow log: " ) + strerror( errno ));
+        }
+
+        const char * pos = m_read_buf.data(), * end = pos + len, * rec;
+        uint32_t rec_len;
+
+        while ( count < a_limit && end - pos >= (ptrdiff_t)sizeof( rec_len )) {
+            rec = pos;
+            rec_len = get<uint32_t>( rec );
+
+            if ( end - rec < (ptrdiff_t)rec_len ) {
+                break;
+            }
+
+            a_records.push_back( Record_t() );
+
+            Record_t & r = a_records.back();
+
+            r.ready_ms = get<uint64_t>( rec );
+            r.due_ms = get<uint64_t>( rec );
+            r.expiry_ms = get<uint64_t>( rec );
+            r.ack_timeout = get<uint32_t>( rec );
+            r.max_retries = get<uint8_t>( rec );
+            getString( rec, r.id );
+            getString( rec, r.msg_class );
+            getString( rec, r.tenant );
+            getString( rec, r.affinity );
+            getString( rec, r.batch );
+
+            pos += sizeof( rec_len ) + rec_len;
+            count++;
+            m_count--;
+        }
+
+        // Records never span segments, and always fit in one chunk
+        if ( pos == m_read_buf.data() && count < a_limit ) {
+            throw runtime_error( "Corrupt overflow log" );
+        }
+
+        m_read_offset += pos - m_read_buf.data();
+    }
+
+    // Release fully read segments, and rewind the tail once empty
+    while ( m_segments.size() > 1 && m_read_offset == m_segments.front().size ) {
+        close( m_segments.front().fd );
+        unlink( segmentPath( m_segments.front().number ).c_str() );
+        m_segments.pop_front();
+        m_read_offset = 0;
+    }
+
+    if ( !m_count && m_segments.size() == 1 && m_write_buf.empty() && ftruncate( m_segments.back().fd, 0 ) == 0 ) {
+        m_segments.back().size = 0;
+        m_read_offset = 0;
+    }
+
+    if ( !m_count ) {
+        std::string().swap( m_read_buf );
+    }
+
+    return count;
+}
+
+/// Number of unread records
+size_t
+OverflowLog::size() const {
+    return m_count;
+}
+
+/** @brief Create next segment file and make it the tail
+ */
+void
+OverflowLog::openSegment() {
+    Segment_t seg;
+
+    seg.number = m_next_number;
+    seg.size = 0;
+    seg.fd = open( segmentPath( seg.number ).c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644 );
+
+    if ( seg.fd < 0 ) {
+        throw runtime_error( string( "Failed to create overflow segment: " ) + strerror( errno ));
+    }
+
+    m_next_number++;
+    m_segments.push_back( seg );
+}
+
+/** @brief Write buffered records to tail segment
+ */
+void
+OverflowLog::flush() {
+    if ( m_write_buf.empty() ) {
+        return;
+    }
+
+    Segment_t & tail = m_segments.back();
+
+    if ( pwrite( tail.fd, m_write_buf.data(), m_write_buf.size(), tail.size ) != (ssize_t)m_write_buf.size() ) {
+        throw runtime_error( string( "Failed to write overflow log: " ) + strerror( errno ));
+    }
+
+    tail.size += m_write_buf.size();
+    m_write_buf.clear();
+}
+
+std::string
+OverflowLog::segmentPath( uint64_t a_number ) const {
+    return m_prefix + "." + to_string( a_number ) + ".ovf";
+}
+
+} // MonQueue namespace
@@ -0,0 +1,74 @@
+#ifndef OVERFLOWLOG_HPP
+#define OVERFLOWLOG_HPP
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <deque>
+
+namespace MonQueue {
+
+/** @brief Segmented on-disk FIFO for messages beyond queue capacity
+ *
+ * Records are appended to the tail of a chain of segment files
+ * ("<prefix>.<n>.ovf") and read back in order from the head. Appends are
+ * buffered and written in large chunks, and reads fetch large chunks and
+ * decode as many records as fit, so both directions are sequential I/O.
+ * Segments are deleted once fully read, keeping disk usage proportional to
+ * the backlog. The log is a spill area rather than durable storage: segment
+ * files are truncated when reused and deleted when the log is destroyed.
+ * Not thread-safe.
+ */
+class OverflowLog {
+public:
+    /// @brief Overflow record (absolute times are msec since epoch, 0 = none)
+    struct Record_t {
+        Record_t() : ready_ms( 0 ), due_ms( 0 ), expiry_ms( 0 ), ack_timeout( 0 ), max_retries( 0 ) {}
+
+        std::string     id;             ///< Message ID
+        uint64_t        ready_ms;       ///< Delayed until (0 = ready)
+        uint64_t        due_ms;         ///< Completion due time
+        uint64_t        expiry_ms;      ///< Expiry time
+        uint32_t        ack_timeout;    ///< Per-message ACK timeout in msec (0 = queue default)
+        uint8_t         max_retries;    ///< Per-message max retries (0 = queue default)
+        std::string     msg_class;      ///< Message class
+        std::string     tenant;         ///< Tenant
+        std::string     affinity;       ///< Affinity key
+        std::string     batch;          ///< Batch key
+    };
+
+    OverflowLog( const std::string & a_prefix, size_t a_segment_size );
+    ~OverflowLog();
+
+    void            append( const Record_t & a_record );
+    size_t          read( size_t a_limit, std::vector<Record_t> & a_records );
+    size_t          size() const;
+
+private:
+    /// Segment file
+    struct Segment_t {
+        uint64_t        number;         ///< Segment number (in file name)
+        int             fd;             ///< File descriptor
+        uint64_t        size;           ///< Bytes written
+    };
+
+    static const size_t     WRITE_CHUNK = 262144;   ///< Buffered bytes that trigger a write
+    static const size_t     READ_CHUNK = 1048576;   ///< Bytes fetched per read (exceeds max record size)
+
+    void            openSegment();
+    void            flush();
+    std::string     segmentPath( uint64_t a_number ) const;
+
+    std::string             m_prefix;       ///< Segment file path prefix
+    size_t                  m_segment_size; ///< Max bytes per segment
+    size_t                  m_count;        ///< Number of unread records
+    uint64_t                m_next_number;  ///< Number of next segment
+    uint64_t                m_read_offset;  ///< Read position in head segment
+    std::deque<Segment_t>   m_segments;     ///< Segments, head (reading) to tail (writing)
+    std::string             m_write_buf;    ///< Encoded records not yet written to tail
+    std::string             m_read_buf;     ///< Read chunk buffer
+};
+
+} // MonQueue namespace
+
+#endif
@@ -1,7 +1,9 @@
 #include <iostream>
 #include <stdexcept>
 #include <algorithm>
+#include <cstdint>
 #include "Queue.hpp"
+#include "Replication.hpp"
 
 using namespace std;
 
@@ -9,6 +11,21 @@ namespace MonQueue {
 
 //================================= PUBLIC METHODS ============================
 
+static Queue::Config_t
+makeConfig( uint8_t a_priority_count, size_t a_msg_capacity, size_t a_msg_ack_timeout_msec, size_t a_msg_max_retries,
+    size_t a_msg_boost_timeout_msec, size_t a_monitor_period_msec ) {
+    Queue::Config_t config;
+
+    config.priority_count = a_priority_count;
+    config.capacity = a_msg_capacity;
+    config.ack_timeout = a_msg_ack_timeout_msec;
+    config.max_retries = a_msg_max_retries;
+    config.boost_timeout = a_msg_boost_timeout_msec;
+    config.monitor_period = a_monitor_period_msec;
+
+    return config;
+}
+
 /** @brief Queue constructor
  *
  * Construct a queue based on specified configuration parameters. Multiple
@@ -19,422 +36,3424 @@ Queue::Queue(
     uint8_t a_priority_count,           ///< Number of priorities (0 to count-1, 0 = highest)
     size_t a_msg_capacity,              ///< Maximum number of active and failed messages
     size_t a_msg_ack_timeout_msec,      ///< Max allowed consumer processing time (0 = no limit)
-    size_t a_msg_max_retries,           ///< Max message retires before message is failed (requires ack timeout set)
+    size_t a_msg_max_retries,           ///< Max message retires before message is failed (0 = no limit, requires ack timeout set)
     size_t a_msg_boost_timeout_msec,    ///< Timeout to boost priority of queued messages
     size_t a_monitor_period_msec,       ///< Monitor thread polling period
     ErrorCB_t a_err_cb                  ///< Error callback function
     ) :
-    m_capacity( a_msg_capacity ),
-    m_fail_timeout( a_msg_ack_timeout_msec ),
-    m_max_retries( a_msg_max_retries ),
-    m_boost_timeout( a_msg_boost_timeout_msec ),
-    m_poll_interval( a_monitor_period_msec ),
+    Queue( makeConfig( a_priority_count, a_msg_capacity, a_msg_ack_timeout_msec, a_msg_max_retries, a_msg_boost_timeout_msec, a_monitor_period_msec ), a_err_cb )
+{
+}
+
+/** @brief Queue constructor
+ *
+ * Construct a queue based on a configuration structure (see Config_t for
+ * parameter documentation).
+ */
+Queue::Queue( const Config_t & a_config, ErrorCB_t a_err_cb, TimerService * a_timers ) :
+    m_capacity( a_config.capacity ),
+    m_fail_timeout( a_config.ack_timeout ),
+    m_max_retries( a_config.max_retries ),
+    m_boost_timeout( a_config.boost_timeout ),
+    m_boost_timeout_max( a_config.boost_timeout ),
+    m_boost_max_wait( a_config.boost_max_wait ),
+    m_poll_interval( a_config.monitor_period ),
+    m_dispatch( a_config.dispatch ),
+    m_weights( a_config.weights ),
+    m_drr_cur( 0 ),
+    m_hedge_quantile( a_config.hedge_quantile ),
+    m_hedge_min_samples( a_config.hedge_min_samples ),
+    m_adapt_quantile( a_config.adaptive_quantile ),
+    m_adapt_factor( a_config.adaptive_factor ),
+    m_adapt_min( a_config.adaptive_min_timeout ),
+    m_adapt_max( a_config.adaptive_max_timeout ? a_config.adaptive_max_timeout : a_config.ack_timeout ),
+    m_adapt_min_samples( a_config.adaptive_min_samples ),
+    m_pop_waiters( 0 ),
     m_err_cb( a_err_cb ),
     m_count_queued( 0 ),
     m_count_failed( 0 ),
-    m_run( true ),
-    m_rng( chrono::steady_clock::now().time_since_epoch().count() )
+    m_fail_seq( 0 ),
+    m_queue_seq( 0 ),
+    m_count_late( 0 ),
+    m_rng( chrono::steady_clock::now().time_since_epoch().count() ),
+    m_timers( a_timers ),
+    m_tenant_quota( a_config.tenant_quota ),
+    m_affinity_wait( a_config.affinity_wait ),
+    m_affinity_capacity( a_config.affinity_capacity ),
+    m_count_held( 0 ),
+    m_count_aff_hits( 0 ),
+    m_count_aff_fallbacks( 0 ),
+    m_rate_limited( false ),
+    m_expire_to_failed( a_config.expire_to_failed ),
+    m_count_expired( 0 ),
+    m_failed_capacity( a_config.failed_capacity ),
+    m_count_dropped( 0 ),
+    m_overflow_batch( min( a_config.overflow_batch, a_config.capacity )),
+    m_count_overflow( 0 ),
+    m_overflow_wake( false ),
+    m_replica( 0 ),
+    m_replica_channel( 0 ),
+    m_standby( false ),
+    m_snapshot_path( a_config.snapshot_path ),
+    m_snapshot_interval( a_config.snapshot_interval ),
+    m_count_snapshots( 0 ),
+    m_snapshot_msec( 0 ),
+    m_snapshot_run( false )
 {
-    m_queue_list.resize( a_priority_count );
+    if ( m_hedge_quantile < 0 || m_hedge_quantile >= 1 ) {
+        throw runtime_error( "Invalid hedge quantile" );
+    }
+
+    if ( m_adapt_quantile < 0 || m_adapt_quantile >= 1 || m_adapt_factor <= 0 ) {
+        throw runtime_error( "Invalid adaptive timeout settings" );
+    }
+
+    if ( m_affinity_wait && !m_affinity_capacity ) {
+        throw runtime_error( "Invalid affinity capacity" );
+    }
+
+    // Spilled records continue the failure sequence so listing cursors stay ordered
+    if ( a_config.dead_letter_path.size() ) {
+        if ( !m_failed_capacity ) {
+            throw runtime_error( "Dead-letter file requires a failed capacity" );
+        }
+
+        m_dead_letter.reset( new DeadLetterFile( a_config.dead_letter_path ));
+        m_fail_seq = m_dead_letter->lastSeq();
+    }
+
+    if ( m_dispatch == DISPATCH_WEIGHTED ) {
+        if ( m_weights.empty() ) {
+            for ( size_t p = 0; p < a_config.priority_count; p++ ) {
+                m_weights.push_back( a_config.priority_count - p );
+            }
+        } else if ( m_weights.size() != a_config.priority_count ) {
+            throw runtime_error( "Dispatch weight count must match priority count" );
+        }
+
+        for ( vector<uint32_t>::iterator w = m_weights.begin(); w != m_weights.end(); w++ ) {
+            if ( !*w ) {
+                throw runtime_error( "Dispatch weights must be greater than zero" );
+            }
+        }
+
+        m_deficit.resize( a_config.priority_count, 0 );
+        if ( a_config.priority_count ) {
+            m_deficit[0] = m_weights[0];
+        }
+    } else if ( m_dispatch != DISPATCH_STRICT && m_dispatch != DISPATCH_DEADLINE ) {
+        throw runtime_error( "Invalid dispatch policy" );
+    }
+
+    // Rate limits
+    if ( a_config.rate_limits.size() > a_config.priority_count ) {
+        throw runtime_error( "Rate limit count exceeds priority count" );
+    }
+
+    if ( a_config.rate_burst <= 0 ) {
+        throw runtime_error( "Invalid rate limit burst" );
+    }
+
+    m_level_rates.resize( a_config.priority_count );
+
+    for ( size_t p = 0; p < a_config.rate_limits.size(); p++ ) {
+        if ( a_config.rate_limits[p] < 0 ) {
+            throw runtime_error( "Invalid rate limit" );
+        }
+
+        if ( a_config.rate_limits[p] > 0 ) {
+            m_level_rates[p] = TokenBucket( a_config.rate_limits[p], a_config.rate_limits[p] * a_config.rate_burst );
+            m_rate_limited = true;
+        }
+    }
+
+    m_queue_list.resize( a_config.priority_count );
+    m_pri_stats.resize( a_config.priority_count );
+
+    if ( a_config.overflow_path.size() ) {
+        if ( !m_overflow_batch || !a_config.overflow_segment_size ) {
+            throw runtime_error( "Invalid overflow settings" );
+        }
+
+        // Overflow logs are not captured by snapshots
+        if ( m_snapshot_path.size() ) {
+            throw runtime_error( "Snapshots not supported with overflow tier" );
+        }
+
+        for ( size_t p = 0; p < a_config.priority_count; p++ ) {
+            m_overflow.emplace_back( new OverflowLog( a_config.overflow_path + "." + to_string( p ), a_config.overflow_segment_size ));
+        }
+    }
+    m_pri_waits.resize( a_config.priority_count, DurationSketch( 100 ));
+
+    // Configured tenants (and untagged messages) are created up front
+    if ( a_config.tenants.size() + ( a_config.tenants.count( "" ) ? 0 : 1 ) > MAX_TENANTS ) {
+        throw runtime_error( "Too many tenants" );
+    }
+
+    for ( map<string,TenantConfig_t>::const_iterator t = a_config.tenants.begin(); t != a_config.tenants.end(); t++ ) {
+        if ( !t->second.weight ) {
+            throw runtime_error( "Tenant weights must be greater than zero" );
+        }
+
+        if ( t->second.rate < 0 ) {
+            throw runtime_error( "Invalid tenant rate limit" );
+        }
+
+        Tenant_t * tenant = getTenant( t->first );
+        tenant->quota = t->second.quota;
+        tenant->weight = t->second.weight;
+
+        if ( t->second.rate > 0 ) {
+            tenant->rate = TokenBucket( t->second.rate, t->second.rate * a_config.rate_burst );
+            m_rate_limited = true;
+        }
+    }
+
+    // Deadline dispatch serves a single heap, so classes cannot be skipped
+    if ( m_rate_limited && m_dispatch == DISPATCH_DEADLINE ) {
+        throw runtime_error( "Rate limits not supported with deadline dispatch" );
+    }
+
+    if ( a_config.tenants.find( "" ) == a_config.tenants.end() ) {
+        getTenant( "" )->quota = 0;
+    }
+
+    // With auto-tuning, start with aging step that meets max wait target
+    if ( m_boost_max_wait && m_boost_timeout_max && a_config.priority_count > 1 ) {
+        m_boost_timeout = max<size_t>( min( m_boost_timeout_max, m_boost_max_wait / ( a_config.priority_count - 1 )), 1 );
+    }
+
+    if ( !m_timers ) {
+        m_own_timers.reset( new TimerService() );
+        m_timers = m_own_timers.get();
+    }
+
+    timestamp_t now = std::chrono::system_clock::now();
+
+    m_monitor_task = m_timers->addTask( [this]( const timestamp_t & a_now ) { return monitorTask( a_now ); },
+        now + std::chrono::milliseconds( m_poll_interval ));
+    m_delay_task = m_timers->addTask( [this]( const timestamp_t & a_now ) { return delayTask( a_now ); },
+        timestamp_t::max() );
+
+    // Restore state (after tasks exist, as restored messages may wake them)
+    if ( a_config.wal_path.size() || m_snapshot_path.size() ) {
+        try {
+            restoreState( a_config );
+        } catch ( ... ) {
+            m_timers->removeTask( m_monitor_task );
+            m_timers->removeTask( m_delay_task );
+            throw;
+        }
+    }
+
+    if ( m_snapshot_path.size() && m_snapshot_interval ) {
+        m_snapshot_run = true;
+        m_snapshot_thread = thread( &Queue::snapshotThread, this );
+    }
+}
+
+Queue::~Queue() {
+    if ( m_snapshot_thread.joinable() ) {
+        {
+            lock_guard<mutex> lock(m_snapshot_mutex);
+            m_snapshot_run = false;
+        }
+
+        m_snapshot_cv.notify_one();
+        m_snapshot_thread.join();
+    }
+
+    // Final snapshot makes the next start fast
+    if ( m_snapshot_path.size() ) {
+        try {
+            snapshot();
+        } catch ( const exception & e ) {
+            if ( m_err_cb ) {
+                (*m_err_cb)( string( "Failed to write snapshot: " ) + e.what() );
+            }
+        }
+    }
+
+    m_timers->removeTask( m_monitor_task );
+    m_timers->removeTask( m_delay_task );
+
+    for ( msg_pool_t::iterator m = m_msg_pool.begin(); m != m_msg_pool.end(); m++ ) {
+        delete *m;
+    }
+
+    for ( msg_map_t::iterator m = m_msg_map.begin(); m != m_msg_map.end(); m++ ) {
+        delete m->second;
+    }
+}
+
+/** @brief Push a message into the queue
+ *
+ * The message is queued at the specified priority, or placed in the delay
+ * queue if a_delay (msec) is non-zero. The optional a_opts parameter overrides
+ * the queue-wide ACK timeout and retry limit for this message only, and may
+ * tag the message with a tenant; ready messages of different tenants at the
+ * same priority are served round robin, and a tenant may not hold more
+ * messages than its quota. If a group is specified, the message is not
+ * dispatched until all earlier messages of the group have been completed or
+ * failed. If prerequisite message IDs are specified, the message is held until
+ * all of them have been completed (IDs not in the queue are considered
+ * complete), and is failed if any of them fails. If a TTL is specified, the
+ * message expires if it is still queued or delayed when the TTL elapses.
+ *
+ * If an overflow tier is configured, messages pushed while the queue is at
+ * capacity (or while earlier messages of the same priority are still in
+ * overflow) are appended to the overflow log of their priority instead of
+ * being rejected. Grouped messages and messages with prerequisites are never
+ * overflowed, since their ordering depends on in-memory entries. Overflowed
+ * messages count against their tenant's quota and their IDs are reserved,
+ * but they do not count as pending prerequisites.
+ */
+void
+Queue::push( const std::string & a_id, /*const std::string & a_data,*/ uint8_t a_priority, size_t a_delay, const MsgOpts_t & a_opts ) {
+    checkPushArgs( a_priority, a_opts );
+
+    lock_guard<mutex> lock(m_mutex);
+
+    // Check for duplicate messages
+    if ( m_msg_map.find( a_id ) != m_msg_map.end() || m_overflow_ids.count( a_id )) {
+        throw runtime_error( "Duplicate message ID" );
+    }
+
+    bool overflow = m_overflow.size() && a_opts.group.empty() && a_opts.depends.empty();
+
+    // Make sure capacity isn't exceeded
+    if ( liveCount() >= m_capacity && !overflow ) {
+        throw length_error( "Queue capacity exceeded" );
+    }
+
+    Tenant_t * tenant = getTenant( a_opts.tenant );
+
+    if ( tenant->quota && tenant->count + tenant->overflow >= tenant->quota ) {
+        throw length_error( "Tenant quota exceeded" );
+    }
+
+    if ( m_wal || m_replica ) {
+        logPush( a_id, a_priority, a_delay, a_opts );
+    }
+
+    // Later messages follow earlier ones into overflow to keep arrival order
+    if ( overflow && ( liveCount() >= m_capacity || m_overflow[a_priority]->size() )) {
+        overflowMsg( a_id, a_priority, a_delay, a_opts );
+        return;
+    }
+
+    pushImpl( a_id, a_priority, a_delay, a_opts );
+
+    // Message may have failed with an already failed prerequisite
+    trimFailed();
+}
+
+/** @brief Push a batch of messages under a single lock acquisition
+ *
+ * Intended for bulk (re)population of a queue, e.g. by a publisher after a
+ * restart. Messages are pushed in order as by push(), except that messages
+ * whose ID is already in the queue are skipped rather than rejected, so that
+ * a backlog that partially survived the restart can simply be pushed again.
+ * If a message cannot be pushed (invalid arguments, capacity or tenant quota
+ * exceeded), an exception is thrown and the preceding messages remain
+ * pushed. On return, or on an exception, a_pushed and a_skipped hold the
+ * number of messages pushed and skipped.
+ */
+void
+Queue::pushBatch( const PushMsgList_t & a_msgs, size_t & a_pushed, size_t & a_skipped ) {
+    PushMsgList_t::const_iterator m;
+
+    a_pushed = 0;
+    a_skipped = 0;
+
+    lock_guard<mutex> lock(m_mutex);
+
+    try {
+        for ( m = a_msgs.begin(); m != a_msgs.end(); m++ ) {
+            checkPushArgs( m->priority, m->opts );
+
+            if ( m_msg_map.find( m->id ) != m_msg_map.end() || m_overflow_ids.count( m->id )) {
+                a_skipped++;
+                continue;
+            }
+
+            bool overflow = m_overflow.size() && m->opts.group.empty() && m->opts.depends.empty();
+
+            if ( liveCount() >= m_capacity && !overflow ) {
+                throw length_error( "Queue capacity exceeded" );
+            }
+
+            Tenant_t * tenant = getTenant( m->opts.tenant );
+
+            if ( tenant->quota && tenant->count + tenant->overflow >= tenant->quota ) {
+                throw length_error( "Tenant quota exceeded" );
+            }
+
+            if ( m_wal || m_replica ) {
+                logPush( m->id, m->priority, m->delay, m->opts );
+            }
+
+            if ( overflow && ( liveCount() >= m_capacity || m_overflow[m->priority]->size() )) {
+                overflowMsg( m->id, m->priority, m->delay, m->opts );
+            } else {
+                pushImpl( m->id, m->priority, m->delay, m->opts );
+            }
+
+            a_pushed++;
+        }
+    } catch ( ... ) {
+        trimFailed();
+        throw;
+    }
+
+    trimFailed();
+}
+
+/** @brief Pop next message, blocking until one is available
+ *
+ * If a_consumer identifies the caller and affinity is enabled, messages held
+ * for that consumer (see queueMsg) are served first, and the affinity keys of
+ * messages popped are mapped to the consumer.
+ */
+const Queue::Msg_t &
+Queue::pop( const std::string & a_consumer ) {
+    unique_lock<mutex> lock(m_mutex);
+
+    return popImpl( lock, a_consumer );
+}
+
+void
+Queue::ack( const std::string & a_id, const std::string & a_token, bool a_requeue, size_t a_delay ) {
+    unique_lock<mutex> lock(m_mutex);
+
+    ackImpl( a_id, a_token, a_requeue, a_delay );
+}
+
+
+const Queue::Msg_t &
+Queue::popAck( const std::string & a_id, const std::string & a_token, bool a_requeue, size_t a_delay, const std::string & a_consumer ) {
+    unique_lock<mutex> lock(m_mutex);
+
+    ackImpl( a_id, a_token, a_requeue, a_delay );
+
+    return popImpl( lock, a_consumer );
+}
+
+/** @brief ACK a message and push follow-up messages atomically
+ *
+ * Completes the specified running message and pushes the messages in a_msgs
+ * under a single lock acquisition, allowing step-wise workloads to enqueue
+ * the next step(s) without a separate push. Either all of the operations
+ * succeed or, if the ACK or any push would fail (invalid token, duplicate ID,
+ * capacity exceeded, etc.), none are applied and an exception is thrown. A
+ * follow-up message may reuse the ID of the ACKed message. Follow-up messages
+ * are never overflowed.
+ */
+void
+Queue::ackAndPush( const std::string & a_id, const std::string & a_token, const PushMsgList_t & a_msgs ) {
+    PushMsgList_t::const_iterator m;
+
+    for ( m = a_msgs.begin(); m != a_msgs.end(); m++ ) {
+        checkPushArgs( m->priority, m->opts );
+    }
+
+    lock_guard<mutex> lock(m_mutex);
+
+    msg_map_t::iterator e = getRunningMsg( a_id, a_token );
+    set<string> ids;
+
+    for ( m = a_msgs.begin(); m != a_msgs.end(); m++ ) {
+        if (( m->id != a_id && m_msg_map.find( m->id ) != m_msg_map.end() ) || m_overflow_ids.count( m->id ) || !ids.insert( m->id ).second ) {
+            throw runtime_error( "Duplicate message ID" );
+        }
+    }
+
+    // ACKed entry frees one slot
+    if ( liveCount() - 1 + a_msgs.size() > m_capacity ) {
+        throw length_error( "Queue capacity exceeded" );
+    }
+
+    map<Tenant_t*,size_t> tenant_counts;
+
+    for ( m = a_msgs.begin(); m != a_msgs.end(); m++ ) {
+        tenant_counts[getTenant( m->opts.tenant )]++;
+    }
+
+    for ( map<Tenant_t*,size_t>::iterator t = tenant_counts.begin(); t != tenant_counts.end(); t++ ) {
+        if ( t->first->quota && t->first->count + t->first->overflow - ( t->first == e->second->tenant ? 1 : 0 ) + t->second > t->first->quota ) {
+            throw length_error( "Tenant quota exceeded" );
+        }
+    }
+
+    // Log records are built and checked before anything is changed
+    vector<WriteAheadLog::Record_t> recs;
+
+    if ( m_wal || m_replica ) {
+        for ( m = a_msgs.begin(); m != a_msgs.end(); m++ ) {
+            recs.push_back( pushRecord( m->id, m->priority, m->delay, m->opts ));
+
+            if ( m_wal ) {
+                WriteAheadLog::checkRecord( recs.back() );
+            }
+        }
+    }
+
+    endRun( e->second, std::chrono::system_clock::now(), true );
+    freeMsgEntry( e );
+
+    for ( size_t i = 0; i < a_msgs.size(); i++ ) {
+        if ( recs.size() ) {
+            logRecord( recs[i] );
+        }
+
+        pushImpl( a_msgs[i].id, a_msgs[i].priority, a_msgs[i].delay, a_msgs[i].opts );
+    }
+
+    trimFailed();
+}
+
+/** @brief Report progress on a running message (heartbeat)
+ *
+ * Extends the ACK deadline of a running message to a_extend msec from now (or
+ * by the message's ACK timeout if a_extend is 0), allowing consumers to use a
+ * short ACK timeout for failure detection while still running long tasks.
+ * Constant-time; the running list is not re-ordered.
+ */
+void
+Queue::touch( const std::string & a_id, const std::string & a_token, size_t a_extend ) {
+    lock_guard<mutex> lock(m_mutex);
+
+    MsgEntry_t * entry = getRunningMsg( a_id, a_token )->second;
+
+    setDeadline( entry, std::chrono::system_clock::now(), a_extend );
+
+    if ( m_replica ) {
+        replicateLease( WriteAheadLog::REC_TOUCH, entry );
+    }
+}
+
+/** @brief Save progress checkpoint for a running message
+ *
+ * Stores a_data with the message and extends its ACK deadline (as for
+ * touch). If the consumer subsequently fails and the message is retried, the
+ * checkpoint is delivered with the message so the next consumer can resume
+ * from it rather than restarting. Checkpoints are discarded when the message
+ * is ACKed (including ACK with requeue), and are limited to
+ * MAX_CHECKPOINT_SIZE bytes.
+ */
+void
+Queue::checkpoint( const std::string & a_id, const std::string & a_token, const std::string & a_data, size_t a_extend ) {
+    if ( a_data.size() > MAX_CHECKPOINT_SIZE ) {
+        throw length_error( "Checkpoint data too large" );
+    }
+
+    lock_guard<mutex> lock(m_mutex);
+
+    MsgEntry_t * entry = getRunningMsg( a_id, a_token )->second;
+
+    entry->message.checkpoint = a_data;
+    setDeadline( entry, std::chrono::system_clock::now(), a_extend );
+
+    if ( m_replica ) {
+        replicateLease( WriteAheadLog::REC_TOUCH, entry );
+    }
+}
+
+size_t
+Queue::getCapacity() const {
+    return m_capacity;
+}
+
+/** @brief Get deadline statistics
+ *
+ * Overdue is the number of queued or delayed messages whose due time has
+ * passed; late is the total number of messages dispatched after their due
+ * time. Counting overdue messages visits only overdue entries of the due
+ * heap.
+ */
+void
+Queue::getDeadlineStats( size_t & a_overdue, size_t & a_late ) const {
+    lock_guard<mutex> lock(m_mutex);
+
+    timestamp_t now = std::chrono::system_clock::now();
+
+    a_overdue = m_due_heap.countBelow( std::chrono::duration_cast<std::chrono::milliseconds>( now.time_since_epoch() ).count() );
+    a_late = m_count_late;
+}
+
+/** @brief Get consumer affinity statistics
+ *
+ * Hits is the number of keyed messages popped by the consumer the key was
+ * mapped to, fallbacks is the number popped by a different consumer (after
+ * the affinity wait expired), and keys is the current size of the affinity
+ * table.
+ */
+void
+Queue::getAffinityStats( size_t & a_hits, size_t & a_fallbacks, size_t & a_keys ) const {
+    lock_guard<mutex> lock(m_mutex);
+
+    a_hits = m_count_aff_hits;
+    a_fallbacks = m_count_aff_fallbacks;
+    a_keys = m_affinity.size();
+}
+
+/** @brief Get number of messages that expired before dispatch
+ */
+size_t
+Queue::getExpiredCount() const {
+    lock_guard<mutex> lock(m_mutex);
+
+    return m_count_expired;
+}
+
+/** @brief Get failed message spill statistics
+ *
+ * Spilled is the number of records in the dead-letter file (including those
+ * written before a restart), and dropped is the number of failed messages
+ * discarded beyond the failed capacity because no dead-letter file is set.
+ */
+void
+Queue::getDeadLetterStats( size_t & a_spilled, size_t & a_dropped ) const {
+    lock_guard<mutex> lock(m_mutex);
+
+    a_spilled = m_dead_letter ? m_dead_letter->size() : 0;
+    a_dropped = m_count_dropped;
+}
+
+/** @brief Get snapshot statistics
+ *
+ * Count is the number of snapshots written since startup, and last msec the
+ * duration of the most recent one (capture and write).
+ */
+void
+Queue::getSnapshotStats( size_t & a_count, size_t & a_last_msec ) const {
+    lock_guard<mutex> lock(m_mutex);
+
+    a_count = m_count_snapshots;
+    a_last_msec = m_snapshot_msec;
+}
+
+/** @brief Write a snapshot now
+ *
+ * The queue is locked only while its state is copied, not while the
+ * snapshot is written. Throws if no snapshot file is configured, or on I/O
+ * errors.
+ */
+void
+Queue::snapshot() {
+    if ( m_snapshot_path.empty() ) {
+        throw logic_error( "Snapshots not enabled" );
+    }
+
+    lock_guard<mutex> lock(m_snapshot_mutex);
+
+    writeSnapshot();
+}
+
+/** @brief Get write-ahead log statistics
+ *
+ * Records is the number of transitions logged, and syncs the number of group
+ * commits (both zero if no log is configured).
+ */
+void
+Queue::getWalStats( size_t & a_records, size_t & a_syncs ) const {
+    lock_guard<mutex> lock(m_mutex);
+
+    if ( m_wal ) {
+        m_wal->getStats( a_records, a_syncs );
+    } else {
+        a_records = 0;
+        a_syncs = 0;
+    }
+}
+
+/** @brief Get number of messages waiting in overflow logs
+ */
+size_t
+Queue::getOverflowCount() const {
+    lock_guard<mutex> lock(m_mutex);
+
+    return m_count_overflow;
+}
+
+/** @brief Get current priority aging step (msec)
+ *
+ * Equals the configured boost timeout unless auto-tuning is enabled.
+ */
+size_t
+Queue::getBoostTimeout() const {
+    lock_guard<mutex> lock(m_mutex);
+
+    return m_boost_timeout;
+}
+
+void
+Queue::getCounts( size_t & a_active, size_t & a_failed, size_t & a_free ) const {
+    lock_guard<mutex> lock(m_mutex);
+
+    //cout << "counts: " << ( m_msg_map.size() - m_count_failed ) << ", " << m_count_failed << ", " << m_capacity - m_msg_map.size() << endl;
+
+    size_t live = liveCount();
+
+    a_active = m_msg_map.size() - m_count_failed;
+    a_failed = m_count_failed;
+    a_free = live < m_capacity ? m_capacity - live : 0;
+}
+
+/** @brief Check whether capacity allows pushing a message with a_opts
+ *
+ * True if there is a free slot, or if the message would go to the overflow
+ * tier (which only takes messages without a group or prerequisites). A push
+ * may still fail for other reasons (e.g. tenant quota).
+ */
+bool
+Queue::hasRoom( const MsgOpts_t & a_opts ) const {
+    lock_guard<mutex> lock(m_mutex);
+
+    return liveCount() < m_capacity || ( m_overflow.size() && a_opts.group.empty() && a_opts.depends.empty() );
+}
+
+
+/** @brief Get processing time statistics
+ *
+ * Returns recent processing (pop to ACK) time statistics, and the resulting
+ * effective default ACK timeout, for each priority followed by each message
+ * class. The reported quantile is the adaptive timeout quantile if adaptive
+ * timeouts are enabled, otherwise the hedge quantile if hedging is enabled,
+ * otherwise the 99th percentile.
+ */
+Queue::RunStatsList_t
+Queue::getRunStats() const {
+    RunStatsList_t stats;
+    double q = m_adapt_quantile ? m_adapt_quantile : m_hedge_quantile ? m_hedge_quantile : 0.99;
+
+    lock_guard<mutex> lock(m_mutex);
+
+    stats.resize( m_pri_stats.size() + m_class_stats.size() );
+
+    RunStatsList_t::iterator r = stats.begin();
+    vector<ClassStats_t>::const_iterator p = m_pri_stats.begin();
+    class_stats_t::const_iterator c = m_class_stats.begin();
+
+    for ( ; r != stats.end(); r++ ) {
+        const ClassStats_t * cs;
+
+        if ( p != m_pri_stats.end() ) {
+            r->priority = (uint8_t)( p - m_pri_stats.begin() );
+            cs = &*p++;
+        } else {
+            r->msg_class = c->first;
+            r->priority = 0;
+            cs = &(c++)->second;
+        }
+
+        r->samples = cs->run_times.count();
+        r->median = cs->run_times.quantile( 0.5 );
+        r->quantile = cs->run_times.quantile( q );
+        r->ack_timeout = cs->ack_timeout ? cs->ack_timeout : m_fail_timeout;
+    }
+
+    return stats;
+}
+
+/** @brief Get IDs of all failed messages
+ *
+ * Returns failed message IDs ordered by failure time. For large failed sets,
+ * the paged form of this method should be used instead to limit the time the
+ * queue lock is held.
+ */
+Queue::MsgIdList_t
+Queue::getFailed() const {
+    MsgIdList_t failed;
+
+    lock_guard<mutex> lock(m_mutex);
+
+    failed.reserve( m_count_failed );
+
+    for ( msg_failed_t::const_iterator f = m_msg_failed.begin(); f != m_msg_failed.end(); f++ ) {
+        failed.push_back( f->second->message.id );
+    }
+
+    return failed;
+}
+
+/** @brief Get one page of failed message IDs
+ *
+ * Returns up to a_limit failed message IDs, ordered by failure time, that
+ * failed after the position indicated by a_cursor (0 = start of list). On
+ * return, a_cursor is set to the position to resume from, or to 0 if there
+ * are no further failed messages. Cost is proportional to the page size, not
+ * the total number of failed messages. Messages failing after a listing has
+ * started will appear at the end of the listing. Messages spilled to the
+ * dead-letter file are listed first, as they are the oldest failures.
+ */
+Queue::MsgIdList_t
+Queue::getFailed( uint64_t & a_cursor, size_t a_limit ) const {
+    MsgIdList_t failed;
+
+    if ( !a_limit ) {
+        throw runtime_error( "Invalid page limit" );
+    }
+
+    lock_guard<mutex> lock(m_mutex);
+
+    failed.reserve( min( a_limit, m_count_failed ));
+
+    if ( m_dead_letter ) {
+        m_dead_letter->readIds( a_cursor, a_limit, failed );
+    }
+
+    msg_failed_t::const_iterator f = m_msg_failed.upper_bound( a_cursor );
+
+    for ( ; f != m_msg_failed.end() && failed.size() < a_limit; f++ ) {
+        failed.push_back( f->second->message.id );
+        a_cursor = f->first;
+    }
+
+    if ( f == m_msg_failed.end() && !( m_dead_letter && m_dead_letter->hasAfter( a_cursor ))) {
+        a_cursor = 0;
+    }
+
+    return failed;
+}
+
+Queue::MsgIdList_t
+Queue::eraseFailed( const MsgIdList_t & a_msg_ids ) {
+    MsgIdList_t failed;
+
+    lock_guard<mutex> lock(m_mutex);
+    msg_map_t::iterator m;
+
+    failed.reserve( min( a_msg_ids.size(), m_count_failed ));
+
+    for ( MsgIdList_t::const_iterator i = a_msg_ids.begin(); i != a_msg_ids.end(); i++ ) {
+        m = m_msg_map.find( *i );
+        if ( m != m_msg_map.end() ) {
+            if ( m->second->state == MSG_FAILED ) {
+                failed.push_back( m->first );
+                m_msg_failed.erase( m->second->fail_seq );
+                freeMsgEntry( m );
+            }
+        }
+    }
+
+    m_count_failed -= failed.size();
+
+    return failed;
+}
+
+/** @brief Requeue specified failed messages
+ *
+ * Moves the specified failed messages back into the ready queue (or the delay
+ * queue if a_delay is non-zero) in place, without requiring the producer to
+ * erase and re-push them. If a_priority is KEEP_PRIORITY, messages retain
+ * their original priority. If a_reset_retries is false, the next ACK timeout
+ * will immediately fail the message again. IDs that do not refer to failed
+ * messages are ignored. Returns the IDs of the requeued messages.
+ */
+Queue::MsgIdList_t
+Queue::requeueFailed( const MsgIdList_t & a_msg_ids, uint8_t a_priority, size_t a_delay, bool a_reset_retries ) {
+    if ( a_priority != KEEP_PRIORITY && a_priority >= m_queue_list.size() ) {
+        throw runtime_error( "Invalid queue priority" );
+    }
+
+    MsgIdList_t requeued;
+
+    lock_guard<mutex> lock(m_mutex);
+    timestamp_t requeue_ts = std::chrono::system_clock::now() + std::chrono::milliseconds( a_delay );
+    msg_map_t::iterator m;
+
+    bool ready = false;
+
+    requeued.reserve( min( a_msg_ids.size(), m_count_failed ));
+
+    for ( MsgIdList_t::const_iterator i = a_msg_ids.begin(); i != a_msg_ids.end(); i++ ) {
+        m = m_msg_map.find( *i );
+        if ( m != m_msg_map.end() && m->second->state == MSG_FAILED ) {
+            ready |= requeueFailedMsg( m->second, a_priority, requeue_ts, a_reset_retries );
+            requeued.push_back( m->first );
+        }
+    }
+
+    if ( ready ) {
+        m_pop_cv.notify_all();
+    }
+
+    return requeued;
+}
+
+/** @brief Requeue all failed messages
+ *
+ * Same as requeueFailed(), but applies to every failed message in a single
+ * pass over the failed index. Returns the number of requeued messages.
+ */
+size_t
+Queue::requeueAllFailed( uint8_t a_priority, size_t a_delay, bool a_reset_retries ) {
+    if ( a_priority != KEEP_PRIORITY && a_priority >= m_queue_list.size() ) {
+        throw runtime_error( "Invalid queue priority" );
+    }
+
+    lock_guard<mutex> lock(m_mutex);
+    timestamp_t requeue_ts = std::chrono::system_clock::now() + std::chrono::milliseconds( a_delay );
+    size_t count = m_count_failed;
+    bool ready = false;
+
+    while ( !m_msg_failed.empty() ) {
+        ready |= requeueFailedMsg( m_msg_failed.begin()->second, a_priority, requeue_ts, a_reset_retries );
+    }
+
+    if ( ready ) {
+        m_pop_cv.notify_all();
+    }
+
+    return count;
+}
+
+void
+Queue::setErrorCallback( ErrorCB_t * a_callback ) {
+    m_err_cb = a_callback;
+}
+
+
+//================================= PRIVATE METHODS ===========================
+
+Queue::MsgEntry_t *
+Queue::getMsgEntry( const string & a_id, /*const string & a_data,*/ uint8_t a_priority ) {
+    MsgEntry_t * msg;
+
+    if ( !m_msg_pool.size() ) {
+        msg = new MsgEntry_t( a_id, /*a_data,*/ a_priority );
+    } else {
+        msg = m_msg_pool.back();
+        msg->reset( a_id, /*a_data,*/ a_priority );
+        m_msg_pool.pop_back();
+    }
+
+    return msg;
+}
+
+/** @brief Verify push arguments that do not depend on queue state
+ */
+void
+Queue::checkPushArgs( uint8_t a_priority, const MsgOpts_t & a_opts ) const {
+    // Verify priority
+    if ( a_priority >= m_queue_list.size() ) {
+        throw runtime_error( "Invalid queue priority" );
+    }
+
+    // Verify per-message options (must fit in entry fields)
+    if ( a_opts.ack_timeout > UINT32_MAX ) {
+        throw runtime_error( "Invalid message ACK timeout" );
+    }
+
+    if ( a_opts.max_retries > UINT8_MAX ) {
+        throw runtime_error( "Invalid message max retries" );
+    }
+
+    if ( a_opts.depends.size() > MAX_DEPENDS ) {
+        throw runtime_error( "Too many message prerequisites" );
+    }
+}
+
+/** @brief Find or create tenant record
+ *
+ * New tenants receive the default quota. The number of tenants is bounded
+ * since tenant records are retained for the life of the queue.
+ */
+Queue::Tenant_t *
+Queue::getTenant( const std::string & a_tenant ) {
+    // Lock must be held before calling (or called from constructor)
+
+    tenant_map_t::iterator t = m_tenants.find( a_tenant );
+
+    if ( t != m_tenants.end() ) {
+        return &t->second;
+    }
+
+    if ( m_tenants.size() >= MAX_TENANTS ) {
+        throw runtime_error( "Too many tenants" );
+    }
+
+    Tenant_t & tenant = m_tenants[a_tenant];
+
+    tenant.quota = m_tenant_quota;
+    tenant.queues.resize( m_queue_list.size() );
+
+    for ( vector<TenantQueue_t>::iterator q = tenant.queues.begin(); q != tenant.queues.end(); q++ ) {
+        q->tenant = &tenant;
+    }
+
+    return &tenant;
+}
+
+/** @brief Create and enqueue a new message entry
+ *
+ * Caller must verify arguments, ID uniqueness, and capacity.
+ */
+void
+Queue::pushImpl( const std::string & a_id, uint8_t a_priority, size_t a_delay, const MsgOpts_t & a_opts ) {
+    // Lock must be held before calling
+
+    MsgEntry_t * msg = getMsgEntry( a_id, /*a_data,*/ a_priority );
+    timestamp_t now = std::chrono::system_clock::now();
+
+    msg->tenant = getTenant( a_opts.tenant );
+    msg->tenant->count++;
+
+    msg->ack_timeout = a_opts.ack_timeout;
+    msg->max_retries = a_opts.max_retries;
+    msg->affinity = a_opts.affinity;
+    msg->batch = a_opts.batch;
+
+    if ( a_opts.due ) {
+        msg->due = std::chrono::system_clock::now() + std::chrono::milliseconds( a_opts.due );
+    }
+
+    if ( a_opts.ttl ) {
+        msg->expiry = now + std::chrono::milliseconds( a_opts.ttl );
+    }
+
+    if ( a_opts.msg_class.size() ) {
+        class_stats_t::iterator c = m_class_stats.find( a_opts.msg_class );
+
+        if ( c != m_class_stats.end() ) {
+            msg->class_stats = &c->second;
+        } else if ( m_class_stats.size() < MAX_MSG_CLASSES ) {
+            msg->class_stats = &m_class_stats[a_opts.msg_class];
+        }
+    }
+
+    m_msg_map[a_id] = msg;
+
+    if ( a_opts.group.size() ) {
+        msg->group = &m_groups.emplace( a_opts.group, Group_t( a_opts.group )).first->second;
+        msg->group->count++;
+    }
+
+    if ( a_opts.depends.size() && addDepends( msg, a_opts.depends )) {
+        msg->state = MSG_BLOCKED;
+        msg->state_ts = now + std::chrono::milliseconds( a_delay );
+
+        // Takes its place in the group now, so later messages of the group
+        // wait behind it while it waits for its prerequisites
+        if ( msg->group ) {
+            acquireGroup( msg, msg->state_ts );
+        }
+        return;
+    }
+
+    if ( msg->state == MSG_FAILED ) {
+        return;
+    }
+
+    releaseMsg( msg, now + std::chrono::milliseconds( a_delay ));
+}
+
+/** @brief Register message as a dependent of its uncompleted prerequisites
+ *
+ * Returns true if message must wait for prerequisites. If a prerequisite has
+ * already failed, the message is failed immediately and false is returned.
+ */
+bool
+Queue::addDepends( MsgEntry_t * a_msg, const std::vector<std::string> & a_depends ) {
+    // Lock must be held before calling
+
+    for ( vector<string>::const_iterator d = a_depends.begin(); d != a_depends.end(); d++ ) {
+        msg_map_t::iterator p = m_msg_map.find( *d );
+
+        if ( p == m_msg_map.end() || p->second == a_msg ) {
+            continue;
+        }
+
+        if ( p->second->state == MSG_FAILED ) {
+            for ( vector<MsgEntry_t*>::iterator q = a_msg->prereqs.begin(); q != a_msg->prereqs.end(); q++ ) {
+                (*q)->dependents.erase( find( (*q)->dependents.begin(), (*q)->dependents.end(), a_msg ));
+            }
+            a_msg->prereqs.clear();
+
+            failMsg( a_msg );
+            return false;
+        }
+
+        if ( find( a_msg->prereqs.begin(), a_msg->prereqs.end(), p->second ) == a_msg->prereqs.end() ) {
+            a_msg->prereqs.push_back( p->second );
+            p->second->dependents.push_back( a_msg );
+        }
+    }
+
+    return !a_msg->prereqs.empty();
+}
+
+/** @brief Release dependents of a completed message
+ *
+ * Dependents with no remaining prerequisites are released for dispatch (at
+ * or after their original ready time). A grouped dependent still waiting in
+ * its group's pending list is instead released by releaseGroup when its turn
+ * comes.
+ */
+void
+Queue::releaseDependents( MsgEntry_t * a_msg ) {
+    // Lock must be held before calling
+
+    for ( vector<MsgEntry_t*>::iterator d = a_msg->dependents.begin(); d != a_msg->dependents.end(); d++ ) {
+        vector<MsgEntry_t*> & prereqs = (*d)->prereqs;
+
+        prereqs.erase( find( prereqs.begin(), prereqs.end(), a_msg ));
+
+        if ( prereqs.empty() && !( (*d)->group && (*d)->group->head != *d )) {
+            releaseMsg( *d, (*d)->state_ts );
+        }
+    }
+
+    a_msg->dependents.clear();
+}
+
+/** @brief Queue or delay a new or unblocked message
+ *
+ * Message waits in its group's pending list instead if the group is held by
+ * another message. Notifies consumers of newly queued message.
+ */
+void
+Queue::releaseMsg( MsgEntry_t * a_msg, const timestamp_t & a_ready_ts ) {
+    // Lock must be held before calling
+
+    if ( a_msg->group && !acquireGroup( a_msg, a_ready_ts )) {
+        return;
+    }
+
+    timestamp_t now = std::chrono::system_clock::now();
+
+    if ( a_ready_ts > now ) {
+        insertDelayedMsg( a_msg, a_ready_ts );
+    } else {
+        queueMsg( a_msg, now );
+        m_pop_cv.notify_one();
+    }
+}
+
+/** @brief Make message the dispatchable head of its group, if group is free
+ *
+ * Returns true if message may be queued (or delayed) as usual. Otherwise the
+ * message is appended to the group's pending list in the blocked state, with
+ * a_ready_ts recorded as the earliest time it may be dispatched; blocked
+ * messages are not in any ready queue and so cost nothing in pop.
+ */
+bool
+Queue::acquireGroup( MsgEntry_t * a_msg, const timestamp_t & a_ready_ts ) {
+    // Lock must be held before calling
+
+    Group_t * group = a_msg->group;
+
+    if ( !group->head || group->head == a_msg ) {
+        group->head = a_msg;
+        return true;
+    }
+
+    a_msg->state = MSG_BLOCKED;
+    a_msg->state_ts = a_ready_ts;
+    group->pending.push_back( a_msg );
+
+    return false;
+}
+
+/** @brief Release group held by message and dispatch next message of group
+ *
+ * Called when a message is completed or failed. Has no effect if message is
+ * not the head of its group. If the next message is still waiting for
+ * prerequisites, it holds the group but is dispatched only once they
+ * complete (see releaseDependents).
+ */
+void
+Queue::releaseGroup( MsgEntry_t * a_msg ) {
+    // Lock must be held before calling
+
+    Group_t * group = a_msg->group;
+
+    if ( !group || group->head != a_msg ) {
+        return;
+    }
+
+    group->head = 0;
+
+    if ( !group->pending.empty() ) {
+        MsgEntry_t * next = group->pending.pop_front();
+        timestamp_t now = std::chrono::system_clock::now();
+
+        group->head = next;
+
+        if ( next->prereqs.size() ) {
+            return;
+        }
+
+        if ( next->state_ts > now ) {
+            insertDelayedMsg( next, next->state_ts );
+        } else {
+            queueMsg( next, now );
+            m_pop_cv.notify_one();
+        }
+    }
+}
+
+/** @brief Remove message from index and return entry to pool
+ *
+ * Entry must already be unlinked from all queues. Checkpoint storage is
+ * released so that pooled entries do not retain large buffers. Dependents
+ * are released, since only completed messages can have dependents here
+ * (failure detaches them).
+ */
+void
+Queue::freeMsgEntry( msg_map_t::iterator a_entry ) {
+    // Lock must be held before calling
+
+    MsgEntry_t * msg = a_entry->second;
+
+    if ( m_wal || m_replica ) {
+        logTransition( WriteAheadLog::REC_REMOVE, msg->message.id );
+    }
+
+    if ( msg->dependents.size() ) {
+        releaseDependents( msg );
+    }
+
+    untrackMsg( msg );
+
+    if ( msg->message.checkpoint.size() ) {
+        std::string().swap( msg->message.checkpoint );
+    }
+
+    msg->tenant->count--;
+
+    if ( msg->group ) {
+        releaseGroup( msg );
+
+        if ( !--msg->group->count ) {
+            m_groups.erase( msg->group->id );
+        }
+    }
+
+    m_msg_map.erase( a_entry );
+    m_msg_pool.push_back( msg );
+
+    checkPageIn();
+}
+
+
+const Queue::Msg_t &
+Queue::popImpl( unique_lock<mutex> & a_lock, const std::string & a_consumer ) {
+    // Lock must be held before calling
+
+    Consumer_t * consumer;
+    MsgEntry_t * entry = 0;
+    timestamp_t now, next;
+
+    while ( true ) {
+        // Consumer may have been added or dropped while waiting
+        consumer = findConsumer( a_consumer );
+        now = std::chrono::system_clock::now();
+        next = timestamp_t::max();
+
+        if ( consumer && !consumer->held.empty() && rateTake( consumer->held.front(), consumer->held.front()->priority, now, next )) {
+            entry = consumer->held.front();
+            unholdMsg( entry );
+            m_count_aff_hits++;
+            break;
+        }
+
+        if ( m_count_queued && ( entry = dequeueMsg( now, next ))) {
+            m_count_queued--;
+
+            if ( entry->affinity.size() && m_affinity_wait ) {
+                affinity_map_t::iterator a = m_affinity.find( entry->affinity );
+
+                if ( a != m_affinity.end() && a->second.consumer && a->second.consumer->id != a_consumer ) {
+                    m_count_aff_fallbacks++;
+                }
+            }
+            break;
+        }
+
+        if ( !m_msg_hedge.empty() ) {
+            // No dispatchable queued messages, issue hedge lease for a straggling message
+            entry = m_msg_hedge.pop_front();
+
+            if ( !entry->hedge ) {
+                entry->hedge.reset( new Msg_t() );
+            }
+
+            entry->hedge->id = entry->message.id;
+            entry->hedge->token = to_string( m_rng() );
+            entry->hedge->checkpoint = entry->message.checkpoint;
+
+            // Hedge lease gets a full ACK timeout (never shortens original deadline)
+            timestamp_t deadline = entry->deadline;
+            setDeadline( entry, now );
+            if ( deadline > entry->deadline ) {
+                entry->deadline = deadline;
+            }
+
+            if ( m_replica ) {
+                replicateLease( WriteAheadLog::REC_RUN, entry, true );
+            }
+
+            return *entry->hedge;
+        }
+
+        /*if ( m_err_cb ) {
+            (*m_err_cb)( "Pop - no msgs avail, wait w/o timeout" );
+        }*/
+
+        // Wait for new messages, or until a rate-limited message becomes eligible
+        m_pop_waiters++;
+        if ( next == timestamp_t::max() ) {
+            m_pop_cv.wait( a_lock );
+        } else {
+            m_pop_cv.wait_until( a_lock, next );
+        }
+        m_pop_waiters--;
+    }
+
+    if ( entry->affinity.size() && m_affinity_wait && a_consumer.size() ) {
+        setAffinity( entry->affinity, a_consumer );
+    }
+
+    runMsg( entry, now );
+
+    return entry->message;
+}
+
+/** @brief Pop next message and other ready messages with the same batch key
+ *
+ * Blocks until a message is available and pops it as for pop(). If the
+ * message has a batch key, up to a_limit - 1 further ready messages with the
+ * same key and at the same priority level are leased with it, in queue order,
+ * so that the consumer can process them together. Batched messages are
+ * located via a per-key index and bypass fair-share accounting across
+ * priorities and tenants (but not rate limits). Each message must be ACKed
+ * individually.
+ */
+Queue::MsgList_t
+Queue::popBatch( size_t a_limit, const std::string & a_consumer ) {
+    if ( !a_limit ) {
+        throw runtime_error( "Invalid batch limit" );
+    }
+
+    unique_lock<mutex> lock(m_mutex);
+
+    const Msg_t & first = popImpl( lock, a_consumer );
+    MsgList_t msgs( 1, first );
+    MsgEntry_t * head = m_msg_map.find( first.id )->second;
+
+    // Hedge leases are not batched
+    if ( head->batch.empty() || &first == head->hedge.get() || a_limit == 1 ) {
+        return msgs;
+    }
+
+    batch_map_t::iterator b = m_batches.find( head->batch );
+
+    if ( b == m_batches.end() ) {
+        return msgs;
+    }
+
+    msg_aux_list_t & ready = b->second.levels[head->level];
+    timestamp_t now = std::chrono::system_clock::now(), next;
+    MsgEntry_t * entry;
+
+    // Batch entry is erased when last message is removed
+    for ( size_t n = ready.size() < a_limit - 1 ? ready.size() : a_limit - 1; n; n-- ) {
+        entry = ready.front();
+
+        if ( m_rate_limited && !rateTake( entry, head->level, now, next )) {
+            break;
+        }
+
+        if ( m_dispatch == DISPATCH_DEADLINE ) {
+            m_ready_heap.remove( entry );
+            batchRemove( entry );
+        } else {
+            readyRemove( entry );
+        }
+
+        m_count_queued--;
+
+        if ( entry->affinity.size() && m_affinity_wait && a_consumer.size() ) {
+            setAffinity( entry->affinity, a_consumer );
+        }
+
+        runMsg( entry, now );
+        msgs.push_back( entry->message );
+    }
+
+    return msgs;
+}
+
+/** @brief Lease a message removed from the ready queues to a consumer
+ */
+void
+Queue::runMsg( MsgEntry_t * a_msg, const timestamp_t & a_now ) {
+    // Lock must be held before calling
+
+    untrackMsg( a_msg );
+
+    if ( a_now > a_msg->due ) {
+        m_count_late++;
+    }
+
+    m_pri_waits[a_msg->priority].add( std::chrono::duration_cast<std::chrono::milliseconds>( a_now - a_msg->state_ts ).count() );
+
+    a_msg->state = MSG_RUNNING;
+    a_msg->state_ts = a_now;
+    setDeadline( a_msg, a_msg->state_ts );
+    a_msg->message.token = to_string( m_rng() );
+    m_msg_running.push_back( a_msg );
+
+    if ( m_replica ) {
+        replicateLease( WriteAheadLog::REC_RUN, a_msg );
+    }
+}
+
+/** @brief Find consumer with affinity keys by ID (null if none)
+ */
+Queue::Consumer_t *
+Queue::findConsumer( const std::string & a_consumer ) {
+    // Lock must be held before calling
+
+    if ( a_consumer.empty() || m_consumers.empty() ) {
+        return 0;
+    }
+
+    consumer_map_t::iterator c = m_consumers.find( a_consumer );
+
+    return c == m_consumers.end() ? 0 : &c->second;
+}
+
+/** @brief Map affinity key to consumer
+ *
+ * The key becomes the most recently used entry of the affinity table. If the
+ * table is full, the least recently used key is dropped first.
+ */
+void
+Queue::setAffinity( const std::string & a_key, const std::string & a_consumer ) {
+    // Lock must be held before calling
+
+    affinity_map_t::iterator a = m_affinity.find( a_key );
+
+    if ( a == m_affinity.end() ) {
+        if ( m_affinity.size() >= m_affinity_capacity ) {
+            AffinityKey_t * lru = m_affinity_lru.pop_front();
+
+            dropConsumerKey( lru->consumer );
+            m_affinity.erase( lru->key );
+        }
+
+        a = m_affinity.emplace( a_key, AffinityKey_t( a_key )).first;
+    } else {
+        m_affinity_lru.remove( &a->second );
+
+        if ( a->second.consumer && a->second.consumer->id != a_consumer ) {
+            dropConsumerKey( a->second.consumer );
+            a->second.consumer = 0;
+        }
+    }
+
+    m_affinity_lru.push_back( &a->second );
+
+    if ( !a->second.consumer ) {
+        Consumer_t & consumer = m_consumers.emplace( a_consumer, Consumer_t( a_consumer )).first->second;
+
+        consumer.keys++;
+        a->second.consumer = &consumer;
+    }
+}
+
+/** @brief Remove one affinity key from consumer
+ *
+ * A consumer left without keys is dropped, and any messages still held for
+ * it are released to the ready queues.
+ */
+void
+Queue::dropConsumerKey( Consumer_t * a_consumer ) {
+    // Lock must be held before calling
+
+    if ( --a_consumer->keys ) {
+        return;
+    }
+
+    timestamp_t now = std::chrono::system_clock::now();
+    size_t count = 0;
+
+    while ( !a_consumer->held.empty() ) {
+        MsgEntry_t * msg = a_consumer->held.front();
+        timestamp_t queued_ts = msg->state_ts;
+
+        unholdMsg( msg );
+        queueMsg( msg, now, false );
+        msg->state_ts = queued_ts;
+        count++;
+    }
+
+    if ( count == 1 ) {
+        m_pop_cv.notify_one();
+    } else if ( count > 1 ) {
+        m_pop_cv.notify_all();
+    }
+
+    m_consumers.erase( a_consumer->id );
+}
+
+
+/** @brief Remove and return next ready message according to dispatch policy
+ *
+ * Strict dispatch serves the highest non-empty priority. Weighted dispatch is
+ * deficit round robin with unit message cost: on each visit a priority level
+ * is credited with its weight and is served until the credit is used or its
+ * queue empties (which forfeits remaining credit), then the next level is
+ * visited. Under contention each busy level therefore receives pops in
+ * proportion to its weight, and idle levels' shares are redistributed. Cost
+ * per pop is O(1) amortized, O(priorities) worst case. Deadline dispatch
+ * serves the ready heap (earliest due time, then priority, then arrival) in
+ * O(log n). Levels and tenants that are rate limited are skipped (see
+ * readyPop); if no message can be dispatched, returns null and lowers a_next
+ * to the earliest time a rate limit allows another dispatch.
+ */
+Queue::MsgEntry_t *
+Queue::dequeueMsg( const timestamp_t & a_now, timestamp_t & a_next ) {
+    // Lock must be held before calling (with m_count_queued > 0)
+
+    MsgEntry_t * msg;
+
+    if ( m_dispatch == DISPATCH_DEADLINE ) {
+        if ( !m_ready_heap.empty() ) {
+            msg = m_ready_heap.pop();
+
+            batchRemove( msg );
+
+            return msg;
+        }
+    } else if ( m_dispatch == DISPATCH_WEIGHTED ) {
+        for ( size_t i = 0; i <= 2 * m_queue_list.size(); i++ ) {
+            if ( m_queue_list[m_drr_cur].count && m_deficit[m_drr_cur] && ( msg = readyPop( m_drr_cur, a_now, a_next ))) {
+                m_deficit[m_drr_cur]--;
+                return msg;
+            }
+
+            // Empty or rate-limited level forfeits rest of its turn
+            m_deficit[m_drr_cur] = 0;
+
+            if ( ++m_drr_cur == m_queue_list.size() ) {
+                m_drr_cur = 0;
+            }
+            m_deficit[m_drr_cur] += m_weights[m_drr_cur];
+        }
+    } else {
+        for ( size_t p = 0; p < m_queue_list.size(); p++ ) {
+            if ( m_queue_list[p].count && ( msg = readyPop( p, a_now, a_next ))) {
+                return msg;
+            }
+        }
+    }
+
+    if ( m_rate_limited ) {
+        return 0;
+    }
+
+    throw logic_error( "All queues empty when m_count_queued > 0" );
+}
+
+/** @brief Append message to its tenant's ready queue at its current level
+ *
+ * A tenant queue that becomes non-empty joins the back of the level's
+ * round-robin ring.
+ */
+void
+Queue::readyPush( MsgEntry_t * a_msg ) {
+    // Lock must be held before calling
+
+    ReadyQueue_t & queue = m_queue_list[a_msg->level];
+    TenantQueue_t & tq = a_msg->tenant->queues[a_msg->level];
+
+    if ( tq.msgs.empty() ) {
+        queue.tenants.push_back( &tq );
+    }
+
+    tq.msgs.push_back( a_msg );
+    queue.count++;
+
+    batchAdd( a_msg );
+}
+
+/** @brief Remove and return next message from a ready queue level
+ *
+ * Tenants at a level are served by deficit round robin with unit message
+ * cost: the tenant at the front of the ring is served until it has received
+ * its weight in pops (or runs out of messages), then moves to the back. A
+ * tenant that empties leaves the ring and forfeits the rest of its turn.
+ * Constant-time without rate limits. With rate limits, returns null if the
+ * level's token bucket is empty; tenants whose buckets are empty are rotated
+ * to the back of the ring (so cost is linear in the number of throttled
+ * tenants at the level), and null is returned if all are throttled.
+ */
+Queue::MsgEntry_t *
+Queue::readyPop( size_t a_level, const timestamp_t & a_now, timestamp_t & a_next ) {
+    // Lock must be held before calling (with level count > 0)
+
+    ReadyQueue_t & queue = m_queue_list[a_level];
+    TenantQueue_t * tq = queue.tenants.front();
+
+    if ( m_rate_limited ) {
+        TokenBucket & level_rate = m_level_rates[a_level];
+
+        if ( !level_rate.ready( a_now )) {
+            a_next = min( a_next, level_rate.readyTime() );
+            return 0;
+        }
+
+        // Rate-limited tenants move to back of ring, forfeiting their turn
+        for ( size_t n = queue.tenants.size(); !tq->tenant->rate.ready( a_now ); tq = queue.tenants.front() ) {
+            a_next = min( a_next, tq->tenant->rate.readyTime() );
+
+            if ( !--n ) {
+                return 0;
+            }
+
+            tq->deficit = 0;
+            queue.tenants.remove( tq );
+            queue.tenants.push_back( tq );
+        }
+
+        level_rate.take();
+        tq->tenant->rate.take();
+    }
+
+    if ( !tq->deficit ) {
+        tq->deficit = tq->tenant->weight;
+    }
+
+    MsgEntry_t * msg = tq->msgs.pop_front();
+
+    queue.count--;
+    tq->deficit--;
+    batchRemove( msg );
+
+    if ( tq->msgs.empty() ) {
+        queue.tenants.remove( tq );
+        tq->deficit = 0;
+    } else if ( !tq->deficit ) {
+        queue.tenants.remove( tq );
+        queue.tenants.push_back( tq );
+    }
+
+    return msg;
+}
+
+/** @brief Consume a dispatch token for message from level and tenant rate limits
+ *
+ * Returns false, and lowers a_next to the time a token becomes available, if
+ * either limit does not currently allow a dispatch.
+ */
+bool
+Queue::rateTake( MsgEntry_t * a_msg, size_t a_level, const timestamp_t & a_now, timestamp_t & a_next ) {
+    // Lock must be held before calling
+
+    if ( !m_rate_limited ) {
+        return true;
+    }
+
+    TokenBucket & level_rate = m_level_rates[a_level];
+
+    if ( !level_rate.ready( a_now )) {
+        a_next = min( a_next, level_rate.readyTime() );
+        return false;
+    }
+
+    if ( !a_msg->tenant->rate.ready( a_now )) {
+        a_next = min( a_next, a_msg->tenant->rate.readyTime() );
+        return false;
+    }
+
+    level_rate.take();
+    a_msg->tenant->rate.take();
+
+    return true;
+}
+
+/** @brief Remove message from its tenant's ready queue (constant-time)
+ */
+void
+Queue::readyRemove( MsgEntry_t * a_msg ) {
+    // Lock must be held before calling
+
+    ReadyQueue_t & queue = m_queue_list[a_msg->level];
+    TenantQueue_t & tq = a_msg->tenant->queues[a_msg->level];
+
+    tq.msgs.remove( a_msg );
+    queue.count--;
+
+    if ( tq.msgs.empty() ) {
+        queue.tenants.remove( &tq );
+        tq.deficit = 0;
+    }
+
+    batchRemove( a_msg );
+}
+
+/** @brief Add ready message to batch key index (if message has a key)
+ */
+void
+Queue::batchAdd( MsgEntry_t * a_msg ) {
+    // Lock must be held before calling
+
+    if ( a_msg->batch.empty() ) {
+        return;
+    }
+
+    Batch_t & batch = m_batches[a_msg->batch];
+
+    if ( batch.levels.empty() ) {
+        batch.levels.resize( m_queue_list.size() );
+    }
+
+    batch.levels[a_msg->level].push_back( a_msg );
+    batch.count++;
+}
+
+/** @brief Remove message from batch key index (if message has a key)
+ *
+ * The index entry for a key is erased when its last ready message is removed.
+ */
+void
+Queue::batchRemove( MsgEntry_t * a_msg ) {
+    // Lock must be held before calling
+
+    if ( a_msg->batch.empty() ) {
+        return;
+    }
+
+    batch_map_t::iterator b = m_batches.find( a_msg->batch );
+
+    msg_aux_list_t::unlink( a_msg );
+
+    if ( !--b->second.count ) {
+        m_batches.erase( b );
+    }
+}
+
+
+void
+Queue::ackImpl( const std::string & a_id, const std::string & a_token, bool a_requeue, size_t a_delay ) {
+    // Lock must be held before calling
+
+    msg_map_t::iterator e = getRunningMsg( a_id, a_token );
+    MsgEntry_t * entry = e->second;
+    timestamp_t now = std::chrono::system_clock::now();
+
+    endRun( entry, now, true );
+
+    if ( a_requeue ) {
+        entry->message.checkpoint.clear();
+
+        if ( m_wal || m_replica ) {
+            logTransition( WriteAheadLog::REC_REQUEUE, entry->message.id, entry->priority, a_delay ?
+                std::chrono::duration_cast<std::chrono::milliseconds>( now.time_since_epoch() ).count() + a_delay : 0, entry->fail_count );
+        }
+
+        if ( a_delay ) {
+            insertDelayedMsg( entry, now + std::chrono::milliseconds( a_delay ));
+        } else {
+            queueMsg( entry, now );
+            m_pop_cv.notify_one();
+        }
+
+    } else {
+        freeMsgEntry( e );
+    }
+}
+
+/** @brief Set ACK deadline of a running message
+ *
+ * Deadline is set to a_timeout msec after a_now, or, if a_timeout is 0, by
+ * the message's own ACK timeout, falling back to the adaptive timeout of the
+ * message's class (or priority) and then to the queue default. If no timeout
+ * applies, the message never expires.
+ */
+void
+Queue::setDeadline( MsgEntry_t * a_msg, const timestamp_t & a_now, size_t a_timeout ) {
+    // Lock must be held before calling
+
+    if ( !a_timeout ) {
+        a_timeout = a_msg->ack_timeout;
+    }
+
+    if ( !a_timeout ) {
+        a_timeout = getClassStats( a_msg ).ack_timeout;
+    }
+
+    if ( !a_timeout ) {
+        a_timeout = m_fail_timeout;
+    }
+
+    a_msg->deadline = a_timeout ? a_now + std::chrono::milliseconds( a_timeout ) : timestamp_t::max();
+}
+
+/** @brief Find a running message and verify consumer's token
+ *
+ * Throws if the message does not exist, the token does not match, or the
+ * message is not running.
+ */
+Queue::msg_map_t::iterator
+Queue::getRunningMsg( const std::string & a_id, const std::string & a_token ) {
+    // Lock must be held before calling
+
+    msg_map_t::iterator e = m_msg_map.find( a_id );
+    if ( e == m_msg_map.end() ) {
+        throw runtime_error( "No message found matching ID" );
+    }
+
+    if ( e->second->message.token != a_token && !( e->second->hedge && e->second->hedge->token.size() && e->second->hedge->token == a_token )) {
+        //cout << "msg tok: " << e->second->message.token << ", rcvd: " << a_token << endl;
+        throw runtime_error( "Invalid message token" );
+    }
+
+    if ( e->second->state != MSG_RUNNING ) {
+        throw runtime_error( "Invalid message state" );
+    }
+
+    return e;
+}
+
+/** @brief End the current run (lease) of a running message
+ *
+ * Removes message from running and hedge lists and cancels all outstanding
+ * leases (primary and hedge). If the run was completed by a consumer ACK,
+ * the processing time is recorded for use in hedging decisions. Caller is
+ * responsible for the subsequent state change.
+ */
+void
+Queue::endRun( MsgEntry_t * a_msg, const timestamp_t & a_now, bool a_completed ) {
+    // Lock must be held before calling
+
+    m_msg_running.remove( a_msg );
+    msg_aux_list_t::unlink( a_msg );
+
+    a_msg->message.token.clear();
+
+    if ( a_msg->hedge ) {
+        a_msg->hedge->token.clear();
+    }
+
+    if ( a_completed ) {
+        ClassStats_t & stats = getClassStats( a_msg );
+
+        stats.run_times.add( std::chrono::duration_cast<std::chrono::milliseconds>( a_now - a_msg->state_ts ).count() );
+        stats.changed = true;
+    }
+}
+
+/** @brief Handle expiry of a running message's ACK deadline
+ *
+ * Ends the run and retries the message, or fails it once its retry limit is
+ * reached. Returns true if the message was requeued (caller is responsible
+ * for notifying consumers).
+ */
+bool
+Queue::timeoutMsg( MsgEntry_t * a_msg, const timestamp_t & a_now ) {
+    // Lock must be held before calling
+
+    endRun( a_msg, a_now, false );
+
+    size_t max_retries = a_msg->max_retries ? a_msg->max_retries : m_max_retries;
+
+    if ( ++a_msg->fail_count >= max_retries && max_retries ) {
+        failMsg( a_msg );
+        return false;
+    }
+
+    queueMsg( a_msg, a_now );
+
+    return true;
+}
+
+/** @brief Get processing time statistics applicable to a message
+ */
+Queue::ClassStats_t &
+Queue::getClassStats( MsgEntry_t * a_msg ) {
+    // Lock must be held before calling
+
+    return a_msg->class_stats ? *a_msg->class_stats : m_pri_stats[a_msg->priority];
+}
+
+/** @brief Recompute hedge threshold and adaptive ACK timeout from statistics
+ *
+ * Called by the monitor thread for statistics that have changed since the
+ * last poll, so per-message operations only use the cached values.
+ */
+void
+Queue::updateClassStats( ClassStats_t & a_stats ) {
+    // Lock must be held before calling
+
+    uint32_t samples = a_stats.run_times.count();
+
+    a_stats.changed = false;
+
+    if ( m_hedge_quantile && samples >= m_hedge_min_samples ) {
+        a_stats.hedge_time = max<size_t>( a_stats.run_times.quantile( m_hedge_quantile ), 1 );
+    } else {
+        a_stats.hedge_time = 0;
+    }
+
+    if ( m_adapt_quantile && samples >= m_adapt_min_samples ) {
+        size_t timeout = (size_t)( m_adapt_factor * a_stats.run_times.quantile( m_adapt_quantile ));
+
+        timeout = max( timeout, m_adapt_min );
+        if ( m_adapt_max ) {
+            timeout = min( timeout, m_adapt_max );
+        }
+
+        a_stats.ack_timeout = timeout;
+    } else {
+        a_stats.ack_timeout = 0;
+    }
+}
+
+/** @brief Select straggling running messages for hedging
+ *
+ * If hedging is enabled, running messages that have been running longer than
+ * the configured quantile of recent processing times (of the message's class
+ * or priority) are placed in the hedge queue, from which idle consumers
+ * receive a duplicate lease. The original lease remains valid; whichever ACK
+ * arrives first wins and cancels the other. Messages are hedged at most once
+ * per run, and no more messages are hedged than there are idle consumers.
+ */
+void
+Queue::hedgeMsgs( const timestamp_t & a_now ) {
+    // Lock must be held before calling
+
+    if ( !m_hedge_quantile || m_pop_waiters <= m_msg_hedge.size() ) {
+        return;
+    }
+
+    size_t count = 0;
+    size_t hedge_time;
+
+    for ( MsgEntry_t * entry = m_msg_running.front(); entry; entry = msg_list_t::next( entry )) {
+        if ( m_msg_hedge.contains( entry ) || ( entry->hedge && entry->hedge->token.size() )) {
+            continue;
+        }
+
+        hedge_time = getClassStats( entry ).hedge_time;
+
+        if ( !hedge_time || a_now - entry->state_ts <= std::chrono::milliseconds( hedge_time )) {
+            continue;
+        }
+
+        m_msg_hedge.push_back( entry );
+        count++;
+
+        if ( m_msg_hedge.size() == m_pop_waiters ) {
+            break;
+        }
+    }
+
+    if ( count == 1 ) {
+        m_pop_cv.notify_one();
+    } else if ( count > 1 ) {
+        m_pop_cv.notify_all();
+    }
+}
+
+/** @brief Append message to the ready queue of its priority
+ *
+ * Message starts at its base priority level; aging (see ageQueuedMsgs) may
+ * later move it to higher priority levels. With deadline dispatch, message
+ * is instead inserted into the ready heap and is not aged. Caller is
+ * responsible for notifying consumers.
+ */
+void
+Queue::queueMsg( MsgEntry_t * a_msg, const timestamp_t & a_now, bool a_hold ) {
+    // Lock must be held before calling
+
+    trackExpiry( a_msg );
+    trackDue( a_msg );
+
+    if ( a_hold && a_msg->affinity.size() && m_affinity_wait && holdMsg( a_msg, a_now )) {
+        return;
+    }
+
+    a_msg->state = MSG_QUEUED;
+    a_msg->state_ts = a_now;
+    a_msg->level = a_msg->priority;
+    a_msg->level_ts = a_now;
+
+    if ( m_dispatch == DISPATCH_DEADLINE ) {
+        // Ties on due time (incl. no due time) broken by priority, then arrival
+        m_ready_heap.push( a_msg, a_msg->due == timestamp_t::max() ? UINT64_MAX :
+            std::chrono::duration_cast<std::chrono::milliseconds>( a_msg->due.time_since_epoch() ).count(),
+            ((uint64_t)a_msg->priority << 56 ) | ( ++m_queue_seq & 0xFFFFFFFFFFFFFFULL ));
+        batchAdd( a_msg );
+    } else {
+        readyPush( a_msg );
+    }
+
+    m_count_queued++;
+}
+
+/** @brief Hold keyed message for the consumer its affinity key is mapped to
+ *
+ * Held messages are queued (for monitoring purposes) but are kept on the
+ * consumer's held list rather than in the ready queues, so only that consumer
+ * can pop them until the affinity wait expires and releaseHeldMsgs moves them
+ * to the ready queues. Returns false (message not held) if the key is not
+ * mapped to a consumer. All waiting consumers are notified since pop waiters
+ * share one condition variable.
+ */
+bool
+Queue::holdMsg( MsgEntry_t * a_msg, const timestamp_t & a_now ) {
+    // Lock must be held before calling
+
+    affinity_map_t::iterator a = m_affinity.find( a_msg->affinity );
+
+    if ( a == m_affinity.end() || !a->second.consumer ) {
+        return false;
+    }
+
+    a_msg->state = MSG_QUEUED;
+    a_msg->state_ts = a_now;
+
+    a->second.consumer->held.push_back( a_msg );
+    m_msg_held.push_back( a_msg );
+    m_count_held++;
+
+    if ( m_msg_held.front() == a_msg ) {
+        m_timers->wakeTask( m_delay_task, a_now + std::chrono::milliseconds( m_affinity_wait ));
+    }
+
+    m_pop_cv.notify_all();
+
+    return true;
+}
+
+/** @brief Remove message from consumer held lists (constant-time)
+ */
+void
+Queue::unholdMsg( MsgEntry_t * a_msg ) {
+    // Lock must be held before calling
+
+    msg_list_t::unlink( a_msg );
+    m_msg_held.remove( a_msg );
+    m_count_held--;
+}
+
+/** @brief Release messages held for longer than the affinity wait
+ *
+ * Expired messages are moved to the ready queues where any consumer may pop
+ * them (retaining their original queue time for wait statistics). Since all
+ * messages are held for the same period, the held list is in expiration order
+ * and only expired messages are visited. Returns expiration time of the next
+ * held message, or max if none.
+ */
+Queue::timestamp_t
+Queue::releaseHeldMsgs( const timestamp_t & a_now ) {
+    // Lock must be held before calling
+
+    std::chrono::milliseconds wait( m_affinity_wait );
+
+    while ( !m_msg_held.empty() ) {
+        MsgEntry_t * msg = m_msg_held.front();
+        timestamp_t queued_ts = msg->state_ts;
+
+        if ( queued_ts + wait > a_now ) {
+            return queued_ts + wait;
+        }
+
+        unholdMsg( msg );
+        queueMsg( msg, a_now, false );
+        msg->state_ts = queued_ts;
+        m_pop_cv.notify_one();
+    }
+
+    return timestamp_t::max();
+}
+
+void
+Queue::insertDelayedMsg( MsgEntry_t * a_msg, const timestamp_t & a_requeue_ts ) {
+    // Lock must be held before calling
+
+    a_msg->state = MSG_DELAYED;
+    a_msg->state_ts = a_requeue_ts;
+
+    m_msg_delay.insert( a_msg );
+
+    if ( *m_msg_delay.begin() == a_msg ) {
+        m_timers->wakeTask( m_delay_task, a_requeue_ts );
+    }
+
+    trackExpiry( a_msg );
+    trackDue( a_msg );
+}
+
+/** @brief Add waiting message with an expiry time to the expiry heap
+ *
+ * Has no effect if message has no expiry or is already in the heap.
+ */
+void
+Queue::trackExpiry( MsgEntry_t * a_msg ) {
+    // Lock must be held before calling
+
+    if ( a_msg->expiry != timestamp_t::max() && !msg_expire_heap_t::contains( a_msg )) {
+        m_expire_heap.push( a_msg, std::chrono::duration_cast<std::chrono::milliseconds>( a_msg->expiry.time_since_epoch() ).count(), ++m_queue_seq );
+
+        if ( m_expire_heap.top() == a_msg ) {
+            m_timers->wakeTask( m_delay_task, a_msg->expiry );
+        }
+    }
+}
+
+/** @brief Add waiting message with a due time to the due heap
+ *
+ * Has no effect if message has no due time or is already in the heap. The
+ * heap lets getDeadlineStats count overdue messages without a scan.
+ */
+void
+Queue::trackDue( MsgEntry_t * a_msg ) {
+    // Lock must be held before calling
+
+    if ( a_msg->due != timestamp_t::max() && !msg_due_heap_t::contains( a_msg )) {
+        m_due_heap.push( a_msg, std::chrono::duration_cast<std::chrono::milliseconds>( a_msg->due.time_since_epoch() ).count(), ++m_queue_seq );
+    }
+}
+
+/** @brief Remove message from the expiry and due heaps (if present)
+ */
+void
+Queue::untrackMsg( MsgEntry_t * a_msg ) {
+    // Lock must be held before calling
+
+    if ( msg_expire_heap_t::contains( a_msg )) {
+        m_expire_heap.remove( a_msg );
+    }
+
+    if ( msg_due_heap_t::contains( a_msg )) {
+        m_due_heap.remove( a_msg );
+    }
+}
+
+/** @brief Remove a queued (ready or held) or delayed message from its queue
+ */
+void
+Queue::unqueueMsg( MsgEntry_t * a_msg ) {
+    // Lock must be held before calling
+
+    if ( a_msg->state == MSG_DELAYED ) {
+        pair<msg_delay_t::iterator,msg_delay_t::iterator> range = m_msg_delay.equal_range( a_msg );
+
+        for ( msg_delay_t::iterator d = range.first; d != range.second; d++ ) {
+            if ( *d == a_msg ) {
+                m_msg_delay.erase( d );
+                break;
+            }
+        }
+    } else if ( m_msg_held.contains( a_msg )) {
+        unholdMsg( a_msg );
+    } else {
+        if ( m_dispatch == DISPATCH_DEADLINE ) {
+            m_ready_heap.remove( a_msg );
+            batchRemove( a_msg );
+        } else {
+            readyRemove( a_msg );
+        }
+
+        m_count_queued--;
+    }
+
+    untrackMsg( a_msg );
+}
+
+/** @brief Expire queued and delayed messages past their expiry time
+ *
+ * Expired messages are failed (which propagates to dependents and releases
+ * their group) and, unless configured to keep them in the failed set, are
+ * then dropped. Only expired messages are visited. Returns expiry time of the
+ * next message, or max if none.
+ */
+Queue::timestamp_t
+Queue::expireMsgs( const timestamp_t & a_now ) {
+    // Lock must be held before calling
+
+    uint64_t now_ms = std::chrono::duration_cast<std::chrono::milliseconds>( a_now.time_since_epoch() ).count();
+    MsgEntry_t * msg;
+
+    while ( !m_expire_heap.empty() ) {
+        if ( m_expire_heap.topKey() > now_ms ) {
+            return m_expire_heap.top()->expiry;
+        }
+
+        msg = m_expire_heap.pop();
+
+        unqueueMsg( msg );
+        failMsg( msg );
+        m_count_expired++;
+
+        if ( !m_expire_to_failed ) {
+            m_msg_failed.erase( msg->fail_seq );
+            m_count_failed--;
+            freeMsgEntry( m_msg_map.find( msg->message.id ));
+        }
+    }
+
+    return timestamp_t::max();
+}
+
+/** @brief Move a message into the failed state
+ *
+ * The message is appended to the failed index, which is ordered by failure
+ * sequence number (i.e. failure time) and used for paged failure listings.
+ * Failure propagates to blocked dependents (transitively), which are
+ * detached from their other prerequisites; requeuing a failed dependent does
+ * not restore its prerequisites.
+ */
+void
+Queue::failMsg( MsgEntry_t * a_msg ) {
+    // Lock must be held before calling
+
+    vector<MsgEntry_t*> fail( 1, a_msg );
+    timestamp_t now = std::chrono::system_clock::now();
+    MsgEntry_t * msg;
+
+    // Worklist rather than recursion, as dependency chains may be long
+    while ( fail.size() ) {
+        msg = fail.back();
+        fail.pop_back();
+
+        msg_list_t::unlink( msg );
+        releaseGroup( msg );
+
+        // Dependent may be waiting in its group's pending list
+        if ( msg->state == MSG_BLOCKED ) {
+            msg_aux_list_t::unlink( msg );
+        }
+
+        msg->state = MSG_FAILED;
+        msg->state_ts = now;
+        msg->message.token.clear();
+        msg->fail_seq = ++m_fail_seq;
+
+        m_msg_failed.emplace_hint( m_msg_failed.end(), msg->fail_seq, msg );
+        m_count_failed++;
+
+        if ( m_wal || m_replica ) {
+            logTransition( WriteAheadLog::REC_FAIL, msg->message.id );
+        }
+
+        for ( vector<MsgEntry_t*>::iterator d = msg->dependents.begin(); d != msg->dependents.end(); d++ ) {
+            for ( vector<MsgEntry_t*>::iterator p = (*d)->prereqs.begin(); p != (*d)->prereqs.end(); p++ ) {
+                if ( *p != msg ) {
+                    (*p)->dependents.erase( find( (*p)->dependents.begin(), (*p)->dependents.end(), *d ));
+                }
+            }
+
+            (*d)->prereqs.clear();
+            fail.push_back( *d );
+        }
+
+        msg->dependents.clear();
+    }
+}
+
+/** @brief Get number of messages counted against queue capacity
+ *
+ * Failed messages are excluded if they have a separate budget.
+ */
+size_t
+Queue::liveCount() const {
+    // Lock must be held before calling
+
+    return m_msg_map.size() - ( m_failed_capacity ? m_count_failed : 0 );
+}
+
+/** @brief Spill (or drop) oldest failed messages beyond the failed capacity
+ *
+ * Spilled messages are appended to the dead-letter file and removed from the
+ * queue, so they can be listed but no longer erased or requeued. Called only
+ * where no caller holds a failed entry, since entries are freed. On a write
+ * error the remaining messages stay in memory and are retried next time.
+ */
+void
+Queue::trimFailed() {
+    // Lock must be held before calling
+
+    if ( !m_failed_capacity ) {
+        return;
+    }
+
+    DeadLetterFile::Record_t rec;
+    MsgEntry_t * msg;
+
+    while ( m_count_failed > m_failed_capacity ) {
+        msg = m_msg_failed.begin()->second;
+
+        if ( m_dead_letter ) {
+            rec.seq = msg->fail_seq;
+            rec.id = msg->message.id;
+            rec.priority = msg->priority;
+            rec.fail_count = msg->fail_count;
+            rec.checkpoint = msg->message.checkpoint;
+
+            try {
+                m_dead_letter->append( rec );
+            } catch ( const exception & e ) {
+                if ( m_err_cb ) {
+                    (*m_err_cb)( e.what() );
+                }
+                return;
+            }
+        } else {
+            m_count_dropped++;
+        }
+
+        m_msg_failed.erase( m_msg_failed.begin() );
+        m_count_failed--;
+        freeMsgEntry( m_msg_map.find( msg->message.id ));
+    }
+}
+
+/** @brief Append a pushed message to the overflow log of its priority
+ *
+ * Times are stored as absolute deadlines so that time spent in overflow
+ * counts against delays, due times and TTLs. The message is held against
+ * its tenant's quota and its ID is reserved until it is paged in.
+ */
+void
+Queue::overflowMsg( const std::string & a_id, uint8_t a_priority, size_t a_delay, const MsgOpts_t & a_opts ) {
+    // Lock must be held before calling
+
+    OverflowLog::Record_t rec;
+    uint64_t now_ms = std::chrono::duration_cast<std::chrono::milliseconds>( std::chrono::system_clock::now().time_since_epoch() ).count();
+
+    rec.id = a_id;
+    rec.ready_ms = a_delay ? now_ms + a_delay : 0;
+    rec.due_ms = a_opts.due ? now_ms + a_opts.due : 0;
+    rec.expiry_ms = a_opts.ttl ? now_ms + a_opts.ttl : 0;
+    rec.ack_timeout = (uint32_t)a_opts.ack_timeout;
+    rec.max_retries = (uint8_t)a_opts.max_retries;
+    rec.msg_class = a_opts.msg_class;
+    rec.tenant = a_opts.tenant;
+    rec.affinity = a_opts.affinity;
+    rec.batch = a_opts.batch;
+
+    Tenant_t * tenant = getTenant( a_opts.tenant );
+
+    m_overflow[a_priority]->append( rec );
+    m_count_overflow++;
+    m_overflow_ids.insert( a_id );
+    tenant->overflow++;
+
+    checkPageIn();
+}
+
+/** @brief Wake delay task to page in overflow if backlog is below low-water mark
+ *
+ * The low-water mark is one overflow batch below capacity, so that paging
+ * reads full batches.
+ */
+void
+Queue::checkPageIn() {
+    // Lock must be held before calling
+
+    if ( m_count_overflow && !m_overflow_wake && liveCount() + m_overflow_batch <= m_capacity ) {
+        m_overflow_wake = true;
+        m_timers->wakeTask( m_delay_task, std::chrono::system_clock::now() );
+    }
+}
+
+/** @brief Page overflowed messages into memory up to capacity
+ *
+ * Higher priorities are paged in first. Messages whose ID is already in use
+ * are dropped (e.g. a message recovered from the write-ahead log). Returns
+ * number of messages paged in.
+ */
+size_t
+Queue::pageInMsgs( const timestamp_t & a_now ) {
+    // Lock must be held before calling
+
+    uint64_t now_ms = std::chrono::duration_cast<std::chrono::milliseconds>( a_now.time_since_epoch() ).count();
+    vector<OverflowLog::Record_t> recs;
+    size_t count = 0, live, before;
+    MsgOpts_t opts;
+
+    m_overflow_wake = false;
+
+    for ( size_t p = 0; p < m_overflow.size() && m_count_overflow; p++ ) {
+        OverflowLog & log = *m_overflow[p];
+
+        while ( log.size() && ( live = liveCount() ) < m_capacity ) {
+            recs.clear();
+            before = log.size();
+
+            try {
+                log.read( min( m_capacity - live, m_overflow_batch ), recs );
+            } catch ( ... ) {
+                m_count_overflow -= before - log.size();
+                releaseOverflow();
+                throw;
+            }
+
+            m_count_overflow -= before - log.size();
+
+            for ( vector<OverflowLog::Record_t>::iterator r = recs.begin(); r != recs.end(); r++ ) {
+                m_overflow_ids.erase( r->id );
+                getTenant( r->tenant )->overflow--;
+
+                if ( m_msg_map.find( r->id ) != m_msg_map.end() ) {
+                    if ( m_err_cb ) {
+                        (*m_err_cb)( string( "Dropped overflow message with duplicate ID " ) + r->id );
+                    }
+                    continue;
+                }
+
+                opts.ack_timeout = r->ack_timeout;
+                opts.max_retries = r->max_retries;
+                opts.msg_class = r->msg_class;
+                opts.tenant = r->tenant;
+                opts.affinity = r->affinity;
+                opts.batch = r->batch;
+
+                if ( restoreMsg( r->id, p, r->ready_ms, r->due_ms, r->expiry_ms, opts, now_ms )) {
+                    count++;
+                }
+            }
+        }
+    }
+
+    releaseOverflow();
+
+    if ( count ) {
+        m_pop_cv.notify_all();
+    }
+
+    return count;
+}
+
+/** @brief Release reserved IDs and tenant counts once overflow logs are empty
+ *
+ * Records lost to a read error cannot be released one by one, so anything
+ * still reserved when the logs are empty is released here.
+ */
+void
+Queue::releaseOverflow() {
+    // Lock must be held before calling
+
+    if ( !m_count_overflow && m_overflow_ids.size() ) {
+        m_overflow_ids.clear();
+
+        for ( tenant_map_t::iterator t = m_tenants.begin(); t != m_tenants.end(); t++ ) {
+            t->second.overflow = 0;
+        }
+    }
+}
+
+/** @brief Push a message restored from disk (overflow or write-ahead log)
+ *
+ * Times are absolute (msec since epoch). A message that expired while on
+ * disk is handled as if it had expired in the queue. If a_failed is set, the
+ * message is restored directly into the failed set, without its group or
+ * prerequisites (failure releases both). Returns false if the message was
+ * dropped.
+ */
+bool
+Queue::restoreMsg( const std::string & a_id, uint8_t a_priority, uint64_t a_ready_ms, uint64_t a_due_ms, uint64_t a_expiry_ms,
+    MsgOpts_t & a_opts, uint64_t a_now_ms, bool a_failed ) {
+    // Lock must be held before calling
+
+    if ( !a_failed && a_expiry_ms && a_expiry_ms <= a_now_ms ) {
+        m_count_expired++;
+
+        if ( !m_expire_to_failed ) {
+            if ( m_wal || m_replica ) {
+                logTransition( WriteAheadLog::REC_REMOVE, a_id );
+            }
+            return false;
+        }
+
+        a_failed = true;
+    }
+
+    if ( a_failed ) {
+        a_opts.group.clear();
+        a_opts.depends.clear();
+        a_opts.due = 0;
+        a_opts.ttl = 0;
+
+        pushImpl( a_id, a_priority, 0, a_opts );
+
+        MsgEntry_t * msg = m_msg_map[a_id];
+
+        unqueueMsg( msg );
+        failMsg( msg );
+
+        return true;
+    }
+
+    a_opts.due = a_due_ms ? ( a_due_ms > a_now_ms ? a_due_ms - a_now_ms : 1 ) : 0;
+    a_opts.ttl = a_expiry_ms ? a_expiry_ms - a_now_ms : 0;
+
+    pushImpl( a_id, a_priority, a_ready_ms > a_now_ms ? a_ready_ms - a_now_ms : 0, a_opts );
+
+    return true;
+}
+
+/** @brief Restore messages recovered from a snapshot or the write-ahead log
+ *
+ * Records are state records (see WriteAheadLog::recover) in the order the
+ * messages are to be queued. Messages beyond capacity go to the
+ * overflow tier if one is configured; otherwise capacity and tenant quotas
+ * are not enforced, as the recovered state was valid when logged. Messages
+ * that cannot be restored are reported and skipped.
+ */
+void
+Queue::recoverMsgs( std::vector<WriteAheadLog::Record_t> & a_records ) {
+    // Lock must be held before calling
+
+    uint64_t now_ms = std::chrono::duration_cast<std::chrono::milliseconds>( std::chrono::system_clock::now().time_since_epoch() ).count();
+
+    for ( vector<WriteAheadLog::Record_t>::iterator r = a_records.begin(); r != a_records.end(); r++ ) {
+        try {
+            recoverMsg( *r, now_ms );
+        } catch ( const exception & e ) {
+            if ( m_err_cb ) {
+                (*m_err_cb)( string( "Failed to recover message " ) + r->id + ": " + e.what() );
+            }
+        }
+    }
+}
+
+/** @brief Restore one message from a state or push record
+ *
+ * Prerequisite IDs are moved out of a_record. Throws if the message cannot
+ * be restored (e.g. duplicate ID).
+ */
+void
+Queue::recoverMsg( WriteAheadLog::Record_t & a_record, uint64_t a_now_ms ) {
+    // Lock must be held before calling
+
+    uint8_t priority = min<size_t>( a_record.priority, m_queue_list.size() - 1 );
+    MsgOpts_t opts;
+
+    opts.ack_timeout = a_record.ack_timeout;
+    opts.max_retries = a_record.max_retries;
+    opts.msg_class = a_record.msg_class;
+    opts.tenant = a_record.tenant;
+    opts.group = a_record.group;
+    opts.affinity = a_record.affinity;
+    opts.batch = a_record.batch;
+    opts.depends.swap( a_record.depends );
+
+    if ( m_msg_map.find( a_record.id ) != m_msg_map.end() || m_overflow_ids.count( a_record.id )) {
+        throw runtime_error( "Duplicate message ID" );
+    }
+
+    if ( !a_record.failed && m_overflow.size() && opts.group.empty() && opts.depends.empty() &&
+        liveCount() >= m_capacity && !( a_record.expiry_ms && a_record.expiry_ms <= a_now_ms )) {
+        opts.due = a_record.due_ms ? ( a_record.due_ms > a_now_ms ? a_record.due_ms - a_now_ms : 1 ) : 0;
+        opts.ttl = a_record.expiry_ms ? a_record.expiry_ms - a_now_ms : 0;
+        overflowMsg( a_record.id, priority, a_record.ready_ms > a_now_ms ? a_record.ready_ms - a_now_ms : 0, opts );
+    } else if ( restoreMsg( a_record.id, priority, a_record.ready_ms, a_record.due_ms, a_record.expiry_ms, opts, a_now_ms, a_record.failed ) && a_record.retries ) {
+        m_msg_map[a_record.id]->fail_count = a_record.retries;
+    }
+}
+
+/** @brief Restore queue state from snapshot and/or write-ahead log
+ *
+ * If both are configured, the snapshot is loaded and only the log records
+ * after its position are applied; if the log does not cover the snapshot
+ * (e.g. it was compacted since), the snapshot is ignored and the whole log
+ * is replayed. A corrupt snapshot is reported and ignored. Messages running
+ * when the state was captured are restored as queued.
+ *
+ * Only decoding the snapshot is spread across threads. Rebuilding the queue
+ * from the records is serial, as each message is linked into the shared ID
+ * map, priority lists and heaps; it runs under m_mutex only for consistency,
+ * since the queue is still being constructed and has no other users.
+ */
+void
+Queue::restoreState( const Config_t & a_config ) {
+    vector<WriteAheadLog::Record_t> records;
+    SnapshotFile::Header_t header;
+    unique_ptr<WriteAheadLog> wal;
+    bool loaded = false;
+
+    if ( m_snapshot_path.size() ) {
+        try {
+            loaded = SnapshotFile::load( m_snapshot_path, a_config.snapshot_threads ? a_config.snapshot_threads :
+                max( 1u, thread::hardware_concurrency() ), header, records );
+        } catch ( const exception & e ) {
+            if ( m_err_cb ) {
+                (*m_err_cb)( string( "Failed to load snapshot: " ) + e.what() );
+            }
+            records.clear();
+        }
+    }
+
+    if ( a_config.wal_path.size() ) {
+        wal.reset( new WriteAheadLog( a_config.wal_path, a_config.wal_sync_interval, a_config.wal_sync_bytes, m_err_cb ));
+
+        if ( !loaded || !wal->recover( records, header.wal_epoch, header.wal_offset )) {
+            if ( loaded && m_err_cb ) {
+                (*m_err_cb)( "Snapshot not covered by write-ahead log; replaying log" );
+            }
+
+            records = wal->recover();
+        }
+    }
+
+    lock_guard<mutex> lock(m_mutex);
+
+    // Log is live during recovery so that messages expiring now are removed
+    m_wal = std::move( wal );
+    recoverMsgs( records );
+
+    if ( m_wal ) {
+        m_wal->start();
+    }
+}
+
+/** @brief Copy state of all messages for a snapshot or replica sync
+ *
+ * Running messages also carry their lease (token and deadline), which only
+ * replication uses. Each record is paired with a sort key in a_order; sorting
+ * by key gives the order in which messages are to be restored: running
+ * messages first (they were dispatched ahead of everything still queued),
+ * then other messages, then blocked messages (so that the messages they wait
+ * for are restored before them), each by the time they entered their current
+ * state.
+ */
+void
+Queue::captureMsgs( std::vector<SnapshotFile::Record_t> & a_records, restore_order_t & a_order ) {
+    // Lock must be held before calling
+
+    map<const ClassStats_t*,const string*> class_names;
+    map<const Tenant_t*,const string*> tenant_names;
+    map<const ClassStats_t*,const string*>::iterator cn;
+    map<const Tenant_t*,const string*>::iterator tn;
+
+    for ( class_stats_t::iterator c = m_class_stats.begin(); c != m_class_stats.end(); c++ ) {
+        class_names[&c->second] = &c->first;
+    }
+
+    for ( tenant_map_t::iterator t = m_tenants.begin(); t != m_tenants.end(); t++ ) {
+        tenant_names[&t->second] = &t->first;
+    }
+
+    a_records.resize( m_msg_map.size() );
+    a_order.reserve( m_msg_map.size() );
+
+    size_t i = 0;
+
+    for ( msg_map_t::iterator m = m_msg_map.begin(); m != m_msg_map.end(); m++, i++ ) {
+        MsgEntry_t * msg = m->second;
+        SnapshotFile::Record_t & r = a_records[i];
+
+        r.id = msg->message.id;
+        r.priority = msg->priority;
+        r.retries = msg->fail_count;
+        r.max_retries = msg->max_retries;
+        r.ack_timeout = msg->ack_timeout;
+        r.failed = msg->state == MSG_FAILED;
+
+        if ( msg->state == MSG_DELAYED ) {
+            r.ready_ms = std::chrono::duration_cast<std::chrono::milliseconds>( msg->state_ts.time_since_epoch() ).count();
+        }
+
+        if ( msg->due != timestamp_t::max() ) {
+            r.due_ms = std::chrono::duration_cast<std::chrono::milliseconds>( msg->due.time_since_epoch() ).count();
+        }
+
+        if ( msg->expiry != timestamp_t::max() ) {
+            r.expiry_ms = std::chrono::duration_cast<std::chrono::milliseconds>( msg->expiry.time_since_epoch() ).count();
+        }
+
+        if ( msg->class_stats && ( cn = class_names.find( msg->class_stats )) != class_names.end() ) {
+            r.msg_class = *cn->second;
+        }
+
+        if ( msg->tenant && ( tn = tenant_names.find( msg->tenant )) != tenant_names.end() ) {
+            r.tenant = *tn->second;
+        }
+
+        if ( msg->group ) {
+            r.group = msg->group->id;
+        }
+
+        r.affinity = msg->affinity;
+        r.batch = msg->batch;
+        r.checkpoint = msg->message.checkpoint;
+
+        if ( msg->state == MSG_RUNNING ) {
+            r.token = msg->message.token;
+
+            if ( msg->deadline != timestamp_t::max() ) {
+                r.deadline_ms = std::chrono::duration_cast<std::chrono::milliseconds>( msg->deadline.time_since_epoch() ).count();
+            }
+        }
+
+        for ( vector<MsgEntry_t*>::iterator p = msg->prereqs.begin(); p != msg->prereqs.end(); p++ ) {
+            r.depends.push_back( (*p)->message.id );
+        }
+
+        a_order.push_back( make_pair( make_pair( msg->state == MSG_RUNNING ? 0 : msg->state == MSG_BLOCKED ? 2 : 1, msg->state_ts ), i ));
+    }
+}
+
+/** @brief Move captured records into restore order (see captureMsgs)
+ */
+void
+Queue::orderMsgs( std::vector<SnapshotFile::Record_t> & a_captured, restore_order_t & a_order, std::vector<SnapshotFile::Record_t> & a_records ) {
+    stable_sort( a_order.begin(), a_order.end(), []( const restore_order_t::value_type & a, const restore_order_t::value_type & b ) {
+        return a.first < b.first;
+    });
+
+    a_records.resize( a_captured.size() );
+
+    for ( size_t i = 0; i < a_order.size(); i++ ) {
+        std::swap( a_records[i], a_captured[a_order[i].second] );
+    }
+
+    a_captured.clear();
+}
+
+/** @brief Capture queue state and write it to the snapshot file
+ *
+ * State is copied under the queue lock, then sorted and written without it.
+ * Once the snapshot is durable, write-ahead log records before its position
+ * are dropped.
+ */
+void
+Queue::writeSnapshot() {
+    // Snapshot lock must be held before calling
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    vector<SnapshotFile::Record_t> captured, records;
+    restore_order_t order;
+    SnapshotFile::Header_t header;
+
+    {
+        lock_guard<mutex> lock(m_mutex);
+
+        captureMsgs( captured, order );
+
+        if ( m_wal ) {
+            m_wal->getPosition( header.wal_epoch, header.wal_offset );
+        }
+    }
+
+    header.created_ms = std::chrono::duration_cast<std::chrono::milliseconds>( std::chrono::system_clock::now().time_since_epoch() ).count();
+
+    orderMsgs( captured, order, records );
+
+    SnapshotFile::write( m_snapshot_path, header, records );
+
+    if ( m_wal ) {
+        m_wal->truncate( header.wal_offset );
+    }
+
+    lock_guard<mutex> lock(m_mutex);
+
+    m_count_snapshots++;
+    m_snapshot_msec = std::chrono::duration_cast<std::chrono::milliseconds>( std::chrono::steady_clock::now() - start ).count();
+}
+
+/** @brief Periodic snapshot loop
+ */
+void
+Queue::snapshotThread() {
+    unique_lock<mutex> lock(m_snapshot_mutex);
+
+    while ( true ) {
+        if ( m_snapshot_cv.wait_for( lock, std::chrono::milliseconds( m_snapshot_interval ), [this]{ return !m_snapshot_run; } )) {
+            break;
+        }
+
+        try {
+            writeSnapshot();
+        } catch ( const exception & e ) {
+            if ( m_err_cb ) {
+                (*m_err_cb)( string( "Failed to write snapshot: " ) + e.what() );
+            }
+        }
+    }
+}
+
+/** @brief Log a push to the write-ahead log
+ */
+void
+Queue::logPush( const std::string & a_id, uint8_t a_priority, size_t a_delay, const MsgOpts_t & a_opts ) {
+    // Lock must be held before calling
+
+    logRecord( pushRecord( a_id, a_priority, a_delay, a_opts ));
+}
+
+/** @brief Build the log record of a push
+ *
+ * Relative times are logged as absolute times, so that replay preserves
+ * delays, due times and TTLs.
+ */
+WriteAheadLog::Record_t
+Queue::pushRecord( const std::string & a_id, uint8_t a_priority, size_t a_delay, const MsgOpts_t & a_opts ) const {
+    WriteAheadLog::Record_t rec( WriteAheadLog::REC_PUSH );
+    uint64_t now_ms = std::chrono::duration_cast<std::chrono::milliseconds>( std::chrono::system_clock::now().time_since_epoch() ).count();
+
+    rec.id = a_id;
+    rec.priority = a_priority;
+    rec.ready_ms = a_delay ? now_ms + a_delay : 0;
+    rec.due_ms = a_opts.due ? now_ms + a_opts.due : 0;
+    rec.expiry_ms = a_opts.ttl ? now_ms + a_opts.ttl : 0;
+    rec.ack_timeout = (uint32_t)a_opts.ack_timeout;
+    rec.max_retries = (uint8_t)a_opts.max_retries;
+    rec.msg_class = a_opts.msg_class;
+    rec.tenant = a_opts.tenant;
+    rec.group = a_opts.group;
+    rec.affinity = a_opts.affinity;
+    rec.batch = a_opts.batch;
+    rec.depends = a_opts.depends;
+
+    return rec;
+}
+
+/** @brief Append a record to the write-ahead log and replication stream
+ */
+void
+Queue::logRecord( const WriteAheadLog::Record_t & a_record ) {
+    // Lock must be held before calling
+
+    if ( m_wal && !m_standby ) {
+        m_wal->append( a_record );
+    }
+
+    if ( m_replica ) {
+        m_replica->append( m_replica_channel, a_record );
+    }
+}
+
+/** @brief Log a remove, fail or requeue transition to the write-ahead log
+ *
+ * The retry count of a requeued message is only replicated.
+ */
+void
+Queue::logTransition( WriteAheadLog::RecordType_t a_type, const std::string & a_id, uint8_t a_priority, uint64_t a_ready_ms, uint8_t a_retries ) {
+    // Lock must be held before calling
+
+    WriteAheadLog::Record_t rec( a_type );
+
+    rec.id = a_id;
+    rec.priority = a_priority;
+    rec.ready_ms = a_ready_ms;
+    rec.retries = a_retries;
+
+    logRecord( rec );
+}
+
+/** @brief Replicate a lease, deadline or checkpoint change, or lease timeout
+ *
+ * Leases are not written to the write-ahead log (running messages are
+ * recovered as queued), but a standby needs them so that consumers holding a
+ * lease can still ACK after a failover.
+ */
+void
+Queue::replicateLease( WriteAheadLog::RecordType_t a_type, MsgEntry_t * a_msg, bool a_hedge ) {
+    // Lock must be held before calling
 
-    m_monitor_thread = thread( &Queue::monitorThread, this );
-    m_delay_thread = thread( &Queue::delayThread, this );
-}
+    WriteAheadLog::Record_t rec( a_type );
 
-Queue::~Queue() {
-    m_run = false;
-    m_mon_cv.notify_one();
-    m_delay_cv.notify_one();
-    m_monitor_thread.join();
-    m_delay_thread.join();
+    rec.id = a_msg->message.id;
+    rec.token = a_hedge ? a_msg->hedge->token : a_msg->message.token;
+    rec.hedge = a_hedge;
+    rec.retries = a_msg->fail_count;
 
-    for ( msg_pool_t::iterator m = m_msg_pool.begin(); m != m_msg_pool.end(); m++ ) {
-        delete *m;
+    if ( a_msg->deadline != timestamp_t::max() ) {
+        rec.deadline_ms = std::chrono::duration_cast<std::chrono::milliseconds>( a_msg->deadline.time_since_epoch() ).count();
     }
-}
 
-void
-Queue::push( const std::string & a_id, /*const std::string & a_data,*/ uint8_t a_priority, size_t a_delay ) {
-    // Verify priority
-    if ( a_priority >= m_queue_list.size() ) {
-        throw runtime_error( "Invalid queue priority" );
+    if ( a_type == WriteAheadLog::REC_TOUCH ) {
+        rec.checkpoint = a_msg->message.checkpoint;
     }
 
+    m_replica->append( m_replica_channel, rec );
+}
+
+/** @brief Stream transitions of this queue to a standby
+ *
+ * Called by ReplicationSender::addQueue. Throws logic_error if an overflow
+ * tier is configured, since overflowed messages are not held in memory.
+ */
+void
+Queue::setReplication( ReplicationSender * a_sender, uint32_t a_channel ) {
     lock_guard<mutex> lock(m_mutex);
 
-    // Check for duplicate messages
-    if ( m_msg_map.find( a_id ) != m_msg_map.end() ) {
-        throw runtime_error( "Duplicate message ID" );
+    if ( m_overflow.size() ) {
+        throw logic_error( "Replication not supported with overflow tier" );
     }
 
-    // Make sure capacity isn't exceeded
-    if ( m_msg_map.size() == m_capacity ) {
-        throw length_error( "Queue capacity exceeded" );
-    }
+    m_replica = a_sender;
+    m_replica_channel = a_channel;
+}
 
-    MsgEntry_t * msg = getMsgEntry( a_id, /*a_data,*/ a_priority );
+/** @brief Send full queue state to the standby
+ *
+ * Called by the replication sender on each new connection. State is
+ * captured and ordered under the queue lock, so that it is followed in the
+ * stream by exactly the transitions made after it.
+ */
+void
+Queue::syncReplica() {
+    vector<SnapshotFile::Record_t> captured, records;
+    restore_order_t order;
 
-    m_msg_map[a_id] = msg;
+    lock_guard<mutex> lock(m_mutex);
 
-    if ( a_delay ) {
-        insertDelayedMsg( msg, std::chrono::system_clock::now() + std::chrono::milliseconds( a_delay ));
-    } else {
-        m_queue_list[a_priority].push_front( msg );
-        m_count_queued++;
-        m_pop_cv.notify_one();
+    if ( !m_replica ) {
+        return;
     }
-}
-
 
-const Queue::Msg_t &
-Queue::pop() {
-    unique_lock<mutex> lock(m_mutex);
+    captureMsgs( captured, order );
+    orderMsgs( captured, order, records );
 
-    return popImpl( lock );
+    m_replica->sync( m_replica_channel, records );
 }
 
+/** @brief Enter or leave (promote) standby mode
+ *
+ * In standby mode the queue applies replicated state, and does not time out
+ * leases, expire messages, issue hedges, or write its write-ahead log;
+ * callers must not push or pop. On promotion, lease deadlines and TTLs
+ * received from the primary take effect, and a snapshot is written (if
+ * configured) so that the write-ahead log is again consistent with the
+ * queue. Throws logic_error if the queue has an overflow tier, or a
+ * write-ahead log without snapshots.
+ */
 void
-Queue::ack( const std::string & a_id, const std::string & a_token, bool a_requeue, size_t a_delay ) {
-    unique_lock<mutex> lock(m_mutex);
+Queue::setStandby( bool a_standby ) {
+    {
+        lock_guard<mutex> lock(m_mutex);
 
-    ackImpl( a_id, a_token, a_requeue, a_delay );
-}
+        if ( a_standby && m_overflow.size() ) {
+            throw logic_error( "Standby not supported with overflow tier" );
+        }
 
+        if ( a_standby && m_wal && m_snapshot_path.empty() ) {
+            throw logic_error( "Standby with write-ahead log requires snapshots" );
+        }
 
-const Queue::Msg_t &
-Queue::popAck( const std::string & a_id, const std::string & a_token, bool a_requeue, size_t a_delay ) {
-    unique_lock<mutex> lock(m_mutex);
+        if ( m_standby == a_standby ) {
+            return;
+        }
 
-    ackImpl( a_id, a_token, a_requeue, a_delay );
+        m_standby = a_standby;
+
+        if ( !a_standby ) {
+            m_timers->wakeTask( m_delay_task, std::chrono::system_clock::now() );
+        }
+    }
 
-    return popImpl( lock );
+    if ( !a_standby && m_snapshot_path.size() ) {
+        snapshot();
+    }
 }
 
-size_t
-Queue::getCapacity() const {
-    return m_capacity;
+bool
+Queue::isStandby() const {
+    lock_guard<mutex> lock(m_mutex);
+
+    return m_standby;
 }
 
+/** @brief Apply replicated transitions, in order, under a single lock acquisition
+ *
+ * Records that do not apply to the current state (e.g. for a message no
+ * longer in the queue) are reported and skipped.
+ */
 void
-Queue::getCounts( size_t & a_active, size_t & a_failed, size_t & a_free ) const {
+Queue::applyReplica( std::vector<WriteAheadLog::Record_t> & a_records ) {
     lock_guard<mutex> lock(m_mutex);
 
-    //cout << "counts: " << ( m_msg_map.size() - m_count_failed ) << ", " << m_count_failed << ", " << m_capacity - m_msg_map.size() << endl;
+    timestamp_t now = std::chrono::system_clock::now();
+    uint64_t now_ms = std::chrono::duration_cast<std::chrono::milliseconds>( now.time_since_epoch() ).count();
 
-    a_active = m_msg_map.size() - m_count_failed;
-    a_failed = m_count_failed;
-    a_free = m_capacity - m_msg_map.size();
+    for ( vector<WriteAheadLog::Record_t>::iterator r = a_records.begin(); r != a_records.end(); r++ ) {
+        try {
+            applyRecord( *r, now, now_ms );
+        } catch ( const exception & e ) {
+            if ( m_err_cb ) {
+                (*m_err_cb)( string( "Failed to apply replicated record for message " ) + r->id + ": " + e.what() );
+            }
+        }
+    }
+
+    trimFailed();
 }
 
+/** @brief Replace queue state with replicated state records
+ *
+ * Records are in restore order (see captureMsgs). Running messages are
+ * restored with their leases and checkpoints. Affinity, rate limit and
+ * processing time state is not replicated.
+ */
+void
+Queue::applyReplicaSync( std::vector<WriteAheadLog::Record_t> & a_records ) {
+    lock_guard<mutex> lock(m_mutex);
 
-Queue::MsgIdList_t
-Queue::getFailed() const {
-    MsgIdList_t failed;
-    failed.reserve( m_count_failed );
+    timestamp_t now = std::chrono::system_clock::now();
+    msg_map_t::iterator m;
 
-    lock_guard<mutex> lock(m_mutex);
+    clearMsgs();
 
-    for ( msg_map_t::const_iterator m = m_msg_map.begin(); m != m_msg_map.end(); m++ ) {
-        if ( m->second->state == MSG_FAILED ) {
-            failed.push_back( m->first );
+    // Running messages do not expire
+    for ( vector<WriteAheadLog::Record_t>::iterator r = a_records.begin(); r != a_records.end(); r++ ) {
+        if ( r->token.size() ) {
+            r->expiry_ms = 0;
         }
     }
 
-    return failed;
-}
+    recoverMsgs( a_records );
 
-Queue::MsgIdList_t
-Queue::eraseFailed( const MsgIdList_t & a_msg_ids ) {
-    MsgIdList_t failed;
-    failed.reserve( m_count_failed );
+    for ( vector<WriteAheadLog::Record_t>::iterator r = a_records.begin(); r != a_records.end(); r++ ) {
+        if (( r->checkpoint.empty() && r->token.empty() ) || ( m = m_msg_map.find( r->id )) == m_msg_map.end() ) {
+            continue;
+        }
 
-    lock_guard<mutex> lock(m_mutex);
-    msg_map_t::iterator m;
+        m->second->message.checkpoint.swap( r->checkpoint );
 
-    for ( MsgIdList_t::const_iterator i = a_msg_ids.begin(); i != a_msg_ids.end(); i++ ) {
-        m = m_msg_map.find( *i );
-        if ( m != m_msg_map.end() ) {
-            if ( m->second->state == MSG_FAILED ) {
-                failed.push_back( m->first );
-                m_msg_pool.push_back( m->second );
-                m_msg_map.erase( m );
+        if ( r->token.size() ) {
+            try {
+                runReplica( m->second, *r, now );
+            } catch ( const exception & e ) {
+                if ( m_err_cb ) {
+                    (*m_err_cb)( string( "Failed to restore lease of message " ) + r->id + ": " + e.what() );
+                }
             }
         }
     }
 
-    m_count_failed -= failed.size();
+    trimFailed();
+}
 
-    return failed;
+/** @brief Remove a message from whatever queue, list or index holds it
+ *
+ * Leaves the entry in the message map (see freeMsgEntry), with its group
+ * and dependents intact.
+ */
+void
+Queue::detachMsg( MsgEntry_t * a_msg, const timestamp_t & a_now ) {
+    // Lock must be held before calling
+
+    switch ( a_msg->state ) {
+    case MSG_QUEUED:
+    case MSG_DELAYED:
+        unqueueMsg( a_msg );
+        break;
+    case MSG_RUNNING:
+        endRun( a_msg, a_now, false );
+        break;
+    case MSG_FAILED:
+        m_msg_failed.erase( a_msg->fail_seq );
+        m_count_failed--;
+        a_msg->fail_seq = 0;
+        break;
+    case MSG_BLOCKED:
+        // Waiting in its group's pending list, or for prerequisites
+        msg_aux_list_t::unlink( a_msg );
+
+        for ( vector<MsgEntry_t*>::iterator p = a_msg->prereqs.begin(); p != a_msg->prereqs.end(); p++ ) {
+            (*p)->dependents.erase( find( (*p)->dependents.begin(), (*p)->dependents.end(), a_msg ));
+        }
+
+        a_msg->prereqs.clear();
+        break;
+    }
+
+    untrackMsg( a_msg );
 }
 
+/** @brief Remove all messages (before a replica sync)
+ */
 void
-Queue::setErrorCallback( ErrorCB_t * a_callback ) {
-    m_err_cb = a_callback;
+Queue::clearMsgs() {
+    // Lock must be held before calling
+
+    timestamp_t now = std::chrono::system_clock::now();
+
+    // Freeing a message may release others, which are then removed in turn
+    while ( !m_msg_map.empty() ) {
+        detachMsg( m_msg_map.begin()->second, now );
+        freeMsgEntry( m_msg_map.begin() );
+    }
 }
 
+/** @brief Lease a queued message, or add a hedge lease, as the primary did
+ *
+ * The lease token and deadline are taken from the replicated record, so
+ * that the consumer holding the lease can ACK or touch it after a failover.
+ */
+void
+Queue::runReplica( MsgEntry_t * a_msg, const WriteAheadLog::Record_t & a_record, const timestamp_t & a_now ) {
+    // Lock must be held before calling
 
-//================================= PRIVATE METHODS ===========================
+    if ( a_record.hedge ) {
+        if ( a_msg->state != MSG_RUNNING ) {
+            throw runtime_error( "Invalid message state" );
+        }
 
-Queue::MsgEntry_t *
-Queue::getMsgEntry( const string & a_id, /*const string & a_data,*/ uint8_t a_priority ) {
-    MsgEntry_t * msg;
+        if ( !a_msg->hedge ) {
+            a_msg->hedge.reset( new Msg_t() );
+        }
 
-    if ( !m_msg_pool.size() ) {
-        msg = new MsgEntry_t( a_id, /*a_data,*/ a_priority );
+        a_msg->hedge->id = a_msg->message.id;
+        a_msg->hedge->token = a_record.token;
+        a_msg->hedge->checkpoint = a_msg->message.checkpoint;
     } else {
-        msg = m_msg_pool.back();
-        msg->reset( a_id, /*a_data,*/ a_priority );
-        m_msg_pool.pop_back();
+        if ( a_msg->state != MSG_QUEUED && a_msg->state != MSG_DELAYED ) {
+            throw runtime_error( "Invalid message state" );
+        }
+
+        unqueueMsg( a_msg );
+        runMsg( a_msg, a_now );
+        a_msg->message.token = a_record.token;
     }
 
-    return msg;
+    a_msg->deadline = a_record.deadline_ms ? timestamp_t( std::chrono::milliseconds( a_record.deadline_ms )) : timestamp_t::max();
 }
 
-
-const Queue::Msg_t &
-Queue::popImpl( unique_lock<mutex> & a_lock ) {
+/** @brief Apply one replicated transition
+ *
+ * Transitions that the standby derives itself from earlier records (e.g.
+ * failure of dependents, or release of the next message of a group) are
+ * also sent by the primary, and are skipped if already applied.
+ */
+void
+Queue::applyRecord( WriteAheadLog::Record_t & a_record, const timestamp_t & a_now, uint64_t a_now_ms ) {
     // Lock must be held before calling
 
-    while ( !m_count_queued ) {
-        /*if ( m_err_cb ) {
-            (*m_err_cb)( "Pop - no msgs avail, wait w/o timeout" );
-        }*/
-
-        m_pop_cv.wait( a_lock );
+    if ( a_record.type == WriteAheadLog::REC_PUSH ) {
+        recoverMsg( a_record, a_now_ms );
+        return;
     }
 
-    MsgEntry_t * entry = 0;
+    msg_map_t::iterator m = m_msg_map.find( a_record.id );
 
-    for ( queue_list_t::iterator q = m_queue_list.begin(); q != m_queue_list.end(); ++q ){
-        if ( !q->empty() ){
-            entry = q->back();
-            q->pop_back();
-            break;
+    if ( m == m_msg_map.end() ) {
+        if ( a_record.type == WriteAheadLog::REC_REMOVE ) {
+            return;
         }
+        throw runtime_error( "No message found matching ID" );
     }
 
-    if ( !entry ) {
-        throw logic_error( "All queues empty when m_count_queued > 0" );
+    MsgEntry_t * msg = m->second;
+
+    switch ( a_record.type ) {
+    case WriteAheadLog::REC_REMOVE:
+        detachMsg( msg, a_now );
+        freeMsgEntry( m );
+        break;
+    case WriteAheadLog::REC_FAIL:
+        if ( msg->state != MSG_FAILED ) {
+            detachMsg( msg, a_now );
+            failMsg( msg );
+        }
+        break;
+    case WriteAheadLog::REC_REQUEUE:
+        if ( msg->state == MSG_FAILED ) {
+            msg->fail_count = a_record.retries;
+            requeueFailedMsg( msg, a_record.priority, a_record.ready_ms ? timestamp_t( std::chrono::milliseconds( a_record.ready_ms )) : a_now, false );
+        } else if ( msg->state == MSG_RUNNING ) {
+            endRun( msg, a_now, false );
+            msg->message.checkpoint.clear();
+
+            if ( a_record.ready_ms > a_now_ms ) {
+                insertDelayedMsg( msg, timestamp_t( std::chrono::milliseconds( a_record.ready_ms )));
+            } else {
+                queueMsg( msg, a_now );
+            }
+        } else {
+            throw runtime_error( "Invalid message state" );
+        }
+        break;
+    case WriteAheadLog::REC_RUN:
+        runReplica( msg, a_record, a_now );
+        break;
+    case WriteAheadLog::REC_TOUCH:
+    case WriteAheadLog::REC_TIMEOUT:
+        if ( msg->state != MSG_RUNNING ) {
+            throw runtime_error( "Invalid message state" );
+        }
+
+        if ( a_record.type == WriteAheadLog::REC_TIMEOUT ) {
+            msg->fail_count = a_record.retries;
+            timeoutMsg( msg, a_now );
+        } else {
+            msg->deadline = a_record.deadline_ms ? timestamp_t( std::chrono::milliseconds( a_record.deadline_ms )) : timestamp_t::max();
+            msg->message.checkpoint.swap( a_record.checkpoint );
+        }
+        break;
+    default:
+        throw runtime_error( "Invalid record type" );
     }
+}
 
-    entry->state = MSG_RUNNING;
-    entry->state_ts = std::chrono::system_clock::now();
-    entry->message.token = to_string( m_rng() );
-    m_count_queued--;
+/** @brief Move a failed message back to the ready or delay queue
+ *
+ * Returns true if the message was queued ready (rather than delayed or held
+ * behind its group); caller is then responsible for notifying consumers.
+ */
+bool
+Queue::requeueFailedMsg( MsgEntry_t * a_msg, uint8_t a_priority, const timestamp_t & a_requeue_ts, bool a_reset_retries ) {
+    // Lock must be held before calling
 
-    return entry->message;
-}
+    m_msg_failed.erase( a_msg->fail_seq );
+    m_count_failed--;
 
+    a_msg->fail_seq = 0;
 
-void
-Queue::ackImpl( const std::string & a_id, const std::string & a_token, bool a_requeue, size_t a_delay ) {
-    // Lock must be held before calling
+    if ( a_priority != KEEP_PRIORITY ) {
+        a_msg->priority = a_priority;
+    }
 
-    msg_map_t::iterator e = m_msg_map.find( a_id );
-    if ( e == m_msg_map.end() ) {
-        throw runtime_error( "No message found matching ID" );
+    if ( a_reset_retries ) {
+        a_msg->fail_count = 0;
     }
 
-    if ( e->second->message.token != a_token ) {
-        //cout << "msg tok: " << e->second->message.token << ", rcvd: " << a_token << endl;
-        throw runtime_error( "Invalid message token" );
+    // Requeued message no longer expires
+    a_msg->expiry = timestamp_t::max();
+
+    timestamp_t now = std::chrono::system_clock::now();
+
+    if ( m_wal || m_replica ) {
+        logTransition( WriteAheadLog::REC_REQUEUE, a_msg->message.id, a_msg->priority, a_requeue_ts > now ?
+            std::chrono::duration_cast<std::chrono::milliseconds>( a_requeue_ts.time_since_epoch() ).count() : 0, a_msg->fail_count );
     }
 
-    if ( e->second->state != MSG_RUNNING ) {
-        throw runtime_error( "Invalid message state" );
+    // Rejoins back of its group if another message now holds the group
+    if ( a_msg->group && !acquireGroup( a_msg, a_requeue_ts )) {
+        return false;
     }
 
-    if ( a_requeue ) {
-        timestamp_t now = std::chrono::system_clock::now();
+    if ( a_requeue_ts > now ) {
+        insertDelayedMsg( a_msg, a_requeue_ts );
+        return false;
+    }
 
-        e->second->boosted = false;
-        e->second->message.token.clear();
+    queueMsg( a_msg, now );
 
-        if ( a_delay ) {
-            insertDelayedMsg( e->second, now + std::chrono::milliseconds( a_delay ));
-        } else {
-            e->second->state = MSG_QUEUED;
-            e->second->state_ts = now;
-            m_queue_list[e->second->priority].push_front( e->second );
-            m_count_queued++;
-            m_pop_cv.notify_one();
-        }
+    return true;
+}
 
-    } else {
-        // Return entry to pool
-        m_msg_pool.push_back( e->second );
-        m_msg_map.erase( e );
+/** @brief Age queued messages through priority levels
+ *
+ * Messages that have waited in a ready queue for longer than the current
+ * boost timeout are moved to the back of the next higher priority queue,
+ * where they must wait again before moving further, so starving low-priority
+ * messages rise gradually rather than jumping straight to priority 0. Since
+ * each tenant queue is in order of arrival, only the front of each active
+ * tenant queue and the messages that are due are touched. Returns the number
+ * of messages aged.
+ */
+size_t
+Queue::ageQueuedMsgs( const timestamp_t & a_now ) {
+    // Lock must be held before calling
+
+    if ( !m_boost_timeout ) {
+        return 0;
     }
+
+    timestamp_t boost_time = a_now - std::chrono::milliseconds( m_boost_timeout );
+    MsgEntry_t * entry;
+    size_t count = 0;
+
+    // Ascending order so that each message moves at most one level per pass
+    for ( size_t p = 1; p < m_queue_list.size(); p++ ) {
+        for ( TenantQueue_t * tq = m_queue_list[p].tenants.front(), * next; tq; tq = next ) {
+            // Tenant queue leaves ring if emptied
+            next = tenant_ring_t::next( tq );
+
+            while ( !tq->msgs.empty() && tq->msgs.front()->level_ts < boost_time ) {
+                entry = tq->msgs.front();
+                readyRemove( entry );
+                entry->level = p - 1;
+                entry->level_ts = a_now;
+                readyPush( entry );
+                count++;
+
+                //cout << "PRIORITY BOOST MSG ID " << entry->message.id << endl;
+            }
+        }
+    }
+
+    return count;
 }
 
+/** @brief Adjust aging step to hold max wait target for low priorities
+ *
+ * Queue wait of low-priority messages is estimated as the larger of the
+ * recent 95th percentile wait of popped low-priority messages and the wait of
+ * the oldest message still queued at a low-priority level. If this exceeds
+ * the target, the aging step is reduced in proportion; if well under the
+ * target, it is relaxed slowly toward the configured boost timeout. The step
+ * is kept within [monitor period, min(boost timeout, max wait)].
+ */
 void
-Queue::insertDelayedMsg( MsgEntry_t * a_msg, const timestamp_t & a_requeue_ts ) {
+Queue::tuneBoostTimeout( const timestamp_t & a_now ) {
     // Lock must be held before calling
 
-    a_msg->state = MSG_DELAYED;
-    a_msg->state_ts = a_requeue_ts;
+    if ( !m_boost_max_wait || !m_boost_timeout_max || m_queue_list.size() < 2 ) {
+        return;
+    }
 
-    m_msg_delay.insert( a_msg );
+    size_t wait = 0, w;
 
-    if ( *m_msg_delay.begin() == a_msg ) {
-        m_delay_cv.notify_one();
+    for ( size_t p = 1; p < m_queue_list.size(); p++ ) {
+        w = m_pri_waits[p].quantile( 0.95 );
+        if ( w > wait ) {
+            wait = w;
+        }
+
+        for ( TenantQueue_t * tq = m_queue_list[p].tenants.front(); tq; tq = tenant_ring_t::next( tq )) {
+            w = std::chrono::duration_cast<std::chrono::milliseconds>( a_now - tq->msgs.front()->state_ts ).count();
+            if ( w > wait ) {
+                wait = w;
+            }
+        }
+    }
+
+    size_t min_step = max<size_t>( m_poll_interval, 1 );
+    size_t max_step = max( min( m_boost_timeout_max, m_boost_max_wait ), min_step );
+
+    if ( wait > m_boost_max_wait ) {
+        // Shrink in proportion to overshoot
+        m_boost_timeout = max( min_step, (size_t)( m_boost_timeout * (double)m_boost_max_wait / wait ));
+    } else if ( wait < m_boost_max_wait / 2 ) {
+        // Relax slowly while comfortably under target
+        m_boost_timeout = min( max_step, m_boost_timeout + max<size_t>( m_boost_timeout / 8, 1 ));
     }
 }
 
 
-void
-Queue::monitorThread() {
-    auto poll_ms = chrono::milliseconds( m_poll_interval );
-    timestamp_t now, fail_time, boost_time;
-    msg_map_t::iterator m;
-    deque<MsgEntry_t*>::iterator q;
-    size_t notify;
+/** @brief Periodic monitoring task (run by timer service)
+ *
+ * Expires running messages past their ACK deadline, refreshes processing time
+ * thresholds, issues hedges, and ages queued messages. In standby mode, lease
+ * timeouts and hedges are left to the primary. Returns next run time.
+ */
+Queue::timestamp_t
+Queue::monitorTask( const timestamp_t & a_now ) {
+    MsgEntry_t * entry, * next;
+    size_t notify = 0;
 
-    unique_lock<mutex> lock( m_mutex );
+    lock_guard<mutex> lock( m_mutex );
 
-    while ( m_run ) {
-        try {
-            m_mon_cv.wait_for( lock, poll_ms );
+    try {
+        // Scan running messages for ACK deadline expiration (a standby applies the primary's timeouts)
 
-            if ( !m_run ){
-                return;
-            }
+        for ( entry = m_standby ? 0 : m_msg_running.front(); entry; entry = next ) {
+            next = msg_list_t::next( entry );
 
-            now = std::chrono::system_clock::now();
-            fail_time = now - std::chrono::milliseconds(m_fail_timeout);
-            boost_time = now - std::chrono::milliseconds(m_boost_timeout);
-            notify = 0;
-
-            // Scan all messages for timeout on running state
-            // and starving low-priority messages
-
-            for ( m = m_msg_map.begin(); m != m_msg_map.end(); m++ ) {
-                if ( m->second->state == MSG_RUNNING && m_fail_timeout ) {
-                    if ( m->second->state_ts < fail_time ) {
-                        if ( ++m->second->fail_count == m_max_retries ) {
-                            // Fail message
-                            m->second->state = MSG_FAILED;
-                            m_count_failed++;
-
-                            /*if ( m_err_cb ) {
-                                (*m_err_cb)( string("FAIL MSG ID ") + m->first );
-                            }*/
-                        } else {
-                            // Retry message
-                            m->second->state = MSG_QUEUED;
-                            m->second->message.token.clear();
-                            m_queue_list[m->second->priority].push_front( m->second );
-                            m_count_queued++;
-                            notify++;
-
-                            //cout << "RETRY MSG ID " << m->first << endl;
-
-                            /*if ( m_err_cb ) {
-                                (*m_err_cb)( string("RETRY MSG ID ") + m->first );
-                            }*/
-                        }
-                    }
-                } else if ( m->second->state == MSG_QUEUED ) {
-                    if ( m->second->priority > 0 && !m->second->boosted && m->second->state_ts < boost_time ) {
-                        // Find message in current queue
-                        q = std::find( m_queue_list[m->second->priority].begin(), m_queue_list[m->second->priority].end(), m->second );
-                        if ( q != m_queue_list[m->second->priority].end() ) {
-                            /*if ( m_err_cb ) {
-                                (*m_err_cb)( string("PRIORITY BOOST MSG ID ") + m->first );
-                            }*/
-                            //cout << "PRIORITY BOOST MSG ID " << m->first << endl;
-
-                            m->second->boosted = true;
-                            // Remove entry from current queue
-                            m_queue_list[m->second->priority].erase( q );
-                            // Push to front of high priority queue
-                            m_queue_list[0].push_front( m->second );
-                        } else {
-                            if ( m_err_cb ) {
-                                (*m_err_cb)( "Message entry not found in expected queue\n" );
-                            }
-                        }
-                    }
+            if ( entry->deadline < a_now ) {
+                if ( m_replica ) {
+                    replicateLease( WriteAheadLog::REC_TIMEOUT, entry );
+                }
+
+                if ( timeoutMsg( entry, a_now )) {
+                    notify++;
                 }
             }
+        }
 
-            if ( notify == 1 ) {
-                m_pop_cv.notify_one();
-            } else if ( notify > 1 ) {
-                m_pop_cv.notify_all();
+        // Refresh cached thresholds from updated processing time statistics
+
+        for ( vector<ClassStats_t>::iterator p = m_pri_stats.begin(); p != m_pri_stats.end(); p++ ) {
+            if ( p->changed ) {
+                updateClassStats( *p );
             }
-        } catch ( const exception & e ) {
-            if ( m_err_cb ) {
-                (*m_err_cb)( e.what() );
+        }
+
+        for ( class_stats_t::iterator c = m_class_stats.begin(); c != m_class_stats.end(); c++ ) {
+            if ( c->second.changed ) {
+                updateClassStats( c->second );
             }
         }
+
+        if ( !m_standby ) {
+            hedgeMsgs( a_now );
+        }
+        trimFailed();
+        checkPageIn();
+
+        // Age starving low-priority messages
+
+        tuneBoostTimeout( a_now );
+        ageQueuedMsgs( a_now );
+
+        if ( notify == 1 ) {
+            m_pop_cv.notify_one();
+        } else if ( notify > 1 ) {
+            m_pop_cv.notify_all();
+        }
+    } catch ( const exception & e ) {
+        if ( m_err_cb ) {
+            (*m_err_cb)( e.what() );
+        }
     }
+
+    return a_now + std::chrono::milliseconds( m_poll_interval );
 }
 
-void
-Queue::delayThread() {
-    timestamp_t now;
+/** @brief Delay queue task (run by timer service)
+ *
+ * Expires messages past their TTL (except in standby mode), pages in
+ * overflowed messages, moves due messages from the delay queue to the ready
+ * queues, and releases expired affinity holds. Returns the earliest of the
+ * next message expiry, the release time of the next delayed message, and the
+ * expiration of the next hold, or max if none (the task is woken when an
+ * earlier expiring, delayed or held message is inserted).
+ */
+Queue::timestamp_t
+Queue::delayTask( const timestamp_t & a_now ) {
     msg_delay_t::iterator m;
 
-    unique_lock<mutex> lock( m_mutex );
+    lock_guard<mutex> lock( m_mutex );
 
-    while ( m_run ) {
-        try {
+    try {
+        // A standby applies the primary's expirations
+        timestamp_t next = min( m_standby ? timestamp_t::max() : expireMsgs( a_now ), releaseHeldMsgs( a_now ));
 
-            // Calc delay time and (maybe) go to sleep
-            if ( m_msg_delay.size() ) {
-                now = std::chrono::system_clock::now();
-                m = m_msg_delay.begin();
-                if ( (*m)->state_ts > now ) {
-                    /*if ( m_err_cb ) {
-                        (*m_err_cb)( "Waiting w/ timeout" );
-                    }*/
+        trimFailed();
 
-                    m_delay_cv.wait_for( lock, (*m)->state_ts - now );
-                }
-            } else {
+        if ( m_count_overflow ) {
+            pageInMsgs( a_now );
+        }
+
+        while ( m_msg_delay.size() ) {
+            m = m_msg_delay.begin();
+
+            if ( (*m)->state_ts <= a_now ) {
                 /*if ( m_err_cb ) {
-                    (*m_err_cb)( "Waiting w/o timeout" );
+                    (*m_err_cb)( string("Queuing delayed msg ID ") + (*m)->message.id );
                 }*/
 
-                m_delay_cv.wait( lock );
-            }
+                // Msg is ready, push to queue
+                queueMsg( *m, a_now );
+                m_pop_cv.notify_one();
 
-            if ( !m_run ){
-                return;
+                // Remove from delay set
+                m_msg_delay.erase( m );
+            } else {
+                return min( next, (*m)->state_ts );
             }
+        }
 
-            // See if one or messages are ready to queue
-            if ( m_msg_delay.size() ) {
-                now = std::chrono::system_clock::now();
-
-                while ( m_msg_delay.size() ) {
-                    m = m_msg_delay.begin();
-
-                    if ( (*m)->state_ts <= now ) {
-                        /*if ( m_err_cb ) {
-                            (*m_err_cb)( string("Queuing delayed msg ID ") + (*m)->message.id );
-                        }*/
-
-                        // Msg is ready, push to queue
-                        (*m)->state = MSG_QUEUED;
-                        (*m)->state_ts = now;
-                        m_queue_list[(*m)->priority].push_back( *m );
-                        m_count_queued++;
-                        m_pop_cv.notify_one();
-
-                        // Remove from delay set
-                        m_msg_delay.erase( m );
-                    } else {
-                        break;
-                    }
-                }
-            }
-        } catch ( const exception & e ) {
-            if ( m_err_cb ) {
-                (*m_err_cb)( e.what() );
-            }
+        return next;
+    } catch ( const exception & e ) {
+        if ( m_err_cb ) {
+            (*m_err_cb)( e.what() );
         }
+
+        return a_now + std::chrono::milliseconds( m_poll_interval );
     }
 }
 
@@ -1,14 +1,25 @@
+#ifndef QUEUE_HPP
+#define QUEUE_HPP
+
 #include <string>
 #include <vector>
 #include <map>
 #include <set>
-#include <deque>
 #include <chrono>
 #include <thread>
 #include <mutex>
 #include <condition_variable>
 #include <memory>
 #include <random>
+#include "MsgList.hpp"
+#include "DurationSketch.hpp"
+#include "MsgHeap.hpp"
+#include "TimerService.hpp"
+#include "TokenBucket.hpp"
+#include "DeadLetterFile.hpp"
+#include "OverflowLog.hpp"
+#include "WriteAheadLog.hpp"
+#include "SnapshotFile.hpp"
 
 /* TODO
 - Add mult-message push
@@ -19,6 +30,8 @@
 
 namespace MonQueue {
 
+class ReplicationSender;
+
 /** @brief Message queue class with progess monitoring
  *
  * The Queue class is a priority message queue with built-in consumer progress
@@ -31,7 +44,20 @@ namespace MonQueue {
  * exceeded on a given message, the message will be marked as failed and no
  * further processing will be attempted. Failed messages a retained internally
  * and consume queue capacity; thus the producer must monitor for, and handle,
- * failed messages.
+ * failed messages. Alternatively, failed messages may be given a separate
+ * budget, beyond which the oldest are spilled to a dead-letter file (or
+ * dropped, if none is configured). An optional overflow tier accepts pushes
+ * beyond capacity into per-priority disk logs, which are paged back into
+ * memory in batches as the in-memory backlog drains. An optional write-ahead
+ * log records pushes, completions, requeues and failures so that queued and
+ * failed messages survive a restart. Optional periodic snapshots of the whole
+ * queue state shorten restarts, and bound the write-ahead log to the records
+ * logged since the last snapshot. A queue may also stream its transitions,
+ * including consumer leases, to a hot standby (see ReplicationSender), whose
+ * queue applies them in standby mode until promoted.
+ *
+ * Monitoring and delay processing run as tasks on a TimerService, which may be
+ * shared by many queues; if none is given, the queue creates its own.
  *
  * The Queue class is fully thread-safe.
  */
@@ -42,9 +68,139 @@ public:
         std::string     id;     ///< Unique producer-specified message ID
         //std::string     data;   ///< Optional producer-specified data payload
         std::string     token;  ///< Queue defined message token required for ACK
+        std::string     checkpoint; ///< Progress checkpoint saved by a prior consumer (empty if none)
+    };
+
+    /// @brief Optional per-message settings for use by producers
+    struct MsgOpts_t {
+        MsgOpts_t() : ack_timeout( 0 ), max_retries( 0 ), due( 0 ), ttl( 0 ) {}
+
+        size_t          ack_timeout;    ///< ACK timeout in msec (0 = queue default)
+        size_t          max_retries;    ///< Max retries before failure (0 = queue default)
+        size_t          due;            ///< Completion due time in msec after push (0 = none)
+        size_t          ttl;            ///< Expiry time in msec after push; expires if waiting then (0 = never)
+        std::string     msg_class;      ///< Message class for processing time statistics (empty = by priority)
+        std::string     tenant;         ///< Tenant (producer) key for fair queuing and quotas (empty = untagged)
+        std::string     group;          ///< Ordered group key; one message per group dispatched at a time (empty = none)
+        std::string     affinity;       ///< Affinity key; routed to consumer that last popped key (empty = none)
+        std::string     batch;          ///< Batch key; ready messages with same key may be popped together (empty = none)
+        std::vector<std::string> depends;   ///< IDs of prerequisite messages that must be completed first
+    };
+
+    /// @brief Per-tenant fair queuing settings
+    struct TenantConfig_t {
+        TenantConfig_t( size_t a_quota = 0, uint32_t a_weight = 1, double a_rate = 0 ) : quota( a_quota ), weight( a_weight ), rate( a_rate ) {}
+
+        size_t          quota;          ///< Max messages held by tenant (0 = no limit)
+        uint32_t        weight;         ///< Pops per round-robin turn within a priority
+        double          rate;           ///< Max pops per second (0 = no limit)
+    };
+
+    /// @brief Message push request (for multi-message operations)
+    struct PushMsg_t {
+        PushMsg_t() : priority( 0 ), delay( 0 ) {}
+
+        std::string     id;             ///< Unique producer-specified message ID
+        uint8_t         priority;       ///< Message priority
+        size_t          delay;          ///< Enqueue delay in msec
+        MsgOpts_t       opts;           ///< Optional per-message settings
+    };
+
+    /// @brief Policy used to choose the priority queue served by each pop
+    enum DispatchPolicy_t {
+        DISPATCH_STRICT = 0,    ///< Always serve highest non-empty priority
+        DISPATCH_WEIGHTED,      ///< Deficit round robin; each busy priority gets a share of pops by weight
+        DISPATCH_DEADLINE       ///< Earliest due time first, then priority (no priority aging)
+    };
+
+    /// @brief Queue configuration
+    struct Config_t {
+        Config_t() :
+            priority_count( 3 ),
+            capacity( 100 ),
+            ack_timeout( 60000 ),
+            max_retries( 10 ),
+            boost_timeout( 60000 ),
+            boost_max_wait( 0 ),
+            monitor_period( 5000 ),
+            dispatch( DISPATCH_STRICT ),
+            hedge_quantile( 0 ),
+            hedge_min_samples( 100 ),
+            adaptive_quantile( 0 ),
+            adaptive_factor( 3 ),
+            adaptive_min_timeout( 1000 ),
+            adaptive_max_timeout( 0 ),
+            adaptive_min_samples( 100 ),
+            tenant_quota( 0 ),
+            affinity_wait( 0 ),
+            affinity_capacity( 10000 ),
+            rate_burst( 1 ),
+            expire_to_failed( false ),
+            failed_capacity( 0 ),
+            overflow_segment_size( 64 << 20 ),
+            overflow_batch( 1000 ),
+            wal_sync_interval( 10 ),
+            wal_sync_bytes( 1 << 20 ),
+            snapshot_interval( 60000 ),
+            snapshot_threads( 0 )
+        {}
+
+        uint8_t         priority_count;     ///< Number of priorities (0 to count-1, 0 = highest)
+        size_t          capacity;           ///< Maximum number of active and failed messages
+        size_t          ack_timeout;        ///< Max allowed consumer processing time in msec (0 = no limit)
+        size_t          max_retries;        ///< Max message retries before message is failed (0 = no limit)
+        size_t          boost_timeout;      ///< Wait in msec before a queued message is aged to the next higher priority (0 = no aging)
+        size_t          boost_max_wait;     ///< Target max wait in msec for low priorities; auto-tunes boost_timeout (0 = off)
+        size_t          monitor_period;     ///< Monitor thread polling period in msec
+        DispatchPolicy_t dispatch;          ///< Dispatch policy across priorities
+        std::vector<uint32_t> weights;      ///< Per-priority pop weights for weighted dispatch (empty = count-p)
+        double          hedge_quantile;     ///< Processing time quantile after which running messages are hedged (0 = off)
+        size_t          hedge_min_samples;  ///< Min processing time samples required before hedging
+        double          adaptive_quantile;  ///< Processing time quantile used to derive ACK timeouts (0 = off)
+        double          adaptive_factor;    ///< Adaptive ACK timeout is this multiple of the quantile
+        size_t          adaptive_min_timeout; ///< Lower bound of adaptive ACK timeout in msec
+        size_t          adaptive_max_timeout; ///< Upper bound of adaptive ACK timeout in msec (0 = ack_timeout)
+        size_t          adaptive_min_samples; ///< Min processing time samples required before adapting
+        size_t          tenant_quota;       ///< Default max messages held per tagged tenant (0 = no limit)
+        std::map<std::string,TenantConfig_t> tenants; ///< Per-tenant settings (overrides default quota)
+        size_t          affinity_wait;      ///< Max msec a keyed message is held for its affinity consumer (0 = no affinity)
+        size_t          affinity_capacity;  ///< Max affinity keys tracked (least recently used are dropped)
+        std::vector<double> rate_limits;    ///< Per-priority max pops per second (empty or 0 = no limit)
+        double          rate_burst;         ///< Rate limit burst size in seconds of rate (at least one message)
+        bool            expire_to_failed;   ///< Move expired messages to failed set rather than dropping them
+        size_t          failed_capacity;    ///< Max failed messages held in memory, outside capacity (0 = share capacity)
+        std::string     dead_letter_path;   ///< File receiving failed messages beyond failed capacity (empty = drop them)
+        std::string     overflow_path;      ///< Path prefix of overflow logs for pushes beyond capacity (empty = reject them)
+        size_t          overflow_segment_size; ///< Max bytes per overflow log segment file
+        size_t          overflow_batch;     ///< Messages paged in per overflow read; paging starts this far below capacity
+        std::string     wal_path;           ///< Write-ahead log file, replayed on startup (empty = not durable)
+        size_t          wal_sync_interval;  ///< Max msec between write-ahead log syncs (group commit)
+        size_t          wal_sync_bytes;     ///< Buffered write-ahead log bytes that trigger an early sync
+        std::string     snapshot_path;      ///< Snapshot file, loaded on startup (empty = no snapshots)
+        size_t          snapshot_interval;  ///< Msec between periodic snapshots (0 = only on shutdown and request)
+        size_t          snapshot_threads;   ///< Threads decoding the snapshot on startup (0 = one per core)
     };
 
+    /// @brief Processing time statistics for one priority or message class
+    struct RunStats_t {
+        std::string     msg_class;      ///< Message class (empty for priority statistics)
+        uint8_t         priority;       ///< Priority (for priority statistics)
+        size_t          samples;        ///< Number of recent samples
+        size_t          median;         ///< Median processing time in msec
+        size_t          quantile;       ///< Adaptive (or hedge) quantile processing time in msec
+        size_t          ack_timeout;    ///< Effective default ACK timeout in msec (0 = no limit)
+    };
+
+    typedef std::vector<RunStats_t>  RunStatsList_t;        ///< Processing time statistics list type
+
+    typedef std::vector<Msg_t>       MsgList_t;             ///< Message list type
+    typedef std::vector<PushMsg_t>   PushMsgList_t;         ///< Message push request list type
     typedef std::vector<std::string> MsgIdList_t;           ///< Message ID list type
+    static const uint8_t KEEP_PRIORITY = 0xFF;              ///< Requeue with original message priority
+    static const size_t MAX_CHECKPOINT_SIZE = 65536;        ///< Max size of message checkpoint data
+    static const size_t MAX_MSG_CLASSES = 1000;             ///< Max tracked message classes (others use priority statistics)
+    static const size_t MAX_TENANTS = 1000;                 ///< Max tenants, including the untagged tenant
+    static const size_t MAX_DEPENDS = 1000;                 ///< Max prerequisites per message
     typedef void (ErrorCB_t)( const std::string & msg );    ///< Error callback type
 
     Queue(
@@ -57,26 +213,56 @@ public:
         ErrorCB_t a_err_cb = 0
     );
 
+    Queue( const Config_t & a_config, ErrorCB_t a_err_cb = 0, TimerService * a_timers = 0 );
+
     ~Queue();
 
     //----- Methods for use by publisher(s)
 
-    void            push( const std::string & a_id /*, const std::string & a_data*/, uint8_t a_priority, size_t a_delay = 0 );
+    void            push( const std::string & a_id /*, const std::string & a_data*/, uint8_t a_priority, size_t a_delay = 0, const MsgOpts_t & a_opts = MsgOpts_t() );
+    void            pushBatch( const PushMsgList_t & a_msgs, size_t & a_pushed, size_t & a_skipped );
 
     //----- Methods for use by consumer(s)
 
-    const Msg_t &   pop();
+    const Msg_t &   pop( const std::string & a_consumer = std::string() );
+    MsgList_t       popBatch( size_t a_limit, const std::string & a_consumer = std::string() );
     void            ack( const std::string & a_id, const std::string & a_token, bool a_requeue = false, size_t a_delay = 0 );
-    const Msg_t &   popAck( const std::string & a_id, const std::string & a_token, bool a_requeue = false, size_t a_delay = 0 );
+    const Msg_t &   popAck( const std::string & a_id, const std::string & a_token, bool a_requeue = false, size_t a_delay = 0, const std::string & a_consumer = std::string() );
+    void            ackAndPush( const std::string & a_id, const std::string & a_token, const PushMsgList_t & a_msgs );
+    void            touch( const std::string & a_id, const std::string & a_token, size_t a_extend = 0 );
+    void            checkpoint( const std::string & a_id, const std::string & a_token, const std::string & a_data, size_t a_extend = 0 );
 
 
     //----- Methods for use by monitoring process
 
     void            setErrorCallback( ErrorCB_t * a_callback );
     size_t          getCapacity() const;
+    size_t          getBoostTimeout() const;
+    void            getDeadlineStats( size_t & a_overdue, size_t & a_late ) const;
+    void            getAffinityStats( size_t & a_hits, size_t & a_fallbacks, size_t & a_keys ) const;
+    size_t          getExpiredCount() const;
+    void            getDeadLetterStats( size_t & a_spilled, size_t & a_dropped ) const;
+    size_t          getOverflowCount() const;
+    void            getWalStats( size_t & a_records, size_t & a_syncs ) const;
+    void            getSnapshotStats( size_t & a_count, size_t & a_last_msec ) const;
+    void            snapshot();
     void            getCounts( size_t & a_active, size_t & a_failed, size_t & a_free ) const;
+    bool            hasRoom( const MsgOpts_t & a_opts ) const;
+    RunStatsList_t  getRunStats() const;
     MsgIdList_t     getFailed() const;
+    MsgIdList_t     getFailed( uint64_t & a_cursor, size_t a_limit ) const;
     MsgIdList_t     eraseFailed( const MsgIdList_t & a_msg_ids );
+    MsgIdList_t     requeueFailed( const MsgIdList_t & a_msg_ids, uint8_t a_priority = KEEP_PRIORITY, size_t a_delay = 0, bool a_reset_retries = true );
+    size_t          requeueAllFailed( uint8_t a_priority = KEEP_PRIORITY, size_t a_delay = 0, bool a_reset_retries = true );
+
+    //----- Methods for use by replication
+
+    void            setReplication( ReplicationSender * a_sender, uint32_t a_channel );
+    void            syncReplica();
+    void            setStandby( bool a_standby );
+    bool            isStandby() const;
+    void            applyReplica( std::vector<WriteAheadLog::Record_t> & a_records );
+    void            applyReplicaSync( std::vector<WriteAheadLog::Record_t> & a_records );
 
 private:
     /// General timestamp type
@@ -87,39 +273,100 @@ private:
         MSG_QUEUED = 0,     ///< Message is in a queue and ready for consumption
         MSG_RUNNING,        ///< Message has been de-queued by consumer
         MSG_DELAYED,        ///< Message is in the delay queue
-        MSG_FAILED          ///< Message is failed
+        MSG_FAILED,         ///< Message is failed
+        MSG_BLOCKED         ///< Message is waiting for prerequisites or prior message in its group
+    };
+
+    /// Processing time tracking for a priority or message class
+    struct ClassStats_t {
+        ClassStats_t() : ack_timeout( 0 ), hedge_time( 0 ), changed( false ) {}
+
+        DurationSketch          run_times;  ///< Recent processing (pop to ACK) times
+        size_t                  ack_timeout;///< Adaptive ACK timeout in msec (0 = use queue default)
+        size_t                  hedge_time; ///< Hedge threshold in msec (0 = do not hedge)
+        bool                    changed;    ///< Samples added since thresholds were last computed
     };
 
+    struct Tenant_t;
+    struct Group_t;
+
     /// Internal message entry record
     struct MsgEntry_t {
         /// Constructor
         MsgEntry_t( const std::string & a_id, /*const std::string & a_data,*/ uint8_t a_priority ) :
             priority( a_priority ),
-            boosted( false ),
+            level( a_priority ),
             fail_count( 0 ),
+            max_retries( 0 ),
+            ack_timeout( 0 ),
+            fail_seq( 0 ),
+            class_stats( 0 ),
+            tenant( 0 ),
+            group( 0 ),
+            heap_pos( (size_t)-1 ),
+            expire_pos( (size_t)-1 ),
+            due_pos( (size_t)-1 ),
             state( MSG_QUEUED ),
             state_ts( std::chrono::system_clock::now() ),
-            message(Msg_t{ a_id })
+            due( timestamp_t::max() ),
+            expiry( timestamp_t::max() ),
+            message(Msg_t{ a_id, std::string(), std::string() })
         {};
 
         /// Reset message for re-use
         void reset( const std::string & a_id, /*const std::string & a_data,*/ uint8_t a_priority ) {
             priority = a_priority;
-            boosted = false;
+            level = a_priority;
             fail_count = 0;
+            max_retries = 0;
+            ack_timeout = 0;
+            fail_seq = 0;
+            class_stats = 0;
+            tenant = 0;
+            group = 0;
+            affinity.clear();
+            batch.clear();
+            prereqs.clear();
+            dependents.clear();
             state = MSG_QUEUED;
             state_ts = std::chrono::system_clock::now();
+            due = timestamp_t::max();
+            expiry = timestamp_t::max();
             message.id = a_id;
             /*message.data = a_data;*/
             message.token.clear();
+            message.checkpoint.clear();
+            if ( hedge ) {
+                hedge->token.clear();
+            }
         }
 
         uint8_t                 priority;   ///< Message priority
-        bool                    boosted;    ///< True if priority has been boosted
+        uint8_t                 level;      ///< Current (aged) priority, index of ready queue while queued
         uint8_t                 fail_count; ///< Fail count
+        uint8_t                 max_retries;///< Per-message max retries (0 = queue default)
+        uint32_t                ack_timeout;///< Per-message ACK timeout in msec (0 = queue default)
+        uint64_t                fail_seq;   ///< Failure sequence number (key in failed index)
+        ClassStats_t *          class_stats;///< Message class statistics (null = use priority statistics)
+        Tenant_t *              tenant;     ///< Tenant holding message
+        Group_t *               group;      ///< Ordered group (null if none)
+        std::string             affinity;   ///< Affinity key (empty if none)
+        std::string             batch;      ///< Batch key (empty if none)
+        std::vector<MsgEntry_t*> prereqs;   ///< Prerequisites not yet completed (while blocked)
+        std::vector<MsgEntry_t*> dependents;///< Blocked messages waiting for this message
+        size_t                  heap_pos;   ///< Index in deadline ready heap (NPOS if not in heap)
+        size_t                  expire_pos; ///< Index in expiry heap (NPOS if not in heap)
+        size_t                  due_pos;    ///< Index in due heap (NPOS if not in heap)
         MsgState_t              state;      ///< Queued, running, failed (for monitoring)
         timestamp_t             state_ts;   ///< Time when message changed state (for monitoring)
+        timestamp_t             deadline;   ///< ACK deadline while running
+        timestamp_t             level_ts;   ///< Time message entered current ready queue (for aging)
+        timestamp_t             due;        ///< Completion due time (max if none)
+        timestamp_t             expiry;     ///< Expiry time while waiting for dispatch (max if none)
+        ListLink<MsgEntry_t>    link;       ///< Ready (tenant) queue, consumer held list, or running list link
+        ListLink<MsgEntry_t>    aux_link;   ///< Hedge queue (running), group pending (blocked), held list (held), or batch index (ready) link
         Msg_t                   message;    ///< Message data
+        std::unique_ptr<Msg_t>  hedge;      ///< Duplicate (hedge) lease (active if token set)
     };
 
     /// Custom multiset comparator to sort message entries by time
@@ -133,41 +380,252 @@ private:
 
     // Typedefs used by implementation
 
-    typedef std::vector<std::deque<MsgEntry_t*>>        queue_list_t;
     typedef std::map<std::string,MsgEntry_t*>           msg_map_t;
     typedef std::multiset<MsgEntry_t*,DelaySetCompare>  msg_delay_t;
     typedef std::vector<MsgEntry_t*>                    msg_pool_t;
+    typedef std::map<uint64_t,MsgEntry_t*>              msg_failed_t;
+    typedef IntrusiveList<MsgEntry_t,&MsgEntry_t::link> msg_list_t;
+    typedef IntrusiveList<MsgEntry_t,&MsgEntry_t::aux_link> msg_aux_list_t;
+    typedef IndexedHeap<MsgEntry_t,&MsgEntry_t::heap_pos> msg_heap_t;
+    typedef IndexedHeap<MsgEntry_t,&MsgEntry_t::expire_pos> msg_expire_heap_t;
+    typedef IndexedHeap<MsgEntry_t,&MsgEntry_t::due_pos> msg_due_heap_t;
+    typedef std::map<std::string,ClassStats_t>          class_stats_t;
+
+    /// Ready messages of one tenant at one priority level
+    struct TenantQueue_t {
+        TenantQueue_t() : deficit( 0 ), tenant( 0 ) {}
+
+        msg_list_t              msgs;       ///< Ready messages in arrival order
+        ListLink<TenantQueue_t> link;       ///< Link in level's round-robin ring (while non-empty)
+        uint32_t                deficit;    ///< Pops remaining in tenant's current turn
+        Tenant_t *              tenant;     ///< Owning tenant
+    };
+
+    typedef IntrusiveList<TenantQueue_t,&TenantQueue_t::link> tenant_ring_t;
+
+    /// Message producer (tenant) state
+    struct Tenant_t {
+        Tenant_t() : count( 0 ), overflow( 0 ), quota( 0 ), weight( 1 ) {}
+
+        size_t                  count;      ///< Number of messages held (any state)
+        size_t                  overflow;   ///< Number of messages in overflow logs (also held against quota)
+        size_t                  quota;      ///< Max messages held (0 = no limit)
+        uint32_t                weight;     ///< Pops per round-robin turn
+        TokenBucket             rate;       ///< Dispatch rate limit
+        std::vector<TenantQueue_t> queues;  ///< Ready queue per priority level
+    };
+
+    /// Ready messages at one priority level, round-robin across tenants
+    struct ReadyQueue_t {
+        ReadyQueue_t() : count( 0 ) {}
+
+        tenant_ring_t           tenants;    ///< Tenants with ready messages, in service order
+        size_t                  count;      ///< Number of ready messages
+    };
+
+    typedef std::vector<ReadyQueue_t>                   queue_list_t;
+    typedef std::map<std::string,Tenant_t>              tenant_map_t;
+
+    /// Ordered message group state
+    struct Group_t {
+        Group_t( const std::string & a_id ) : id( a_id ), head( 0 ), count( 0 ) {}
+
+        std::string             id;         ///< Group key
+        MsgEntry_t *            head;       ///< Message currently released for dispatch (null if none)
+        msg_aux_list_t          pending;    ///< Blocked messages in push order
+        size_t                  count;      ///< Number of messages referencing group (any state)
+    };
+
+    typedef std::map<std::string,Group_t>               group_map_t;
+
+    /// Consumer with affinity keys
+    struct Consumer_t {
+        Consumer_t( const std::string & a_id ) : id( a_id ), keys( 0 ) {}
+
+        std::string             id;         ///< Consumer ID
+        msg_list_t              held;       ///< Messages held for consumer, in hold order
+        size_t                  keys;       ///< Number of affinity keys mapped to consumer
+    };
+
+    /// Affinity table entry
+    struct AffinityKey_t {
+        AffinityKey_t( const std::string & a_key ) : key( a_key ), consumer( 0 ) {}
+
+        std::string             key;        ///< Affinity key
+        Consumer_t *            consumer;   ///< Consumer that last popped a message with key
+        ListLink<AffinityKey_t> link;       ///< Link in least-recently-used list
+    };
+
+    /// Ready messages sharing a batch key
+    struct Batch_t {
+        Batch_t() : count( 0 ) {}
+
+        std::vector<msg_aux_list_t> levels; ///< Ready messages per priority level, in queue order
+        size_t                  count;      ///< Number of ready messages
+    };
+
+    typedef std::map<std::string,Batch_t>               batch_map_t;
+    typedef std::map<std::string,Consumer_t>            consumer_map_t;
+    typedef std::map<std::string,AffinityKey_t>         affinity_map_t;
+    typedef IntrusiveList<AffinityKey_t,&AffinityKey_t::link> affinity_lru_t;
+    typedef std::vector<std::pair<std::pair<uint8_t,timestamp_t>,size_t>> restore_order_t;
 
     // Private methods (see source for documentation)
 
     MsgEntry_t *    getMsgEntry( const std::string & a_id, /*const std::string & a_data,*/ uint8_t a_priority );
-    const Msg_t &   popImpl( std::unique_lock<std::mutex> & a_lock );
+    void            checkPushArgs( uint8_t a_priority, const MsgOpts_t & a_opts ) const;
+    Tenant_t *      getTenant( const std::string & a_tenant );
+    bool            acquireGroup( MsgEntry_t * a_msg, const timestamp_t & a_ready_ts );
+    void            releaseGroup( MsgEntry_t * a_msg );
+    bool            addDepends( MsgEntry_t * a_msg, const std::vector<std::string> & a_depends );
+    void            releaseDependents( MsgEntry_t * a_msg );
+    void            releaseMsg( MsgEntry_t * a_msg, const timestamp_t & a_ready_ts );
+    void            pushImpl( const std::string & a_id, uint8_t a_priority, size_t a_delay, const MsgOpts_t & a_opts );
+    void            freeMsgEntry( msg_map_t::iterator a_entry );
+    const Msg_t &   popImpl( std::unique_lock<std::mutex> & a_lock, const std::string & a_consumer );
+    void            runMsg( MsgEntry_t * a_msg, const timestamp_t & a_now );
     void            ackImpl( const std::string & a_id, const std::string & a_token, bool a_requeue, size_t a_delay );
+    void            queueMsg( MsgEntry_t * a_msg, const timestamp_t & a_now, bool a_hold = true );
+    void            trackExpiry( MsgEntry_t * a_msg );
+    void            trackDue( MsgEntry_t * a_msg );
+    void            untrackMsg( MsgEntry_t * a_msg );
+    void            unqueueMsg( MsgEntry_t * a_msg );
+    timestamp_t     expireMsgs( const timestamp_t & a_now );
+    bool            holdMsg( MsgEntry_t * a_msg, const timestamp_t & a_now );
+    void            unholdMsg( MsgEntry_t * a_msg );
+    timestamp_t     releaseHeldMsgs( const timestamp_t & a_now );
+    Consumer_t *    findConsumer( const std::string & a_consumer );
+    void            setAffinity( const std::string & a_key, const std::string & a_consumer );
+    void            dropConsumerKey( Consumer_t * a_consumer );
+    MsgEntry_t *    dequeueMsg( const timestamp_t & a_now, timestamp_t & a_next );
+    void            readyPush( MsgEntry_t * a_msg );
+    MsgEntry_t *    readyPop( size_t a_level, const timestamp_t & a_now, timestamp_t & a_next );
+    bool            rateTake( MsgEntry_t * a_msg, size_t a_level, const timestamp_t & a_now, timestamp_t & a_next );
+    void            readyRemove( MsgEntry_t * a_msg );
+    void            batchAdd( MsgEntry_t * a_msg );
+    void            batchRemove( MsgEntry_t * a_msg );
     void            insertDelayedMsg( MsgEntry_t * a_msg, const timestamp_t & a_requeue_ts  );
-    void            monitorThread();
-    void            delayThread();
+    size_t          ageQueuedMsgs( const timestamp_t & a_now );
+    void            tuneBoostTimeout( const timestamp_t & a_now );
+    void            setDeadline( MsgEntry_t * a_msg, const timestamp_t & a_now, size_t a_timeout = 0 );
+    msg_map_t::iterator getRunningMsg( const std::string & a_id, const std::string & a_token );
+    void            endRun( MsgEntry_t * a_msg, const timestamp_t & a_now, bool a_completed );
+    void            hedgeMsgs( const timestamp_t & a_now );
+    ClassStats_t &  getClassStats( MsgEntry_t * a_msg );
+    void            updateClassStats( ClassStats_t & a_stats );
+    void            failMsg( MsgEntry_t * a_msg );
+    bool            requeueFailedMsg( MsgEntry_t * a_msg, uint8_t a_priority, const timestamp_t & a_requeue_ts, bool a_reset_retries );
+    size_t          liveCount() const;
+    void            trimFailed();
+    void            overflowMsg( const std::string & a_id, uint8_t a_priority, size_t a_delay, const MsgOpts_t & a_opts );
+    void            releaseOverflow();
+    void            checkPageIn();
+    size_t          pageInMsgs( const timestamp_t & a_now );
+    bool            restoreMsg( const std::string & a_id, uint8_t a_priority, uint64_t a_ready_ms, uint64_t a_due_ms, uint64_t a_expiry_ms, MsgOpts_t & a_opts, uint64_t a_now_ms, bool a_failed = false );
+    void            recoverMsg( WriteAheadLog::Record_t & a_record, uint64_t a_now_ms );
+    void            recoverMsgs( std::vector<WriteAheadLog::Record_t> & a_records );
+    void            logPush( const std::string & a_id, uint8_t a_priority, size_t a_delay, const MsgOpts_t & a_opts );
+    WriteAheadLog::Record_t pushRecord( const std::string & a_id, uint8_t a_priority, size_t a_delay, const MsgOpts_t & a_opts ) const;
+    void            logRecord( const WriteAheadLog::Record_t & a_record );
+    void            logTransition( WriteAheadLog::RecordType_t a_type, const std::string & a_id, uint8_t a_priority = 0, uint64_t a_ready_ms = 0, uint8_t a_retries = 0 );
+    void            replicateLease( WriteAheadLog::RecordType_t a_type, MsgEntry_t * a_msg, bool a_hedge = false );
+    void            restoreState( const Config_t & a_config );
+    void            captureMsgs( std::vector<SnapshotFile::Record_t> & a_records, restore_order_t & a_order );
+    static void     orderMsgs( std::vector<SnapshotFile::Record_t> & a_captured, restore_order_t & a_order, std::vector<SnapshotFile::Record_t> & a_records );
+    bool            timeoutMsg( MsgEntry_t * a_msg, const timestamp_t & a_now );
+    void            detachMsg( MsgEntry_t * a_msg, const timestamp_t & a_now );
+    void            clearMsgs();
+    void            runReplica( MsgEntry_t * a_msg, const WriteAheadLog::Record_t & a_record, const timestamp_t & a_now );
+    void            applyRecord( WriteAheadLog::Record_t & a_record, const timestamp_t & a_now, uint64_t a_now_ms );
+    void            writeSnapshot();
+    void            snapshotThread();
+    timestamp_t     monitorTask( const timestamp_t & a_now );
+    timestamp_t     delayTask( const timestamp_t & a_now );
 
-    size_t                      m_capacity;         ///< Max message capacity (including failed)
+    size_t                      m_capacity;         ///< Max message capacity (including failed, unless separately budgeted)
     size_t                      m_fail_timeout;     ///< Message ACK fail timeout in msec (max runtime)
     size_t                      m_max_retries;      ///< Maximum per-message dequeue retries
-    size_t                      m_boost_timeout;    ///< Message priority boost timeout in msec
+    size_t                      m_boost_timeout;    ///< Current message priority aging step in msec
+    size_t                      m_boost_timeout_max;///< Configured (max) message priority aging step in msec
+    size_t                      m_boost_max_wait;   ///< Target max queue wait for low priorities in msec (0 = fixed aging)
     size_t                      m_poll_interval;    ///< Internal monitoring poll interval in msec
+    DispatchPolicy_t            m_dispatch;         ///< Dispatch policy across priorities
+    std::vector<uint32_t>       m_weights;          ///< Per-priority quantum (pops per round) for weighted dispatch
+    std::vector<uint32_t>       m_deficit;          ///< Per-priority pops remaining in current round for weighted dispatch
+    size_t                      m_drr_cur;          ///< Priority currently served by weighted dispatch
+    double                      m_hedge_quantile;   ///< Processing time quantile that triggers hedging (0 = off)
+    size_t                      m_hedge_min_samples;///< Min processing time samples before hedging
+    double                      m_adapt_quantile;   ///< Processing time quantile for adaptive ACK timeouts (0 = off)
+    double                      m_adapt_factor;     ///< Adaptive ACK timeout multiple of quantile
+    size_t                      m_adapt_min;        ///< Min adaptive ACK timeout in msec
+    size_t                      m_adapt_max;        ///< Max adaptive ACK timeout in msec
+    size_t                      m_adapt_min_samples;///< Min processing time samples before adapting
+    size_t                      m_pop_waiters;      ///< Number of consumers blocked in pop
+    std::vector<ClassStats_t>   m_pri_stats;        ///< Processing time statistics per priority
+    std::vector<DurationSketch> m_pri_waits;        ///< Recent queue residence times per (base) priority
+    class_stats_t               m_class_stats;      ///< Processing time statistics per message class
     ErrorCB_t                 * m_err_cb;           ///< Error callback function ptr
     size_t                      m_count_queued;     ///< Number of messages in queues
     size_t                      m_count_failed;     ///< Number of messages in failed state
-    bool                        m_run;              ///< Run/stop flag for internal threads
+    uint64_t                    m_fail_seq;         ///< Last assigned failure sequence number
+    uint64_t                    m_queue_seq;        ///< Arrival sequence number for deadline ready heap
+    size_t                      m_count_late;       ///< Number of messages dispatched after their due time
     std::mt19937_64             m_rng;              ///< Random number generator for ACK tokens
-    std::thread                 m_monitor_thread;   ///< Monitoring thread
-    std::condition_variable     m_mon_cv;           ///< Monitoring cond var
-    std::thread                 m_delay_thread;     ///< Delay thread
-    std::condition_variable     m_delay_cv;         ///< Delay cond var
+    std::unique_ptr<TimerService> m_own_timers;     ///< Private timer service (if none shared)
+    TimerService              * m_timers;           ///< Timer service running monitor and delay tasks
+    TimerService::TaskId_t      m_monitor_task;     ///< Monitoring task
+    TimerService::TaskId_t      m_delay_task;       ///< Delay queue task
     mutable std::mutex          m_mutex;            ///< Mutex for all shared message structures
     std::condition_variable     m_pop_cv;           ///< Cond var for pop methods
     msg_pool_t                  m_msg_pool;         ///< Message entry memory pool
     msg_map_t                   m_msg_map;          ///< Message ID to entry index
     msg_delay_t                 m_msg_delay;        ///< Message delay queue
-    queue_list_t                m_queue_list;       ///< Queue list (one queue per priority)
+    msg_failed_t                m_msg_failed;       ///< Failed message index (ordered by failure time)
+    msg_list_t                  m_msg_running;      ///< Running messages (scanned by monitor)
+    msg_aux_list_t              m_msg_hedge;        ///< Running messages awaiting a hedge consumer
+    queue_list_t                m_queue_list;       ///< Ready queue list (one per priority level)
+    tenant_map_t                m_tenants;          ///< Tenants by key (untagged messages use empty key)
+    size_t                      m_tenant_quota;     ///< Default quota for new tagged tenants
+    group_map_t                 m_groups;           ///< Ordered groups with messages, by key
+    size_t                      m_affinity_wait;    ///< Max time keyed messages are held for affinity consumer in msec (0 = off)
+    size_t                      m_affinity_capacity;///< Max tracked affinity keys
+    size_t                      m_count_held;       ///< Number of messages held for affinity consumers
+    size_t                      m_count_aff_hits;   ///< Number of messages popped by their affinity consumer
+    size_t                      m_count_aff_fallbacks; ///< Number of keyed messages popped by another consumer
+    consumer_map_t              m_consumers;        ///< Consumers with affinity keys, by ID
+    affinity_map_t              m_affinity;         ///< Affinity table (key to consumer)
+    affinity_lru_t              m_affinity_lru;     ///< Affinity keys, least recently used first
+    msg_aux_list_t              m_msg_held;         ///< Held messages in hold order (all consumers)
+    batch_map_t                 m_batches;          ///< Index of ready messages by batch key
+    bool                        m_rate_limited;     ///< True if any priority or tenant rate limit is set
+    std::vector<TokenBucket>    m_level_rates;      ///< Dispatch rate limit per priority level
+    bool                        m_expire_to_failed; ///< Move expired messages to failed set (else drop)
+    size_t                      m_count_expired;    ///< Number of messages expired
+    msg_expire_heap_t           m_expire_heap;      ///< Queued and delayed messages with an expiry, by expiry time
+    msg_due_heap_t              m_due_heap;         ///< Queued and delayed messages with a due time, by due time
+    size_t                      m_failed_capacity;  ///< Max in-memory failed messages (0 = failed share m_capacity)
+    size_t                      m_count_dropped;    ///< Number of failed messages dropped beyond failed capacity
+    std::unique_ptr<DeadLetterFile> m_dead_letter;  ///< Spill file for failed messages beyond failed capacity (null = drop)
+    std::vector<std::unique_ptr<OverflowLog>> m_overflow; ///< Overflow log per priority (empty = no overflow tier)
+    size_t                      m_overflow_batch;   ///< Max messages paged in per overflow read
+    size_t                      m_count_overflow;   ///< Number of messages in overflow logs
+    std::set<std::string>       m_overflow_ids;     ///< IDs of messages in overflow logs
+    bool                        m_overflow_wake;    ///< True if delay task has been woken to page in overflow
+    std::unique_ptr<WriteAheadLog> m_wal;           ///< Write-ahead log (null = not durable)
+    ReplicationSender         * m_replica;          ///< Replication stream to standby (null = not replicated)
+    uint32_t                    m_replica_channel;  ///< Replication channel of queue
+    bool                        m_standby;          ///< Applying replicated state (no local timeouts, expiry or logging)
+    std::string                 m_snapshot_path;    ///< Snapshot file (empty = no snapshots)
+    size_t                      m_snapshot_interval;///< Msec between periodic snapshots (0 = none)
+    size_t                      m_count_snapshots;  ///< Number of snapshots written
+    size_t                      m_snapshot_msec;    ///< Duration of last snapshot in msec
+    std::mutex                  m_snapshot_mutex;   ///< Serializes snapshot writes; guards snapshot thread run flag
+    std::condition_variable     m_snapshot_cv;      ///< Snapshot thread wake-up cond var
+    bool                        m_snapshot_run;     ///< Run/stop flag for snapshot thread
+    std::thread                 m_snapshot_thread;  ///< Periodic snapshot thread
+    msg_heap_t                  m_ready_heap;       ///< Ready heap ordered by due time (deadline dispatch)
 };
 
 } // MonQueue namespace
 
+#endif
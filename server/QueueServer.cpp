@@ -2,6 +2,8 @@
 #include <stdexcept>
 #include <chrono>
 #include <thread>
+#include <sstream>
+#include <iomanip>
 #include <Poco/Exception.h>
 #include <Poco/Timespan.h>
 #include <Poco/Net/HTTPRequestHandler.h>
@@ -10,6 +12,7 @@
 #include <Poco/Net/HTTPServerResponse.h>
 #include <Poco/Net/HTTPServerParams.h>
 #include "QueueServer.hpp"
+#include "BulkLoader.hpp"
 #include "libjson.hpp"
 
 
@@ -19,6 +22,12 @@ using namespace Poco::Net;
 
 namespace MonQueue {
 
+/// Max number of failed message IDs read from the queue per lock acquisition
+const size_t FAILED_PAGE_SIZE = 1000;
+
+/// Max number of messages returned by a batch pop
+const size_t MAX_POP_BATCH = 1000;
+
 void logger( const std::string & msg ) {
     cerr << "[MQSERVER] " << msg << endl;
 }
@@ -26,17 +35,51 @@ void logger( const std::string & msg ) {
 class Handler : public HTTPRequestHandler {
   public:
 
-    Handler( Queue & a_queue ) : m_queue( a_queue ) {
+    Handler( QueueServer & a_server ) : m_server( a_server ), m_queue( 0 ) {
     }
 
     ~Handler() {
     }
 
+    /** @brief Route request to endpoint
+     *
+     * Queue endpoints are served for the default queue at /<endpoint>, or for
+     * a named queue at /q/<name>/<endpoint>. Admin endpoints are top-level only.
+     */
     void handleRequest( HTTPServerRequest & a_request, HTTPServerResponse & a_response ) {
         Poco::URI uri( a_request.getURI() );
-        RouteMap_t::iterator r = m_route_map.find( uri.getPath() );
+        string path = uri.getPath();
+        string name;
+
+        // A standby serves only reads until promoted
+        if ( a_request.getMethod() != "GET" && path != "/promote" && path != "/ping" && m_server.isStandby() ) {
+            string payload = "{\"type\":\"error\",\"message\":\"Server is a standby\"}";
+            sendResponse( a_response, &payload, HTTPResponse::HTTP_SERVICE_UNAVAILABLE );
+            return;
+        }
+
+        if ( path.compare( 0, 3, "/q/" ) == 0 ) {
+            size_t pos = path.find( '/', 3 );
+
+            if ( pos == string::npos || pos == 3 ) {
+                sendResponse( a_response, 0, HTTPResponse::HTTP_NOT_FOUND );
+                return;
+            }
 
-        if ( r != m_route_map.end() ) {
+            name = path.substr( 3, pos - 3 );
+            path = path.substr( pos );
+        } else {
+            RouteMap_t::iterator r = m_admin_route_map.find( path );
+
+            if ( r != m_admin_route_map.end() ) {
+                (this->*(r->second))( a_request, a_response );
+                return;
+            }
+        }
+
+        RouteMap_t::iterator r = m_route_map.find( path );
+
+        if ( r != m_route_map.end() && ( m_queue = m_server.getQueue( name )) != 0 ) {
             (this->*(r->second))( a_request, a_response );
         } else {
             sendResponse( a_response, 0, HTTPResponse::HTTP_NOT_FOUND );
@@ -72,7 +115,25 @@ class Handler : public HTTPRequestHandler {
      *
      * Request is POST, body is JSON array:
      *
-     *   [{ id: <string>, pri: <uint>, del: <uint> (optional) }]
+     *   [{ id: <string>, pri: <uint>, del: <uint> (optional), tmo: <uint> (optional), ret: <uint> (optional),
+     *      cls: <string> (optional), due: <uint> (optional), tnt: <string> (optional), grp: <string> (optional),
+     *      aff: <string> (optional), bat: <string> (optional), dep: [<string>] (optional),
+     *      ttl: <uint> (optional) }]
+     *
+     * Where tmo (ACK timeout, msec) and ret (max retries) override queue
+     * defaults for the message, cls sets the message class used for
+     * processing time statistics (and adaptive ACK timeouts), and due is the
+     * completion due time in msec from now (orders dispatch in deadline mode).
+     * Tnt tags the message with a tenant (producer) key; tenants are served
+     * round robin within a priority and are subject to per-tenant quotas.
+     * Grp places the message in an ordered group; messages of a group are
+     * dispatched one at a time, in push order. Aff is an affinity key; the
+     * message is preferentially dispatched to the consumer that last popped a
+     * message with the same key. Bat is a batch key; ready messages with the
+     * same key may be popped together (see PopBatchRequest). Dep lists IDs of
+     * prerequisite messages; the message is held until all prerequisites are
+     * ACKed, and fails if any prerequisite fails. Ttl is the time in msec after
+     * which the message expires if it has not been dispatched.
      *
      * Response is empty (success), or JSON error document
      */
@@ -80,7 +141,6 @@ class Handler : public HTTPRequestHandler {
         //cout << "PushRequest" << endl;
 
         if ( a_request.getMethod() == "POST" ) {
-            size_t active, failed, free;
             libjson::Value req_json;
 
             try {
@@ -89,21 +149,17 @@ class Handler : public HTTPRequestHandler {
 
                 libjson::Value::Array & arr = req_json.asArray();
                 for ( libjson::Value::ArrayIter m = arr.begin(); m != arr.end(); m++ ) {
-                    libjson::Value::Object & msg = m->asObject();
-                    msg.has("id");
-                    msg.has("pri");
-                    msg.has("del");
+                    Queue::PushMsg_t msg;
+
+                    parsePushMsg( m->asObject(), msg );
 
                     // TODO This is a hack until push has a built-in wait/timeout
-                    while ( true ) {
-                        m_queue.getCounts( active, failed, free );
-                        if ( free ) {
-                            break;
-                        }
+                    // (no wait if the message can go to the overflow tier)
+                    while ( !m_queue->hasRoom( msg.opts )) {
                         this_thread::sleep_for(chrono::milliseconds( 100 ));
                     }
 
-                    m_queue.push( msg.getString("id"), (uint8_t)msg.getNumber("pri"), (size_t)(msg.has("del")?m->asNumber():0) );
+                    m_queue->push( msg.id, msg.priority, msg.delay, msg.opts );
                 }
 
                 sendResponse( a_response, 0, HTTPResponse::HTTP_OK );
@@ -116,25 +172,65 @@ class Handler : public HTTPRequestHandler {
         }
     }
 
-    /** @brief Push one or more messages into queue
+    /** @brief Bulk load messages into queue
+     *
+     * Request is POST, body is a stream of push records, either one JSON
+     * object per line with the fields of a PushRequest entry, or binary
+     * records (see BulkLoader). The body is parsed as it is received and may
+     * be sent with chunked transfer encoding. Messages are pushed in batches
+     * under a single lock acquisition each; messages whose ID is already in
+     * the queue are skipped, so a publisher can re-push its whole backlog
+     * after a restart. Loading stops at the first invalid record or push
+     * error (e.g. capacity exceeded); records before it remain pushed.
      *
-     * Request is POST, there are no params
+     * Response is a JSON loaded doc or JSON error document (naming the
+     * failing record):
+     *
+     *   { type: loaded, count: <uint>, skipped: <uint> }
+     */
+    void LoadRequest( HTTPServerRequest & a_request, HTTPServerResponse & a_response ) {
+        if ( a_request.getMethod() == "POST" ) {
+            try {
+                BulkLoader loader( *m_queue );
+
+                loader.load( a_request.stream() );
+
+                string payload = "{\"type\":\"loaded\",\"count\":";
+                payload += to_string( loader.getPushed() );
+                payload += ",\"skipped\":";
+                payload += to_string( loader.getSkipped() );
+                payload += "}";
+
+                sendResponse( a_response, &payload, HTTPResponse::HTTP_OK );
+            } catch( exception & e ) {
+                string payload = string( "{\"type\":\"error\",\"message\":\"" ) + e.what() + "\"}";
+                sendResponse( a_response, &payload, HTTPResponse::HTTP_BAD_REQUEST );
+            }
+        } else {
+            sendResponse( a_response, 0, HTTPResponse::HTTP_METHOD_NOT_ALLOWED );
+        }
+    }
+
+    /** @brief Pop a message from the queue
+     *
+     * Request is POST, optional URI query param:
+     *
+     *   con=<string> - Consumer ID, for affinity routing of keyed messages
      *
      * Response is a JSON message doc or JSON error document:
      *
-     *   { type: msg, id: <string>, tok: <uint> }
+     *   { type: msg, id: <string>, tok: <uint>, chk: <string> (if checkpoint saved) }
      */
     void PopRequest( HTTPServerRequest & a_request, HTTPServerResponse & a_response ) {
         //cout << "PopRequest" << endl;
 
         if ( a_request.getMethod() == "POST" ) {
-            const Queue::Msg_t & msg = m_queue.pop();
+            Poco::URI uri( a_request.getURI() );
+            string consumer;
+
+            getQueryParam( uri, "con", consumer );
 
-            string payload = "{\"type\":\"msg\",\"id\":\"";
-            payload += msg.id;
-            payload += "\",\"tok\":\"";
-            payload += msg.token;
-            payload += "\"}";
+            string payload = msgPayload( m_queue->pop( consumer ));
 
             sendResponse( a_response, &payload, HTTPResponse::HTTP_OK );
         } else {
@@ -142,6 +238,58 @@ class Handler : public HTTPRequestHandler {
         }
     }
 
+    /** @brief Pop a message and ready messages sharing its batch key
+     *
+     * Request is POST, URI query params:
+     *
+     *   max=<uint>    - Max number of messages to return (required)
+     *   con=<string>  - Consumer ID (optional, as for PopRequest)
+     *
+     * Response is a JSON message list doc or JSON error document:
+     *
+     *   { type: msgs, msgs: [<message doc>] }
+     *
+     * Where message docs are as returned by PopRequest. Each message must be
+     * ACKed individually.
+     */
+    void PopBatchRequest( HTTPServerRequest & a_request, HTTPServerResponse & a_response ) {
+        if ( a_request.getMethod() == "POST" ) {
+            try {
+                Poco::URI uri( a_request.getURI() );
+                string param, consumer;
+                size_t limit = 0;
+
+                if ( getQueryParam( uri, "max", param )) {
+                    limit = stoull( param );
+                }
+
+                if ( !limit || limit > MAX_POP_BATCH ) {
+                    throw runtime_error( "Invalid batch limit" );
+                }
+
+                getQueryParam( uri, "con", consumer );
+
+                Queue::MsgList_t msgs = m_queue->popBatch( limit, consumer );
+
+                string payload = "{\"type\":\"msgs\",\"msgs\":[";
+                for ( Queue::MsgList_t::iterator m = msgs.begin(); m != msgs.end(); m++ ) {
+                    if ( m != msgs.begin() ){
+                        payload += ",";
+                    }
+                    payload += msgPayload( *m );
+                }
+                payload += "]}";
+
+                sendResponse( a_response, &payload, HTTPResponse::HTTP_OK );
+            } catch( exception & e ) {
+                string payload = string( "{\"type\":\"error\",\"message\":\"" ) + e.what() + "\"}";
+                sendResponse( a_response, &payload, HTTPResponse::HTTP_BAD_REQUEST );
+            }
+        } else {
+            sendResponse( a_response, 0, HTTPResponse::HTTP_METHOD_NOT_ALLOWED );
+        }
+    }
+
     /** @brief Push one or more messages into queue
      *
      * Request is POST, body is JSON array:
@@ -160,7 +308,7 @@ class Handler : public HTTPRequestHandler {
                 libjson::Value::Object & ack = req_json.asObject();
 
                 //cout << "tok" << ack.getNumber("tok") << ", as int: " << (uint64_t)ack.getNumber("tok") << "\n";
-                m_queue.ack(
+                m_queue->ack(
                     ack.getString("id"),
                     ack.getString("tok"),
                     ack.has("que")?ack.asBool():false,
@@ -177,6 +325,83 @@ class Handler : public HTTPRequestHandler {
         }
     }
 
+    /** @brief ACK a message and push follow-up messages atomically
+     *
+     * Request is POST, body is JSON object:
+     *
+     *   { id: <string>, tok: <string>, msgs: [<push entry>] }
+     *
+     * Where push entries are as for PushRequest. Either the ACK and all pushes
+     * succeed, or none are applied.
+     *
+     * Response is empty (success), or JSON error document
+     */
+    void AckPushRequest( HTTPServerRequest & a_request, HTTPServerResponse & a_response ) {
+        if ( a_request.getMethod() == "POST" ) {
+            libjson::Value req_json;
+
+            try {
+                string body = readBody( a_request );
+                req_json.fromString( body );
+                libjson::Value::Object & ack = req_json.asObject();
+                libjson::Value::Array & arr = ack.getArray("msgs");
+                Queue::PushMsgList_t msgs( arr.size() );
+                size_t i = 0;
+
+                for ( libjson::Value::ArrayIter m = arr.begin(); m != arr.end(); m++, i++ ) {
+                    parsePushMsg( m->asObject(), msgs[i] );
+                }
+
+                m_queue->ackAndPush( ack.getString("id"), ack.getString("tok"), msgs );
+
+                sendResponse( a_response, 0, HTTPResponse::HTTP_OK );
+            } catch( exception & e ) {
+                string payload = string( "{\"type\":\"error\",\"message\":\"" ) + e.what() + "\"}";
+                sendResponse( a_response, &payload, HTTPResponse::HTTP_BAD_REQUEST );
+            }
+        } else {
+            sendResponse( a_response, 0, HTTPResponse::HTTP_METHOD_NOT_ALLOWED );
+        }
+    }
+
+    /** @brief Extend ACK deadline of a running message (heartbeat)
+     *
+     * Request is POST, body is JSON object:
+     *
+     *   { id: <string>, tok: <string>, ext: <uint> (optional, msec), chk: <string> (optional) }
+     *
+     * If chk is given, it is saved as the message's progress checkpoint and
+     * returned with the message if it is retried.
+     *
+     * Response is empty (success), or JSON error document
+     */
+    void TouchRequest( HTTPServerRequest & a_request, HTTPServerResponse & a_response ) {
+        if ( a_request.getMethod() == "POST" ) {
+            libjson::Value req_json;
+
+            try {
+                string body = readBody( a_request );
+                req_json.fromString( body );
+                libjson::Value::Object & touch = req_json.asObject();
+
+                size_t ext = (size_t)(touch.has("ext")?touch.asNumber():0);
+
+                if ( touch.has("chk") ) {
+                    m_queue->checkpoint( touch.getString("id"), touch.getString("tok"), touch.asString(), ext );
+                } else {
+                    m_queue->touch( touch.getString("id"), touch.getString("tok"), ext );
+                }
+
+                sendResponse( a_response, 0, HTTPResponse::HTTP_OK );
+            } catch( exception & e ) {
+                string payload = string( "{\"type\":\"error\",\"message\":\"" ) + e.what() + "\"}";
+                sendResponse( a_response, &payload, HTTPResponse::HTTP_BAD_REQUEST );
+            }
+        } else {
+            sendResponse( a_response, 0, HTTPResponse::HTTP_METHOD_NOT_ALLOWED );
+        }
+    }
+
     void PopAckRequest( HTTPServerRequest & a_request, HTTPServerResponse & a_response ) {
         if ( a_request.getMethod() == "POST" ) {
             libjson::Value req_json;
@@ -188,20 +413,14 @@ class Handler : public HTTPRequestHandler {
 
                 //cout << "tok" << ack.getNumber("tok") << ", as int: " << (uint64_t)ack.getNumber("tok") << "\n";
 
-                m_queue.ack(
+                m_queue->ack(
                     ack.getString("id"),
                     ack.getString("tok"),
                     ack.has("que")?ack.asBool():false,
                     (size_t)(ack.has("del")?ack.asNumber():0)
                 );
 
-                const Queue::Msg_t & msg = m_queue.pop();
-
-                string payload = "{\"type\":\"msg\",\"id\":\"";
-                payload += msg.id;
-                payload += "\",\"tok\":\"";
-                payload += msg.token;
-                payload += "\"}";
+                string payload = msgPayload( m_queue->pop( ack.has("con")?ack.asString():string() ));
 
                 sendResponse( a_response, &payload, HTTPResponse::HTTP_OK );
             } catch( exception & e ) {
@@ -218,10 +437,10 @@ class Handler : public HTTPRequestHandler {
             try {
                 size_t active, failed, free;
 
-                m_queue.getCounts( active, failed, free );
+                m_queue->getCounts( active, failed, free );
 
                 string payload = "{\"type\":\"count\",\"capacity\":";
-                payload += to_string( m_queue.getCapacity() );
+                payload += to_string( m_queue->getCapacity() );
                 payload += ",\"active\":";
                 payload += to_string( active );
                 payload += ",\"failed\":";
@@ -240,24 +459,208 @@ class Handler : public HTTPRequestHandler {
         }
     }
 
-    void GetFailedRequest( HTTPServerRequest & a_request, HTTPServerResponse & a_response ) {
+    /** @brief Get processing time statistics and effective ACK timeouts
+     *
+     * Request is GET, there are no params
+     *
+     * Response is a JSON stats doc or JSON error document:
+     *
+     *   { type: stats, stats: [{ pri: <uint> | cls: <string>, samples: <uint>, median: <uint>,
+     *     quantile: <uint>, timeout: <uint> }], boost: <uint>, overdue: <uint>, late: <uint>,
+     *     aff_hits: <uint>, aff_fallbacks: <uint>, aff_keys: <uint>, expired: <uint>,
+     *     spilled: <uint>, dropped: <uint>, overflow: <uint>, wal_records: <uint>,
+     *     wal_syncs: <uint>, snapshots: <uint>, snapshot_ms: <uint> }
+     *
+     * Times are in msec. Priority entries are listed first, followed by
+     * message class entries. Boost is the current priority aging step,
+     * overdue is the number of waiting messages past their due time, and late
+     * is the number of messages dispatched after their due time. Affinity
+     * hits and fallbacks count keyed messages popped by their affinity
+     * consumer and by other consumers, respectively. Expired is the number of
+     * messages that expired before dispatch. Spilled is the number of failed
+     * messages in the dead-letter file, and dropped the number discarded
+     * beyond the failed capacity without one. Overflow is the number of
+     * pushed messages waiting in overflow logs. WAL records and syncs count
+     * transitions written to the write-ahead log and the group commits that
+     * made them durable (zero without a log). Snapshots is the number of
+     * snapshots written since startup, and snapshot_ms the duration of the
+     * last one.
+     */
+    void StatsRequest( HTTPServerRequest & a_request, HTTPServerResponse & a_response ) {
         if ( a_request.getMethod() == "GET" ) {
             try {
-                Queue::MsgIdList_t failed = m_queue.getFailed();
+                Queue::RunStatsList_t stats = m_queue->getRunStats();
 
-                string payload = "{\"type\":\"failed\",\"ids\":[";
-                for ( Queue::MsgIdList_t::iterator i = failed.begin(); i != failed.end(); i++ ) {
-                    if ( i != failed.begin() ){
+                string payload = "{\"type\":\"stats\",\"stats\":[";
+                for ( Queue::RunStatsList_t::iterator i = stats.begin(); i != stats.end(); i++ ) {
+                    if ( i != stats.begin() ){
                         payload += ",";
                     }
-                    payload += "\"";
-                    payload += *i;
-                    payload += "\"";
+                    if ( i->msg_class.size() ) {
+                        payload += "{\"cls\":";
+                        appendJsonString( payload, i->msg_class );
+                    } else {
+                        payload += "{\"pri\":";
+                        payload += to_string( i->priority );
+                    }
+                    payload += ",\"samples\":";
+                    payload += to_string( i->samples );
+                    payload += ",\"median\":";
+                    payload += to_string( i->median );
+                    payload += ",\"quantile\":";
+                    payload += to_string( i->quantile );
+                    payload += ",\"timeout\":";
+                    payload += to_string( i->ack_timeout );
+                    payload += "}";
                 }
-                payload += "]}";
+                size_t overdue, late;
+
+                m_queue->getDeadlineStats( overdue, late );
+
+                payload += "],\"boost\":";
+                payload += to_string( m_queue->getBoostTimeout() );
+                payload += ",\"overdue\":";
+                payload += to_string( overdue );
+                payload += ",\"late\":";
+                payload += to_string( late );
+
+                size_t hits, fallbacks, keys;
+
+                m_queue->getAffinityStats( hits, fallbacks, keys );
+
+                payload += ",\"aff_hits\":";
+                payload += to_string( hits );
+                payload += ",\"aff_fallbacks\":";
+                payload += to_string( fallbacks );
+                payload += ",\"aff_keys\":";
+                payload += to_string( keys );
+                payload += ",\"expired\":";
+                payload += to_string( m_queue->getExpiredCount() );
+
+                size_t spilled, dropped;
+
+                m_queue->getDeadLetterStats( spilled, dropped );
+
+                payload += ",\"spilled\":";
+                payload += to_string( spilled );
+                payload += ",\"dropped\":";
+                payload += to_string( dropped );
+                payload += ",\"overflow\":";
+                payload += to_string( m_queue->getOverflowCount() );
+
+                size_t wal_records, wal_syncs;
+
+                m_queue->getWalStats( wal_records, wal_syncs );
+
+                payload += ",\"wal_records\":";
+                payload += to_string( wal_records );
+                payload += ",\"wal_syncs\":";
+                payload += to_string( wal_syncs );
+
+                size_t snapshots, snapshot_ms;
+
+                m_queue->getSnapshotStats( snapshots, snapshot_ms );
+
+                payload += ",\"snapshots\":";
+                payload += to_string( snapshots );
+                payload += ",\"snapshot_ms\":";
+                payload += to_string( snapshot_ms );
+                payload += "}";
 
                 sendResponse( a_response, &payload, HTTPResponse::HTTP_OK );
+            } catch( exception & e ) {
+                string payload = string( "{\"type\":\"error\",\"message\":\"" ) + e.what() + "\"}";
+                sendResponse( a_response, &payload, HTTPResponse::HTTP_BAD_REQUEST );
+            }
+        } else {
+            sendResponse( a_response, 0, HTTPResponse::HTTP_METHOD_NOT_ALLOWED );
+        }
+    }
+
+    /** @brief Get IDs of failed messages
+     *
+     * Request is GET, optional URI query params:
+     *
+     *   cursor=<uint> - Resume listing after this position (default 0 = start)
+     *   limit=<uint>  - Return at most this many IDs (default all)
+     *
+     * Response is a JSON failed doc or JSON error document:
+     *
+     *   { type: failed, ids: [<string>], next: <uint> }
+     *
+     * where next is the cursor for the following page, or 0 if there are no
+     * more failed messages. Messages spilled to the dead-letter file are
+     * listed first. The response is streamed and, when no limit is
+     * given, is built from successive pages so the queue is never locked for
+     * longer than one page. If a later page cannot be read, the listing ends
+     * early with next set to resume after the last ID sent.
+     */
+    void GetFailedRequest( HTTPServerRequest & a_request, HTTPServerResponse & a_response ) {
+        if ( a_request.getMethod() == "GET" ) {
+            try {
+                Poco::URI uri( a_request.getURI() );
+                string param;
+                uint64_t cursor = 0;
+                size_t limit = 0;
+
+                if ( getQueryParam( uri, "cursor", param )) {
+                    cursor = stoull( param );
+                }
+
+                if ( getQueryParam( uri, "limit", param )) {
+                    limit = stoull( param );
+                    if ( !limit ) {
+                        throw runtime_error( "Invalid limit" );
+                    }
+                }
+
+                size_t remaining = limit;
+                bool first = true;
+                Queue::MsgIdList_t failed = m_queue->getFailed( cursor, limit?min( limit, FAILED_PAGE_SIZE ):FAILED_PAGE_SIZE );
+
+                a_response.setStatus( HTTPResponse::HTTP_OK );
+                a_response.setContentType( "application/json" );
+                a_response.setChunkedTransferEncoding( true );
+
+                ostream & out = a_response.send();
+
+                out << "{\"type\":\"failed\",\"ids\":[";
+
+                while ( true ) {
+                    string ids;
+
+                    for ( Queue::MsgIdList_t::iterator i = failed.begin(); i != failed.end(); i++ ) {
+                        if ( !first ){
+                            ids += ",";
+                        }
+                        appendJsonString( ids, *i );
+                        first = false;
+                    }
+
+                    out << ids;
+
+                    if ( limit ) {
+                        remaining -= failed.size();
+                    }
+
+                    if ( !cursor || ( limit && !remaining )) {
+                        break;
+                    }
 
+                    // Response already started, so errors can no longer be replied
+                    uint64_t next = cursor;
+
+                    try {
+                        failed = m_queue->getFailed( next, limit?min( remaining, FAILED_PAGE_SIZE ):FAILED_PAGE_SIZE );
+                    } catch( exception & e ) {
+                        logger( string( "Failed message listing ended early: " ) + e.what() );
+                        break;
+                    }
+
+                    cursor = next;
+                }
+
+                out << "],\"next\":" << cursor << "}";
             } catch( exception & e ) {
                 string payload = string( "{\"type\":\"error\",\"message\":\"" ) + e.what() + "\"}";
                 sendResponse( a_response, &payload, HTTPResponse::HTTP_BAD_REQUEST );
@@ -281,7 +684,7 @@ class Handler : public HTTPRequestHandler {
                     ids.push_back( i->asString() );
                 }
 
-                Queue::MsgIdList_t erased = m_queue.eraseFailed( ids );
+                Queue::MsgIdList_t erased = m_queue->eraseFailed( ids );
 
                 string payload = "{\"type\":\"erased\",\"ids\":[";
                 for ( Queue::MsgIdList_t::iterator i = erased.begin(); i != erased.end(); i++ ) {
@@ -304,6 +707,331 @@ class Handler : public HTTPRequestHandler {
         }
     }
 
+    static string msgPayload( const Queue::Msg_t & a_msg ) {
+        string payload = "{\"type\":\"msg\",\"id\":\"";
+        payload += a_msg.id;
+        payload += "\",\"tok\":\"";
+        payload += a_msg.token;
+        payload += "\"";
+
+        if ( a_msg.checkpoint.size() ) {
+            payload += ",\"chk\":";
+            appendJsonString( payload, a_msg.checkpoint );
+        }
+
+        payload += "}";
+
+        return payload;
+    }
+
+    /// Append quoted and escaped JSON string (for arbitrary producer/consumer data)
+    static void appendJsonString( string & a_buffer, const string & a_value ) {
+        static const char * hex = "0123456789abcdef";
+
+        a_buffer += "\"";
+
+        for ( string::const_iterator c = a_value.begin(); c != a_value.end(); c++ ) {
+            if ( *c == '"' || *c == '\\' ) {
+                a_buffer += '\\';
+                a_buffer += *c;
+            } else if ( (unsigned char)*c < 0x20 ) {
+                a_buffer += "\\u00";
+                a_buffer += hex[(unsigned char)*c >> 4];
+                a_buffer += hex[*c & 0xF];
+            } else {
+                a_buffer += *c;
+            }
+        }
+
+        a_buffer += "\"";
+    }
+
+    /// Parse message push entry (see PushRequest for format)
+    static void parsePushMsg( libjson::Value::Object & a_msg, Queue::PushMsg_t & a_push ) {
+        a_push.id = a_msg.getString("id");
+        a_push.priority = (uint8_t)a_msg.getNumber("pri");
+
+        if ( a_msg.has("del") ) {
+            a_push.delay = (size_t)a_msg.asNumber();
+        }
+
+        if ( a_msg.has("tmo") ) {
+            a_push.opts.ack_timeout = (size_t)a_msg.asNumber();
+        }
+
+        if ( a_msg.has("ret") ) {
+            a_push.opts.max_retries = (size_t)a_msg.asNumber();
+        }
+
+        if ( a_msg.has("cls") ) {
+            a_push.opts.msg_class = a_msg.asString();
+        }
+
+        if ( a_msg.has("due") ) {
+            a_push.opts.due = (size_t)a_msg.asNumber();
+        }
+
+        if ( a_msg.has("ttl") ) {
+            a_push.opts.ttl = (size_t)a_msg.asNumber();
+        }
+
+        if ( a_msg.has("tnt") ) {
+            a_push.opts.tenant = a_msg.asString();
+        }
+
+        if ( a_msg.has("grp") ) {
+            a_push.opts.group = a_msg.asString();
+        }
+
+        if ( a_msg.has("aff") ) {
+            a_push.opts.affinity = a_msg.asString();
+        }
+
+        if ( a_msg.has("bat") ) {
+            a_push.opts.batch = a_msg.asString();
+        }
+
+        if ( a_msg.has("dep") ) {
+            libjson::Value::Array & deps = a_msg.asArray();
+
+            for ( libjson::Value::ArrayIter d = deps.begin(); d != deps.end(); d++ ) {
+                a_push.opts.depends.push_back( d->asString() );
+            }
+        }
+    }
+
+    static bool getQueryParam( const Poco::URI & a_uri, const string & a_name, string & a_value ) {
+        Poco::URI::QueryParameters params = a_uri.getQueryParameters();
+
+        for ( Poco::URI::QueryParameters::iterator p = params.begin(); p != params.end(); p++ ) {
+            if ( p->first == a_name ) {
+                a_value = p->second;
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    /** @brief Requeue failed messages
+     *
+     * Request is POST, body is JSON object:
+     *
+     *   { ids: [<string>] | all: <bool>, pri: <uint> (optional), del: <uint> (optional), reset: <bool> (optional) }
+     *
+     * If pri is omitted, messages keep their original priority; otherwise it
+     * must be below the number of priorities. del must not be negative. Retry
+     * counts are reset unless reset is false.
+     *
+     * Response is a JSON requeued doc or JSON error document:
+     *
+     *   { type: requeued, count: <uint>, ids: [<string>] (only if ids given) }
+     */
+    void RequeueFailedRequest( HTTPServerRequest & a_request, HTTPServerResponse & a_response ) {
+        if ( a_request.getMethod() == "POST" ) {
+            libjson::Value req_json;
+
+            try {
+                string body = readBody( a_request );
+                req_json.fromString( body );
+                libjson::Value::Object & req = req_json.asObject();
+
+                uint8_t pri = Queue::KEEP_PRIORITY;
+                size_t del = 0;
+                bool reset = req.has("reset")?req.asBool():true;
+                string payload = "{\"type\":\"requeued\",\"count\":";
+
+                // Range-check before narrowing so that out-of-range values
+                // are rejected rather than wrapping (e.g. to KEEP_PRIORITY)
+                if ( req.has("pri") ) {
+                    double value = req.asNumber();
+                    if ( value < 0 || value >= Queue::KEEP_PRIORITY || value != (uint8_t)value ) {
+                        throw runtime_error( "Invalid queue priority" );
+                    }
+                    pri = (uint8_t)value;
+                }
+
+                if ( req.has("del") ) {
+                    double value = req.asNumber();
+                    if ( value < 0 ) {
+                        throw runtime_error( "Invalid delay" );
+                    }
+                    del = (size_t)value;
+                }
+
+                if ( req.has("all") && req.asBool() ) {
+                    payload += to_string( m_queue->requeueAllFailed( pri, del, reset ));
+                } else {
+                    libjson::Value::Array & req_ids = req.getArray("ids");
+                    Queue::MsgIdList_t ids;
+
+                    for ( libjson::Value::ArrayIter i = req_ids.begin(); i != req_ids.end(); i++ ) {
+                        ids.push_back( i->asString() );
+                    }
+
+                    Queue::MsgIdList_t requeued = m_queue->requeueFailed( ids, pri, del, reset );
+
+                    payload += to_string( requeued.size() );
+                    payload += ",\"ids\":[";
+                    for ( Queue::MsgIdList_t::iterator i = requeued.begin(); i != requeued.end(); i++ ) {
+                        if ( i != requeued.begin() ){
+                            payload += ",";
+                        }
+                        appendJsonString( payload, *i );
+                    }
+                    payload += "]";
+                }
+                payload += "}";
+
+                sendResponse( a_response, &payload, HTTPResponse::HTTP_OK );
+            } catch( exception & e ) {
+                string payload = string( "{\"type\":\"error\",\"message\":\"" ) + e.what() + "\"}";
+                sendResponse( a_response, &payload, HTTPResponse::HTTP_BAD_REQUEST );
+            }
+        } else {
+            sendResponse( a_response, 0, HTTPResponse::HTTP_METHOD_NOT_ALLOWED );
+        }
+    }
+
+    /** @brief List named queues
+     *
+     * Request is GET, there are no params
+     *
+     * Response is a JSON queues doc:
+     *
+     *   { type: queues, names: [<string>] }
+     */
+    void ListQueuesRequest( HTTPServerRequest & a_request, HTTPServerResponse & a_response ) {
+        if ( a_request.getMethod() == "GET" ) {
+            vector<string> names = m_server.getQueueNames();
+
+            string payload = "{\"type\":\"queues\",\"names\":[";
+            for ( vector<string>::iterator n = names.begin(); n != names.end(); n++ ) {
+                if ( n != names.begin() ) {
+                    payload += ",";
+                }
+                appendJsonString( payload, *n );
+            }
+            payload += "]}";
+
+            sendResponse( a_response, &payload, HTTPResponse::HTTP_OK );
+        } else {
+            sendResponse( a_response, 0, HTTPResponse::HTTP_METHOD_NOT_ALLOWED );
+        }
+    }
+
+    /** @brief Create a named queue
+     *
+     * Request is POST, body is JSON object:
+     *
+     *   { name: <string>, cfg: { <option>: <number|string> } (optional) }
+     *
+     * Where options are named as the mqserver command-line options (e.g.
+     * capacity, ack-timeout, priorities) and default to the server's default
+     * queue configuration. The queue is then served at /q/<name>/...
+     *
+     * Response is empty (success), or JSON error document
+     */
+    void CreateQueueRequest( HTTPServerRequest & a_request, HTTPServerResponse & a_response ) {
+        if ( a_request.getMethod() == "POST" ) {
+            libjson::Value req_json;
+
+            try {
+                string body = readBody( a_request );
+                req_json.fromString( body );
+
+                libjson::Value::Object & obj = req_json.asObject();
+                Queue::Config_t config = m_server.m_config;
+                QueueOptions_t options;
+
+                if ( obj.has( "cfg" )) {
+                    libjson::Value::Object & cfg = obj.asObject();
+
+                    for ( libjson::Value::ObjectIter o = cfg.begin(); o != cfg.end(); o++ ) {
+                        if ( o->second.isString() ) {
+                            options.emplace_back( o->first, o->second.asString() );
+                        } else {
+                            ostringstream value;
+                            value << setprecision( 17 ) << o->second.asNumber();
+                            options.emplace_back( o->first, value.str() );
+                        }
+
+                        QueueServer::setConfigOption( config, options.back().first, options.back().second );
+                    }
+                }
+
+                string name = obj.getString( "name" );
+
+                if ( name.empty() ) {
+                    throw runtime_error( "Invalid queue name" );
+                }
+
+                m_server.addQueue( name, config, options );
+
+                sendResponse( a_response, 0, HTTPResponse::HTTP_OK );
+            } catch( exception & e ) {
+                string payload = string( "{\"type\":\"error\",\"message\":\"" ) + e.what() + "\"}";
+                sendResponse( a_response, &payload, HTTPResponse::HTTP_BAD_REQUEST );
+            }
+        } else {
+            sendResponse( a_response, 0, HTTPResponse::HTTP_METHOD_NOT_ALLOWED );
+        }
+    }
+
+    /** @brief Promote standby server to primary
+     *
+     * Request is POST, there are no params. Stops replication from the
+     * primary (which should no longer be serving) and starts serving all
+     * requests from the replicated state; leases held by consumers of the
+     * primary remain valid.
+     *
+     * Response is empty (success), or JSON error document
+     */
+    void PromoteRequest( HTTPServerRequest & a_request, HTTPServerResponse & a_response ) {
+        if ( a_request.getMethod() == "POST" ) {
+            try {
+                m_server.promote();
+
+                sendResponse( a_response, 0, HTTPResponse::HTTP_OK );
+            } catch( exception & e ) {
+                string payload = string( "{\"type\":\"error\",\"message\":\"" ) + e.what() + "\"}";
+                sendResponse( a_response, &payload, HTTPResponse::HTTP_BAD_REQUEST );
+            }
+        } else {
+            sendResponse( a_response, 0, HTTPResponse::HTTP_METHOD_NOT_ALLOWED );
+        }
+    }
+
+    /** @brief Get replication status
+     *
+     * Request is GET, there are no params
+     *
+     * Response is a JSON replication doc:
+     *
+     *   { type: replication, role: primary|standby|none, connected: <bool>,
+     *     records: <number>, lag_bytes: <number> }
+     *
+     * Records is the number of records sent (primary) or applied (standby);
+     * lag is the number of bytes sent but not yet applied by the standby.
+     */
+    void ReplicationRequest( HTTPServerRequest & a_request, HTTPServerResponse & a_response ) {
+        if ( a_request.getMethod() == "GET" ) {
+            string role;
+            bool connected;
+            size_t records;
+            uint64_t lag_bytes;
+
+            m_server.getReplicationStats( role, connected, records, lag_bytes );
+
+            string payload = "{\"type\":\"replication\",\"role\":\"" + role + "\",\"connected\":" + ( connected ? "true" : "false" ) +
+                ",\"records\":" + to_string( records ) + ",\"lag_bytes\":" + to_string( lag_bytes ) + "}";
+
+            sendResponse( a_response, &payload, HTTPResponse::HTTP_OK );
+        } else {
+            sendResponse( a_response, 0, HTTPResponse::HTTP_METHOD_NOT_ALLOWED );
+        }
+    }
+
     void sendResponse( HTTPServerResponse & a_response, string * a_payload, HTTPResponse::HTTPStatus a_status ) {
         a_response.setStatus( a_status );
         a_response.setContentType("application/json");
@@ -321,60 +1049,70 @@ class Handler : public HTTPRequestHandler {
     typedef map<string,Endpoint_t> RouteMap_t;
 
     static RouteMap_t m_route_map;
+    static RouteMap_t m_admin_route_map;
 
     static void setupRouteMap() {
         if ( !m_route_map.size() ) {
             m_route_map["/ping"] = &Handler::PingRequest;
             m_route_map["/push"] = &Handler::PushRequest;
+            m_route_map["/load"] = &Handler::LoadRequest;
             m_route_map["/pop"] = &Handler::PopRequest;
+            m_route_map["/pop_batch"] = &Handler::PopBatchRequest;
             m_route_map["/ack"] = &Handler::AckRequest;
             m_route_map["/pop_ack"] = &Handler::PopAckRequest;
+            m_route_map["/touch"] = &Handler::TouchRequest;
+            m_route_map["/ack_push"] = &Handler::AckPushRequest;
             m_route_map["/count"] = &Handler::CountRequest;
+            m_route_map["/stats"] = &Handler::StatsRequest;
             m_route_map["/failed"] = &Handler::GetFailedRequest;
             m_route_map["/failed/erase"] = &Handler::EraseFailedRequest;
+            m_route_map["/failed/requeue"] = &Handler::RequeueFailedRequest;
+
+            m_admin_route_map["/queues"] = &Handler::ListQueuesRequest;
+            m_admin_route_map["/queues/create"] = &Handler::CreateQueueRequest;
+            m_admin_route_map["/promote"] = &Handler::PromoteRequest;
+            m_admin_route_map["/replication"] = &Handler::ReplicationRequest;
         }
     }
 
-    Queue & m_queue;
+    QueueServer &   m_server;
+    Queue *         m_queue;    ///< Queue addressed by current request
 };
 
 Handler::RouteMap_t Handler::m_route_map;
+Handler::RouteMap_t Handler::m_admin_route_map;
 
 class HandlerFactory : public Poco::Net::HTTPRequestHandlerFactory {
   public:
 
-    HandlerFactory( Queue & a_queue ) : m_queue( a_queue ) {
+    HandlerFactory( QueueServer & a_server ) : m_server( a_server ) {
     }
 
     Poco::Net::HTTPRequestHandler * createRequestHandler( const Poco::Net::HTTPServerRequest & request ) {
-        return new Handler( m_queue );
+        return new Handler( m_server );
     }
 
   private:
 
-    Queue &     m_queue;
+    QueueServer &   m_server;
 };
 
 
-QueueServer::QueueServer(
-    uint8_t a_priority_count,
-    size_t a_msg_capacity,
-    size_t a_msg_ack_timeout_msec,
-    size_t a_msg_max_retries,
-    size_t a_msg_boost_timeout_msec,
-    size_t a_monitor_period_msec
-) :
-    m_queue(
-        a_priority_count,
-        a_msg_capacity,
-        a_msg_ack_timeout_msec,
-        a_msg_max_retries,
-        a_msg_boost_timeout_msec,
-        a_monitor_period_msec
-    )
+/** @brief Construct server with a default queue
+ *
+ * The default queue (served at top-level routes) uses a_config, which is also
+ * the base configuration for named queues created via the admin endpoint. All
+ * queues share one timer service with a_timer_threads threads.
+ */
+QueueServer::QueueServer( const Queue::Config_t & a_config, uint16_t a_port, size_t a_timer_threads ) :
+    m_config( a_config ),
+    m_timers( a_timer_threads ),
+    m_standby( false ),
+    m_server_params( 0 ),
+    m_server( 0 )
 {
     try {
-        m_queue.setErrorCallback( &logger );
+        addQueue( "", a_config );
 
         Handler::setupRouteMap();
 
@@ -384,7 +1122,7 @@ QueueServer::QueueServer(
         m_server_params->setKeepAliveTimeout( Timespan( 5, 0 ));
         m_server_params->setMaxKeepAliveRequests( 10 );
 
-        m_server = new HTTPServer( new HandlerFactory( m_queue ), ServerSocket(8080), m_server_params );
+        m_server = new HTTPServer( new HandlerFactory( *this ), ServerSocket( a_port ), m_server_params );
     } catch ( const Poco::Exception & e ) {
         cout << "ctor exception: " << e.displayText() << endl;
         throw;
@@ -396,6 +1134,14 @@ QueueServer::QueueServer(
 
 QueueServer::~QueueServer() {
     delete m_server;
+
+    if ( m_sender ) {
+        m_sender->stop();
+    }
+
+    if ( m_receiver ) {
+        m_receiver->stop();
+    }
 }
 
 void
@@ -412,5 +1158,340 @@ void
 QueueServer::stop(){
 }
 
+/** @brief Create a named queue
+ *
+ * Names may contain letters, digits, '-', '_', and '.'. Queues exist for the
+ * life of the server. If a dead-letter file is configured, a named queue uses
+ * "<path>.<name>.dl", if an overflow tier is configured, overflow logs
+ * prefixed "<path>.<name>", if a write-ahead log is configured,
+ * "<path>.<name>.wal", and if snapshots are configured, "<path>.<name>.snap"
+ * (both recovered if present). Throws if the name is invalid or in use, if
+ * the queue limit is reached, or if the configuration is invalid. a_options
+ * are the configuration options that a_config was built with (see
+ * setConfigOption), from which a standby creates the same queue. The name is
+ * reserved while the queue is constructed (which may recover it from disk)
+ * outside the queue map lock, so that requests to other queues are not held
+ * up.
+ */
+Queue &
+QueueServer::addQueue( const std::string & a_name, const Queue::Config_t & a_config, const QueueOptions_t & a_options ) {
+    if ( a_name.size() > MAX_QUEUE_NAME ) {
+        throw runtime_error( "Invalid queue name" );
+    }
+
+    for ( string::const_iterator c = a_name.begin(); c != a_name.end(); c++ ) {
+        if ( !isalnum( (unsigned char)*c ) && *c != '-' && *c != '_' && *c != '.' ) {
+            throw runtime_error( "Invalid queue name" );
+        }
+    }
+
+    unique_lock<mutex> lock(m_queues_mutex);
+
+    if ( m_queues.find( a_name ) != m_queues.end() || m_queues_pending.count( a_name )) {
+        throw runtime_error( "Queue already exists" );
+    }
+
+    if ( m_queues.size() + m_queues_pending.size() > MAX_QUEUES ) {
+        throw length_error( "Too many queues" );
+    }
+
+    m_queues_pending.insert( a_name );
+    lock.unlock();
+
+    unique_ptr<Queue> owner;
+    Queue::Config_t config = a_config;
+
+    // Named queues spill to their own files beside the default queue's
+    if ( a_name.size() ) {
+        if ( config.dead_letter_path.size() ) {
+            config.dead_letter_path += "." + a_name + ".dl";
+        }
+
+        if ( config.overflow_path.size() ) {
+            config.overflow_path += "." + a_name;
+        }
+
+        if ( config.wal_path.size() ) {
+            config.wal_path += "." + a_name + ".wal";
+        }
+
+        if ( config.snapshot_path.size() ) {
+            config.snapshot_path += "." + a_name + ".snap";
+        }
+    }
+
+    try {
+        owner.reset( new Queue( config, &logger, &m_timers ));
+    } catch ( ... ) {
+        lock.lock();
+        m_queues_pending.erase( a_name );
+        throw;
+    }
+
+    Queue * queue = owner.get();
+
+    lock.lock();
+    m_queues_pending.erase( a_name );
+
+    if ( m_standby ) {
+        queue->setStandby( true );
+    }
+
+    if ( m_sender ) {
+        m_sender->addQueue( a_name, a_options, *queue );
+    }
+
+    m_queues[a_name] = std::move( owner );
+    m_queue_options[a_name] = a_options;
+
+    return *queue;
+}
+
+/** @brief Get queue by name (empty = default), or null if not found
+ */
+Queue *
+QueueServer::getQueue( const std::string & a_name ) {
+    lock_guard<mutex> lock(m_queues_mutex);
+
+    queue_map_t::iterator q = m_queues.find( a_name );
+
+    return q != m_queues.end() ? q->second.get() : 0;
+}
+
+/** @brief Get names of named queues (excludes default queue)
+ */
+std::vector<std::string>
+QueueServer::getQueueNames() {
+    lock_guard<mutex> lock(m_queues_mutex);
+
+    vector<string> names;
+
+    for ( queue_map_t::iterator q = m_queues.begin(); q != m_queues.end(); q++ ) {
+        if ( q->first.size() ) {
+            names.push_back( q->first );
+        }
+    }
+
+    return names;
+}
+
+/** @brief Replicate all queues (current and future) to a standby server
+ *
+ * The standby at a_host:a_port must have been started with startStandby
+ * (and the same options as this server). Throws if replication is already
+ * configured, or if a queue cannot be replicated.
+ */
+void
+QueueServer::replicateTo( const std::string & a_host, uint16_t a_port ) {
+    lock_guard<mutex> lock(m_queues_mutex);
+
+    if ( m_sender || m_standby ) {
+        throw logic_error( "Replication already configured" );
+    }
+
+    unique_ptr<ReplicationSender> sender( new ReplicationSender( a_host, a_port, &logger ));
+
+    for ( queue_map_t::iterator q = m_queues.begin(); q != m_queues.end(); q++ ) {
+        sender->addQueue( q->first, m_queue_options[q->first], *q->second );
+    }
+
+    sender->start();
+    m_sender = std::move( sender );
+}
+
+/** @brief Serve as a hot standby, receiving replication on a_address:a_port (0 = any port)
+ *
+ * All queues are put in standby mode, and queues replicated from the
+ * primary are created as needed. Until promoted, only read requests are
+ * served. The replication stream is not authenticated, so a_address should
+ * be loopback or on a trusted network. Returns the replication port.
+ */
+uint16_t
+QueueServer::startStandby( const std::string & a_address, uint16_t a_port ) {
+    lock_guard<mutex> lock(m_queues_mutex);
+
+    if ( m_sender || m_standby ) {
+        throw logic_error( "Replication already configured" );
+    }
+
+    for ( queue_map_t::iterator q = m_queues.begin(); q != m_queues.end(); q++ ) {
+        q->second->setStandby( true );
+    }
+
+    m_standby = true;
+
+    m_receiver.reset( new ReplicationReceiver( a_address, a_port, [this]( const string & a_name, const QueueOptions_t & a_options ) {
+        Queue * queue = getQueue( a_name );
+
+        if ( !queue ) {
+            Queue::Config_t config = m_config;
+
+            for ( QueueOptions_t::const_iterator o = a_options.begin(); o != a_options.end(); o++ ) {
+                setConfigOption( config, o->first, o->second );
+            }
+
+            queue = &addQueue( a_name, config, a_options );
+        }
+
+        return queue;
+    }, &logger ));
+
+    m_receiver->start();
+
+    return m_receiver->getPort();
+}
+
+/** @brief Promote standby to primary
+ *
+ * Stops receiving replication and takes over with the replicated state,
+ * including leases held by consumers of the primary. Throws logic_error if
+ * the server is not a standby.
+ */
+void
+QueueServer::promote() {
+    if ( !isStandby() ) {
+        throw logic_error( "Server is not a standby" );
+    }
+
+    // Receiver applies records under queue locks only, so stop it unlocked
+    m_receiver->stop();
+
+    lock_guard<mutex> lock(m_queues_mutex);
+
+    for ( queue_map_t::iterator q = m_queues.begin(); q != m_queues.end(); q++ ) {
+        q->second->setStandby( false );
+    }
+
+    m_standby = false;
+}
+
+bool
+QueueServer::isStandby() {
+    lock_guard<mutex> lock(m_queues_mutex);
+
+    return m_standby;
+}
+
+/** @brief Get replication role (primary, standby or none) and statistics
+ *
+ * For a primary, records sent and bytes not yet applied by the standby; for
+ * a standby (or promoted standby), records applied.
+ */
+void
+QueueServer::getReplicationStats( std::string & a_role, bool & a_connected, size_t & a_records, uint64_t & a_lag_bytes ) {
+    lock_guard<mutex> lock(m_queues_mutex);
+
+    a_connected = false;
+    a_records = 0;
+    a_lag_bytes = 0;
+
+    if ( m_sender ) {
+        a_role = "primary";
+        m_sender->getStats( a_connected, a_records, a_lag_bytes );
+    } else if ( m_receiver ) {
+        size_t syncs;
+
+        a_role = m_standby ? "standby" : "primary";
+        m_receiver->getStats( a_connected, a_records, syncs );
+    } else {
+        a_role = "none";
+    }
+}
+
+/** @brief Set queue configuration option by name
+ *
+ * Option names match the mqserver command-line options. Throws on unknown
+ * options or invalid values.
+ */
+void
+QueueServer::setConfigOption( Queue::Config_t & a_config, const std::string & a_key, const std::string & a_value ) {
+    double value;
+    size_t len = 0;
+
+    if ( a_key == "dispatch" ) {
+        if ( a_value == "strict" ) {
+            a_config.dispatch = Queue::DISPATCH_STRICT;
+        } else if ( a_value == "weighted" ) {
+            a_config.dispatch = Queue::DISPATCH_WEIGHTED;
+            a_config.weights.clear();
+        } else if ( a_value == "deadline" ) {
+            a_config.dispatch = Queue::DISPATCH_DEADLINE;
+        } else {
+            throw runtime_error( "Invalid dispatch policy" );
+        }
+        return;
+    }
+
+    try {
+        value = stod( a_value, &len );
+    } catch ( exception & e ) {
+        value = -1;
+    }
+
+    if ( len != a_value.size() || value < 0 ) {
+        throw runtime_error( string( "Invalid value for queue option " ) + a_key );
+    }
+
+    if ( a_key == "priorities" ) {
+        if ( value < 1 || value > 255 ) {
+            throw runtime_error( "Invalid number of priorities" );
+        }
+        a_config.priority_count = (uint8_t)value;
+        a_config.weights.clear();
+    } else if ( a_key == "capacity" ) {
+        a_config.capacity = (size_t)value;
+    } else if ( a_key == "ack-timeout" ) {
+        a_config.ack_timeout = (size_t)value;
+    } else if ( a_key == "max-retries" ) {
+        a_config.max_retries = (size_t)value;
+    } else if ( a_key == "boost-timeout" ) {
+        a_config.boost_timeout = (size_t)value;
+    } else if ( a_key == "boost-max-wait" ) {
+        a_config.boost_max_wait = (size_t)value;
+    } else if ( a_key == "monitor-period" ) {
+        a_config.monitor_period = (size_t)value;
+    } else if ( a_key == "hedge-quantile" ) {
+        a_config.hedge_quantile = value;
+    } else if ( a_key == "hedge-min-samples" ) {
+        a_config.hedge_min_samples = (size_t)value;
+    } else if ( a_key == "adaptive-quantile" ) {
+        a_config.adaptive_quantile = value;
+    } else if ( a_key == "adaptive-factor" ) {
+        a_config.adaptive_factor = value;
+    } else if ( a_key == "adaptive-min-timeout" ) {
+        a_config.adaptive_min_timeout = (size_t)value;
+    } else if ( a_key == "adaptive-max-timeout" ) {
+        a_config.adaptive_max_timeout = (size_t)value;
+    } else if ( a_key == "adaptive-min-samples" ) {
+        a_config.adaptive_min_samples = (size_t)value;
+    } else if ( a_key == "tenant-quota" ) {
+        a_config.tenant_quota = (size_t)value;
+    } else if ( a_key == "affinity-wait" ) {
+        a_config.affinity_wait = (size_t)value;
+    } else if ( a_key == "affinity-capacity" ) {
+        a_config.affinity_capacity = (size_t)value;
+    } else if ( a_key == "rate-burst" ) {
+        a_config.rate_burst = value;
+    } else if ( a_key == "expire-to-failed" ) {
+        a_config.expire_to_failed = value != 0;
+    } else if ( a_key == "failed-capacity" ) {
+        a_config.failed_capacity = (size_t)value;
+    } else if ( a_key == "overflow-segment-size" ) {
+        a_config.overflow_segment_size = (size_t)value;
+    } else if ( a_key == "overflow-batch" ) {
+        a_config.overflow_batch = (size_t)value;
+    } else if ( a_key == "wal-sync-interval" ) {
+        a_config.wal_sync_interval = (size_t)value;
+    } else if ( a_key == "wal-sync-bytes" ) {
+        a_config.wal_sync_bytes = (size_t)value;
+    } else if ( a_key == "snapshot-interval" ) {
+        a_config.snapshot_interval = (size_t)value;
+    } else if ( a_key == "snapshot-threads" ) {
+        a_config.snapshot_threads = (size_t)value;
+    } else {
+        throw runtime_error( string( "Unknown queue option " ) + a_key );
+    }
+}
+
 
 } // namespace MonQueue
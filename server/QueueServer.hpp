@@ -1,33 +1,58 @@
 #include <map>
+#include <set>
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
 #include <Poco/URI.h>
 #include <Poco/Net/HTTPServer.h>
 #include <Poco/Net/HTTPServerParams.h>
 #include "Queue.hpp"
+#include "Replication.hpp"
 
 namespace MonQueue {
 
 class QueueServer {
   public:
 
-    QueueServer(
-        uint8_t a_priority_count,
-        size_t a_msg_capacity,
-        size_t a_msg_ack_timeout_msec,
-        size_t a_msg_max_retries,
-        size_t a_msg_boost_timeout_msec,
-        size_t a_monitor_period_msec
-    );
+    QueueServer( const Queue::Config_t & a_config, uint16_t a_port = 8080, size_t a_timer_threads = 1 );
 
     ~QueueServer();
 
     void start();
     void stop();
 
+    Queue &                     addQueue( const std::string & a_name, const Queue::Config_t & a_config, const QueueOptions_t & a_options = QueueOptions_t() );
+    Queue *                     getQueue( const std::string & a_name );
+    std::vector<std::string>    getQueueNames();
+
+    void                        replicateTo( const std::string & a_host, uint16_t a_port );
+    uint16_t                    startStandby( const std::string & a_address, uint16_t a_port );
+    void                        promote();
+    bool                        isStandby();
+    void                        getReplicationStats( std::string & a_role, bool & a_connected, size_t & a_records, uint64_t & a_lag_bytes );
+
+    static void                 setConfigOption( Queue::Config_t & a_config, const std::string & a_key, const std::string & a_value );
+
+    static const size_t         MAX_QUEUES = 1000;      ///< Max number of named queues
+    static const size_t         MAX_QUEUE_NAME = 64;    ///< Max length of queue names
+
   private:
 
+    typedef std::map<std::string,std::unique_ptr<Queue>> queue_map_t;
+    typedef std::map<std::string,QueueOptions_t> options_map_t;
+
+    Queue::Config_t                     m_config;           ///< Default queue configuration
+    TimerService                        m_timers;           ///< Timer service shared by all queues
+    std::mutex                          m_queues_mutex;     ///< Mutex for queue map and replication state
+    queue_map_t                         m_queues;           ///< Named queues (default queue has empty name)
+    options_map_t                       m_queue_options;    ///< Options of named queues (sent to standby)
+    std::set<std::string>               m_queues_pending;   ///< Names of queues being created (reserved)
+    std::unique_ptr<ReplicationSender>  m_sender;           ///< Replication to standby (null if none; stopped before queues are destroyed)
+    std::unique_ptr<ReplicationReceiver> m_receiver;        ///< Replication from primary (null if not a standby)
+    bool                                m_standby;          ///< Serving as standby (read-only until promoted)
     Poco::Net::HTTPServerParams *       m_server_params;
     Poco::Net::HTTPServer *             m_server;
-    Queue                               m_queue;
 
     friend class HandlerFactory;
     friend class Handler;
@@ -0,0 +1,1067 @@
+#include <stdexcept>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include "Replication.hpp"
+#include "Queue.hpp"
+
+using namespace std;
+
+namespace MonQueue {
+
+// Stream layout: u32 magic, u32 version, then frames of u32 length, u8 frame
+// type and payload:
+//
+// - Queue: u32 channel, u32-prefixed name, u32 option count, then
+//   u32-prefixed name and value strings per option.
+// - Sync: u32 channel, u64 record count; the next count record frames hold
+//   the full state of the queue (replacing its current state).
+// - Record: u32 channel, u8 record type, u8 priority, u8 retries, u8 max
+//   retries, u8 flags (1 = failed, 2 = hedge), u32 ACK timeout, u64 ready,
+//   due, expiry and deadline times, u32-prefixed ID, class, tenant, group,
+//   affinity, batch, token and checkpoint strings, and a u32 count of
+//   u32-prefixed prerequisite IDs.
+//
+// The standby replies with a u64 count of stream bytes applied (cumulative)
+// after each block it reads. All integers are in host byte order.
+
+static const uint32_t STREAM_MAGIC = 0x5052514d;   // "MQRP"
+static const uint32_t STREAM_VERSION = 1;
+static const size_t STREAM_HEADER_SIZE = 8;
+static const uint8_t FRAME_QUEUE = 1;
+static const uint8_t FRAME_SYNC = 2;
+static const uint8_t FRAME_RECORD = 3;
+static const uint8_t FLAG_FAILED = 1;
+static const uint8_t FLAG_HEDGE = 2;
+static const uint32_t MAX_FRAME = 16777216;
+static const size_t CONNECT_TIMEOUT = 1000;
+
+template<typename T>
+static void
+put( std::string & a_buf, T a_value ) {
+    a_buf.append( (const char *)&a_value, sizeof( a_value ));
+}
+
+static void
+putString( std::string & a_buf, const std::string & a_value ) {
+    put<uint32_t>( a_buf, (uint32_t)a_value.size() );
+    a_buf += a_value;
+}
+
+template<typename T>
+static T
+get( const char *& a_pos, const char * a_end ) {
+    T value;
+
+    if ( a_end - a_pos < (ptrdiff_t)sizeof( value )) {
+        throw runtime_error( "Truncated replication frame" );
+    }
+
+    memcpy( &value, a_pos, sizeof( value ));
+    a_pos += sizeof( value );
+
+    return value;
+}
+
+static void
+getString( const char *& a_pos, const char * a_end, std::string & a_value ) {
+    uint32_t len = get<uint32_t>( a_pos, a_end );
+
+    if ( (uint64_t)( a_end - a_pos ) < len ) {
+        throw runtime_error( "Truncated replication frame" );
+    }
+
+    a_value.assign( a_pos, len );
+    a_pos += len;
+}
+
+static size_t
+beginFrame( std::string & a_buf, uint8_t a_type ) {
+    size_t start = a_buf.size();
+
+    put<uint32_t>( a_buf, 0 );
+    put<uint8_t>( a_buf, a_type );
+
+    return start;
+}
+
+static void
+endFrame( std::string & a_buf, size_t a_start ) {
+    uint32_t len = (uint32_t)( a_buf.size() - a_start - sizeof( uint32_t ));
+
+    memcpy( &a_buf[a_start], &len, sizeof( len ));
+}
+
+static void
+encodeRecord( std::string & a_buf, uint32_t a_channel, const WriteAheadLog::Record_t & a_record ) {
+    size_t start = beginFrame( a_buf, FRAME_RECORD );
+
+    put<uint32_t>( a_buf, a_channel );
+    put<uint8_t>( a_buf, a_record.type );
+    put<uint8_t>( a_buf, a_record.priority );
+    put<uint8_t>( a_buf, a_record.retries );
+    put<uint8_t>( a_buf, a_record.max_retries );
+    put<uint8_t>( a_buf, ( a_record.failed ? FLAG_FAILED : 0 ) | ( a_record.hedge ? FLAG_HEDGE : 0 ));
+    put<uint32_t>( a_buf, a_record.ack_timeout );
+    put<uint64_t>( a_buf, a_record.ready_ms );
+    put<uint64_t>( a_buf, a_record.due_ms );
+    put<uint64_t>( a_buf, a_record.expiry_ms );
+    put<uint64_t>( a_buf, a_record.deadline_ms );
+    putString( a_buf, a_record.id );
+    putString( a_buf, a_record.msg_class );
+    putString( a_buf, a_record.tenant );
+    putString( a_buf, a_record.group );
+    putString( a_buf, a_record.affinity );
+    putString( a_buf, a_record.batch );
+    putString( a_buf, a_record.token );
+    putString( a_buf, a_record.checkpoint );
+    put<uint32_t>( a_buf, (uint32_t)a_record.depends.size() );
+
+    for ( auto & dep : a_record.depends ) {
+        putString( a_buf, dep );
+    }
+
+    endFrame( a_buf, start );
+}
+
+static void
+decodeRecord( const char *& a_pos, const char * a_end, WriteAheadLog::Record_t & a_record ) {
+    uint8_t type = get<uint8_t>( a_pos, a_end );
+
+    if ( type < WriteAheadLog::REC_PUSH || type > WriteAheadLog::REC_TIMEOUT ) {
+        throw runtime_error( "Invalid replication record type" );
+    }
+
+    a_record.type = (WriteAheadLog::RecordType_t)type;
+    a_record.priority = get<uint8_t>( a_pos, a_end );
+    a_record.retries = get<uint8_t>( a_pos, a_end );
+    a_record.max_retries = get<uint8_t>( a_pos, a_end );
+
+    uint8_t flags = get<uint8_t>( a_pos, a_end );
+
+    a_record.failed = flags & FLAG_FAILED;
+    a_record.hedge = flags & FLAG_HEDGE;
+    a_record.ack_timeout = get<uint32_t>( a_pos, a_end );
+    a_record.ready_ms = get<uint64_t>( a_pos, a_end );
+    a_record.due_ms = get<uint64_t>( a_pos, a_end );
+    a_record.expiry_ms = get<uint64_t>( a_pos, a_end );
+    a_record.deadline_ms = get<uint64_t>( a_pos, a_end );
+    getString( a_pos, a_end, a_record.id );
+    getString( a_pos, a_end, a_record.msg_class );
+    getString( a_pos, a_end, a_record.tenant );
+    getString( a_pos, a_end, a_record.group );
+    getString( a_pos, a_end, a_record.affinity );
+    getString( a_pos, a_end, a_record.batch );
+    getString( a_pos, a_end, a_record.token );
+    getString( a_pos, a_end, a_record.checkpoint );
+
+    uint32_t count = get<uint32_t>( a_pos, a_end );
+
+    if ( count > (uint64_t)( a_end - a_pos ) / sizeof( uint32_t )) {
+        throw runtime_error( "Truncated replication frame" );
+    }
+
+    a_record.depends.resize( count );
+
+    for ( auto & dep : a_record.depends ) {
+        getString( a_pos, a_end, dep );
+    }
+}
+
+//============================================================================
+//----- ReplicationSender
+
+/** @brief Construct sender for standby at a_host:a_port
+ *
+ * Nothing is replicated until start() is called. If more than
+ * a_max_pending bytes await sending, the standby is considered too far
+ * behind and is resynced on a new connection.
+ */
+ReplicationSender::ReplicationSender( const std::string & a_host, uint16_t a_port, ErrorCB_t * a_err_cb, size_t a_max_pending ) :
+    m_host( a_host ),
+    m_port( a_port ),
+    m_err_cb( a_err_cb ),
+    m_max_pending( a_max_pending ),
+    m_fd( -1 ),
+    m_connected( false ),
+    m_run( false ),
+    m_reset( false ),
+    m_reported( false ),
+    m_pending_sync( 0 ),
+    m_stream( 0 ),
+    m_acked( 0 ),
+    m_count_records( 0 )
+{
+    if ( m_host.empty() || !m_port || !m_max_pending ) {
+        throw runtime_error( "Invalid replication settings" );
+    }
+}
+
+/** @brief Stop sender thread
+ */
+ReplicationSender::~ReplicationSender() {
+    stop();
+}
+
+/** @brief Start sender thread (connects to standby)
+ */
+void
+ReplicationSender::start() {
+    lock_guard<mutex> lock(m_mutex);
+
+    if ( !m_run ) {
+        m_run = true;
+        m_thread = thread( &ReplicationSender::senderThread, this );
+    }
+}
+
+/** @brief Stop sender thread
+ *
+ * Records already buffered are sent (if connected) before the connection is
+ * closed. Registered queues must not be destroyed before the sender is
+ * stopped.
+ */
+void
+ReplicationSender::stop() {
+    {
+        lock_guard<mutex> lock(m_mutex);
+        m_run = false;
+    }
+
+    m_cv.notify_one();
+
+    if ( m_thread.joinable() ) {
+        m_thread.join();
+    }
+}
+
+/** @brief Replicate a_queue under a_name
+ *
+ * The standby creates the queue (if needed) with a_options. The queue must
+ * outlive the sender thread. Throws logic_error if the queue cannot be
+ * replicated (see Queue::setReplication).
+ */
+void
+ReplicationSender::addQueue( const std::string & a_name, const QueueOptions_t & a_options, Queue & a_queue ) {
+    uint32_t channel;
+
+    {
+        lock_guard<mutex> lock(m_mutex);
+
+        channel = (uint32_t)m_channels.size();
+        m_channels.emplace_back( a_name, a_options, nullptr );
+    }
+
+    a_queue.setReplication( this, channel );
+
+    {
+        lock_guard<mutex> lock(m_mutex);
+
+        // Synced by sender thread if already connected
+        m_channels[channel].queue = &a_queue;
+    }
+
+    m_cv.notify_one();
+}
+
+/** @brief Buffer record of a transition of a queue
+ *
+ * Must be called with the queue lock held, so that records of a queue are
+ * buffered in order. Records for a queue not yet synced on the current
+ * connection are dropped (its sync will reflect them).
+ */
+void
+ReplicationSender::append( uint32_t a_channel, const Record_t & a_record ) {
+    lock_guard<mutex> lock(m_mutex);
+
+    if ( !m_channels[a_channel].synced ) {
+        return;
+    }
+
+    bool wake = m_pending.empty();
+    size_t size = m_pending.size();
+
+    encodeRecord( m_pending, a_channel, a_record );
+    m_stream += m_pending.size() - size;
+    m_count_records++;
+
+    if ( m_pending.size() - m_pending_sync > m_max_pending ) {
+        m_reset = true;
+        m_pending.clear();
+        m_pending_sync = 0;
+
+        for ( auto & ch : m_channels ) {
+            ch.synced = false;
+        }
+
+        wake = true;
+    }
+
+    if ( wake ) {
+        m_cv.notify_one();
+    }
+}
+
+/** @brief Buffer full state of a queue
+ *
+ * Called by Queue::syncReplica with the queue lock held. Subsequent records
+ * of the queue are buffered after its state. The state does not count
+ * against the pending byte limit.
+ */
+void
+ReplicationSender::sync( uint32_t a_channel, const std::vector<Record_t> & a_state ) {
+    lock_guard<mutex> lock(m_mutex);
+
+    if ( !m_connected || m_reset ) {
+        return;
+    }
+
+    Channel_t & ch = m_channels[a_channel];
+    size_t size = m_pending.size();
+    size_t start = beginFrame( m_pending, FRAME_QUEUE );
+
+    put<uint32_t>( m_pending, a_channel );
+    putString( m_pending, ch.name );
+    put<uint32_t>( m_pending, (uint32_t)ch.options.size() );
+
+    for ( auto & opt : ch.options ) {
+        putString( m_pending, opt.first );
+        putString( m_pending, opt.second );
+    }
+
+    endFrame( m_pending, start );
+
+    start = beginFrame( m_pending, FRAME_SYNC );
+    put<uint32_t>( m_pending, a_channel );
+    put<uint64_t>( m_pending, a_state.size() );
+    endFrame( m_pending, start );
+
+    for ( auto & rec : a_state ) {
+        encodeRecord( m_pending, a_channel, rec );
+    }
+
+    m_stream += m_pending.size() - size;
+    m_pending_sync += m_pending.size() - size;
+    ch.synced = true;
+
+    m_cv.notify_one();
+}
+
+/** @brief Get connection state, records replicated, and bytes not yet applied by standby
+ */
+void
+ReplicationSender::getStats( bool & a_connected, size_t & a_records, uint64_t & a_lag_bytes ) const {
+    lock_guard<mutex> lock(m_mutex);
+
+    a_connected = m_connected;
+    a_records = m_count_records;
+    a_lag_bytes = m_connected ? m_stream - m_acked : 0;
+}
+
+/** @brief Connect to standby
+ *
+ * Returns the connected socket. Throws runtime_error if the standby cannot
+ * be reached within the connect timeout.
+ */
+int
+ReplicationSender::connectStandby() {
+    struct addrinfo hints, * res;
+    string port = to_string( m_port );
+    string error = "no address";
+
+    memset( &hints, 0, sizeof( hints ));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+
+    int rc = getaddrinfo( m_host.c_str(), port.c_str(), &hints, &res );
+
+    if ( rc ) {
+        throw runtime_error( "Failed to resolve standby " + m_host + ": " + gai_strerror( rc ));
+    }
+
+    int fd = -1;
+
+    for ( struct addrinfo * ai = res; ai; ai = ai->ai_next ) {
+        fd = socket( ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC | SOCK_NONBLOCK, ai->ai_protocol );
+
+        if ( fd < 0 ) {
+            error = strerror( errno );
+            continue;
+        }
+
+        if ( connect( fd, ai->ai_addr, ai->ai_addrlen ) < 0 && errno == EINPROGRESS ) {
+            struct pollfd pfd = { fd, POLLOUT, 0 };
+            int err = ETIMEDOUT;
+            socklen_t len = sizeof( err );
+
+            if ( poll( &pfd, 1, CONNECT_TIMEOUT ) > 0 ) {
+                getsockopt( fd, SOL_SOCKET, SO_ERROR, &err, &len );
+            }
+
+            errno = err;
+        }
+
+        if ( errno == 0 || errno == EISCONN ) {
+            break;
+        }
+
+        error = strerror( errno );
+        close( fd );
+        fd = -1;
+    }
+
+    freeaddrinfo( res );
+
+    if ( fd < 0 ) {
+        throw runtime_error( "Failed to connect to standby " + m_host + ":" + port + ": " + error );
+    }
+
+    // Sends block (with a timeout to check for stop); acks are read non-blocking
+    int one = 1;
+    struct timeval tv = { 0, (suseconds_t)ACK_POLL_INTERVAL * 1000 };
+
+    fcntl( fd, F_SETFL, fcntl( fd, F_GETFL ) & ~O_NONBLOCK );
+    setsockopt( fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof( one ));
+    setsockopt( fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof( tv ));
+
+    return fd;
+}
+
+/** @brief Close connection and drop buffered records (reporting a_error)
+ *
+ * Lock must be held before calling.
+ */
+void
+ReplicationSender::disconnect( const std::string & a_error ) {
+    if ( m_fd >= 0 ) {
+        close( m_fd );
+        m_fd = -1;
+    }
+
+    m_connected = false;
+    m_reset = false;
+    m_pending.clear();
+    m_pending_sync = 0;
+
+    for ( auto & ch : m_channels ) {
+        ch.synced = false;
+    }
+
+    if ( m_err_cb && !a_error.empty() ) {
+        (*m_err_cb)( a_error );
+    }
+}
+
+/** @brief Send a_buf to standby
+ *
+ * Throws runtime_error if the connection fails, or if the sender is stopped
+ * or reset while the standby is not reading.
+ */
+void
+ReplicationSender::sendAll( const std::string & a_buf ) {
+    const char * pos = a_buf.data(), * end = pos + a_buf.size();
+    ssize_t wr;
+
+    while ( pos < end ) {
+        wr = ::send( m_fd, pos, end - pos, MSG_NOSIGNAL );
+
+        if ( wr < 0 ) {
+            if ( errno == EINTR ) {
+                continue;
+            }
+
+            if ( errno == EAGAIN || errno == EWOULDBLOCK ) {
+                readAcks();
+
+                lock_guard<mutex> lock(m_mutex);
+
+                if ( !m_run || m_reset ) {
+                    throw runtime_error( "Replication to standby stalled" );
+                }
+                continue;
+            }
+
+            throw runtime_error( string( "Failed to send to standby: " ) + strerror( errno ));
+        }
+
+        pos += wr;
+    }
+}
+
+/** @brief Read any acknowledgements received from standby
+ *
+ * Throws runtime_error if the connection was closed.
+ */
+void
+ReplicationSender::readAcks() {
+    char buf[4096];
+    ssize_t rd;
+
+    while (( rd = recv( m_fd, buf, sizeof( buf ), MSG_DONTWAIT )) != 0 ) {
+        if ( rd < 0 ) {
+            if ( errno == EINTR ) {
+                continue;
+            }
+            if ( errno == EAGAIN || errno == EWOULDBLOCK ) {
+                break;
+            }
+            throw runtime_error( string( "Failed to read from standby: " ) + strerror( errno ));
+        }
+
+        m_ack_buf.append( buf, rd );
+    }
+
+    if ( m_ack_buf.size() >= sizeof( uint64_t )) {
+        size_t last = m_ack_buf.size() / sizeof( uint64_t ) * sizeof( uint64_t );
+        uint64_t acked;
+
+        memcpy( &acked, &m_ack_buf[last - sizeof( uint64_t )], sizeof( acked ));
+        m_ack_buf.erase( 0, last );
+
+        lock_guard<mutex> lock(m_mutex);
+        m_acked = acked;
+    }
+
+    if ( rd == 0 ) {
+        throw runtime_error( "Standby closed replication connection" );
+    }
+}
+
+/** @brief Connection and send loop
+ *
+ * While disconnected, retries the connection every reconnect interval. Once
+ * connected, syncs every registered queue, then repeatedly sends everything
+ * buffered since the previous send. Appends continue into a fresh buffer
+ * while a send is in progress.
+ */
+void
+ReplicationSender::senderThread() {
+    unique_lock<mutex> lock(m_mutex);
+
+    while ( true ) {
+        if ( !m_connected ) {
+            if ( !m_run ) {
+                break;
+            }
+
+            int fd = -1;
+
+            lock.unlock();
+
+            try {
+                fd = connectStandby();
+            } catch ( const exception & e ) {
+                // Reported once per outage
+                if ( m_err_cb && !m_reported ) {
+                    (*m_err_cb)( e.what() );
+                }
+                m_reported = true;
+            }
+
+            lock.lock();
+
+            if ( fd < 0 ) {
+                if ( m_run ) {
+                    m_cv.wait_for( lock, std::chrono::milliseconds( RECONNECT_INTERVAL ));
+                }
+                continue;
+            }
+
+            m_fd = fd;
+            m_connected = true;
+            m_reset = false;
+            m_reported = false;
+            m_ack_buf.clear();
+            m_pending.clear();
+            m_pending_sync = 0;
+
+            put<uint32_t>( m_pending, STREAM_MAGIC );
+            put<uint32_t>( m_pending, STREAM_VERSION );
+            m_stream = m_pending.size();
+            m_acked = 0;
+        }
+
+        // Sync registered queues not yet synced on this connection
+        vector<Queue*> unsynced;
+
+        for ( auto & ch : m_channels ) {
+            if ( ch.queue && !ch.synced ) {
+                unsynced.push_back( ch.queue );
+            }
+        }
+
+        if ( unsynced.size() && !m_reset ) {
+            lock.unlock();
+
+            for ( auto q : unsynced ) {
+                q->syncReplica();
+            }
+
+            lock.lock();
+        }
+
+        if ( m_reset ) {
+            disconnect( "Standby fell too far behind; resyncing" );
+            continue;
+        }
+
+        if ( m_run && m_pending.empty() ) {
+            m_cv.wait_for( lock, std::chrono::milliseconds( ACK_POLL_INTERVAL ));
+        }
+
+        m_writing.swap( m_pending );
+        m_pending_sync = 0;
+
+        lock.unlock();
+
+        string error;
+
+        try {
+            if ( m_writing.size() ) {
+                sendAll( m_writing );
+            }
+            readAcks();
+        } catch ( const exception & e ) {
+            error = e.what();
+        }
+
+        m_writing.clear();
+
+        lock.lock();
+
+        if ( error.size() ) {
+            disconnect( error );
+        } else if ( !m_run && m_pending.empty() ) {
+            disconnect( string() );
+        }
+    }
+}
+
+//============================================================================
+//----- ReplicationReceiver
+
+/** @brief Listen for primary on a_address:a_port (0 = any free port)
+ *
+ * a_address is a local host name or address ("::" for all interfaces).
+ * a_get_queue returns the queue to apply records for a queue name to (and
+ * may throw to reject it). Throws runtime_error if the address cannot be
+ * bound.
+ */
+ReplicationReceiver::ReplicationReceiver( const std::string & a_address, uint16_t a_port, const QueueFactory_t & a_get_queue, ErrorCB_t * a_err_cb ) :
+    m_get_queue( a_get_queue ),
+    m_err_cb( a_err_cb ),
+    m_fd( -1 ),
+    m_run( false ),
+    m_connected( false ),
+    m_header( false ),
+    m_received( 0 ),
+    m_batch_channel( 0 ),
+    m_sync_channel( 0 ),
+    m_sync_remaining( 0 ),
+    m_count_records( 0 ),
+    m_count_syncs( 0 )
+{
+    struct addrinfo hints, * res;
+    string port = to_string( a_port );
+
+    memset( &hints, 0, sizeof( hints ));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE;
+
+    int rc = getaddrinfo( a_address.c_str(), port.c_str(), &hints, &res );
+
+    if ( rc ) {
+        throw runtime_error( "Failed to resolve replication address " + a_address + ": " + gai_strerror( rc ));
+    }
+
+    struct sockaddr_storage addr;
+    socklen_t len = sizeof( addr );
+    int one = 1, zero = 0;
+
+    m_listen_fd = socket( res->ai_family, res->ai_socktype | SOCK_CLOEXEC, res->ai_protocol );
+
+    if ( m_listen_fd >= 0 ) {
+        setsockopt( m_listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof( one ));
+
+        // "::" also accepts IPv4 connections
+        if ( res->ai_family == AF_INET6 ) {
+            setsockopt( m_listen_fd, IPPROTO_IPV6, IPV6_V6ONLY, &zero, sizeof( zero ));
+        }
+    }
+
+    if ( m_listen_fd < 0 || ::bind( m_listen_fd, res->ai_addr, res->ai_addrlen ) < 0 || listen( m_listen_fd, 1 ) < 0 ||
+            getsockname( m_listen_fd, (struct sockaddr *)&addr, &len ) < 0 ) {
+        string error = strerror( errno );
+
+        if ( m_listen_fd >= 0 ) {
+            close( m_listen_fd );
+        }
+        freeaddrinfo( res );
+        throw runtime_error( "Failed to listen on replication address " + a_address + ":" + port + ": " + error );
+    }
+
+    freeaddrinfo( res );
+
+    m_port = ntohs( addr.ss_family == AF_INET6 ? ((struct sockaddr_in6 *)&addr)->sin6_port : ((struct sockaddr_in *)&addr)->sin_port );
+}
+
+/** @brief Stop receiver thread and close listening socket
+ */
+ReplicationReceiver::~ReplicationReceiver() {
+    stop();
+    close( m_listen_fd );
+}
+
+/** @brief Start receiver thread (accepts connections from primary)
+ */
+void
+ReplicationReceiver::start() {
+    lock_guard<mutex> lock(m_mutex);
+
+    if ( !m_run ) {
+        m_run = true;
+        m_thread = thread( &ReplicationReceiver::receiverThread, this );
+    }
+}
+
+/** @brief Stop receiver thread and close connection from primary
+ *
+ * Records received but not yet applied (e.g. a partial sync) are discarded.
+ */
+void
+ReplicationReceiver::stop() {
+    {
+        lock_guard<mutex> lock(m_mutex);
+        m_run = false;
+    }
+
+    if ( m_thread.joinable() ) {
+        m_thread.join();
+    }
+}
+
+/** @brief Get bound replication port
+ */
+uint16_t
+ReplicationReceiver::getPort() const {
+    return m_port;
+}
+
+/** @brief Get connection state, records applied, and full state syncs applied
+ */
+void
+ReplicationReceiver::getStats( bool & a_connected, size_t & a_records, size_t & a_syncs ) const {
+    lock_guard<mutex> lock(m_mutex);
+
+    a_connected = m_connected;
+    a_records = m_count_records;
+    a_syncs = m_count_syncs;
+}
+
+/** @brief Accept pending connection from primary
+ *
+ * Rejected (and reported) if a primary is already connected.
+ */
+void
+ReplicationReceiver::acceptConnection() {
+    struct sockaddr_storage addr;
+    socklen_t len = sizeof( addr );
+    int fd = accept4( m_listen_fd, (struct sockaddr *)&addr, &len, SOCK_CLOEXEC );
+
+    if ( fd < 0 ) {
+        return;
+    }
+
+    if ( m_fd >= 0 ) {
+        char host[NI_MAXHOST];
+
+        if ( getnameinfo( (struct sockaddr *)&addr, len, host, sizeof( host ), nullptr, 0, NI_NUMERICHOST )) {
+            strcpy( host, "unknown address" );
+        }
+
+        close( fd );
+
+        if ( m_err_cb ) {
+            (*m_err_cb)( string( "Rejected replication connection from " ) + host + ": primary already connected" );
+        }
+        return;
+    }
+
+    int one = 1, idle = KEEPALIVE_IDLE, count = KEEPALIVE_COUNT;
+
+    setsockopt( fd, SOL_SOCKET, SO_KEEPALIVE, &one, sizeof( one ));
+    setsockopt( fd, IPPROTO_TCP, TCP_KEEPIDLE, &idle, sizeof( idle ));
+    setsockopt( fd, IPPROTO_TCP, TCP_KEEPINTVL, &one, sizeof( one ));
+    setsockopt( fd, IPPROTO_TCP, TCP_KEEPCNT, &count, sizeof( count ));
+
+    m_fd = fd;
+
+    lock_guard<mutex> lock(m_mutex);
+    m_connected = true;
+}
+
+/** @brief Close connection from primary and discard partial state
+ */
+void
+ReplicationReceiver::closeConnection() {
+    if ( m_fd >= 0 ) {
+        close( m_fd );
+        m_fd = -1;
+    }
+
+    m_header = false;
+    m_received = 0;
+    m_ack_out.clear();
+    m_channels.clear();
+    m_batch.clear();
+    m_sync.clear();
+    m_sync_remaining = 0;
+
+    lock_guard<mutex> lock(m_mutex);
+    m_connected = false;
+}
+
+/** @brief Parse and apply complete frames in [a_pos, a_end)
+ *
+ * Returns the number of bytes consumed; a trailing partial frame is left
+ * for the next call. Throws runtime_error on an invalid stream.
+ */
+size_t
+ReplicationReceiver::processFrames( const char * a_pos, const char * a_end ) {
+    const char * start = a_pos;
+
+    if ( !m_header ) {
+        if ( (size_t)( a_end - a_pos ) < STREAM_HEADER_SIZE ) {
+            return 0;
+        }
+
+        if ( get<uint32_t>( a_pos, a_end ) != STREAM_MAGIC || get<uint32_t>( a_pos, a_end ) != STREAM_VERSION ) {
+            throw runtime_error( "Invalid replication stream header" );
+        }
+
+        m_header = true;
+    }
+
+    while ( a_end - a_pos >= (ptrdiff_t)sizeof( uint32_t )) {
+        uint32_t len;
+
+        memcpy( &len, a_pos, sizeof( len ));
+
+        if ( len == 0 || len > MAX_FRAME ) {
+            throw runtime_error( "Invalid replication frame length" );
+        }
+
+        if ( (uint64_t)( a_end - a_pos ) < sizeof( len ) + len ) {
+            break;
+        }
+
+        const char * pos = a_pos + sizeof( len ), * end = pos + len;
+        uint8_t type = get<uint8_t>( pos, end );
+        uint32_t channel = get<uint32_t>( pos, end );
+
+        if ( type == FRAME_QUEUE ) {
+            string name;
+            QueueOptions_t options;
+
+            getString( pos, end, name );
+
+            uint32_t count = get<uint32_t>( pos, end );
+
+            for ( uint32_t i = 0; i < count; i++ ) {
+                options.emplace_back();
+                getString( pos, end, options.back().first );
+                getString( pos, end, options.back().second );
+            }
+
+            if ( channel >= m_channels.size() ) {
+                m_channels.resize( channel + 1, nullptr );
+            }
+
+            m_channels[channel] = m_get_queue( name, options );
+        } else {
+            if ( channel >= m_channels.size() || !m_channels[channel] ) {
+                throw runtime_error( "Unknown replication channel" );
+            }
+
+            if ( type == FRAME_SYNC ) {
+                // Preceding records apply to the state being replaced
+                applyBatch();
+
+                m_sync.clear();
+                m_sync_channel = channel;
+                m_sync_remaining = get<uint64_t>( pos, end );
+
+                if ( !m_sync_remaining ) {
+                    applySync();
+                }
+            } else if ( type == FRAME_RECORD ) {
+                if ( m_sync_remaining ) {
+                    if ( channel != m_sync_channel ) {
+                        throw runtime_error( "Replication record interleaved with sync" );
+                    }
+
+                    m_sync.emplace_back();
+                    decodeRecord( pos, end, m_sync.back() );
+
+                    if ( --m_sync_remaining == 0 ) {
+                        applySync();
+                    }
+                } else {
+                    if ( m_batch.size() && channel != m_batch_channel ) {
+                        applyBatch();
+                    }
+
+                    m_batch_channel = channel;
+                    m_batch.emplace_back();
+                    decodeRecord( pos, end, m_batch.back() );
+                }
+            } else {
+                throw runtime_error( "Invalid replication frame type" );
+            }
+        }
+
+        a_pos += sizeof( len ) + len;
+    }
+
+    return a_pos - start;
+}
+
+/** @brief Apply records awaiting apply to their queue
+ */
+void
+ReplicationReceiver::applyBatch() {
+    if ( m_batch.empty() ) {
+        return;
+    }
+
+    m_channels[m_batch_channel]->applyReplica( m_batch );
+
+    size_t count = m_batch.size();
+
+    m_batch.clear();
+
+    lock_guard<mutex> lock(m_mutex);
+    m_count_records += count;
+}
+
+/** @brief Replace state of queue being synced with the records received
+ */
+void
+ReplicationReceiver::applySync() {
+    m_channels[m_sync_channel]->applyReplicaSync( m_sync );
+    m_sync.clear();
+
+    lock_guard<mutex> lock(m_mutex);
+    m_count_syncs++;
+}
+
+/** @brief Send as much of the unsent acknowledgement bytes as the socket takes
+ */
+void
+ReplicationReceiver::sendAck() {
+    ssize_t wr = send( m_fd, m_ack_out.data(), m_ack_out.size(), MSG_DONTWAIT | MSG_NOSIGNAL );
+
+    if ( wr > 0 ) {
+        m_ack_out.erase( 0, wr );
+    }
+}
+
+/** @brief Accept and receive loop
+ *
+ * Reads the stream in large blocks and applies each block's records before
+ * acknowledging the bytes consumed. A connection with an invalid stream is
+ * closed.
+ */
+void
+ReplicationReceiver::receiverThread() {
+    string buf;
+
+    while ( true ) {
+        {
+            lock_guard<mutex> lock(m_mutex);
+
+            if ( !m_run ) {
+                break;
+            }
+        }
+
+        struct pollfd pfds[2] = {{ m_listen_fd, POLLIN, 0 }, { m_fd, (short)( POLLIN | ( m_ack_out.size() ? POLLOUT : 0 )), 0 }};
+
+        if ( poll( pfds, m_fd >= 0 ? 2 : 1, POLL_INTERVAL ) <= 0 ) {
+            continue;
+        }
+
+        if ( pfds[0].revents & POLLIN ) {
+            acceptConnection();
+            continue;
+        }
+
+        if ( m_fd < 0 ) {
+            continue;
+        }
+
+        if ( pfds[1].revents & POLLOUT ) {
+            sendAck();
+        }
+
+        if ( !( pfds[1].revents & ( POLLIN | POLLHUP | POLLERR ))) {
+            continue;
+        }
+
+        size_t size = buf.size();
+
+        buf.resize( size + READ_BLOCK );
+
+        ssize_t rd = recv( m_fd, &buf[size], READ_BLOCK, 0 );
+
+        if ( rd <= 0 ) {
+            if ( rd < 0 && errno == EINTR ) {
+                buf.resize( size );
+                continue;
+            }
+
+            if ( rd < 0 && m_err_cb ) {
+                (*m_err_cb)( string( "Failed to read replication stream: " ) + strerror( errno ));
+            }
+
+            closeConnection();
+            buf.clear();
+            continue;
+        }
+
+        buf.resize( size + rd );
+
+        try {
+            size_t used = processFrames( buf.data(), buf.data() + buf.size() );
+
+            applyBatch();
+            buf.erase( 0, used );
+            m_received += used;
+        } catch ( const exception & e ) {
+            if ( m_err_cb ) {
+                (*m_err_cb)( e.what() );
+            }
+
+            closeConnection();
+            buf.clear();
+            continue;
+        }
+
+        // Cumulative, so an acknowledgement not yet started is replaced by the
+        // latest; only the rest of a partially sent one must go out first
+        m_ack_out.resize( m_ack_out.size() % sizeof( m_received ));
+        m_ack_out.append( (const char *)&m_received, sizeof( m_received ));
+        sendAck();
+    }
+
+    closeConnection();
+}
+
+} // MonQueue namespace
@@ -0,0 +1,166 @@
+#ifndef REPLICATION_HPP
+#define REPLICATION_HPP
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include "WriteAheadLog.hpp"
+
+namespace MonQueue {
+
+class Queue;
+
+typedef std::vector<std::pair<std::string,std::string>> QueueOptions_t;   ///< Queue configuration options (name, value)
+
+/** @brief Streams queue state transitions to a hot standby server (primary side)
+ *
+ * Queues registered with addQueue() append a record for each state
+ * transition (see Queue::setReplication) while holding their own lock;
+ * append() only encodes the record into a memory buffer, so replication
+ * never blocks queue operations on the network. A sender thread writes the
+ * buffer to the standby and keeps writing whatever accumulated meanwhile,
+ * without waiting for the standby to apply earlier records, so records are
+ * batched under load and the stream is pipelined. The standby acknowledges
+ * the bytes it has applied, which gives the replication lag.
+ *
+ * On each (re)connection, the full state of every queue is sent first (see
+ * Queue::syncReplica), followed by its transitions. If the standby cannot
+ * be reached, or falls more than the pending byte limit behind, the
+ * connection is dropped and retried; nothing is buffered while disconnected.
+ * Queue state buffered by a sync is not counted against the limit, so a
+ * queue larger than the limit can still be synced.
+ * The public methods are thread-safe.
+ */
+class ReplicationSender {
+public:
+    typedef WriteAheadLog::Record_t Record_t;               ///< Replicated record type
+    typedef void (ErrorCB_t)( const std::string & msg );    ///< Error callback type
+
+    ReplicationSender( const std::string & a_host, uint16_t a_port, ErrorCB_t * a_err_cb = 0, size_t a_max_pending = DEFAULT_MAX_PENDING );
+    ~ReplicationSender();
+
+    void            start();
+    void            stop();
+    void            addQueue( const std::string & a_name, const QueueOptions_t & a_options, Queue & a_queue );
+    void            append( uint32_t a_channel, const Record_t & a_record );
+    void            sync( uint32_t a_channel, const std::vector<Record_t> & a_state );
+    void            getStats( bool & a_connected, size_t & a_records, uint64_t & a_lag_bytes ) const;
+
+    static const size_t     DEFAULT_MAX_PENDING = 256 << 20;///< Default max bytes awaiting send
+
+private:
+    /// Registered queue
+    struct Channel_t {
+        Channel_t( const std::string & a_name, const QueueOptions_t & a_options, Queue * a_queue ) :
+            name( a_name ), options( a_options ), queue( a_queue ), synced( false ) {}
+
+        std::string             name;       ///< Queue name
+        QueueOptions_t          options;    ///< Queue configuration options
+        Queue                 * queue;      ///< Queue
+        bool                    synced;     ///< Full state sent on current connection
+    };
+
+    static const size_t     RECONNECT_INTERVAL = 1000;  ///< Msec between connection attempts
+    static const size_t     ACK_POLL_INTERVAL = 100;    ///< Max msec between reads of standby acknowledgements
+
+    int             connectStandby();
+    void            disconnect( const std::string & a_error );
+    void            sendAll( const std::string & a_buf );
+    void            readAcks();
+    void            senderThread();
+
+    std::string                 m_host;         ///< Standby host
+    uint16_t                    m_port;         ///< Standby replication port
+    ErrorCB_t                 * m_err_cb;       ///< Error callback function ptr
+    size_t                      m_max_pending;  ///< Max bytes awaiting send before the connection is reset
+    int                         m_fd;           ///< Connection socket (sender thread)
+    bool                        m_connected;    ///< Connected to standby
+    bool                        m_run;          ///< Run/stop flag for sender thread
+    bool                        m_reset;        ///< Standby fell behind; reconnect and resync
+    bool                        m_reported;     ///< Connection failure reported (until next connection)
+    std::vector<Channel_t>      m_channels;     ///< Registered queues by channel number
+    std::string                 m_pending;      ///< Encoded frames awaiting send
+    size_t                      m_pending_sync; ///< Bytes of m_pending holding synced queue state
+    std::string                 m_writing;      ///< Frames being sent by sender thread
+    std::string                 m_ack_buf;      ///< Partial acknowledgement frame (sender thread)
+    uint64_t                    m_stream;       ///< Bytes appended to stream on current connection
+    uint64_t                    m_acked;        ///< Bytes applied by standby on current connection
+    size_t                      m_count_records;///< Records replicated
+    mutable std::mutex          m_mutex;        ///< Mutex for buffers, channels and counters
+    std::condition_variable     m_cv;           ///< Sender thread wake-up cond var
+    std::thread                 m_thread;       ///< Sender thread
+};
+
+/** @brief Receives and applies a replication stream (standby side)
+ *
+ * Listens for a connection from the primary and applies the records it
+ * receives to the standby's queues, which are looked up (or created) by name
+ * through a factory callback and are expected to be in standby mode (see
+ * Queue::setStandby). Consecutive records for a queue are applied as one
+ * batch under a single lock acquisition. Each connection begins with a full
+ * state sync. stop() closes the connection, after which the queues hold the
+ * state last received and the standby can be promoted.
+ *
+ * The stream is not authenticated, so the receiver binds to loopback unless
+ * given the address of a trusted network. Connections made while the
+ * primary is connected are rejected rather than replacing its stream; TCP
+ * keepalive closes the connection of a primary whose host went down, so
+ * that a restarted primary can reconnect.
+ */
+class ReplicationReceiver {
+public:
+    typedef WriteAheadLog::Record_t Record_t;               ///< Replicated record type
+    typedef void (ErrorCB_t)( const std::string & msg );    ///< Error callback type
+    typedef std::function<Queue * ( const std::string & a_name, const QueueOptions_t & a_options )> QueueFactory_t; ///< Queue lookup type
+
+    ReplicationReceiver( const std::string & a_address, uint16_t a_port, const QueueFactory_t & a_get_queue, ErrorCB_t * a_err_cb = 0 );
+    ~ReplicationReceiver();
+
+    void            start();
+    void            stop();
+    uint16_t        getPort() const;
+    void            getStats( bool & a_connected, size_t & a_records, size_t & a_syncs ) const;
+
+private:
+    static const size_t     READ_BLOCK = 1048576;   ///< Bytes read from connection per call
+    static const size_t     POLL_INTERVAL = 100;    ///< Max msec between checks of the run flag
+    static const int        KEEPALIVE_IDLE = 5;     ///< Sec idle before probing the primary
+    static const int        KEEPALIVE_COUNT = 3;    ///< Unanswered probes (1 sec apart) before the connection is closed
+
+    void            acceptConnection();
+    void            closeConnection();
+    size_t          processFrames( const char * a_pos, const char * a_end );
+    void            applyBatch();
+    void            applySync();
+    void            sendAck();
+    void            receiverThread();
+
+    QueueFactory_t              m_get_queue;    ///< Queue lookup
+    ErrorCB_t                 * m_err_cb;       ///< Error callback function ptr
+    int                         m_listen_fd;    ///< Listening socket
+    int                         m_fd;           ///< Connection socket (-1 if none)
+    uint16_t                    m_port;         ///< Bound port
+    bool                        m_run;          ///< Run/stop flag for receiver thread
+    bool                        m_connected;    ///< Connected to primary
+    bool                        m_header;       ///< Stream header received on current connection
+    uint64_t                    m_received;     ///< Bytes applied on current connection
+    std::string                 m_ack_out;      ///< Acknowledgement bytes not yet sent (at most one partial and one whole)
+    std::vector<Queue*>         m_channels;     ///< Queues by channel number
+    std::vector<Record_t>       m_batch;        ///< Records awaiting apply
+    uint32_t                    m_batch_channel;///< Channel of records awaiting apply
+    std::vector<Record_t>       m_sync;         ///< State records of sync in progress
+    uint32_t                    m_sync_channel; ///< Channel of sync in progress
+    uint64_t                    m_sync_remaining;///< State records still to receive for sync in progress
+    size_t                      m_count_records;///< Records applied
+    size_t                      m_count_syncs;  ///< Full state syncs applied
+    mutable std::mutex          m_mutex;        ///< Mutex for run flag and counters
+    std::thread                 m_thread;       ///< Receiver thread
+};
+
+} // MonQueue namespace
+
+#endif
@@ -0,0 +1,389 @@
+#include <stdexcept>
+#include <algorithm>
+#include <thread>
+#include <atomic>
+#include <system_error>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "SnapshotFile.hpp"
+
+using namespace std;
+
+namespace MonQueue {
+
+// File layout: u32 magic, u32 version, u64 log epoch, u64 log offset, u64
+// creation time, u64 record count, u64 index offset, then the chunks, then
+// the index (u64 offset, u32 size, u32 checksum per chunk).
+//
+// Record layout: u8 priority, u8 flags (1 = failed), u8 retries, u8 max
+// retries, u32 ACK timeout, u64 ready, due and expiry times, u32-prefixed ID,
+// class, tenant, group, affinity and batch strings, and a u32 count of
+// u32-prefixed prerequisite IDs (host byte order).
+
+static const size_t WRITE_CHUNK = 1048576;
+static const uint8_t FLAG_FAILED = 1;
+
+template<typename T>
+static void
+put( std::string & a_buf, T a_value ) {
+    a_buf.append( (const char *)&a_value, sizeof( a_value ));
+}
+
+static void
+putString( std::string & a_buf, const std::string & a_value ) {
+    put<uint32_t>( a_buf, (uint32_t)a_value.size() );
+    a_buf += a_value;
+}
+
+template<typename T>
+static bool
+get( const char *& a_pos, const char * a_end, T & a_value ) {
+    if ( a_end - a_pos < (ptrdiff_t)sizeof( a_value )) {
+        return false;
+    }
+
+    memcpy( &a_value, a_pos, sizeof( a_value ));
+    a_pos += sizeof( a_value );
+
+    return true;
+}
+
+static bool
+getString( const char *& a_pos, const char * a_end, std::string & a_value ) {
+    uint32_t len;
+
+    if ( !get( a_pos, a_end, len ) || (uint64_t)( a_end - a_pos ) < len ) {
+        return false;
+    }
+
+    a_value.assign( a_pos, len );
+    a_pos += len;
+
+    return true;
+}
+
+static uint32_t
+checksum( const char * a_data, size_t a_len ) {
+    uint32_t hash = 2166136261u;
+
+    for ( size_t i = 0; i < a_len; i++ ) {
+        hash = ( hash ^ (uint8_t)a_data[i] ) * 16777619u;
+    }
+
+    return hash;
+}
+
+static void
+writeAll( int a_fd, const std::string & a_buf ) {
+    const char * pos = a_buf.data(), * end = pos + a_buf.size();
+    ssize_t wr;
+
+    while ( pos < end ) {
+        wr = ::write( a_fd, pos, end - pos );
+
+        if ( wr < 0 ) {
+            if ( errno == EINTR ) {
+                continue;
+            }
+            throw runtime_error( string( "Failed to write snapshot: " ) + strerror( errno ));
+        }
+
+        pos += wr;
+    }
+}
+
+// Sync the directory containing a_path so a rename within it is durable
+static void
+syncDir( const std::string & a_path ) {
+    size_t slash = a_path.find_last_of( '/' );
+    string dir = slash == string::npos ? string( "." ) : slash == 0 ? string( "/" ) : a_path.substr( 0, slash );
+    int fd = open( dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC );
+
+    if ( fd < 0 || fsync( fd ) < 0 ) {
+        int err = errno;
+
+        if ( fd >= 0 ) {
+            close( fd );
+        }
+        throw runtime_error( string( "Failed to sync snapshot directory: " ) + strerror( err ));
+    }
+
+    close( fd );
+}
+
+/** @brief Write snapshot of a_records to a_path
+ *
+ * The record count in a_header is set from a_records. The previous snapshot
+ * (if any) is replaced only once the new one is complete and synced, and the
+ * containing directory is synced after the rename so the replacement itself
+ * survives a crash. Throws on I/O errors.
+ */
+void
+SnapshotFile::write( const std::string & a_path, Header_t & a_header, const std::vector<Record_t> & a_records ) {
+    string tmp_path = a_path + ".tmp";
+    int fd = open( tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644 );
+
+    if ( fd < 0 ) {
+        throw runtime_error( string( "Failed to create snapshot: " ) + strerror( errno ));
+    }
+
+    a_header.count = a_records.size();
+
+    try {
+        string buf, index;
+        uint64_t written = 0;
+        size_t start;
+
+        // Header is written last, once the index offset is known
+        buf.assign( FILE_HEADER_SIZE, '\0' );
+
+        for ( size_t c = 0; c < a_records.size(); c += CHUNK_RECORDS ) {
+            start = buf.size();
+
+            for ( size_t r = c; r < min( c + CHUNK_RECORDS, a_records.size() ); r++ ) {
+                encode( buf, a_records[r] );
+            }
+
+            if ( buf.size() - start > UINT32_MAX ) {
+                throw length_error( "Snapshot chunk too large" );
+            }
+
+            put<uint64_t>( index, written + start );
+            put<uint32_t>( index, (uint32_t)( buf.size() - start ));
+            put<uint32_t>( index, checksum( buf.data() + start, buf.size() - start ));
+
+            if ( buf.size() >= WRITE_CHUNK ) {
+                writeAll( fd, buf );
+                written += buf.size();
+                buf.clear();
+            }
+        }
+
+        uint64_t index_offset = written + buf.size();
+
+        buf += index;
+        writeAll( fd, buf );
+        buf.clear();
+
+        put<uint32_t>( buf, FILE_MAGIC );
+        put<uint32_t>( buf, FILE_VERSION );
+        put<uint64_t>( buf, a_header.wal_epoch );
+        put<uint64_t>( buf, a_header.wal_offset );
+        put<uint64_t>( buf, a_header.created_ms );
+        put<uint64_t>( buf, a_header.count );
+        put<uint64_t>( buf, index_offset );
+
+        if ( pwrite( fd, buf.data(), buf.size(), 0 ) != (ssize_t)buf.size() ) {
+            throw runtime_error( string( "Failed to write snapshot: " ) + strerror( errno ));
+        }
+
+        if ( fdatasync( fd ) < 0 || rename( tmp_path.c_str(), a_path.c_str() ) < 0 ) {
+            throw runtime_error( string( "Failed to replace snapshot: " ) + strerror( errno ));
+        }
+    } catch ( ... ) {
+        close( fd );
+        unlink( tmp_path.c_str() );
+        throw;
+    }
+
+    close( fd );
+    syncDir( a_path );
+}
+
+/** @brief Load snapshot from a_path using up to a_threads decoding threads
+ *
+ * Returns false if there is no snapshot. Throws runtime_error on I/O errors
+ * or if the snapshot is corrupt.
+ */
+bool
+SnapshotFile::load( const std::string & a_path, size_t a_threads, Header_t & a_header, std::vector<Record_t> & a_records ) {
+    int fd = open( a_path.c_str(), O_RDONLY | O_CLOEXEC );
+
+    if ( fd < 0 ) {
+        if ( errno == ENOENT ) {
+            return false;
+        }
+        throw runtime_error( string( "Failed to open snapshot: " ) + strerror( errno ));
+    }
+
+    struct stat st;
+    void * map = MAP_FAILED;
+
+    if ( fstat( fd, &st ) == 0 && st.st_size >= (off_t)FILE_HEADER_SIZE ) {
+        map = mmap( 0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+    }
+
+    close( fd );
+
+    if ( map == MAP_FAILED ) {
+        throw runtime_error( "Failed to map snapshot" );
+    }
+
+    madvise( map, st.st_size, MADV_WILLNEED );
+
+    const char * data = (const char *)map, * pos = data, * end = data + st.st_size;
+    uint32_t magic = 0, version = 0;
+    uint64_t index_offset = 0, chunks;
+    bool valid;
+
+    get( pos, end, magic );
+    get( pos, end, version );
+    get( pos, end, a_header.wal_epoch );
+    get( pos, end, a_header.wal_offset );
+    get( pos, end, a_header.created_ms );
+    get( pos, end, a_header.count );
+    get( pos, end, index_offset );
+
+    chunks = ( a_header.count + CHUNK_RECORDS - 1 ) / CHUNK_RECORDS;
+    valid = magic == FILE_MAGIC && version == FILE_VERSION && index_offset >= FILE_HEADER_SIZE &&
+        index_offset <= (uint64_t)st.st_size && ( st.st_size - index_offset ) / INDEX_ENTRY_SIZE == chunks &&
+        ( st.st_size - index_offset ) % INDEX_ENTRY_SIZE == 0;
+
+    if ( valid ) {
+        a_records.clear();
+
+        try {
+            a_records.resize( a_header.count );
+
+            // Each thread decodes every n-th chunk into its slots
+            size_t count = max<size_t>( 1, min<size_t>( a_threads, chunks ));
+            vector<thread> threads;
+            atomic<bool> ok( true );
+
+            auto worker = [&]( size_t a_first ) {
+                for ( size_t c = a_first; c < chunks && ok; c += count ) {
+                    if ( !decodeChunk( data, index_offset, data + index_offset + c * INDEX_ENTRY_SIZE, &a_records[c * CHUNK_RECORDS],
+                        min<uint64_t>( CHUNK_RECORDS, a_header.count - c * CHUNK_RECORDS ))) {
+                        ok = false;
+                    }
+                }
+            };
+
+            size_t started = 1;
+
+            for ( ; started < count; started++ ) {
+                try {
+                    threads.push_back( thread( worker, started ));
+                } catch ( const system_error & ) {
+                    break;
+                }
+            }
+
+            // Shares of threads that could not be started are decoded here
+            for ( size_t t = started; t < count; t++ ) {
+                worker( t );
+            }
+
+            worker( 0 );
+
+            for ( vector<thread>::iterator t = threads.begin(); t != threads.end(); t++ ) {
+                t->join();
+            }
+
+            valid = ok;
+        } catch ( ... ) {
+            munmap( map, st.st_size );
+            throw;
+        }
+    }
+
+    munmap( map, st.st_size );
+
+    if ( !valid ) {
+        a_records.clear();
+        throw runtime_error( "Corrupt snapshot file" );
+    }
+
+    return true;
+}
+
+/** @brief Append encoded record to a_buf
+ */
+void
+SnapshotFile::encode( std::string & a_buf, const Record_t & a_record ) {
+    put<uint8_t>( a_buf, a_record.priority );
+    put<uint8_t>( a_buf, a_record.failed ? FLAG_FAILED : 0 );
+    put<uint8_t>( a_buf, a_record.retries );
+    put<uint8_t>( a_buf, a_record.max_retries );
+    put<uint32_t>( a_buf, a_record.ack_timeout );
+    put<uint64_t>( a_buf, a_record.ready_ms );
+    put<uint64_t>( a_buf, a_record.due_ms );
+    put<uint64_t>( a_buf, a_record.expiry_ms );
+    putString( a_buf, a_record.id );
+    putString( a_buf, a_record.msg_class );
+    putString( a_buf, a_record.tenant );
+    putString( a_buf, a_record.group );
+    putString( a_buf, a_record.affinity );
+    putString( a_buf, a_record.batch );
+    put<uint32_t>( a_buf, (uint32_t)a_record.depends.size() );
+
+    for ( vector<string>::const_iterator d = a_record.depends.begin(); d != a_record.depends.end(); d++ ) {
+        putString( a_buf, *d );
+    }
+}
+
+/** @brief Decode record at a_pos; returns false if malformed
+ */
+bool
+SnapshotFile::decode( const char *& a_pos, const char * a_end, Record_t & a_record ) {
+    uint8_t flags;
+    uint32_t count;
+
+    if ( !get( a_pos, a_end, a_record.priority ) || !get( a_pos, a_end, flags ) ||
+        !get( a_pos, a_end, a_record.retries ) || !get( a_pos, a_end, a_record.max_retries ) ||
+        !get( a_pos, a_end, a_record.ack_timeout ) || !get( a_pos, a_end, a_record.ready_ms ) ||
+        !get( a_pos, a_end, a_record.due_ms ) || !get( a_pos, a_end, a_record.expiry_ms ) ||
+        !getString( a_pos, a_end, a_record.id ) || !getString( a_pos, a_end, a_record.msg_class ) ||
+        !getString( a_pos, a_end, a_record.tenant ) || !getString( a_pos, a_end, a_record.group ) ||
+        !getString( a_pos, a_end, a_record.affinity ) || !getString( a_pos, a_end, a_record.batch ) ||
+        !get( a_pos, a_end, count ) || (uint64_t)( a_end - a_pos ) < count * sizeof( uint32_t )) {
+        return false;
+    }
+
+    a_record.failed = flags & FLAG_FAILED;
+    a_record.depends.resize( count );
+
+    for ( vector<string>::iterator d = a_record.depends.begin(); d != a_record.depends.end(); d++ ) {
+        if ( !getString( a_pos, a_end, *d )) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/** @brief Verify and decode the chunk described by index entry a_index
+ *
+ * Chunks must lie within the first a_size bytes of a_data and hold exactly
+ * a_count records.
+ */
+bool
+SnapshotFile::decodeChunk( const char * a_data, size_t a_size, const char * a_index, Record_t * a_records, size_t a_count ) {
+    const char * idx_end = a_index + INDEX_ENTRY_SIZE;
+    uint64_t offset;
+    uint32_t size, chk;
+
+    get( a_index, idx_end, offset );
+    get( a_index, idx_end, size );
+    get( a_index, idx_end, chk );
+
+    if ( offset < FILE_HEADER_SIZE || offset > a_size || a_size - offset < size || checksum( a_data + offset, size ) != chk ) {
+        return false;
+    }
+
+    const char * pos = a_data + offset, * end = pos + size;
+
+    for ( size_t r = 0; r < a_count; r++ ) {
+        if ( !decode( pos, end, a_records[r] )) {
+            return false;
+        }
+    }
+
+    return pos == end;
+}
+
+} // MonQueue namespace
@@ -0,0 +1,53 @@
+#ifndef SNAPSHOTFILE_HPP
+#define SNAPSHOTFILE_HPP
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "WriteAheadLog.hpp"
+
+namespace MonQueue {
+
+/** @brief Compact binary snapshot of queue state
+ *
+ * A snapshot holds one state record per message (see
+ * WriteAheadLog::recover), in queue order, plus the write-ahead log position
+ * it reflects. Records are encoded in chunks of a fixed number of records,
+ * and a chunk index (offset, size and checksum of each chunk) is written
+ * after the last chunk, so that load() can memory-map the file and decode
+ * chunks on several threads directly into their slots of the result. A
+ * snapshot is written to a temporary file, synced, and renamed over the
+ * previous one, so the file at the path is always complete.
+ */
+class SnapshotFile {
+public:
+    typedef WriteAheadLog::Record_t Record_t;  ///< State record type
+
+    /// @brief Snapshot header
+    struct Header_t {
+        Header_t() : wal_epoch( 0 ), wal_offset( 0 ), created_ms( 0 ), count( 0 ) {}
+
+        uint64_t        wal_epoch;      ///< Write-ahead log epoch (0 = no log)
+        uint64_t        wal_offset;     ///< Write-ahead log position reflected
+        uint64_t        created_ms;     ///< Capture time (msec since epoch)
+        uint64_t        count;          ///< Number of records
+    };
+
+    static void     write( const std::string & a_path, Header_t & a_header, const std::vector<Record_t> & a_records );
+    static bool     load( const std::string & a_path, size_t a_threads, Header_t & a_header, std::vector<Record_t> & a_records );
+
+private:
+    static const size_t     CHUNK_RECORDS = 16384;  ///< Records per chunk
+    static const size_t     FILE_HEADER_SIZE = 48;  ///< Magic, version and header fields
+    static const size_t     INDEX_ENTRY_SIZE = 16;  ///< Chunk offset, size and checksum
+    static const uint32_t   FILE_MAGIC = 0x5353514d;///< File header magic ("MQSS")
+    static const uint32_t   FILE_VERSION = 1;       ///< File format version
+
+    static void     encode( std::string & a_buf, const Record_t & a_record );
+    static bool     decode( const char *& a_pos, const char * a_end, Record_t & a_record );
+    static bool     decodeChunk( const char * a_data, size_t a_size, const char * a_index, Record_t * a_records, size_t a_count );
+};
+
+} // MonQueue namespace
+
+#endif
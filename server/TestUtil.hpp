@@ -0,0 +1,56 @@
+#ifndef TESTUTIL_HPP
+#define TESTUTIL_HPP
+
+#include <iostream>
+#include <string>
+#include <cstdlib>
+#include <sys/stat.h>
+#include "Queue.hpp"
+
+// Helpers shared by the queue unit tests. Each test is a single translation
+// unit, so the error counter has internal linkage rather than a source file.
+
+static size_t errors = 0;   ///< Number of messages reported via logger
+
+/// Queue logger callback; prints the message and counts it in errors
+inline void logger( const std::string & a_msg ) {
+    std::cerr << "[QUEUE] " << a_msg << "\n";
+    errors++;
+}
+
+/// Aborts the test with a message if a_cond is false
+inline void check( bool a_cond, const char * a_msg ) {
+    if ( !a_cond ) {
+        std::cerr << "Check failed: " << a_msg << std::endl;
+        abort();
+    }
+}
+
+/// Base queue configuration used by tests (two priorities)
+inline MonQueue::Queue::Config_t testConfig( size_t a_capacity, size_t a_monitor_period = 10 ) {
+    MonQueue::Queue::Config_t config;
+
+    config.priority_count = 2;
+    config.capacity = a_capacity;
+    config.monitor_period = a_monitor_period;
+
+    return config;
+}
+
+/// Pops (blocking) and acknowledges a message, returning its ID
+inline std::string popAck( MonQueue::Queue & a_queue ) {
+    MonQueue::Queue::Msg_t m = a_queue.pop();
+
+    a_queue.ack( m.id, m.token );
+
+    return m.id;
+}
+
+/// Returns the size of a file, or 0 if it does not exist
+inline size_t fileSize( const std::string & a_path ) {
+    struct stat st;
+
+    return stat( a_path.c_str(), &st ) == 0 ? st.st_size : 0;
+}
+
+#endif
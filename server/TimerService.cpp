@@ -0,0 +1,178 @@
+#include <stdexcept>
+#include "TimerService.hpp"
+
+using namespace std;
+
+namespace MonQueue {
+
+TimerService::TimerService( size_t a_thread_count ) :
+    m_run( true ),
+    m_thread_count( a_thread_count ),
+    m_next_id( 1 )
+{
+    if ( !a_thread_count ) {
+        throw runtime_error( "Invalid timer thread count" );
+    }
+
+    for ( size_t i = 0; i < a_thread_count; i++ ) {
+        m_threads.push_back( thread( &TimerService::workerThread, this ));
+    }
+}
+
+TimerService::~TimerService() {
+    {
+        lock_guard<mutex> lock(m_mutex);
+        m_run = false;
+    }
+
+    m_cv.notify_all();
+
+    for ( vector<thread>::iterator t = m_threads.begin(); t != m_threads.end(); t++ ) {
+        t->join();
+    }
+}
+
+/** @brief Register a task to first run at a_run_ts
+ *
+ * Returns a handle used to wake or remove the task.
+ */
+TimerService::TaskId_t
+TimerService::addTask( const Task_t & a_task, const timestamp_t & a_run_ts ) {
+    lock_guard<mutex> lock(m_mutex);
+
+    TaskId_t id = m_next_id++;
+    TaskEntry_t & entry = m_tasks.emplace( id, TaskEntry_t( a_task, timestamp_t::max() )).first->second;
+
+    schedule( id, entry, a_run_ts );
+
+    return id;
+}
+
+/** @brief Run task no later than a_run_ts
+ *
+ * Has no effect if the task is already scheduled to run earlier. If the task
+ * is currently running, the wake time is applied when it completes.
+ */
+void
+TimerService::wakeTask( TaskId_t a_id, const timestamp_t & a_run_ts ) {
+    lock_guard<mutex> lock(m_mutex);
+
+    task_map_t::iterator t = m_tasks.find( a_id );
+
+    if ( t == m_tasks.end() ) {
+        throw runtime_error( "Invalid timer task ID" );
+    }
+
+    if ( t->second.running ) {
+        if ( a_run_ts < t->second.wake_ts ) {
+            t->second.wake_ts = a_run_ts;
+        }
+    } else if ( a_run_ts < t->second.run_ts ) {
+        schedule( a_id, t->second, a_run_ts );
+    }
+}
+
+/** @brief Unregister task, waiting for a running invocation to complete
+ */
+void
+TimerService::removeTask( TaskId_t a_id ) {
+    unique_lock<mutex> lock(m_mutex);
+
+    task_map_t::iterator t = m_tasks.find( a_id );
+
+    if ( t == m_tasks.end() ) {
+        throw runtime_error( "Invalid timer task ID" );
+    }
+
+    while ( t->second.running ) {
+        m_done_cv.wait( lock );
+    }
+
+    m_schedule.erase( make_pair( t->second.run_ts, a_id ));
+    m_tasks.erase( t );
+}
+
+size_t
+TimerService::getTaskCount() const {
+    lock_guard<mutex> lock(m_mutex);
+
+    return m_tasks.size();
+}
+
+/** @brief Place idle task in schedule at a_run_ts
+ */
+void
+TimerService::schedule( TaskId_t a_id, TaskEntry_t & a_entry, const timestamp_t & a_run_ts ) {
+    // Lock must be held before calling
+
+    m_schedule.erase( make_pair( a_entry.run_ts, a_id ));
+    a_entry.run_ts = a_run_ts;
+
+    if ( a_run_ts != timestamp_t::max() ) {
+        bool first = m_schedule.empty() || a_run_ts < m_schedule.begin()->first;
+
+        m_schedule.insert( make_pair( a_run_ts, a_id ));
+
+        if ( first ) {
+            m_cv.notify_one();
+        }
+    }
+}
+
+void
+TimerService::workerThread() {
+    unique_lock<mutex> lock(m_mutex);
+    timestamp_t now, next;
+    task_map_t::iterator t;
+    TaskId_t id;
+
+    while ( m_run ) {
+        if ( m_schedule.empty() ) {
+            m_cv.wait( lock );
+            continue;
+        }
+
+        now = std::chrono::system_clock::now();
+
+        if ( m_schedule.begin()->first > now ) {
+            next = m_schedule.begin()->first;
+            m_cv.wait_until( lock, next );
+            continue;
+        }
+
+        id = m_schedule.begin()->second;
+        m_schedule.erase( m_schedule.begin() );
+
+        t = m_tasks.find( id );
+        t->second.run_ts = timestamp_t::max();
+        t->second.wake_ts = timestamp_t::max();
+        t->second.running = true;
+
+        // Another task may be due before this one completes
+        if ( m_schedule.size() && m_thread_count > 1 ) {
+            m_cv.notify_one();
+        }
+
+        Task_t & task = t->second.task;
+
+        lock.unlock();
+
+        try {
+            next = task( now );
+        } catch ( ... ) {
+            next = now + std::chrono::seconds( 1 );
+        }
+
+        lock.lock();
+
+        // Task entry is not removed while running
+        t = m_tasks.find( id );
+        t->second.running = false;
+
+        schedule( id, t->second, t->second.wake_ts < next ? t->second.wake_ts : next );
+
+        m_done_cv.notify_all();
+    }
+}
+
+} // MonQueue namespace
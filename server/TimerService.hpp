@@ -0,0 +1,76 @@
+#ifndef TIMERSERVICE_HPP
+#define TIMERSERVICE_HPP
+
+#include <cstdint>
+#include <map>
+#include <set>
+#include <vector>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+namespace MonQueue {
+
+/** @brief Shared timer thread pool for periodic and on-demand tasks
+ *
+ * The TimerService runs registered tasks on a small, fixed set of threads so
+ * that many queues can share monitoring and delay processing rather than
+ * each running dedicated threads. A task is a callback that receives the
+ * current time and returns the time at which it should next run (or
+ * timestamp_t::max() to sleep until woken). A task never runs concurrently
+ * with itself. Tasks may be woken early (e.g. when a shorter delay is
+ * scheduled), and removal waits for a running invocation to finish so that
+ * task owners can safely be destroyed afterwards.
+ *
+ * Tasks must not call removeTask on themselves. Callers of wakeTask may hold
+ * their own locks, so tasks are always invoked without the service lock held.
+ * The TimerService class is fully thread-safe.
+ */
+class TimerService {
+public:
+    typedef std::chrono::time_point<std::chrono::system_clock> timestamp_t;
+    typedef std::function<timestamp_t ( const timestamp_t & )> Task_t;  ///< Task callback; returns next run time
+    typedef uint64_t TaskId_t;                                          ///< Task handle type
+
+    TimerService( size_t a_thread_count = 1 );
+    ~TimerService();
+
+    TaskId_t        addTask( const Task_t & a_task, const timestamp_t & a_run_ts );
+    void            wakeTask( TaskId_t a_id, const timestamp_t & a_run_ts );
+    void            removeTask( TaskId_t a_id );
+    size_t          getTaskCount() const;
+
+private:
+    /// Registered task state
+    struct TaskEntry_t {
+        TaskEntry_t( const Task_t & a_task, const timestamp_t & a_run_ts ) :
+            task( a_task ), run_ts( a_run_ts ), wake_ts( timestamp_t::max() ), running( false ) {}
+
+        Task_t          task;       ///< Task callback
+        timestamp_t     run_ts;     ///< Scheduled run time (key in schedule while idle)
+        timestamp_t     wake_ts;    ///< Earliest wake requested while running
+        bool            running;    ///< True while callback is executing
+    };
+
+    typedef std::map<TaskId_t,TaskEntry_t>              task_map_t;
+    typedef std::set<std::pair<timestamp_t,TaskId_t>>   schedule_t;
+
+    void            schedule( TaskId_t a_id, TaskEntry_t & a_entry, const timestamp_t & a_run_ts );
+    void            workerThread();
+
+    bool                        m_run;          ///< Run/stop flag for worker threads
+    size_t                      m_thread_count; ///< Number of worker threads
+    TaskId_t                    m_next_id;      ///< Next task ID
+    task_map_t                  m_tasks;        ///< Registered tasks by ID
+    schedule_t                  m_schedule;     ///< Idle tasks ordered by run time
+    mutable std::mutex          m_mutex;        ///< Mutex for task structures
+    std::condition_variable     m_cv;           ///< Worker wake-up cond var
+    std::condition_variable     m_done_cv;      ///< Signaled when a task invocation completes
+    std::vector<std::thread>    m_threads;      ///< Worker threads
+};
+
+} // MonQueue namespace
+
+#endif
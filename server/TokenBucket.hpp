@@ -0,0 +1,72 @@
+#ifndef TOKENBUCKET_HPP
+#define TOKENBUCKET_HPP
+
+#include <chrono>
+
+namespace MonQueue {
+
+/** @brief Token bucket rate limiter
+ *
+ * Tokens accrue continuously at the configured rate (per second) up to the
+ * burst size, and each admitted event removes one token. Refill is computed
+ * lazily from the elapsed time when the bucket is checked, so an idle bucket
+ * costs nothing. A bucket with a zero rate is unlimited. Not thread-safe.
+ */
+class TokenBucket {
+public:
+    typedef std::chrono::time_point<std::chrono::system_clock> timestamp_t;
+
+    TokenBucket( double a_rate = 0, double a_burst = 1 ) :
+        m_rate( a_rate ), m_burst( a_burst < 1 ? 1 : a_burst ), m_tokens( m_burst ) {}
+
+    /// Returns true if bucket limits rate
+    bool limited() const {
+        return m_rate > 0;
+    }
+
+    /// Refill bucket to a_now and return true if a token is available
+    bool ready( const timestamp_t & a_now ) {
+        if ( m_rate <= 0 ) {
+            return true;
+        }
+
+        if ( a_now > m_ts ) {
+            m_tokens += std::chrono::duration<double>( a_now - m_ts ).count() * m_rate;
+            if ( m_tokens > m_burst ) {
+                m_tokens = m_burst;
+            }
+            m_ts = a_now;
+        }
+
+        return m_tokens >= 1 - EPSILON;
+    }
+
+    /// Remove a token (after ready returned true)
+    void take() {
+        if ( m_rate > 0 ) {
+            m_tokens -= 1;
+        }
+    }
+
+    /// Time at which next token will be available (as of last refill)
+    timestamp_t readyTime() const {
+        if ( m_rate <= 0 || m_tokens >= 1 - EPSILON ) {
+            return m_ts;
+        }
+
+        return m_ts + std::chrono::duration_cast<timestamp_t::duration>(
+            std::chrono::duration<double>(( 1 - m_tokens ) / m_rate ));
+    }
+
+private:
+    static constexpr double EPSILON = 1e-6;  ///< Tolerance for refill rounding
+
+    double          m_rate;     ///< Tokens per second (0 = unlimited)
+    double          m_burst;    ///< Max tokens
+    double          m_tokens;   ///< Available tokens as of m_ts
+    timestamp_t     m_ts;       ///< Time of last refill
+};
+
+} // MonQueue namespace
+
+#endif
@@ -0,0 +1,765 @@
+#include <stdexcept>
+#include <cstring>
+#include <cerrno>
+#include <algorithm>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "WriteAheadLog.hpp"
+
+using namespace std;
+
+namespace MonQueue {
+
+// File layout: u32 magic, u32 version, u64 epoch, u64 logical offset of first
+// record, then records.
+//
+// Record layout: u32 payload length, u32 payload checksum (FNV-1a), then the
+// payload: u8 type, u16-prefixed ID, and for push records u8 priority, u64
+// ready, due and expiry times, u32 ACK timeout, u8 max retries, u16-prefixed
+// class, tenant, group, affinity and batch strings, and a u16 count of
+// u16-prefixed prerequisite IDs; for requeue records u8 priority and u64
+// ready time (host byte order).
+
+template<typename T>
+static void
+put( std::string & a_buf, T a_value ) {
+    a_buf.append( (const char *)&a_value, sizeof( a_value ));
+}
+
+static void
+putString( std::string & a_buf, const std::string & a_value ) {
+    put<uint16_t>( a_buf, (uint16_t)a_value.size() );
+    a_buf += a_value;
+}
+
+template<typename T>
+static bool
+get( const char *& a_pos, const char * a_end, T & a_value ) {
+    if ( a_end - a_pos < (ptrdiff_t)sizeof( a_value )) {
+        return false;
+    }
+
+    memcpy( &a_value, a_pos, sizeof( a_value ));
+    a_pos += sizeof( a_value );
+
+    return true;
+}
+
+static bool
+getString( const char *& a_pos, const char * a_end, std::string & a_value ) {
+    uint16_t len;
+
+    if ( !get( a_pos, a_end, len ) || a_end - a_pos < len ) {
+        return false;
+    }
+
+    a_value.assign( a_pos, len );
+    a_pos += len;
+
+    return true;
+}
+
+static uint32_t
+checksum( const char * a_data, size_t a_len ) {
+    uint32_t hash = 2166136261u;
+
+    for ( size_t i = 0; i < a_len; i++ ) {
+        hash = ( hash ^ (uint8_t)a_data[i] ) * 16777619u;
+    }
+
+    return hash;
+}
+
+/** @brief Open (or create) log at a_path
+ *
+ * The log must be recovered before records are appended, and records
+ * appended before start() are buffered. Throws if the file cannot be opened.
+ */
+WriteAheadLog::WriteAheadLog( const std::string & a_path, size_t a_sync_interval_msec, size_t a_sync_bytes, ErrorCB_t * a_err_cb, size_t a_max_pending ) :
+    m_path( a_path ),
+    m_sync_interval( a_sync_interval_msec ),
+    m_sync_bytes( a_sync_bytes ),
+    m_err_cb( a_err_cb ),
+    m_max_pending( a_max_pending ),
+    m_epoch( 0 ),
+    m_base( 0 ),
+    m_written( 0 ),
+    m_end( 0 ),
+    m_truncate( 0 ),
+    m_run( false ),
+    m_failing( false ),
+    m_count_records( 0 ),
+    m_count_syncs( 0 )
+{
+    if ( !m_sync_interval || !m_sync_bytes || !m_max_pending ) {
+        throw runtime_error( "Invalid WAL sync settings" );
+    }
+
+    m_fd = openLog( m_path, 0 );
+}
+
+/** @brief Stop flusher, writing and syncing any buffered records
+ */
+WriteAheadLog::~WriteAheadLog() {
+    if ( m_thread.joinable() ) {
+        {
+            lock_guard<mutex> lock(m_mutex);
+            m_run = false;
+        }
+
+        m_cv.notify_one();
+        m_thread.join();
+    }
+
+    close( m_fd );
+}
+
+/** @brief Read log and return records describing messages still queued
+ *
+ * Returns a push record for each message not yet removed, in push order
+ * (reflecting its latest requeue and failure). The log is then atomically
+ * replaced by these records, starting a new epoch. Must be called before
+ * start() (unless the log is recovered from a snapshot). Throws on I/O
+ * errors or if the file is not a log.
+ */
+std::vector<WriteAheadLog::Record_t>
+WriteAheadLog::recover() {
+    vector<Record_t> state;
+    state_index_t index;
+    uint64_t epoch, base;
+
+    if ( readHeader( epoch, base )) {
+        readRecords( FILE_HEADER_SIZE, [&]( Record_t & a_rec, uint64_t ) { applyRecord( state, index, a_rec ); } );
+    } else {
+        epoch = 0;
+    }
+
+    index.clear();
+    state.erase( remove_if( state.begin(), state.end(), []( const Record_t & a_rec ) { return a_rec.id.empty(); } ), state.end() );
+
+    // Replace log with compacted state
+    string tmp_path = m_path + ".tmp";
+    int fd = openLog( tmp_path, O_TRUNC );
+    string buf;
+
+    try {
+        writeHeader( fd, epoch + 1, 0 );
+
+        for ( vector<Record_t>::iterator r = state.begin(); r != state.end(); r++ ) {
+            encode( buf, *r );
+
+            if ( r->failed ) {
+                Record_t fail( REC_FAIL );
+
+                fail.id = r->id;
+                encode( buf, fail );
+            }
+
+            if ( buf.size() >= READ_CHUNK ) {
+                writeAll( fd, buf );
+                buf.clear();
+            }
+        }
+
+        writeAll( fd, buf );
+
+        if ( fdatasync( fd ) < 0 || rename( tmp_path.c_str(), m_path.c_str() ) < 0 ) {
+            throw runtime_error( string( "Failed to replace WAL: " ) + strerror( errno ));
+        }
+    } catch ( ... ) {
+        close( fd );
+        throw;
+    }
+
+    close( m_fd );
+
+    struct stat st;
+
+    m_fd = fd;
+    m_epoch = epoch + 1;
+    m_base = 0;
+    m_end = fstat( m_fd, &st ) == 0 ? st.st_size - FILE_HEADER_SIZE : 0;
+    m_written = m_end;
+
+    return state;
+}
+
+/** @brief Apply records logged after a snapshot to the snapshot's state
+ *
+ * The a_state records (as returned by recover()) describe the queue at
+ * position a_offset of epoch a_epoch. Records logged after that position are
+ * applied to a_state, and the log is kept as is (a torn tail is truncated).
+ * An empty log adopts the snapshot's position. Returns false, leaving
+ * a_state unchanged, if the log does not cover the position (e.g. it was
+ * compacted since); recover() must then be used instead. Must be called
+ * before start(). Throws on I/O errors or if the file is not a log.
+ */
+bool
+WriteAheadLog::recover( std::vector<Record_t> & a_state, uint64_t a_epoch, uint64_t a_offset ) {
+    vector<Record_t> tail;
+    uint64_t epoch, base, start, end;
+
+    if ( !readHeader( epoch, base )) {
+        if ( ftruncate( m_fd, 0 ) < 0 ) {
+            throw runtime_error( string( "Failed to write WAL: " ) + strerror( errno ));
+        }
+
+        writeHeader( m_fd, a_epoch, a_offset );
+
+        m_epoch = a_epoch;
+        m_base = m_written = m_end = a_offset;
+
+        return true;
+    }
+
+    if ( epoch != a_epoch || base > a_offset ) {
+        return false;
+    }
+
+    // Records before the snapshot position are already reflected in it
+    start = FILE_HEADER_SIZE + a_offset - base;
+    end = readRecords( FILE_HEADER_SIZE, [&]( Record_t & a_rec, uint64_t a_pos ) {
+        if ( a_pos >= start ) {
+            tail.push_back( Record_t() );
+            std::swap( tail.back(), a_rec );
+        }
+    });
+
+    if ( end < start ) {
+        return false;
+    }
+
+    if ( ftruncate( m_fd, end ) < 0 ) {
+        throw runtime_error( string( "Failed to truncate WAL: " ) + strerror( errno ));
+    }
+
+    end = base + end - FILE_HEADER_SIZE;
+
+    if ( tail.size() ) {
+        state_index_t index;
+
+        for ( size_t s = 0; s < a_state.size(); s++ ) {
+            index[a_state[s].id] = s;
+        }
+
+        for ( vector<Record_t>::iterator r = tail.begin(); r != tail.end(); r++ ) {
+            applyRecord( a_state, index, *r );
+        }
+
+        a_state.erase( remove_if( a_state.begin(), a_state.end(), []( const Record_t & a_rec ) { return a_rec.id.empty(); } ), a_state.end() );
+    }
+
+    m_epoch = epoch;
+    m_base = base;
+    m_written = m_end = end;
+
+    return true;
+}
+
+/** @brief Start flusher thread
+ */
+void
+WriteAheadLog::start() {
+    lock_guard<mutex> lock(m_mutex);
+
+    if ( !m_run ) {
+        m_run = true;
+        m_thread = thread( &WriteAheadLog::flushThread, this );
+    }
+}
+
+/** @brief Buffer record for the next group commit
+ *
+ * Waits for the flusher while the pending byte limit is reached (only once
+ * the flusher is running). Throws length_error if a string field exceeds
+ * 65535 bytes.
+ */
+void
+WriteAheadLog::append( const Record_t & a_record ) {
+    unique_lock<mutex> lock(m_mutex);
+
+    while ( m_run && m_pending.size() >= m_max_pending ) {
+        m_cv.notify_one();
+        m_space_cv.wait( lock );
+    }
+
+    size_t size = m_pending.size();
+
+    encode( m_pending, a_record );
+    m_end += m_pending.size() - size;
+    m_count_records++;
+
+    if ( m_pending.size() >= m_sync_bytes ) {
+        m_cv.notify_one();
+    }
+}
+
+/** @brief Get epoch and logical offset of the end of the log
+ *
+ * A snapshot of the queue taken while no records can be appended reflects
+ * exactly the records before this position.
+ */
+void
+WriteAheadLog::getPosition( uint64_t & a_epoch, uint64_t & a_offset ) const {
+    lock_guard<mutex> lock(m_mutex);
+
+    a_epoch = m_epoch;
+    a_offset = m_end;
+}
+
+/** @brief Drop records before a_offset (of the current epoch)
+ *
+ * The flusher rewrites the log without them once they have been written.
+ * Must only be called once a snapshot taken at a_offset is durable.
+ */
+void
+WriteAheadLog::truncate( uint64_t a_offset ) {
+    lock_guard<mutex> lock(m_mutex);
+
+    if ( a_offset > m_truncate && a_offset <= m_end ) {
+        m_truncate = a_offset;
+        m_cv.notify_one();
+    }
+}
+
+/** @brief Get number of records appended and syncs completed
+ */
+void
+WriteAheadLog::getStats( size_t & a_records, size_t & a_syncs ) const {
+    lock_guard<mutex> lock(m_mutex);
+
+    a_records = m_count_records;
+    a_syncs = m_count_syncs;
+}
+
+/** @brief Read file header; returns false if the file is empty
+ *
+ * Throws if the file is not a log.
+ */
+bool
+WriteAheadLog::readHeader( uint64_t & a_epoch, uint64_t & a_base ) {
+    char buf[FILE_HEADER_SIZE];
+    const char * pos = buf, * end = buf + FILE_HEADER_SIZE;
+    uint32_t magic, version;
+    ssize_t rd = pread( m_fd, buf, FILE_HEADER_SIZE, 0 );
+
+    if ( rd < 0 ) {
+        throw runtime_error( string( "Failed to read WAL: " ) + strerror( errno ));
+    }
+
+    if ( rd == 0 ) {
+        return false;
+    }
+
+    if ( rd != FILE_HEADER_SIZE || !get( pos, end, magic ) || !get( pos, end, version ) || magic != FILE_MAGIC || version != FILE_VERSION ) {
+        throw runtime_error( "Invalid WAL file header" );
+    }
+
+    get( pos, end, a_epoch );
+    get( pos, end, a_base );
+
+    return true;
+}
+
+/** @brief Write file header to a_fd (at current end of file)
+ */
+void
+WriteAheadLog::writeHeader( int a_fd, uint64_t a_epoch, uint64_t a_base ) {
+    string buf;
+
+    put<uint32_t>( buf, FILE_MAGIC );
+    put<uint32_t>( buf, FILE_VERSION );
+    put<uint64_t>( buf, a_epoch );
+    put<uint64_t>( buf, a_base );
+
+    writeAll( a_fd, buf );
+}
+
+/** @brief Decode records from file position a_pos to the end of the log
+ *
+ * Each record is passed to a_handler with its file position. Returns the file
+ * position after the last valid record; a torn or corrupt tail is reported.
+ */
+uint64_t
+WriteAheadLog::readRecords( uint64_t a_pos, const std::function<void( Record_t &, uint64_t )> & a_handler ) {
+    string buf;
+    size_t pos = 0;
+    uint64_t offset = a_pos;
+    uint32_t len, chk;
+    ssize_t rd;
+    Record_t rec;
+    bool eof = false, corrupt = false;
+
+    while ( !corrupt ) {
+        // Parse complete records in buffer
+        while ( buf.size() - pos >= RECORD_HEADER_SIZE ) {
+            memcpy( &len, buf.data() + pos, sizeof( len ));
+            memcpy( &chk, buf.data() + pos + sizeof( len ), sizeof( chk ));
+
+            if ( buf.size() - pos - RECORD_HEADER_SIZE < len ) {
+                break;
+            }
+
+            const char * payload = buf.data() + pos + RECORD_HEADER_SIZE;
+
+            if ( checksum( payload, len ) != chk || !decode( payload, payload + len, rec )) {
+                corrupt = true;
+                break;
+            }
+
+            a_handler( rec, a_pos );
+
+            pos += RECORD_HEADER_SIZE + len;
+            a_pos += RECORD_HEADER_SIZE + len;
+        }
+
+        if ( corrupt || eof ) {
+            break;
+        }
+
+        // Read next chunk, keeping any partial record
+        buf.erase( 0, pos );
+        pos = 0;
+
+        size_t old_size = buf.size();
+
+        buf.resize( old_size + READ_CHUNK );
+        rd = pread( m_fd, &buf[old_size], READ_CHUNK, offset );
+
+        if ( rd < 0 ) {
+            throw runtime_error( string( "Failed to read WAL: " ) + strerror( errno ));
+        }
+
+        buf.resize( old_size + rd );
+        offset += rd;
+        eof = rd == 0;
+    }
+
+    if (( corrupt || buf.size() > pos ) && m_err_cb ) {
+        (*m_err_cb)( "Discarded torn or corrupt WAL tail" );
+    }
+
+    return a_pos;
+}
+
+/** @brief Apply a logged transition to reduced state
+ *
+ * Removed messages are left in a_state with an empty ID.
+ */
+void
+WriteAheadLog::applyRecord( std::vector<Record_t> & a_state, state_index_t & a_index, Record_t & a_record ) {
+    state_index_t::iterator i = a_index.find( a_record.id );
+
+    if ( a_record.type == REC_PUSH ) {
+        if ( i == a_index.end() ) {
+            a_index[a_record.id] = a_state.size();
+            a_state.push_back( Record_t() );
+            std::swap( a_state.back(), a_record );
+        }
+    } else if ( i != a_index.end() ) {
+        Record_t & state = a_state[i->second];
+
+        if ( a_record.type == REC_REMOVE ) {
+            state = Record_t();
+            a_index.erase( i );
+        } else if ( a_record.type == REC_REQUEUE ) {
+            state.priority = a_record.priority;
+            state.ready_ms = a_record.ready_ms;
+            state.failed = false;
+        } else {
+            state.failed = true;
+        }
+    }
+}
+
+/** @brief Check that a record fits the log format
+ *
+ * Throws length_error if a string field exceeds 65535 bytes.
+ */
+void
+WriteAheadLog::checkRecord( const Record_t & a_record ) {
+    const std::string * strings[] = { &a_record.id, &a_record.msg_class, &a_record.tenant, &a_record.group, &a_record.affinity, &a_record.batch };
+
+    for ( size_t s = 0; s < sizeof( strings ) / sizeof( strings[0] ); s++ ) {
+        if ( strings[s]->size() > UINT16_MAX ) {
+            throw length_error( "WAL record field too large" );
+        }
+    }
+
+    if ( a_record.depends.size() > UINT16_MAX ) {
+        throw length_error( "WAL record field too large" );
+    }
+
+    for ( vector<string>::const_iterator d = a_record.depends.begin(); d != a_record.depends.end(); d++ ) {
+        if ( d->size() > UINT16_MAX ) {
+            throw length_error( "WAL record field too large" );
+        }
+    }
+}
+
+/** @brief Append encoded record to a_buf
+ *
+ * Fields are validated before anything is written to a_buf.
+ */
+void
+WriteAheadLog::encode( std::string & a_buf, const Record_t & a_record ) const {
+    checkRecord( a_record );
+
+    size_t start = a_buf.size();
+
+    a_buf.append( RECORD_HEADER_SIZE, '\0' );
+    put<uint8_t>( a_buf, a_record.type );
+    putString( a_buf, a_record.id );
+
+    if ( a_record.type == REC_PUSH ) {
+        put<uint8_t>( a_buf, a_record.priority );
+        put<uint64_t>( a_buf, a_record.ready_ms );
+        put<uint64_t>( a_buf, a_record.due_ms );
+        put<uint64_t>( a_buf, a_record.expiry_ms );
+        put<uint32_t>( a_buf, a_record.ack_timeout );
+        put<uint8_t>( a_buf, a_record.max_retries );
+        putString( a_buf, a_record.msg_class );
+        putString( a_buf, a_record.tenant );
+        putString( a_buf, a_record.group );
+        putString( a_buf, a_record.affinity );
+        putString( a_buf, a_record.batch );
+        put<uint16_t>( a_buf, (uint16_t)a_record.depends.size() );
+
+        for ( vector<string>::const_iterator d = a_record.depends.begin(); d != a_record.depends.end(); d++ ) {
+            putString( a_buf, *d );
+        }
+    } else if ( a_record.type == REC_REQUEUE ) {
+        put<uint8_t>( a_buf, a_record.priority );
+        put<uint64_t>( a_buf, a_record.ready_ms );
+    }
+
+    uint32_t len = a_buf.size() - start - RECORD_HEADER_SIZE;
+    uint32_t chk = checksum( a_buf.data() + start + RECORD_HEADER_SIZE, len );
+
+    memcpy( &a_buf[start], &len, sizeof( len ));
+    memcpy( &a_buf[start + sizeof( len )], &chk, sizeof( chk ));
+}
+
+/** @brief Decode record payload; returns false if malformed
+ */
+bool
+WriteAheadLog::decode( const char * a_pos, const char * a_end, Record_t & a_record ) const {
+    uint8_t type;
+    uint16_t count;
+
+    if ( !get( a_pos, a_end, type ) || type < REC_PUSH || type > REC_FAIL ) {
+        return false;
+    }
+
+    a_record = Record_t( (RecordType_t)type );
+
+    if ( !getString( a_pos, a_end, a_record.id )) {
+        return false;
+    }
+
+    if ( type == REC_PUSH ) {
+        if ( !get( a_pos, a_end, a_record.priority ) || !get( a_pos, a_end, a_record.ready_ms ) ||
+            !get( a_pos, a_end, a_record.due_ms ) || !get( a_pos, a_end, a_record.expiry_ms ) ||
+            !get( a_pos, a_end, a_record.ack_timeout ) || !get( a_pos, a_end, a_record.max_retries ) ||
+            !getString( a_pos, a_end, a_record.msg_class ) || !getString( a_pos, a_end, a_record.tenant ) ||
+            !getString( a_pos, a_end, a_record.group ) || !getString( a_pos, a_end, a_record.affinity ) ||
+            !getString( a_pos, a_end, a_record.batch ) || !get( a_pos, a_end, count )) {
+            return false;
+        }
+
+        a_record.depends.resize( count );
+
+        for ( vector<string>::iterator d = a_record.depends.begin(); d != a_record.depends.end(); d++ ) {
+            if ( !getString( a_pos, a_end, *d )) {
+                return false;
+            }
+        }
+    } else if ( type == REC_REQUEUE ) {
+        if ( !get( a_pos, a_end, a_record.priority ) || !get( a_pos, a_end, a_record.ready_ms )) {
+            return false;
+        }
+    }
+
+    return a_pos == a_end;
+}
+
+/** @brief Write all of a_buf to a_fd
+ */
+void
+WriteAheadLog::writeAll( int a_fd, const std::string & a_buf ) {
+    const char * pos = a_buf.data(), * end = pos + a_buf.size();
+    ssize_t wr;
+
+    while ( pos < end ) {
+        wr = write( a_fd, pos, end - pos );
+
+        if ( wr < 0 ) {
+            if ( errno == EINTR ) {
+                continue;
+            }
+            throw runtime_error( string( "Failed to write WAL: " ) + strerror( errno ));
+        }
+
+        pos += wr;
+    }
+}
+
+/** @brief Open log file for appending (a_flags are added to the defaults)
+ */
+int
+WriteAheadLog::openLog( const std::string & a_path, int a_flags ) {
+    int fd = open( a_path.c_str(), O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC | a_flags, 0644 );
+
+    if ( fd < 0 ) {
+        throw runtime_error( string( "Failed to open WAL: " ) + strerror( errno ));
+    }
+
+    return fd;
+}
+
+/** @brief Replace log with one holding only records from a_offset on
+ *
+ * Called by the flusher (which owns the file) once records up to a_offset
+ * have been written.
+ */
+void
+WriteAheadLog::rotate( uint64_t a_offset ) {
+    string tmp_path = m_path + ".tmp";
+    int fd = openLog( tmp_path, O_TRUNC );
+    uint64_t pos = FILE_HEADER_SIZE + a_offset - m_base, end = FILE_HEADER_SIZE + m_written - m_base;
+    string buf;
+    ssize_t rd;
+
+    try {
+        writeHeader( fd, m_epoch, a_offset );
+
+        while ( pos < end ) {
+            buf.resize( min<uint64_t>( READ_CHUNK, end - pos ));
+            rd = pread( m_fd, &buf[0], buf.size(), pos );
+
+            if ( rd <= 0 ) {
+                throw runtime_error( string( "Failed to read WAL: " ) + strerror( errno ));
+            }
+
+            buf.resize( rd );
+            writeAll( fd, buf );
+            pos += rd;
+        }
+
+        if ( fdatasync( fd ) < 0 || rename( tmp_path.c_str(), m_path.c_str() ) < 0 ) {
+            throw runtime_error( string( "Failed to replace WAL: " ) + strerror( errno ));
+        }
+    } catch ( ... ) {
+        close( fd );
+        throw;
+    }
+
+    close( m_fd );
+
+    m_fd = fd;
+    m_base = a_offset;
+}
+
+/** @brief Write and sync records being committed
+ *
+ * Called by the flusher (which owns the file). The file is first cut back to
+ * the end of the records already committed, so that a retry never follows
+ * a partial write. Throws on I/O errors.
+ */
+void
+WriteAheadLog::commit() {
+    if ( ftruncate( m_fd, FILE_HEADER_SIZE + m_written - m_base ) < 0 ) {
+        throw runtime_error( string( "Failed to write WAL: " ) + strerror( errno ));
+    }
+
+    writeAll( m_fd, m_writing );
+
+    if ( fdatasync( m_fd ) < 0 ) {
+        throw runtime_error( string( "Failed to sync WAL: " ) + strerror( errno ));
+    }
+}
+
+/** @brief Group commit loop
+ *
+ * Writes and syncs buffered records every sync interval, or as soon as the
+ * buffer reaches the sync byte threshold. Appends continue into a fresh
+ * buffer while a commit is in progress. Records that fail to commit are kept
+ * ahead of those appended since, and retried after a sync interval; if the
+ * log is stopped while failing, they are dropped.
+ */
+void
+WriteAheadLog::flushThread() {
+    unique_lock<mutex> lock(m_mutex);
+
+    while ( true ) {
+        if ( m_run && ( m_failing || m_pending.size() < m_sync_bytes )) {
+            m_cv.wait_for( lock, std::chrono::milliseconds( m_sync_interval ));
+        }
+
+        if ( m_pending.size() ) {
+            bool committed = true, run = m_run;
+
+            m_writing.swap( m_pending );
+
+            lock.unlock();
+
+            try {
+                commit();
+
+                if ( m_failing && m_err_cb ) {
+                    (*m_err_cb)( "WAL writes resumed" );
+                }
+            } catch ( const exception & e ) {
+                if ( m_err_cb && ( !m_failing || !run )) {
+                    (*m_err_cb)( run ? e.what() : "WAL stopped with uncommitted records" );
+                }
+                committed = false;
+            }
+
+            lock.lock();
+
+            if ( committed ) {
+                m_written += m_writing.size();
+                m_count_syncs++;
+            } else if ( run ) {
+                m_writing += m_pending;
+                m_pending.swap( m_writing );
+            }
+
+            m_writing.clear();
+            m_failing = !committed;
+            m_space_cv.notify_all();
+        }
+
+        // Drop records covered by a snapshot once written
+        if ( m_truncate > m_base && m_truncate <= m_written ) {
+            uint64_t offset = m_truncate;
+            bool rotated = true;
+
+            lock.unlock();
+
+            try {
+                rotate( offset );
+            } catch ( const exception & e ) {
+                if ( m_err_cb ) {
+                    (*m_err_cb)( e.what() );
+                }
+                rotated = false;
+            }
+
+            lock.lock();
+
+            // Left to the next snapshot on failure
+            if ( !rotated ) {
+                m_truncate = 0;
+            }
+        }
+
+        if ( !m_run && m_pending.empty() ) {
+            break;
+        }
+    }
+}
+
+} // MonQueue namespace
@@ -0,0 +1,149 @@
+#ifndef WRITEAHEADLOG_HPP
+#define WRITEAHEADLOG_HPP
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <unordered_map>
+
+namespace MonQueue {
+
+/** @brief Append-only log of message state transitions with group commit
+ *
+ * Records are encoded into a memory buffer by append(), which never waits
+ * for I/O. A flusher thread writes the buffer and calls fdatasync once per
+ * sync interval, or sooner once the buffer reaches the sync byte threshold,
+ * so the cost of each sync is shared by every record appended since the
+ * last one. A transition is therefore durable within one sync interval.
+ * If a write or sync fails, the file is cut back to its last synced length
+ * and the same records are retried every sync interval; the failure is
+ * reported once until a retry succeeds. Once the records awaiting a sync
+ * reach the pending byte limit (e.g. while the disk is failing), append()
+ * waits for the flusher, holding callers back rather than buffering without
+ * bound.
+ *
+ * On startup, recover() reads the log and reduces it to the messages still
+ * in the queue (a push record, with its latest priority and ready time, and
+ * whether it is failed), then rewrites the log in that compact form so that
+ * it does not grow across restarts. Each record carries a length and
+ * checksum; a torn or corrupt tail (e.g. from a crash mid-write) ends
+ * recovery.
+ *
+ * Records are addressed by a logical byte offset that keeps increasing until
+ * the log is next compacted (which starts a new epoch). A snapshot of the
+ * queue taken at a position (see getPosition) can instead be recovered by
+ * applying only the records after that position, and once the snapshot is
+ * durable, truncate() drops the records before it. The file begins with a
+ * header holding the epoch and the logical offset of its first record. The
+ * append, position, truncate and stats methods are thread-safe.
+ */
+class WriteAheadLog {
+public:
+    /// @brief Record types
+    enum RecordType_t : uint8_t {
+        REC_PUSH = 1,       ///< Message pushed
+        REC_REMOVE,         ///< Message completed or erased
+        REC_REQUEUE,        ///< Message requeued (priority and ready time)
+        REC_FAIL,           ///< Message failed
+        REC_RUN,            ///< Message leased to a consumer (replication only)
+        REC_TOUCH,          ///< Running message deadline or checkpoint updated (replication only)
+        REC_TIMEOUT         ///< Running message ACK deadline expired (replication only)
+    };
+
+    /// @brief Log record (absolute times are msec since epoch, 0 = none)
+    struct Record_t {
+        Record_t( RecordType_t a_type = REC_PUSH ) :
+            type( a_type ), priority( 0 ), ready_ms( 0 ), due_ms( 0 ), expiry_ms( 0 ), ack_timeout( 0 ), max_retries( 0 ),
+            retries( 0 ), failed( false ), deadline_ms( 0 ), hedge( false ) {}
+
+        RecordType_t    type;           ///< Record type
+        std::string     id;             ///< Message ID
+        uint8_t         priority;       ///< Priority (push, requeue)
+        uint64_t        ready_ms;       ///< Delayed until (push, requeue; 0 = ready)
+        uint64_t        due_ms;         ///< Completion due time (push)
+        uint64_t        expiry_ms;      ///< Expiry time (push)
+        uint32_t        ack_timeout;    ///< Per-message ACK timeout in msec (push)
+        uint8_t         max_retries;    ///< Per-message max retries (push)
+        std::string     msg_class;      ///< Message class (push)
+        std::string     tenant;         ///< Tenant (push)
+        std::string     group;          ///< Ordered group (push)
+        std::string     affinity;       ///< Affinity key (push)
+        std::string     batch;          ///< Batch key (push)
+        std::vector<std::string> depends; ///< Prerequisite IDs (push)
+        uint8_t         retries;        ///< Retries so far (state records; requeue for replication; not logged)
+        bool            failed;         ///< Message is failed (state records only)
+        std::string     token;          ///< Lease token (run; running state records; replication only)
+        uint64_t        deadline_ms;    ///< ACK deadline (run, touch; running state records; replication only)
+        std::string     checkpoint;     ///< Progress checkpoint (touch; running state records; replication only)
+        bool            hedge;          ///< Run is a hedge lease (run; replication only)
+    };
+
+    typedef void (ErrorCB_t)( const std::string & msg );    ///< Error callback type
+
+    WriteAheadLog( const std::string & a_path, size_t a_sync_interval_msec, size_t a_sync_bytes, ErrorCB_t * a_err_cb = 0, size_t a_max_pending = DEFAULT_MAX_PENDING );
+    ~WriteAheadLog();
+
+    std::vector<Record_t> recover();
+    bool            recover( std::vector<Record_t> & a_state, uint64_t a_epoch, uint64_t a_offset );
+    void            start();
+    void            append( const Record_t & a_record );
+    void            getPosition( uint64_t & a_epoch, uint64_t & a_offset ) const;
+    void            truncate( uint64_t a_offset );
+    void            getStats( size_t & a_records, size_t & a_syncs ) const;
+
+    static void     checkRecord( const Record_t & a_record );
+
+    static const size_t     DEFAULT_MAX_PENDING = 64 << 20; ///< Default max bytes awaiting sync before appends wait
+
+private:
+    typedef std::unordered_map<std::string,size_t> state_index_t;
+
+    static const size_t     READ_CHUNK = 1048576;   ///< Bytes read per chunk during recovery
+    static const size_t     RECORD_HEADER_SIZE = 8; ///< Payload length and checksum
+    static const size_t     FILE_HEADER_SIZE = 24;  ///< Magic, version, epoch and base offset
+    static const uint32_t   FILE_MAGIC = 0x4c57514d;///< File header magic ("MQWL")
+    static const uint32_t   FILE_VERSION = 1;       ///< File format version
+
+    bool            readHeader( uint64_t & a_epoch, uint64_t & a_base );
+    void            writeHeader( int a_fd, uint64_t a_epoch, uint64_t a_base );
+    uint64_t        readRecords( uint64_t a_pos, const std::function<void( Record_t &, uint64_t )> & a_handler );
+    void            applyRecord( std::vector<Record_t> & a_state, state_index_t & a_index, Record_t & a_record );
+    void            encode( std::string & a_buf, const Record_t & a_record ) const;
+    bool            decode( const char * a_pos, const char * a_end, Record_t & a_record ) const;
+    void            writeAll( int a_fd, const std::string & a_buf );
+    int             openLog( const std::string & a_path, int a_flags );
+    void            rotate( uint64_t a_offset );
+    void            commit();
+    void            flushThread();
+
+    std::string                 m_path;         ///< Log file path
+    size_t                      m_sync_interval;///< Max msec between syncs
+    size_t                      m_sync_bytes;   ///< Buffered bytes that trigger an early sync
+    ErrorCB_t                 * m_err_cb;       ///< Error callback function ptr
+    size_t                      m_max_pending;  ///< Max bytes awaiting sync before appends wait
+    int                         m_fd;           ///< Log file descriptor
+    uint64_t                    m_epoch;        ///< Log epoch (incremented by compaction)
+    uint64_t                    m_base;         ///< Logical offset of first record in file (flusher)
+    uint64_t                    m_written;      ///< Logical offset of end of written records (flusher)
+    uint64_t                    m_end;          ///< Logical offset of end of appended records
+    uint64_t                    m_truncate;     ///< Requested truncation offset
+    bool                        m_run;          ///< Run/stop flag for flusher thread
+    bool                        m_failing;      ///< Last commit failed; retrying (flusher)
+    std::string                 m_pending;      ///< Encoded records awaiting write
+    std::string                 m_writing;      ///< Records being written by flusher
+    size_t                      m_count_records;///< Records appended
+    size_t                      m_count_syncs;  ///< Syncs completed
+    mutable std::mutex          m_mutex;        ///< Mutex for buffers and counters
+    std::condition_variable     m_cv;           ///< Flusher wake-up cond var
+    std::condition_variable     m_space_cv;     ///< Wake-up cond var for appends waiting on the pending limit
+    std::thread                 m_thread;       ///< Flusher thread
+};
+
+} // MonQueue namespace
+
+#endif
@@ -0,0 +1,80 @@
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <chrono>
+#include "Queue.hpp"
+
+using namespace std;
+using namespace MonQueue;
+
+/** @brief Dispatch policy benchmark
+ *
+ * Fills every priority with a backlog, then measures the share of pops each
+ * priority receives while all are contending and the mean cost of a pop.
+ * Usage: bench_dispatch [backlog per priority] [pops]
+ */
+
+void bench( const char * a_name, Queue::DispatchPolicy_t a_policy, const vector<uint32_t> & a_weights, size_t a_backlog, size_t a_pops ) {
+    Queue::Config_t config;
+
+    config.priority_count = (uint8_t)a_weights.size();
+    config.capacity = a_backlog * a_weights.size();
+    config.ack_timeout = 0;
+    config.boost_timeout = 0;
+    config.dispatch = a_policy;
+    config.weights = a_weights;
+
+    Queue q( config );
+    vector<Queue::Msg_t> msgs;
+    vector<size_t> counts( a_weights.size(), 0 );
+    uint32_t weight_sum = 0;
+
+    for ( size_t p = 0; p < a_weights.size(); p++ ) {
+        weight_sum += a_weights[p];
+        for ( size_t i = 0; i < a_backlog; i++ ) {
+            q.push( to_string( p ) + "." + to_string( i ), p );
+        }
+    }
+
+    msgs.reserve( a_pops );
+
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+    for ( size_t i = 0; i < a_pops; i++ ) {
+        msgs.push_back( q.pop() );
+    }
+
+    double nsec = chrono::duration_cast<chrono::nanoseconds>( chrono::steady_clock::now() - start ).count();
+
+    for ( vector<Queue::Msg_t>::iterator m = msgs.begin(); m != msgs.end(); m++ ) {
+        counts[stoul( m->id )]++;
+        q.ack( m->id, m->token );
+    }
+
+    cout << a_name << ": " << fixed << setprecision( 1 ) << nsec / a_pops << " nsec/pop\n";
+
+    for ( size_t p = 0; p < a_weights.size(); p++ ) {
+        cout << "  pri " << p << ": share " << setprecision( 4 ) << (double)counts[p] / a_pops;
+        if ( a_policy == Queue::DISPATCH_WEIGHTED ) {
+            cout << " (target " << (double)a_weights[p] / weight_sum << ")";
+        }
+        cout << "\n";
+    }
+}
+
+int main( int argc, char ** argv ) {
+    size_t backlog = argc > 1 ? stoul( argv[1] ) : 100000;
+    size_t pops = argc > 2 ? stoul( argv[2] ) : backlog;
+    vector<uint32_t> weights = { 8, 4, 2, 1 };
+
+    if ( pops > backlog ) {
+        cerr << "Pops must not exceed backlog (all priorities must stay busy)\n";
+        return 1;
+    }
+
+    bench( "strict", Queue::DISPATCH_STRICT, weights, backlog, pops );
+    bench( "weighted", Queue::DISPATCH_WEIGHTED, weights, backlog, pops );
+
+    return 0;
+}
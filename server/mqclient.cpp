@@ -3,6 +3,7 @@
 #include <vector>
 #include <chrono>
 #include <thread>
+#include <iterator>
 #include <Poco/Timespan.h>
 #include <Poco/URI.h>
 #include <Poco/Net/HTTPClientSession.h>
@@ -37,10 +38,16 @@ void doRequest( HTTPClientSession& session, HTTPRequest& request, string * body,
 
     //cout << "reply cont len: " << size << endl;
 
-    if ( size > 0 ) {
+    if ( size > 0 || response.getChunkedTransferEncoding() ) {
         string reply_body;
-        reply_body.resize( size );
-        rs.read( &reply_body[0], size );
+
+        if ( size > 0 ) {
+            reply_body.resize( size );
+            rs.read( &reply_body[0], size );
+        } else {
+            // Streamed (chunked) reply - read until end of body
+            reply_body.assign( istreambuf_iterator<char>( rs ), istreambuf_iterator<char>() );
+        }
 
         //cout << "reply[" << reply_body << "]" << endl;
 
@@ -181,12 +188,17 @@ int testPop( HTTPClientSession & session, size_t offset, size_t count ){
     }
 }
 
-void doGetFailed( HTTPClientSession & session, vector<string> & ids ) {
+uint64_t doGetFailed( HTTPClientSession & session, vector<string> & ids, uint64_t cursor = 0, size_t limit = 0 ) {
     libjson::Value reply;
+    string uri = "/failed";
 
     ids.clear();
 
-    HTTPRequest request( HTTPRequest::HTTP_GET, "/failed", HTTPMessage::HTTP_1_1 );
+    if ( limit ) {
+        uri += "?cursor=" + to_string( cursor ) + "&limit=" + to_string( limit );
+    }
+
+    HTTPRequest request( HTTPRequest::HTTP_GET, uri, HTTPMessage::HTTP_1_1 );
     doRequest( session, request, 0, reply );
 
     libjson::Value::Object & obj = reply.asObject();
@@ -195,6 +207,8 @@ void doGetFailed( HTTPClientSession & session, vector<string> & ids ) {
         ids.push_back( i->asString() );
         //cout << " " << i->asString() << endl;
     }
+
+    return (uint64_t)obj.getNumber( "next" );
 }
 
 void doEraseFailed( HTTPClientSession & session, vector<string> & ids ) {
@@ -248,6 +262,11 @@ int testFailureHanding( HTTPClientSession & session ){
         }
 
         vector<string> ids;
+
+        if ( doGetFailed( session, ids, 0, 1 ) != 0 || ids.size() != 1 ){
+            throw runtime_error( "Incorrect failed page" );
+        }
+
         doGetFailed( session, ids );
         doEraseFailed( session, ids );
 
@@ -273,6 +292,112 @@ int testFailureHanding( HTTPClientSession & session ){
     }
 }
 
+int testTouch( HTTPClientSession & session ){
+    cout << "testTouch: ";
+    cout.flush();
+
+    libjson::Value reply;
+
+    try {
+        doPush( session, 0, 1 );
+
+        HTTPRequest request( HTTPRequest::HTTP_POST, "/pop", HTTPMessage::HTTP_1_1 );
+        doRequest( session, request, 0, reply );
+
+        libjson::Value::Object & obj = reply.asObject();
+        string body = "{\"id\":\"" + obj.getString( "id" ) + "\",\"tok\":\"" + obj.getString( "tok" ) + "\"}";
+
+        // Send heartbeats for 2.5 seconds (assuming 1 sec ack timeout)
+        request.setURI( "/touch" );
+        for ( int i = 0; i < 5; i++ ) {
+            this_thread::sleep_for( chrono::milliseconds( 500 ));
+            doRequest( session, request, &body, reply );
+        }
+
+        // Ack must still succeed
+        request.setURI( "/ack" );
+        doRequest( session, request, &body, reply );
+
+        cout << "OK\n";
+        return 0;
+    } catch ( exception & e ) {
+        cout << "FAILED - ";
+        cout << e.what() << endl;
+        return 1;
+    }
+}
+
+int testNamedQueues( HTTPClientSession & session ){
+    cout << "testNamedQueues: ";
+    cout.flush();
+
+    libjson::Value reply;
+
+    try {
+        string body = "{\"name\":\"work\",\"cfg\":{\"capacity\":10,\"priorities\":5}}";
+
+        HTTPRequest request( HTTPRequest::HTTP_POST, "/queues/create", HTTPMessage::HTTP_1_1 );
+        doRequest( session, request, &body, reply );
+
+        // Duplicate name is rejected
+        bool failed = false;
+        try {
+            doRequest( session, request, &body, reply );
+        } catch ( exception & e ) {
+            failed = true;
+        }
+        if ( !failed ) throw runtime_error( "Duplicate queue created" );
+
+        request.setMethod( HTTPRequest::HTTP_GET );
+        request.setURI( "/queues" );
+        doRequest( session, request, 0, reply );
+
+        libjson::Value::Array & names = reply.asObject().getArray( "names" );
+        if ( names.size() != 1 || names.begin()->asString() != "work" ) throw runtime_error( "Bad queue list" );
+
+        // Queue settings and contents are independent of default queue
+        body = "[{\"id\":\"a\",\"pri\":4}]";
+        request.setMethod( HTTPRequest::HTTP_POST );
+        request.setURI( "/q/work/push" );
+        doRequest( session, request, &body, reply );
+
+        request.setMethod( HTTPRequest::HTTP_GET );
+        request.setURI( "/q/work/count" );
+        doRequest( session, request, 0, reply );
+
+        libjson::Value::Object & obj = reply.asObject();
+        if ( obj.getNumber( "capacity" ) != 10 || obj.getNumber( "active" ) != 1 ) throw runtime_error( "Bad named queue count" );
+
+        if ( testCount( session, 0, 0 )) throw runtime_error( "Default queue changed" );
+
+        request.setMethod( HTTPRequest::HTTP_POST );
+        request.setURI( "/q/work/pop" );
+        doRequest( session, request, 0, reply );
+
+        body = "{\"id\":\"" + reply.asObject().getString( "id" ) + "\",\"tok\":\"" + reply.asObject().getString( "tok" ) + "\"}";
+        request.setURI( "/q/work/ack" );
+        doRequest( session, request, &body, reply );
+
+        // Unknown queue
+        failed = false;
+        try {
+            request.setMethod( HTTPRequest::HTTP_GET );
+            request.setURI( "/q/none/count" );
+            doRequest( session, request, 0, reply );
+        } catch ( exception & e ) {
+            failed = true;
+        }
+        if ( !failed ) throw runtime_error( "Unknown queue accepted" );
+
+        cout << "OK\n";
+        return 0;
+    } catch ( exception & e ) {
+        cout << "FAILED - ";
+        cout << e.what() << endl;
+        return 1;
+    }
+}
+
 int testPingSpeed( HTTPClientSession & session ){
     cout << "testPingSpeed: ";
     cout.flush();
@@ -340,6 +465,8 @@ int main( int argc, char ** argv ) {
         ec |= testPop( session, 0, 100 );
         ec |= testCount( session, 0, 0 );
         ec |= testFailureHanding( session );
+        ec |= testTouch( session );
+        ec |= testNamedQueues( session );
         ec |= testPingSpeed( session );
         ec |= testPushPopSpeed( session );
 
@@ -1,7 +1,11 @@
 #include <iostream>
+#include <fstream>
 #include <chrono>
 #include <thread>
+#include <vector>
+#include <string>
 #include <QueueServer.hpp>
+#include <BulkLoader.hpp>
 #include <boost/program_options.hpp>
 
 using namespace std;
@@ -11,12 +15,20 @@ const char * VERSION = "1.0";
 
 int main( int a_argc, char ** a_argv ) {
     uint16_t port = 8080;
-    uint8_t priority_count = 3;
-    size_t msg_capacity = 100;
-    size_t msg_ack_timeout_msec = 60000;
-    size_t msg_max_retries = 5;
-    size_t msg_boost_timeout_msec = 300000;
-    size_t monitor_period_msec = 5000;
+    unsigned priority_count = 3;
+    string dispatch = "strict";
+    vector<uint32_t> weights;
+    vector<string> tenants;
+    vector<string> queues;
+    string load_file;
+    string replicate_to;
+    uint16_t standby_port = 0;
+    string standby_address = "127.0.0.1";
+    size_t timer_threads = 1;
+    MonQueue::Queue::Config_t config;
+
+    config.max_retries = 5;
+    config.boost_timeout = 300000;
 
     po::options_description opts( "Options" );
 
@@ -24,12 +36,46 @@ int main( int a_argc, char ** a_argv ) {
         ("help,?", "Show help")
         ("version,v", "Show version number")
         ("port,P",po::value<uint16_t>( &port ),"Port number")
-        ("priorities,p",po::value<uint8_t>( &priority_count ),"Number of priorities")
-        ("capacity,c",po::value<size_t>( &msg_capacity ),"Message capacity")
-        ("ack-timeout,a",po::value<size_t>( &msg_ack_timeout_msec ),"Client ack timeout (msec)")
-        ("max-retries,r",po::value<size_t>( &msg_max_retries ),"Max retries before fail")
-        ("boost-timeout,b",po::value<size_t>( &msg_boost_timeout_msec ),"Priority boost timeout (msec)")
-        ("monitor-period,m",po::value<size_t>( &monitor_period_msec ),"Client monitor poll period (msec)")
+        ("priorities,p",po::value<unsigned>( &priority_count ),"Number of priorities")
+        ("capacity,c",po::value<size_t>( &config.capacity ),"Message capacity")
+        ("ack-timeout,a",po::value<size_t>( &config.ack_timeout ),"Client ack timeout (msec)")
+        ("max-retries,r",po::value<size_t>( &config.max_retries ),"Max retries before fail")
+        ("boost-timeout,b",po::value<size_t>( &config.boost_timeout ),"Priority boost (aging) timeout per priority level (msec)")
+        ("boost-max-wait",po::value<size_t>( &config.boost_max_wait ),"Auto-tune boost timeout to hold low-priority wait under this (msec, 0 = off)")
+        ("monitor-period,m",po::value<size_t>( &config.monitor_period ),"Client monitor poll period (msec)")
+        ("dispatch,d",po::value<string>( &dispatch ),"Dispatch policy (strict, weighted, deadline)")
+        ("weight,w",po::value<vector<uint32_t>>( &weights )->multitoken(),"Weighted dispatch share per priority (default priorities-p)")
+        ("hedge-quantile",po::value<double>( &config.hedge_quantile ),"Hedge messages running longer than this processing time quantile (0 = off)")
+        ("hedge-min-samples",po::value<size_t>( &config.hedge_min_samples ),"Min processing time samples before hedging")
+        ("adaptive-quantile",po::value<double>( &config.adaptive_quantile ),"Derive ack timeouts from this processing time quantile (0 = off)")
+        ("adaptive-factor",po::value<double>( &config.adaptive_factor ),"Adaptive ack timeout multiple of quantile")
+        ("adaptive-min-timeout",po::value<size_t>( &config.adaptive_min_timeout ),"Min adaptive ack timeout (msec)")
+        ("adaptive-max-timeout",po::value<size_t>( &config.adaptive_max_timeout ),"Max adaptive ack timeout (msec, 0 = ack-timeout)")
+        ("adaptive-min-samples",po::value<size_t>( &config.adaptive_min_samples ),"Min processing time samples before adapting")
+        ("tenant-quota",po::value<size_t>( &config.tenant_quota ),"Default max messages held per tenant (0 = no limit)")
+        ("tenant",po::value<vector<string>>( &tenants ),"Tenant settings as name:quota[:weight[:rate]] (repeatable)")
+        ("affinity-wait",po::value<size_t>( &config.affinity_wait ),"Max time keyed messages wait for their affinity consumer (msec, 0 = off)")
+        ("affinity-capacity",po::value<size_t>( &config.affinity_capacity ),"Max affinity keys tracked")
+        ("rate-limit",po::value<vector<double>>( &config.rate_limits )->multitoken(),"Max pops per second per priority (0 = no limit)")
+        ("rate-burst",po::value<double>( &config.rate_burst ),"Rate limit burst size (seconds of rate)")
+        ("expire-to-failed",po::bool_switch( &config.expire_to_failed ),"Move expired messages to failed set instead of dropping them")
+        ("failed-capacity",po::value<size_t>( &config.failed_capacity ),"Max failed messages kept in memory, outside capacity (0 = share capacity)")
+        ("dead-letter-path",po::value<string>( &config.dead_letter_path ),"File receiving failed messages beyond failed capacity (default = drop them)")
+        ("overflow-path",po::value<string>( &config.overflow_path ),"Path prefix of overflow logs for pushes beyond capacity (default = reject them)")
+        ("overflow-segment-size",po::value<size_t>( &config.overflow_segment_size ),"Max bytes per overflow log segment")
+        ("overflow-batch",po::value<size_t>( &config.overflow_batch ),"Messages paged in from overflow per read")
+        ("wal-path",po::value<string>( &config.wal_path ),"Write-ahead log file, replayed on restart (default = no persistence)")
+        ("wal-sync-interval",po::value<size_t>( &config.wal_sync_interval ),"Max time between write-ahead log syncs (msec)")
+        ("wal-sync-bytes",po::value<size_t>( &config.wal_sync_bytes ),"Buffered write-ahead log bytes that trigger an early sync")
+        ("snapshot-path",po::value<string>( &config.snapshot_path ),"Snapshot file of queue state, loaded on restart (default = no snapshots)")
+        ("snapshot-interval",po::value<size_t>( &config.snapshot_interval ),"Time between periodic snapshots (msec, 0 = only on shutdown)")
+        ("snapshot-threads",po::value<size_t>( &config.snapshot_threads ),"Threads loading the snapshot on restart (0 = one per core)")
+        ("load-file",po::value<string>( &load_file ),"File of push records bulk loaded into the default queue on startup")
+        ("queue",po::value<vector<string>>( &queues ),"Named queue as name[:option=value,...] (repeatable; options as above)")
+        ("replicate-to",po::value<string>( &replicate_to ),"Stream queue state to hot standby at host:port")
+        ("standby-port",po::value<uint16_t>( &standby_port ),"Run as hot standby, receiving replication on this port (read-only until promoted)")
+        ("standby-address",po::value<string>( &standby_address ),"Local address receiving replication (unauthenticated; use loopback or a trusted network, :: = all)")
+        ("timer-threads",po::value<size_t>( &timer_threads ),"Number of threads for queue monitoring and delays")
         ;
 
     try {
@@ -50,6 +96,61 @@ int main( int a_argc, char ** a_argv ) {
             cout << VERSION << endl;
             return 0;
         }
+
+        if ( replicate_to.size() && standby_port ) {
+            cerr << "Options error: a standby cannot replicate to another standby\n";
+            return 1;
+        }
+
+        if ( !priority_count || priority_count > 255 ) {
+            cerr << "Options error: invalid number of priorities\n";
+            return 1;
+        }
+
+        config.priority_count = (uint8_t)priority_count;
+
+        if ( dispatch == "strict" ) {
+            config.dispatch = MonQueue::Queue::DISPATCH_STRICT;
+        } else if ( dispatch == "weighted" ) {
+            config.dispatch = MonQueue::Queue::DISPATCH_WEIGHTED;
+        } else if ( dispatch == "deadline" ) {
+            config.dispatch = MonQueue::Queue::DISPATCH_DEADLINE;
+        } else {
+            cerr << "Options error: invalid dispatch policy\n";
+            return 1;
+        }
+
+        if ( weights.size() && ( weights.size() != priority_count || config.dispatch != MonQueue::Queue::DISPATCH_WEIGHTED )) {
+            cerr << "Options error: weights require weighted dispatch and one weight per priority\n";
+            return 1;
+        }
+
+        config.weights = weights;
+
+        for ( vector<string>::iterator t = tenants.begin(); t != tenants.end(); t++ ) {
+            size_t pos = t->find( ':' );
+            if ( pos == string::npos ) {
+                cerr << "Options error: invalid tenant settings (expected name:quota[:weight[:rate]])\n";
+                return 1;
+            }
+
+            MonQueue::Queue::TenantConfig_t & tenant = config.tenants[t->substr( 0, pos )];
+            size_t wpos = t->find( ':', pos + 1 );
+            size_t rpos = wpos == string::npos ? string::npos : t->find( ':', wpos + 1 );
+
+            try {
+                tenant.quota = stoul( t->substr( pos + 1, wpos == string::npos ? string::npos : wpos - pos - 1 ));
+                if ( wpos != string::npos ) {
+                    tenant.weight = stoul( t->substr( wpos + 1, rpos == string::npos ? string::npos : rpos - wpos - 1 ));
+                }
+                if ( rpos != string::npos ) {
+                    tenant.rate = stod( t->substr( rpos + 1 ));
+                }
+            } catch ( exception & e ) {
+                cerr << "Options error: invalid tenant settings (expected name:quota[:weight[:rate]])\n";
+                return 1;
+            }
+        }
     }
     catch( po::unknown_option & e )
     {
@@ -57,14 +158,74 @@ int main( int a_argc, char ** a_argv ) {
         return 1;
     }
 
-    MonQueue::QueueServer mqserver(
-        priority_count,
-        msg_capacity,
-        msg_ack_timeout_msec,
-        msg_max_retries,
-        msg_boost_timeout_msec,
-        monitor_period_msec
-    );
+    MonQueue::QueueServer mqserver( config, port, timer_threads );
+
+    // Named queues start from default configuration
+    for ( vector<string>::iterator q = queues.begin(); q != queues.end(); q++ ) {
+        try {
+            MonQueue::Queue::Config_t queue_config = config;
+            MonQueue::QueueOptions_t queue_options;
+            size_t pos = q->find( ':' ), end, eq;
+
+            while ( pos != string::npos ) {
+                end = q->find( ',', pos + 1 );
+                eq = q->find( '=', pos + 1 );
+
+                if ( eq == string::npos || eq > end ) {
+                    throw runtime_error( "expected name[:option=value,...]" );
+                }
+
+                queue_options.emplace_back( q->substr( pos + 1, eq - pos - 1 ), q->substr( eq + 1, end == string::npos ? string::npos : end - eq - 1 ));
+                MonQueue::QueueServer::setConfigOption( queue_config, queue_options.back().first, queue_options.back().second );
+
+                pos = end;
+            }
+
+            mqserver.addQueue( q->substr( 0, q->find( ':' )), queue_config, queue_options );
+        } catch ( exception & e ) {
+            cerr << "Options error: invalid queue " << *q << " (" << e.what() << ")\n";
+            return 1;
+        }
+    }
+
+    // Loaded before serving requests, while the queue has no other users
+    if ( load_file.size() ) {
+        ifstream in( load_file, ios::binary );
+
+        if ( !in ) {
+            cerr << "Options error: cannot open load file " << load_file << "\n";
+            return 1;
+        }
+
+        MonQueue::BulkLoader loader( *mqserver.getQueue( "" ));
+
+        try {
+            loader.load( in );
+        } catch ( exception & e ) {
+            cerr << "Load error: " << load_file << " (" << e.what() << ")\n";
+            return 1;
+        }
+
+        cout << "Loaded " << loader.getPushed() << " messages from " << load_file << " (" << loader.getSkipped() << " skipped)" << endl;
+    }
+
+    // Standby connection starts with a full sync, so the loaded state is included
+    try {
+        if ( replicate_to.size() ) {
+            size_t pos = replicate_to.rfind( ':' );
+
+            if ( pos == string::npos || pos == 0 ) {
+                throw runtime_error( "expected host:port" );
+            }
+
+            mqserver.replicateTo( replicate_to.substr( 0, pos ), (uint16_t)stoul( replicate_to.substr( pos + 1 )));
+        } else if ( standby_port ) {
+            mqserver.startStandby( standby_address, standby_port );
+        }
+    } catch ( exception & e ) {
+        cerr << "Replication error: " << e.what() << "\n";
+        return 1;
+    }
 
     mqserver.start();
 
@@ -0,0 +1,151 @@
+#include <iostream>
+#include <string>
+#include <thread>
+#include <chrono>
+#include "Queue.hpp"
+#include "TestUtil.hpp"
+
+using namespace std;
+using namespace MonQueue;
+
+Queue::MsgOpts_t affinity( const string & a_key ) {
+    Queue::MsgOpts_t opts;
+
+    opts.affinity = a_key;
+
+    return opts;
+}
+
+void testRouting() {
+    Queue::Config_t config;
+
+    config.monitor_period = 10;
+    config.affinity_wait = 200;
+
+    Queue q( config, &logger );
+    size_t hits, fallbacks, keys;
+
+    // First message with key goes to any consumer, which then owns the key
+    q.push( "m1", 1, 0, affinity( "k1" ));
+
+    Queue::Msg_t m = q.pop( "A" );
+    check( m.id == "m1", "first keyed pop" );
+    q.ack( m.id, m.token );
+
+    // Keyed message is held for owner; other consumers skip it
+    q.push( "m2", 1, 0, affinity( "k1" ));
+    q.push( "m3", 2 );
+
+    m = q.pop( "B" );
+    check( m.id == "m3", "held message skipped" );
+    q.ack( m.id, m.token );
+
+    m = q.pop( "A" );
+    check( m.id == "m2", "held message to owner" );
+    q.ack( m.id, m.token );
+
+    q.getAffinityStats( hits, fallbacks, keys );
+    check( hits == 1 && fallbacks == 0 && keys == 1, "hit stats" );
+
+    // After the affinity wait, any consumer may take message and becomes owner
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+    q.push( "m4", 1, 0, affinity( "k1" ));
+
+    m = q.pop( "B" );
+    check( m.id == "m4", "fallback pop" );
+    check( chrono::steady_clock::now() - start >= chrono::milliseconds( 150 ), "fallback wait" );
+    q.ack( m.id, m.token );
+
+    q.getAffinityStats( hits, fallbacks, keys );
+    check( hits == 1 && fallbacks == 1, "fallback stats" );
+
+    q.push( "m5", 1, 0, affinity( "k1" ));
+
+    m = q.pop( "B" );
+    check( m.id == "m5", "key moved to new owner" );
+    q.ack( m.id, m.token );
+
+    // Requeued message is held for consumer that requeued it
+    q.push( "m6", 1, 0, affinity( "k1" ));
+    q.push( "m7", 2 );
+
+    m = q.pop( "B" );
+    check( m.id == "m6", "owner pop" );
+    q.ack( m.id, m.token, true );
+
+    m = q.pop( "A" );
+    check( m.id == "m7", "requeued held" );
+    q.ack( m.id, m.token );
+
+    m = q.pop( "B" );
+    check( m.id == "m6", "requeued to owner" );
+    q.ack( m.id, m.token );
+}
+
+void testCapacity() {
+    Queue::Config_t config;
+
+    config.monitor_period = 10;
+    config.affinity_wait = 10000;
+    config.affinity_capacity = 2;
+
+    Queue q( config, &logger );
+    Queue::Msg_t m;
+    size_t hits, fallbacks, keys;
+
+    q.push( "a", 1, 0, affinity( "k1" ));
+    q.push( "b", 1, 0, affinity( "k2" ));
+    q.push( "c", 1, 0, affinity( "k3" ));
+
+    for ( int i = 0; i < 3; i++ ) {
+        m = q.pop( i < 2 ? "A" : "B" );
+        q.ack( m.id, m.token );
+    }
+
+    q.getAffinityStats( hits, fallbacks, keys );
+    check( keys == 2, "affinity table bounded" );
+
+    // Least recently used key (k1) was dropped, so its message is not held
+    q.push( "d", 1, 0, affinity( "k1" ));
+
+    m = q.pop( "B" );
+    check( m.id == "d", "dropped key not held" );
+    q.ack( m.id, m.token );
+
+    // Dropping consumer's last key releases its held messages
+    q.push( "e", 1, 0, affinity( "k5" ));
+
+    m = q.pop( "A" );
+    q.ack( m.id, m.token );
+
+    q.push( "g", 1, 0, affinity( "k5" ));
+    q.push( "h", 1, 0, affinity( "k6" ));
+    q.push( "i", 1, 0, affinity( "k7" ));
+
+    m = q.pop( "C" );
+    check( m.id == "h", "unheld pop 1" );
+    q.ack( m.id, m.token );
+
+    m = q.pop( "C" );
+    check( m.id == "i", "unheld pop 2" );
+    q.ack( m.id, m.token );
+
+    m = q.pop( "C" );
+    check( m.id == "g", "released by key drop" );
+    q.ack( m.id, m.token );
+}
+
+int main( int argc, char ** argv ) {
+    cout << "AFFINITY ROUTING TESTING\n";
+
+    testRouting();
+
+    cout << "AFFINITY CAPACITY TESTING\n";
+
+    testCapacity();
+
+    cout << "PASSED\n";
+
+    return 0;
+}
@@ -0,0 +1,93 @@
+#include <iostream>
+#include <string>
+#include "Queue.hpp"
+#include "TestUtil.hpp"
+
+using namespace std;
+using namespace MonQueue;
+
+Queue::MsgOpts_t batch( const string & a_key ) {
+    Queue::MsgOpts_t opts;
+
+    opts.batch = a_key;
+
+    return opts;
+}
+
+void ackAll( Queue & a_queue, const Queue::MsgList_t & a_msgs ) {
+    for ( Queue::MsgList_t::const_iterator m = a_msgs.begin(); m != a_msgs.end(); m++ ) {
+        a_queue.ack( m->id, m->token );
+    }
+}
+
+void testBatch( Queue::DispatchPolicy_t a_dispatch ) {
+    Queue::Config_t config;
+
+    config.monitor_period = 10;
+    config.dispatch = a_dispatch;
+
+    Queue q( config, &logger );
+    Queue::MsgList_t msgs;
+
+    q.push( "b1", 1, 0, batch( "k" ));
+    q.push( "x", 1 );
+    q.push( "b2", 1, 0, batch( "k" ));
+    q.push( "b3", 2, 0, batch( "k" ));
+    q.push( "c1", 1, 0, batch( "c" ));
+    q.push( "b4", 1, 0, batch( "k" ));
+
+    // Same key at same priority, in queue order
+    msgs = q.popBatch( 10 );
+    check( msgs.size() == 3 && msgs[0].id == "b1" && msgs[1].id == "b2" && msgs[2].id == "b4", "batch pop" );
+    check( msgs[1].token.size() && msgs[1].token != msgs[0].token, "batch tokens" );
+    ackAll( q, msgs );
+
+    // Unkeyed message pops alone
+    msgs = q.popBatch( 10 );
+    check( msgs.size() == 1 && msgs[0].id == "x", "unkeyed batch pop" );
+    ackAll( q, msgs );
+
+    // Other key and other priority pop alone (order depends on dispatch policy)
+    Queue::MsgList_t msgs2;
+
+    msgs = q.popBatch( 10 );
+    msgs2 = q.popBatch( 10 );
+    check( msgs.size() == 1 && msgs2.size() == 1, "single batch pops" );
+    check(( msgs[0].id == "c1" && msgs2[0].id == "b3" ) || ( msgs[0].id == "b3" && msgs2[0].id == "c1" ), "other key or priority batch pop" );
+    ackAll( q, msgs );
+    ackAll( q, msgs2 );
+
+    // Limit respected; remaining messages stay indexed
+    for ( int i = 0; i < 5; i++ ) {
+        q.push( string( "d" ) + to_string( i ), 0, 0, batch( "d" ));
+    }
+
+    msgs = q.popBatch( 3 );
+    check( msgs.size() == 3 && msgs[2].id == "d2", "batch limit" );
+    ackAll( q, msgs );
+
+    // Requeued message returns to index
+    Queue::Msg_t m = q.pop();
+    check( m.id == "d3", "pop after batch" );
+    q.ack( m.id, m.token, true );
+
+    msgs = q.popBatch( 3 );
+    check( msgs.size() == 2 && msgs[0].id == "d4" && msgs[1].id == "d3", "batch after requeue" );
+    ackAll( q, msgs );
+
+    size_t act, failed, free;
+    q.getCounts( act, failed, free );
+    check( act == 0, "batch drained" );
+}
+
+int main( int argc, char ** argv ) {
+    cout << "BATCH POP TESTING\n";
+
+    testBatch( Queue::DISPATCH_STRICT );
+    testBatch( Queue::DISPATCH_WEIGHTED );
+    testBatch( Queue::DISPATCH_DEADLINE );
+
+    cout << "PASSED\n";
+
+    return 0;
+}
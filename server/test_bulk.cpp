@@ -0,0 +1,181 @@
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <chrono>
+#include <stdexcept>
+#include "Queue.hpp"
+#include "TestUtil.hpp"
+#include "BulkLoader.hpp"
+
+using namespace std;
+using namespace MonQueue;
+
+void putLE( string & a_buf, uint64_t a_value, size_t a_size ) {
+    for ( size_t i = 0; i < a_size; i++ ) {
+        a_buf += (char)( a_value >> ( 8 * i ));
+    }
+}
+
+void putString( string & a_buf, const string & a_value ) {
+    putLE( a_buf, a_value.size(), 4 );
+    a_buf += a_value;
+}
+
+string binaryRecord( const string & a_id, uint8_t a_priority, uint32_t a_delay, const string & a_group = string() ) {
+    string rec;
+
+    putLE( rec, a_priority, 1 );
+    putLE( rec, 0, 1 );
+    putLE( rec, a_delay, 4 );
+    putLE( rec, 0, 4 );
+    putLE( rec, 0, 4 );
+    putLE( rec, 0, 4 );
+    putString( rec, a_id );
+    putString( rec, "" );
+    putString( rec, "" );
+    putString( rec, a_group );
+    putString( rec, "" );
+    putString( rec, "" );
+    putLE( rec, 0, 4 );
+
+    string out;
+
+    putLE( out, rec.size(), 4 );
+
+    return out + rec;
+}
+
+void testText() {
+    Queue q( testConfig( 100 ), &logger );
+    BulkLoader loader( q, 2 );
+    istringstream in(
+        "{\"id\":\"a\",\"pri\":1}\n"
+        "\n"
+        "  { \"pri\" : 0, \"id\" : \"b\\\"\\u00e9\\ud83d\\ude00\", \"xyz\": [1] }\r\n" );
+
+    // Unknown fields with non-scalar values are rejected
+    try {
+        loader.load( in );
+        check( false, "invalid record rejected" );
+    } catch ( runtime_error & e ) {
+        check( string( e.what() ).find( "Record 2:" ) == 0, "error names record" );
+    }
+
+    check( loader.getPushed() == 1, "records before error pushed" );
+
+    istringstream in2(
+        "{\"id\":\"a\",\"pri\":1}\n"
+        "{\"pri\":0,\"id\":\"b\\\"\\u00e9\\ud83d\\ude00\",\"cls\":\"c\",\"ok\":true}\n"
+        "{\"id\":\"d\",\"pri\":0,\"del\":20}\n"
+        "{\"id\":\"g1\",\"pri\":1,\"grp\":\"g\"}\n"
+        "{\"id\":\"g2\",\"pri\":1,\"grp\":\"g\",\"dep\":[\"a\"]}\n"
+        "{\"id\":\"e\",\"pri\":1,\"ttl\":1,\"tmo\":5,\"ret\":1}" );
+
+    loader.load( in2 );
+    check( loader.getPushed() == 5 && loader.getSkipped() == 1, "duplicate skipped" );
+
+    this_thread::sleep_for( chrono::milliseconds( 50 ));
+
+    check( popAck( q ) == "b\"\xc3\xa9\xf0\x9f\x98\x80", "escaped ID" );
+    check( popAck( q ) == "d", "delayed message ready" );
+    check( popAck( q ) == "a" && popAck( q ) == "g1", "queue order" );
+    check( popAck( q ) == "g2", "group and prerequisites" );
+
+    size_t act, failed, free;
+
+    q.getCounts( act, failed, free );
+    check( act == 0, "expired message dropped" );
+}
+
+void testBinary() {
+    Queue q( testConfig( 3 ), &logger );
+    BulkLoader loader( q );
+    string data;
+
+    putLE( data, BulkLoader::BINARY_MAGIC, 4 );
+    putLE( data, BulkLoader::BINARY_VERSION, 4 );
+    data += binaryRecord( "x", 1, 0 );
+    data += binaryRecord( "y", 0, 0, "g" );
+    data += binaryRecord( "x", 0, 0 );
+    data += binaryRecord( "z", 1, 0 );
+    data += binaryRecord( "w", 1, 0 );
+
+    istringstream in( data );
+
+    // Capacity exceeded by last record
+    try {
+        loader.load( in );
+        check( false, "capacity exceeded" );
+    } catch ( runtime_error & e ) {
+        check( string( e.what() ).find( "Record 5:" ) == 0, "error names pushed record" );
+    }
+
+    check( loader.getPushed() == 3 && loader.getSkipped() == 1, "binary records pushed" );
+    check( popAck( q ) == "y" && popAck( q ) == "x" && popAck( q ) == "z", "binary order" );
+
+    // Truncated record
+    data.resize( data.size() - 3 );
+    istringstream in2( data );
+
+    try {
+        loader.load( in2 );
+        check( false, "truncated record rejected" );
+    } catch ( runtime_error & e ) {
+        check( string( e.what() ).find( "Truncated" ) != string::npos, "truncation reported" );
+    }
+
+    check( loader.getPushed() == 3, "records before truncation pushed" );
+
+    // Invalid priority (not checked by the parser)
+    Queue q2( testConfig( 3 ), &logger );
+    BulkLoader loader2( q2 );
+
+    data.resize( 8 );
+    data += binaryRecord( "p", 0, 0 );
+    data += binaryRecord( "q", 1, 0 );
+    data += binaryRecord( "r", 5, 0 );
+    data += binaryRecord( "s", 0, 0 );
+    istringstream in3( data );
+
+    try {
+        loader2.load( in3 );
+        check( false, "invalid priority rejected" );
+    } catch ( runtime_error & e ) {
+        check( string( e.what() ).find( "Record 3:" ) == 0, "error names invalid record" );
+    }
+
+    check( loader2.getPushed() == 2 && popAck( q2 ) == "p" && popAck( q2 ) == "q", "records before invalid record pushed" );
+}
+
+void testRate() {
+    const size_t count = 1000000;
+    Queue q( testConfig( count ), &logger );
+    BulkLoader loader( q );
+    string data;
+
+    for ( size_t i = 0; i < count; i++ ) {
+        data += "{\"id\":\"m" + to_string( i ) + "\",\"pri\":" + to_string( i % 2 ) + "}\n";
+    }
+
+    istringstream in( data );
+    auto start = chrono::steady_clock::now();
+
+    loader.load( in );
+
+    double secs = chrono::duration<double>( chrono::steady_clock::now() - start ).count();
+
+    check( loader.getPushed() == count, "all messages loaded" );
+    cout << "Loaded " << count << " messages in " << (size_t)( secs * 1000 ) << " msec (" << (size_t)( count / secs ) << " msg/sec)\n";
+}
+
+int main( int argc, char ** argv ) {
+    cout << "BULK LOAD TESTING\n";
+
+    testText();
+    testBinary();
+    testRate();
+
+    cout << "PASSED\n";
+
+    return 0;
+}
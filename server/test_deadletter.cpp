@@ -0,0 +1,205 @@
+#include <iostream>
+#include <string>
+#include <thread>
+#include <chrono>
+#include <cstdio>
+#include <unistd.h>
+#include "Queue.hpp"
+#include "TestUtil.hpp"
+
+using namespace std;
+using namespace MonQueue;
+
+Queue::MsgOpts_t ttl( size_t a_ttl ) {
+    Queue::MsgOpts_t opts;
+
+    opts.ttl = a_ttl;
+
+    return opts;
+}
+
+Queue::Config_t failConfig( size_t a_capacity, size_t a_failed_capacity, const string & a_path = string() ) {
+    Queue::Config_t config = testConfig( a_capacity, 1000 );
+
+    config.expire_to_failed = true;
+    config.failed_capacity = a_failed_capacity;
+    config.dead_letter_path = a_path;
+
+    return config;
+}
+
+// Expire messages with increasing TTLs so they fail in push order
+void failMsgs( Queue & a_queue, const string & a_prefix, size_t a_count ) {
+    for ( size_t i = 0; i < a_count; i++ ) {
+        a_queue.push( a_prefix + to_string( i ), 0, 0, ttl( 20 + i ));
+    }
+
+    this_thread::sleep_for( chrono::milliseconds( 100 ));
+}
+
+void removeFiles( const string & a_path ) {
+    remove( a_path.c_str() );
+    remove(( a_path + ".idx" ).c_str() );
+}
+
+void testBudget() {
+    Queue q( failConfig( 2, 2 ), &logger );
+    size_t act, failed, free, spilled, dropped;
+
+    failMsgs( q, "a", 2 );
+
+    // Failed messages do not consume live capacity
+    q.getCounts( act, failed, free );
+    check( act == 0 && failed == 2 && free == 2, "failed outside capacity" );
+
+    failMsgs( q, "b", 2 );
+
+    // Oldest failed messages dropped beyond failed capacity
+    q.getCounts( act, failed, free );
+    q.getDeadLetterStats( spilled, dropped );
+    check( failed == 2 && spilled == 0 && dropped == 2, "failed dropped" );
+
+    Queue::MsgIdList_t ids = q.getFailed();
+    check( ids.size() == 2 && ids[0] == "b0" && ids[1] == "b1", "newest failed kept" );
+
+    q.push( "c", 0 );
+    q.push( "d", 0 );
+
+    try {
+        q.push( "e", 0 );
+        check( false, "live capacity enforced" );
+    } catch ( length_error & e ) {
+    }
+
+    // Without a separate budget, failed messages share capacity
+    Queue shared( failConfig( 2, 0 ), &logger );
+
+    failMsgs( shared, "a", 2 );
+
+    try {
+        shared.push( "c", 0 );
+        check( false, "shared capacity" );
+    } catch ( length_error & e ) {
+    }
+}
+
+void testSpill( const string & a_path ) {
+    size_t act, failed, free, spilled, dropped;
+    uint64_t cursor = 0;
+    Queue::MsgIdList_t ids;
+
+    removeFiles( a_path );
+
+    {
+        Queue q( failConfig( 10, 2, a_path ), &logger );
+
+        failMsgs( q, "a", 5 );
+
+        q.getCounts( act, failed, free );
+        q.getDeadLetterStats( spilled, dropped );
+        check( failed == 2 && spilled == 3 && dropped == 0, "failed spilled" );
+
+        // Spilled messages are no longer in the queue
+        check( q.getFailed().size() == 2, "in-memory failed" );
+        check( q.eraseFailed( { "a0" } ).empty(), "spilled not erasable" );
+        q.push( "a0", 0 );
+
+        // Paging runs through file, then memory
+        ids = q.getFailed( cursor, 2 );
+        check( ids.size() == 2 && ids[0] == "a0" && ids[1] == "a1" && cursor, "file page" );
+        ids = q.getFailed( cursor, 2 );
+        check( ids.size() == 2 && ids[0] == "a2" && ids[1] == "a3" && cursor, "file and memory page" );
+        ids = q.getFailed( cursor, 2 );
+        check( ids.size() == 1 && ids[0] == "a4" && !cursor, "memory page" );
+
+        cursor = 0;
+        ids = q.getFailed( cursor, 3 );
+        check( ids.size() == 3 && ids[2] == "a2", "page ends at file end" );
+        ids = q.getFailed( cursor, 10 );
+        check( ids.size() == 2 && ids[0] == "a3" && !cursor, "remaining page" );
+    }
+
+    // File survives restart, and new failures list after spilled ones
+    Queue q( failConfig( 10, 2, a_path ), &logger );
+
+    q.getDeadLetterStats( spilled, dropped );
+    check( spilled == 3, "reopened spill" );
+
+    failMsgs( q, "b", 3 );
+
+    q.getDeadLetterStats( spilled, dropped );
+    check( spilled == 4, "spilled after restart" );
+
+    cursor = 0;
+    ids = q.getFailed( cursor, 100 );
+    check( ids.size() == 6 && ids[2] == "a2" && ids[3] == "b0" && ids[5] == "b2" && !cursor, "listing after restart" );
+}
+
+void testFile( const string & a_path ) {
+    DeadLetterFile::Record_t rec;
+
+    removeFiles( a_path );
+
+    {
+        DeadLetterFile dl( a_path );
+
+        rec.seq = 5;
+        rec.id = "x";
+        rec.priority = 2;
+        rec.fail_count = 3;
+        rec.checkpoint = string( 1000, 'c' );
+        dl.append( rec );
+
+        rec.seq = 4;
+
+        try {
+            dl.append( rec );
+            check( false, "out of order append" );
+        } catch ( logic_error & e ) {
+        }
+    }
+
+    // Partial record after last indexed record is discarded
+    FILE * f = fopen( a_path.c_str(), "a" );
+    fputs( "partial", f );
+    fclose( f );
+
+    DeadLetterFile dl( a_path );
+
+    rec.seq = 9;
+    rec.id = "y";
+    rec.checkpoint.clear();
+    dl.append( rec );
+
+    check( dl.size() == 2 && dl.lastSeq() == 9 && dl.hasAfter( 5 ) && !dl.hasAfter( 9 ), "reopened file" );
+    check( dl.read( 0, rec ) && rec.seq == 5 && rec.id == "x" && rec.priority == 2 && rec.fail_count == 3 &&
+        rec.checkpoint == string( 1000, 'c' ), "read record" );
+    check( dl.read( 1, rec ) && rec.seq == 9 && rec.id == "y" && rec.checkpoint.empty(), "read appended record" );
+    check( !dl.read( 2, rec ), "read out of range" );
+
+    // Index grows beyond initial mapping
+    for ( uint64_t seq = 10; seq < 70010; seq++ ) {
+        rec.seq = seq;
+        dl.append( rec );
+    }
+
+    vector<string> ids;
+    uint64_t cursor = 70000;
+
+    dl.readIds( cursor, 100, ids );
+    check( dl.size() == 70002 && ids.size() == 9 && cursor == 70009, "grown index" );
+}
+
+int main( int argc, char ** argv ) {
+    string path = string( "/tmp/test_deadletter." ) + to_string( getpid() );
+
+    testBudget();
+    testSpill( path );
+    testFile( path );
+
+    removeFiles( path );
+
+    cout << "PASSED" << endl;
+
+    return 0;
+}
@@ -0,0 +1,198 @@
+#include <iostream>
+#include <string>
+#include <thread>
+#include <chrono>
+#include "Queue.hpp"
+#include "TestUtil.hpp"
+
+using namespace std;
+using namespace MonQueue;
+
+Queue::MsgOpts_t depends( const vector<string> & a_ids ) {
+    Queue::MsgOpts_t opts;
+
+    opts.depends = a_ids;
+
+    return opts;
+}
+
+void testRelease() {
+    Queue::Config_t config;
+
+    config.monitor_period = 10;
+
+    Queue q( config, &logger );
+    Queue::Msg_t m1, m2, m;
+
+    // Fan-in: unknown prerequisite IDs are treated as complete
+    q.push( "c1", 1 );
+    q.push( "c2", 1 );
+    q.push( "d", 0, 0, depends( { "c1", "c2", "c1", "gone" } ));
+
+    m1 = q.pop();
+    m2 = q.pop();
+    check( m1.id == "c1" && m2.id == "c2", "prerequisites first" );
+
+    q.ack( m1.id, m1.token );
+    q.push( "x", 2 );
+
+    m = q.pop();
+    check( m.id == "x", "dependent held" );
+    q.ack( m.id, m.token );
+
+    // Requeue does not complete prerequisite
+    q.ack( m2.id, m2.token, true );
+    m2 = q.pop();
+    check( m2.id == "c2", "requeued prerequisite" );
+
+    // ACK with follow-up push completes prerequisite
+    Queue::PushMsgList_t next( 1 );
+    next[0].id = "y";
+    next[0].priority = 2;
+    q.ackAndPush( m2.id, m2.token, next );
+
+    m = q.pop();
+    check( m.id == "d", "dependent released" );
+    q.ack( m.id, m.token );
+
+    m = q.pop();
+    check( m.id == "y", "follow-up" );
+    q.ack( m.id, m.token );
+
+    // Dependent keeps its delay
+    q.push( "e", 1 );
+    q.push( "f", 1, 100, depends( { "e" } ));
+
+    m = q.pop();
+    q.ack( m.id, m.token );
+
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    m = q.pop();
+    check( m.id == "f" && chrono::steady_clock::now() - start >= chrono::milliseconds( 50 ), "dependent delay" );
+    q.ack( m.id, m.token );
+
+    size_t act, failed, free;
+    q.getCounts( act, failed, free );
+    check( act == 0, "depends drained" );
+}
+
+void testFailure() {
+    Queue::Config_t config;
+
+    config.ack_timeout = 50;
+    config.max_retries = 1;
+    config.monitor_period = 10;
+
+    Queue q( config, &logger );
+    size_t act, failed, free;
+
+    // Diamond: p -> a, b -> c; c also waits on unrelated o
+    q.push( "p", 0 );
+    q.push( "o", 2 );
+    q.push( "a", 0, 0, depends( { "p" } ));
+    q.push( "b", 0, 0, depends( { "p" } ));
+    q.push( "c", 0, 0, depends( { "a", "b", "o" } ));
+
+    Queue::Msg_t m = q.pop();
+    check( m.id == "p", "pop prerequisite" );
+
+    for ( int i = 0; i < 100; i++ ) {
+        this_thread::sleep_for( chrono::milliseconds( 10 ));
+        q.getCounts( act, failed, free );
+        if ( failed == 4 ) {
+            break;
+        }
+    }
+
+    check( failed == 4, "failure propagated" );
+
+    // Prerequisite that already failed fails new dependent immediately
+    q.push( "d", 0, 0, depends( { "a" } ));
+    q.getCounts( act, failed, free );
+    check( failed == 5, "failed prerequisite" );
+
+    // Unrelated prerequisite no longer references failed dependent
+    m = q.pop();
+    check( m.id == "o", "pop unrelated" );
+    q.ack( m.id, m.token );
+
+    q.getCounts( act, failed, free );
+    check( act == 0 && failed == 5, "failed counts" );
+
+    // Requeued dependent no longer waits
+    check( q.requeueFailed( Queue::MsgIdList_t{ "c" } ).size() == 1, "requeue dependent" );
+
+    m = q.pop();
+    check( m.id == "c", "requeued dependent" );
+    q.ack( m.id, m.token );
+}
+
+// Grouped dependents keep their place in group order
+void testGroups() {
+    Queue::Config_t config;
+
+    config.monitor_period = 10;
+
+    Queue q( config, &logger );
+    Queue::MsgOpts_t opts = depends( { "p" } );
+    Queue::Msg_t p, m;
+
+    opts.group = "g";
+    q.push( "p", 0 );
+    q.push( "g1", 0, 0, opts );
+    opts.depends.clear();
+    q.push( "g2", 0, 0, opts );
+    q.push( "x", 2 );
+
+    p = q.pop();
+    check( p.id == "p", "group prerequisite" );
+
+    m = q.pop();
+    check( m.id == "x", "group waits for dependent" );
+    q.ack( m.id, m.token );
+    q.ack( p.id, p.token );
+
+    check( popAck( q ) == "g1", "group dependent first" );
+    check( popAck( q ) == "g2", "group order kept" );
+
+    // Failed dependent leaves its group's pending list
+    opts.group = "h";
+    q.push( "h1", 0, 0, opts );
+    m = q.pop();
+
+    opts = Queue::MsgOpts_t();
+    opts.ttl = 30;
+    q.push( "t", 2, 0, opts );
+    opts = depends( { "t" } );
+    opts.group = "h";
+    q.push( "h2", 0, 0, opts );
+    opts.depends.clear();
+    q.push( "h3", 0, 0, opts );
+
+    this_thread::sleep_for( chrono::milliseconds( 80 ));
+
+    q.ack( m.id, m.token );
+    check( popAck( q ) == "h3", "group skips failed dependent" );
+
+    size_t act, failed, free;
+    q.getCounts( act, failed, free );
+    check( act == 0 && failed == 1, "group depends drained" );
+}
+
+int main( int argc, char ** argv ) {
+    cout << "DEPENDENCY RELEASE TESTING\n";
+
+    testRelease();
+
+    cout << "DEPENDENCY FAILURE TESTING\n";
+
+    testFailure();
+
+    cout << "GROUPED DEPENDENCY TESTING\n";
+
+    testGroups();
+
+    cout << "PASSED\n";
+
+    return 0;
+}
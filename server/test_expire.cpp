@@ -0,0 +1,109 @@
+#include <iostream>
+#include <string>
+#include <thread>
+#include <chrono>
+#include "Queue.hpp"
+#include "TestUtil.hpp"
+
+using namespace std;
+using namespace MonQueue;
+
+Queue::MsgOpts_t ttl( size_t a_ttl, const string & a_group = string() ) {
+    Queue::MsgOpts_t opts;
+
+    opts.ttl = a_ttl;
+    opts.group = a_group;
+
+    return opts;
+}
+
+void testDrop( Queue::DispatchPolicy_t a_dispatch ) {
+    Queue::Config_t config;
+
+    config.monitor_period = 1000;
+    config.dispatch = a_dispatch;
+
+    Queue q( config, &logger );
+    Queue::Msg_t m;
+    size_t act, failed, free;
+
+    q.push( "a", 1, 0, ttl( 50 ));
+    q.push( "b", 1, 200, ttl( 50 ));
+    q.push( "c", 1 );
+    q.push( "d", 1, 0, ttl( 1000 ));
+    q.push( "e", 0, 0, ttl( 50 ));
+
+    // Running messages do not expire
+    m = q.pop();
+    check( m.id == "e", "pop before expiry" );
+
+    this_thread::sleep_for( chrono::milliseconds( 150 ));
+
+    q.getCounts( act, failed, free );
+    check( act == 3 && failed == 0 && q.getExpiredCount() == 2, "queued and delayed expired" );
+
+    q.ack( m.id, m.token );
+
+    m = q.pop();
+    check( m.id == "c", "unexpired 1" );
+    q.ack( m.id, m.token );
+
+    m = q.pop();
+    check( m.id == "d", "unexpired 2" );
+    q.ack( m.id, m.token );
+
+    // Expired group head releases group; dependents of expired message fail
+    Queue::MsgOpts_t dep;
+    dep.depends.push_back( "g1" );
+
+    q.push( "g1", 1, 0, ttl( 50, "g" ));
+    q.push( "g2", 1, 0, ttl( 0, "g" ));
+    q.push( "h", 1, 0, dep );
+
+    this_thread::sleep_for( chrono::milliseconds( 150 ));
+
+    m = q.pop();
+    check( m.id == "g2", "group released by expiry" );
+    q.ack( m.id, m.token );
+
+    q.getCounts( act, failed, free );
+    check( act == 0 && failed == 1 && q.getExpiredCount() == 3, "dependent of expired failed" );
+}
+
+void testFail() {
+    Queue::Config_t config;
+
+    config.monitor_period = 1000;
+    config.expire_to_failed = true;
+
+    Queue q( config, &logger );
+    size_t act, failed, free;
+
+    q.push( "a", 1, 0, ttl( 30 ));
+
+    this_thread::sleep_for( chrono::milliseconds( 100 ));
+
+    q.getCounts( act, failed, free );
+    check( act == 0 && failed == 1 && q.getExpiredCount() == 1, "expired to failed" );
+
+    // Requeued message no longer expires
+    check( q.requeueFailed( Queue::MsgIdList_t{ "a" } ).size() == 1, "requeue expired" );
+
+    this_thread::sleep_for( chrono::milliseconds( 50 ));
+
+    Queue::Msg_t m = q.pop();
+    check( m.id == "a", "requeued expired" );
+    q.ack( m.id, m.token );
+}
+
+int main( int argc, char ** argv ) {
+    cout << "TTL EXPIRY TESTING\n";
+
+    testDrop( Queue::DISPATCH_STRICT );
+    testDrop( Queue::DISPATCH_DEADLINE );
+    testFail();
+
+    cout << "PASSED\n";
+
+    return 0;
+}
@@ -0,0 +1,112 @@
+#include <iostream>
+#include <string>
+#include <thread>
+#include <chrono>
+#include "Queue.hpp"
+#include "TestUtil.hpp"
+
+#define MSG_COUNT       25
+#define PAGE_SIZE       10
+
+using namespace std;
+using namespace MonQueue;
+
+// Pop all messages without acking them, then wait for monitor to fail them
+void failMessages( Queue & q, size_t a_count ) {
+    for ( size_t i = 0; i < a_count; i++ ) {
+        q.pop();
+        // Space out pops so failure order matches push order
+        this_thread::sleep_for( chrono::milliseconds( 20 ));
+    }
+
+    this_thread::sleep_for( chrono::milliseconds( 500 ));
+}
+
+int main( int argc, char ** argv ) {
+    size_t  i, act, failed, free;
+    Queue   q( 3, 100, 100, 1, 30000, 10, &logger );
+
+    cout << "FAILED INDEX TESTING\n";
+
+    for ( i = 0; i < MSG_COUNT; i++ ) {
+        q.push( to_string( i ), 0 );
+    }
+
+    failMessages( q, MSG_COUNT );
+
+    q.getCounts( act, failed, free );
+    check( act == 0 && failed == MSG_COUNT, "all messages failed" );
+
+    // Page through failed list and verify order
+    Queue::MsgIdList_t all = q.getFailed();
+    Queue::MsgIdList_t page;
+    uint64_t cursor = 0;
+    size_t pages = 0;
+
+    check( all.size() == MSG_COUNT, "full listing size" );
+
+    i = 0;
+    do {
+        page = q.getFailed( cursor, PAGE_SIZE );
+        pages++;
+        for ( Queue::MsgIdList_t::iterator p = page.begin(); p != page.end(); p++, i++ ) {
+            check( *p == all[i], "paged listing matches full listing" );
+        }
+    } while ( cursor );
+
+    check( i == MSG_COUNT, "paged listing size" );
+    check( pages == ( MSG_COUNT + PAGE_SIZE - 1 ) / PAGE_SIZE, "page count" );
+
+    // Erase first page, listing must resume with remaining messages
+    cursor = 0;
+    page = q.getFailed( cursor, PAGE_SIZE );
+    check( q.eraseFailed( page ).size() == PAGE_SIZE, "erase page" );
+
+    cursor = 0;
+    page = q.getFailed( cursor, MSG_COUNT );
+    check( page.size() == MSG_COUNT - PAGE_SIZE, "listing after erase" );
+    check( page[0] == all[PAGE_SIZE], "listing after erase order" );
+    check( cursor == 0, "cursor at end" );
+
+    q.eraseFailed( page );
+    q.getCounts( act, failed, free );
+    check( failed == 0 && free == 100, "counts after erase" );
+
+    cout << "FAILED REQUEUE TESTING\n";
+
+    for ( i = 0; i < MSG_COUNT; i++ ) {
+        q.push( to_string( i ), 1 );
+    }
+
+    failMessages( q, MSG_COUNT );
+
+    // Requeue selected messages at a new priority
+    Queue::MsgIdList_t ids = { "0", "1", "bogus" };
+    check( q.requeueFailed( ids, 0 ).size() == 2, "requeue selected" );
+
+    q.getCounts( act, failed, free );
+    check( act == 2 && failed == MSG_COUNT - 2, "counts after requeue selected" );
+
+    // Requeue all remaining without resetting retries, with delay
+    check( q.requeueAllFailed( Queue::KEEP_PRIORITY, 100, false ) == MSG_COUNT - 2, "requeue all" );
+
+    q.getCounts( act, failed, free );
+    check( act == MSG_COUNT && failed == 0, "counts after requeue all" );
+
+    // Reset messages must be consumable and ackable
+    for ( i = 0; i < 2; i++ ) {
+        const Queue::Msg_t & msg = q.pop();
+        check( msg.id == "0" || msg.id == "1", "requeued priority" );
+        q.ack( msg.id, msg.token );
+    }
+
+    // Non-reset messages fail again on first timeout
+    failMessages( q, MSG_COUNT - 2 );
+
+    q.getCounts( act, failed, free );
+    check( act == 0 && failed == MSG_COUNT - 2, "refailed without retry reset" );
+
+    q.eraseFailed( q.getFailed() );
+
+    cout << "PASSED\n";
+}
@@ -0,0 +1,119 @@
+#include <iostream>
+#include <string>
+#include <thread>
+#include <chrono>
+#include "Queue.hpp"
+#include "TestUtil.hpp"
+
+using namespace std;
+using namespace MonQueue;
+
+Queue::MsgOpts_t group( const string & a_group ) {
+    Queue::MsgOpts_t opts;
+
+    opts.group = a_group;
+
+    return opts;
+}
+
+void testOrder() {
+    Queue::Config_t config;
+
+    config.monitor_period = 10;
+
+    Queue q( config, &logger );
+
+    q.push( "a1", 1, 0, group( "a" ));
+    q.push( "a2", 0, 0, group( "a" ));
+    q.push( "b1", 1, 0, group( "b" ));
+    q.push( "a3", 1, 0, group( "a" ));
+    q.push( "x", 2 );
+
+    // One message per group in flight; blocked a2 does not jump ahead
+    Queue::Msg_t a1 = q.pop();
+    Queue::Msg_t b1 = q.pop();
+    Queue::Msg_t x = q.pop();
+
+    check( a1.id == "a1" && b1.id == "b1" && x.id == "x", "group first pops" );
+
+    // Requeue keeps group held
+    q.ack( a1.id, a1.token, true );
+    a1 = q.pop();
+    check( a1.id == "a1", "group requeue" );
+
+    // Completion releases next message of group
+    q.ack( a1.id, a1.token );
+
+    Queue::Msg_t a2 = q.pop();
+    check( a2.id == "a2", "group release" );
+
+    // Follow-up pushed to same group runs after existing messages
+    Queue::PushMsgList_t next( 1 );
+    next[0].id = "a4";
+    next[0].opts = group( "a" );
+
+    q.ackAndPush( a2.id, a2.token, next );
+
+    Queue::Msg_t a3 = q.pop();
+    check( a3.id == "a3", "group ack push order" );
+    q.ack( a3.id, a3.token );
+
+    Queue::Msg_t a4 = q.pop();
+    check( a4.id == "a4", "group ack push" );
+    q.ack( a4.id, a4.token );
+
+    q.ack( b1.id, b1.token );
+    q.ack( x.id, x.token );
+
+    size_t act, failed, free;
+    q.getCounts( act, failed, free );
+    check( act == 0, "group drained" );
+}
+
+void testFailure() {
+    Queue::Config_t config;
+
+    config.ack_timeout = 50;
+    config.max_retries = 1;
+    config.monitor_period = 10;
+
+    Queue q( config, &logger );
+
+    q.push( "g1", 0, 0, group( "g" ));
+    q.push( "g2", 0, 100, group( "g" ));
+    q.push( "g3", 0, 0, group( "g" ));
+
+    // Failure of g1 releases g2 (which still honors its own delay)
+    Queue::Msg_t g1 = q.pop();
+    check( g1.id == "g1", "group fail pop" );
+
+    Queue::Msg_t g2 = q.pop();
+    check( g2.id == "g2", "group release after fail" );
+
+    // Failed message requeued behind the current head of its group
+    check( q.requeueFailed( Queue::MsgIdList_t{ "g1" } ).size() == 1, "group requeue failed" );
+
+    q.ack( g2.id, g2.token );
+
+    Queue::Msg_t g3 = q.pop();
+    check( g3.id == "g3", "group g3" );
+    q.ack( g3.id, g3.token );
+
+    g1 = q.pop();
+    check( g1.id == "g1", "group requeued g1" );
+    q.ack( g1.id, g1.token );
+}
+
+int main( int argc, char ** argv ) {
+    cout << "GROUP ORDER TESTING\n";
+
+    testOrder();
+
+    cout << "GROUP FAILURE TESTING\n";
+
+    testFailure();
+
+    cout << "PASSED\n";
+
+    return 0;
+}
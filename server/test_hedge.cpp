@@ -0,0 +1,149 @@
+#include <iostream>
+#include <string>
+#include <thread>
+#include <chrono>
+#include "Queue.hpp"
+#include "TestUtil.hpp"
+
+using namespace std;
+using namespace MonQueue;
+
+bool ackFails( Queue & q, const string & a_id, const string & a_token ) {
+    try {
+        q.ack( a_id, a_token );
+    } catch ( exception & e ) {
+        return true;
+    }
+    return false;
+}
+
+Queue::Msg_t popCopy( Queue & q ) {
+    return q.pop();
+}
+
+void testSketch() {
+    DurationSketch sketch( 10000 );
+
+    for ( uint64_t i = 1; i <= 1000; i++ ) {
+        sketch.add( i );
+    }
+
+    uint64_t p50 = sketch.quantile( 0.5 );
+    uint64_t p99 = sketch.quantile( 0.99 );
+
+    check( sketch.count() == 1000, "sketch count" );
+    check( p50 >= 500 && p50 <= 500 * 1.07, "sketch p50" );
+    check( p99 >= 990 && p99 <= 990 * 1.07, "sketch p99" );
+
+    // Old samples decay as new ones arrive
+    DurationSketch recent( 100 );
+
+    for ( int i = 0; i < 1000; i++ ) {
+        recent.add( 1000 );
+    }
+    for ( int i = 0; i < 1000; i++ ) {
+        recent.add( 10 );
+    }
+
+    check( recent.quantile( 0.9 ) == 10, "sketch decay" );
+}
+
+int main( int argc, char ** argv ) {
+    Queue::Config_t config;
+    size_t act, failed, free;
+    int i;
+
+    config.ack_timeout = 5000;
+    config.monitor_period = 10;
+    config.hedge_quantile = 0.9;
+    config.hedge_min_samples = 20;
+
+    Queue q( config, &logger );
+
+    cout << "SKETCH TESTING\n";
+
+    testSketch();
+
+    cout << "HEDGE TESTING\n";
+
+    // Establish processing time distribution (~10 msec)
+    for ( i = 0; i < 30; i++ ) {
+        q.push( to_string( i ), 0 );
+        const Queue::Msg_t & msg = q.pop();
+        this_thread::sleep_for( chrono::milliseconds( 10 ));
+        q.ack( msg.id, msg.token );
+    }
+
+    // Straggler is hedged to an idle consumer, hedge ACK wins
+    q.push( "slow", 0 );
+    Queue::Msg_t orig = q.pop();
+
+    auto start = chrono::system_clock::now();
+    Queue::Msg_t hedge = popCopy( q );
+    auto wait = chrono::duration_cast<chrono::milliseconds>( chrono::system_clock::now() - start ).count();
+
+    check( hedge.id == "slow" && hedge.token != orig.token, "hedge lease issued" );
+    check( wait < 1000, "hedge issued well before ACK timeout" );
+
+    q.touch( orig.id, orig.token );
+    q.ack( hedge.id, hedge.token );
+    check( ackFails( q, orig.id, orig.token ), "original lease cancelled" );
+
+    // Original ACK wins
+    q.push( "slow2", 0 );
+    orig = q.pop();
+    hedge = popCopy( q );
+
+    check( hedge.id == "slow2", "second hedge lease issued" );
+    q.ack( orig.id, orig.token );
+    check( ackFails( q, hedge.id, hedge.token ), "hedge lease cancelled" );
+
+    q.getCounts( act, failed, free );
+    check( act == 0 && failed == 0, "counts" );
+
+    cout << "ADAPTIVE TIMEOUT TESTING\n";
+
+    config.hedge_quantile = 0;
+    config.adaptive_quantile = 0.9;
+    config.adaptive_factor = 2;
+    config.adaptive_min_timeout = 50;
+    config.adaptive_min_samples = 20;
+
+    Queue aq( config, &logger );
+    Queue::MsgOpts_t opts;
+
+    opts.msg_class = "fast";
+
+    for ( i = 0; i < 30; i++ ) {
+        aq.push( to_string( i ), 0, 0, opts );
+        const Queue::Msg_t & msg = aq.pop();
+        this_thread::sleep_for( chrono::milliseconds( 10 ));
+        aq.ack( msg.id, msg.token );
+    }
+
+    // Wait for monitor to refresh thresholds
+    this_thread::sleep_for( chrono::milliseconds( 50 ));
+
+    Queue::RunStatsList_t stats = aq.getRunStats();
+    check( stats.size() == 4 && stats[3].msg_class == "fast", "class statistics listed" );
+    check( stats[3].samples == 30, "class sample count" );
+    check( stats[3].ack_timeout >= 50 && stats[3].ack_timeout < 100, "adaptive timeout derived" );
+    check( stats[0].samples == 0 && stats[0].ack_timeout == 5000, "priority timeout unchanged" );
+
+    // Hung message of adapted class is detected quickly
+    aq.push( "hung", 0, 0, opts );
+    orig = aq.pop();
+    this_thread::sleep_for( chrono::milliseconds( 300 ));
+    check( ackFails( aq, orig.id, orig.token ), "adaptive timeout expired" );
+
+    // Message without class uses queue default
+    aq.push( "plain", 0 );
+    const Queue::Msg_t & retry = aq.pop();
+    check( retry.id == "hung", "adaptive timeout retry" );
+    aq.ack( retry.id, retry.token );
+    orig = aq.pop();
+    this_thread::sleep_for( chrono::milliseconds( 300 ));
+    aq.ack( orig.id, orig.token );
+
+    cout << "PASSED\n";
+}
@@ -0,0 +1,197 @@
+#include <iostream>
+#include <string>
+#include <thread>
+#include <chrono>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "Queue.hpp"
+#include "TestUtil.hpp"
+
+using namespace std;
+using namespace MonQueue;
+
+Queue::Config_t overflowConfig( const string & a_path, size_t a_capacity, size_t a_batch, size_t a_segment_size = 64 << 20 ) {
+    Queue::Config_t config = testConfig( a_capacity, 1000 );
+
+    config.overflow_path = a_path;
+    config.overflow_batch = a_batch;
+    config.overflow_segment_size = a_segment_size;
+
+    return config;
+}
+
+bool exists( const string & a_path ) {
+    struct stat st;
+
+    return stat( a_path.c_str(), &st ) == 0;
+}
+
+void testOrder( const string & a_path ) {
+    size_t act, failed, free;
+
+    {
+        // Small segments force many segment files
+        Queue q( overflowConfig( a_path, 4, 2, 200 ), &logger );
+
+        for ( size_t i = 0; i < 100; i++ ) {
+            q.push( "m" + to_string( i ), 1 );
+        }
+
+        q.getCounts( act, failed, free );
+        check( act == 4 && free == 0 && q.getOverflowCount() == 96, "pushes overflowed" );
+        check( exists( a_path + ".1.0.ovf" ) && !exists( a_path + ".0.1.ovf" ), "segment files" );
+
+        for ( size_t i = 0; i < 100; i++ ) {
+            check( popAck( q ) == "m" + to_string( i ), "overflow order" );
+        }
+
+        q.getCounts( act, failed, free );
+        check( act == 0 && q.getOverflowCount() == 0, "overflow drained" );
+
+        // Without an overflow tier, a full queue has no room
+        Queue full( testConfig( 1 ), &logger );
+        full.push( "f", 0 );
+        check( !full.hasRoom( Queue::MsgOpts_t() ), "no room without overflow" );
+        check( !exists( a_path + ".1.0.ovf" ), "read segments removed" );
+
+        q.push( "n", 1 );
+    }
+
+    check( !exists( a_path + ".1.0.ovf" ) && !exists( a_path + ".0.0.ovf" ), "logs removed" );
+}
+
+void testPriority( const string & a_path ) {
+    Queue q( overflowConfig( a_path, 4, 2 ), &logger );
+    size_t last_y = 0, next_x = 0, next_y = 0;
+    string id;
+
+    for ( size_t i = 0; i < 10; i++ ) {
+        q.push( "x" + to_string( i ), 1 );
+    }
+
+    for ( size_t i = 0; i < 6; i++ ) {
+        q.push( "y" + to_string( i ), 0 );
+    }
+
+    check( q.getOverflowCount() == 12, "both priorities overflowed" );
+
+    // Each priority stays in order, and higher priority is paged in first
+    for ( size_t i = 0; i < 16; i++ ) {
+        id = popAck( q );
+
+        if ( id[0] == 'x' ) {
+            check( id == "x" + to_string( next_x++ ), "low priority order" );
+        } else {
+            check( id == "y" + to_string( next_y++ ), "high priority order" );
+            last_y = i;
+        }
+    }
+
+    check( last_y < 10, "high priority paged first" );
+}
+
+void testOptions( const string & a_path ) {
+    Queue q( overflowConfig( a_path, 2, 1 ), &logger );
+    Queue::MsgOpts_t opts;
+
+    q.push( "a1", 0 );
+    q.push( "a2", 0 );
+
+    // At capacity, room remains only for messages that can overflow
+    check( q.hasRoom( opts ), "room in overflow" );
+
+    // Grouped messages are not overflowed
+    opts.group = "g";
+    check( !q.hasRoom( opts ), "no room for grouped message" );
+
+    try {
+        q.push( "g", 0, 0, opts );
+        check( false, "grouped message rejected" );
+    } catch ( length_error & e ) {
+    }
+
+    // TTL and delay keep running while in overflow
+    opts = Queue::MsgOpts_t();
+    opts.ttl = 50;
+    q.push( "t", 0, 0, opts );
+
+    auto delay_start = chrono::steady_clock::now();
+
+    q.push( "d", 0, 150 );
+
+    // Overflowed IDs are reserved
+    try {
+        q.push( "d", 0 );
+        check( false, "duplicate of overflowed message rejected" );
+    } catch ( runtime_error & e ) {
+    }
+
+    q.push( "b", 0 );
+
+    this_thread::sleep_for( chrono::milliseconds( 100 ));
+
+    errors = 0;
+    check( popAck( q ) == "a1" && popAck( q ) == "a2", "in-memory messages" );
+
+    // Expired message is discarded when paged in
+    check( popAck( q ) == "b", "paged message" );
+    check( popAck( q ) == "d", "delayed message" );
+    check( chrono::steady_clock::now() - delay_start >= chrono::milliseconds( 140 ), "delay kept" );
+    check( q.getExpiredCount() == 1 && q.getOverflowCount() == 0 && errors == 0, "expired message" );
+
+    q.push( "d", 0 );
+}
+
+void testTenantQuota( const string & a_path ) {
+    Queue::Config_t config = overflowConfig( a_path, 2, 1 );
+    Queue::MsgOpts_t opts;
+
+    config.tenants["t"].quota = 3;
+
+    Queue q( config, &logger );
+
+    opts.tenant = "t";
+    q.push( "a", 0, 0, opts );
+    q.push( "b", 0, 0, opts );
+    q.push( "c", 0, 0, opts );
+
+    // Overflowed message is held against the quota
+    try {
+        q.push( "d", 0, 0, opts );
+        check( false, "quota includes overflow" );
+    } catch ( length_error & e ) {
+    }
+
+    q.push( "x", 0 );
+    check( q.getOverflowCount() == 2, "overflowed" );
+
+    // Paged in without exceeding the quota
+    check( popAck( q ) == "a", "first message" );
+    this_thread::sleep_for( chrono::milliseconds( 50 ));
+    check( q.getOverflowCount() == 1, "paged in" );
+
+    q.push( "d", 0, 0, opts );
+
+    try {
+        q.push( "e", 0, 0, opts );
+        check( false, "quota kept after page-in" );
+    } catch ( length_error & e ) {
+    }
+
+    check( popAck( q ) == "b" && popAck( q ) == "c", "paged message" );
+    check( popAck( q ) == "x" && popAck( q ) == "d", "queue order" );
+    q.push( "e", 0, 0, opts );
+}
+
+int main( int argc, char ** argv ) {
+    string path = string( "/tmp/test_overflow." ) + to_string( getpid() );
+
+    testOrder( path );
+    testPriority( path );
+    testOptions( path );
+    testTenantQuota( path );
+
+    cout << "PASSED" << endl;
+
+    return 0;
+}
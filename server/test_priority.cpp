@@ -0,0 +1,384 @@
+#include <iostream>
+#include <string>
+#include <thread>
+#include <chrono>
+#include <random>
+#include <vector>
+#include <algorithm>
+#include "Queue.hpp"
+#include "TestUtil.hpp"
+
+using namespace std;
+using namespace MonQueue;
+
+void testOrder() {
+    Queue::Config_t config;
+
+    config.monitor_period = 10;
+
+    Queue q( config, &logger );
+
+    // FIFO within priority, higher priority first
+    q.push( "a", 1 );
+    q.push( "b", 1 );
+    q.push( "c", 2 );
+    q.push( "d", 0 );
+    q.push( "e", 1 );
+
+    check( popAck( q ) == "d", "order d" );
+    check( popAck( q ) == "a", "order a" );
+    check( popAck( q ) == "b", "order b" );
+    check( popAck( q ) == "e", "order e" );
+    check( popAck( q ) == "c", "order c" );
+}
+
+void testAging() {
+    Queue::Config_t config;
+
+    config.boost_timeout = 100;
+    config.monitor_period = 10;
+
+    Queue q( config, &logger );
+
+    // After one boost period, message has aged one level only
+    q.push( "lo", 2 );
+    this_thread::sleep_for( chrono::milliseconds( 150 ));
+    q.push( "mid", 1 );
+    q.push( "hi", 0 );
+
+    check( popAck( q ) == "hi", "aging hi first" );
+    check( popAck( q ) == "lo", "aging lo ahead of mid" );
+    check( popAck( q ) == "mid", "aging mid last" );
+
+    // After two boost periods, message reaches top priority
+    q.push( "lo", 2 );
+    this_thread::sleep_for( chrono::milliseconds( 300 ));
+    q.push( "hi", 0 );
+
+    check( popAck( q ) == "lo", "aging lo at top" );
+    check( popAck( q ) == "hi", "aging hi after lo" );
+    check( q.getBoostTimeout() == 100, "fixed boost timeout" );
+}
+
+void testAutoTune() {
+    Queue::Config_t config;
+
+    config.boost_timeout = 10000;
+    config.boost_max_wait = 200;
+    config.monitor_period = 10;
+
+    Queue q( config, &logger );
+
+    // Initial step spreads max wait across priority levels
+    check( q.getBoostTimeout() == 100, "initial boost timeout" );
+
+    // Low-priority message waits well past target
+    q.push( "lo", 2 );
+    this_thread::sleep_for( chrono::milliseconds( 500 ));
+    check( popAck( q ) == "lo", "auto-tune pop" );
+    this_thread::sleep_for( chrono::milliseconds( 50 ));
+
+    size_t boost = q.getBoostTimeout();
+
+    check( boost < 100 && boost >= 10, "boost timeout reduced" );
+
+    // Short waits relax step, but never beyond max wait
+    for ( int i = 0; i < 300; i++ ) {
+        q.push( "x", 2 );
+        popAck( q );
+    }
+    this_thread::sleep_for( chrono::milliseconds( 500 ));
+
+    check( q.getBoostTimeout() > boost, "boost timeout relaxed" );
+    check( q.getBoostTimeout() <= 200, "boost timeout bounded" );
+}
+
+void testWeighted() {
+    Queue::Config_t config;
+
+    config.capacity = 1000;
+    config.monitor_period = 10;
+    config.dispatch = Queue::DISPATCH_WEIGHTED;
+    config.weights = { 3, 2, 1 };
+
+    Queue q( config, &logger );
+    size_t counts[3] = { 0, 0, 0 };
+    int i;
+
+    for ( i = 0; i < 300; i++ ) {
+        q.push( to_string( i ), i % 3 );
+    }
+
+    // While all priorities are busy, pops follow weights exactly per round
+    for ( i = 0; i < 120; i++ ) {
+        counts[stoul( popAck( q )) % 3]++;
+    }
+
+    check( counts[0] == 60 && counts[1] == 40 && counts[2] == 20, "weighted shares" );
+
+    // Share of an idle priority goes to busy priorities
+    Queue q2( config, &logger );
+
+    counts[0] = counts[1] = counts[2] = 0;
+
+    for ( i = 0; i < 60; i++ ) {
+        q2.push( to_string( i ), i % 2 ? 2 : 0 );
+    }
+
+    for ( i = 0; i < 40; i++ ) {
+        counts[stoul( popAck( q2 )) % 2 ? 2 : 0]++;
+    }
+
+    check( counts[0] == 30 && counts[2] == 10, "weighted idle share" );
+
+    // Invalid weights rejected
+    config.weights = { 1, 0, 1 };
+
+    bool failed = false;
+    try {
+        Queue bad( config );
+    } catch ( exception & e ) {
+        failed = true;
+    }
+
+    check( failed, "weighted zero weight" );
+}
+
+struct HeapItem {
+    HeapItem() : pos( (size_t)-1 ), key( 0 ) {}
+
+    size_t      pos;
+    uint64_t    key;
+};
+
+void testHeap() {
+    IndexedHeap<HeapItem,&HeapItem::pos> heap;
+    vector<HeapItem> items( 1000 );
+    mt19937 rng( 1 );
+    uint64_t last = 0;
+    size_t i, count = 0;
+
+    for ( i = 0; i < items.size(); i++ ) {
+        items[i].key = rng() % 500;
+        heap.push( &items[i], items[i].key, i );
+    }
+
+    // Remove every third item from arbitrary positions
+    for ( i = 0; i < items.size(); i += 3 ) {
+        heap.remove( &items[i] );
+        check( !heap.contains( &items[i] ), "heap remove" );
+    }
+
+    check( heap.countBelow( 250 ) == (size_t)count_if( items.begin(), items.end(),
+        []( const HeapItem & a ) { return a.pos != (size_t)-1 && a.key < 250; }), "heap count below" );
+
+    while ( !heap.empty() ) {
+        check( heap.topKey() >= last, "heap order" );
+        last = heap.topKey();
+        heap.pop();
+        count++;
+    }
+
+    check( count == items.size() - ( items.size() + 2 ) / 3, "heap size" );
+}
+
+void testDeadline() {
+    Queue::Config_t config;
+    Queue::MsgOpts_t opts;
+    size_t overdue, late;
+
+    config.monitor_period = 10;
+    config.dispatch = Queue::DISPATCH_DEADLINE;
+
+    Queue q( config, &logger );
+
+    // Earliest due first regardless of priority, then priority, then arrival
+    q.push( "none-lo", 2 );
+    q.push( "none-hi", 0 );
+    opts.due = 5000;
+    q.push( "due-5s", 2, 0, opts );
+    opts.due = 1000;
+    q.push( "due-1s-lo", 2, 0, opts );
+    q.push( "due-1s-hi", 1, 0, opts );
+    opts.due = 20;
+    q.push( "due-now", 2, 0, opts );
+
+    this_thread::sleep_for( chrono::milliseconds( 50 ));
+
+    q.getDeadlineStats( overdue, late );
+    check( overdue == 1 && late == 0, "deadline overdue" );
+
+    check( popAck( q ) == "due-now", "deadline due-now" );
+    check( popAck( q ) == "due-1s-hi", "deadline due-1s-hi" );
+    check( popAck( q ) == "due-1s-lo", "deadline due-1s-lo" );
+    check( popAck( q ) == "due-5s", "deadline due-5s" );
+    check( popAck( q ) == "none-hi", "deadline none-hi" );
+    check( popAck( q ) == "none-lo", "deadline none-lo" );
+
+    q.getDeadlineStats( overdue, late );
+    check( overdue == 0 && late == 1, "deadline late" );
+}
+
+// Overdue count covers ready and delayed messages, but not expired ones
+void testOverdue() {
+    Queue::Config_t config;
+    Queue::MsgOpts_t opts;
+    size_t overdue, late;
+
+    config.monitor_period = 10;
+    config.expire_to_failed = true;
+
+    Queue q( config, &logger );
+
+    opts.due = 20;
+    q.push( "ready", 1, 0, opts );
+    q.push( "delayed", 1, 1000, opts );
+    opts.ttl = 30;
+    q.push( "expired", 1, 0, opts );
+    opts.ttl = 0;
+    opts.due = 5000;
+    q.push( "not-due", 0, 0, opts );
+
+    this_thread::sleep_for( chrono::milliseconds( 80 ));
+
+    q.getDeadlineStats( overdue, late );
+    check( overdue == 2 && late == 0, "overdue waiting" );
+
+    check( popAck( q ) == "not-due", "overdue pop not-due" );
+    check( popAck( q ) == "ready", "overdue pop ready" );
+
+    q.getDeadlineStats( overdue, late );
+    check( overdue == 1 && late == 1, "overdue after pop" );
+
+    check( q.requeueAllFailed() == 1, "overdue requeue expired" );
+
+    q.getDeadlineStats( overdue, late );
+    check( overdue == 2, "overdue requeued" );
+}
+
+bool pushFails( Queue & q, const string & a_id, uint8_t a_priority, const Queue::MsgOpts_t & a_opts ) {
+    try {
+        q.push( a_id, a_priority, 0, a_opts );
+    } catch ( exception & e ) {
+        return true;
+    }
+    return false;
+}
+
+void testTenants() {
+    Queue::Config_t config;
+    Queue::MsgOpts_t bulk, team, vip;
+    int i;
+
+    config.capacity = 1000;
+    config.monitor_period = 10;
+    config.tenant_quota = 100;
+    config.tenants["vip"] = Queue::TenantConfig_t( 0, 2 );
+
+    Queue q( config, &logger );
+
+    bulk.tenant = "bulk";
+    team.tenant = "team";
+    vip.tenant = "vip";
+
+    // Quota enforced per tenant; untagged and unlimited tenants exempt
+    for ( i = 0; i < 100; i++ ) {
+        q.push( "b" + to_string( i ), 1, 0, bulk );
+    }
+
+    check( pushFails( q, "b100", 1, bulk ), "tenant quota" );
+
+    for ( i = 0; i < 150; i++ ) {
+        q.push( "u" + to_string( i ), 2 );
+        q.push( "v" + to_string( i ), 2, 0, vip );
+    }
+
+    // Backlog of one tenant does not delay another at the same priority
+    q.push( "t0", 1, 0, team );
+    q.push( "t1", 1, 0, team );
+
+    check( popAck( q ) == "b0", "tenant b0" );
+    check( popAck( q ) == "t0", "tenant t0" );
+    check( popAck( q ) == "b1", "tenant b1" );
+    check( popAck( q ) == "t1", "tenant t1" );
+    check( popAck( q ) == "b2", "tenant b2" );
+
+    // ACK frees quota
+    check( !pushFails( q, "b100", 1, bulk ), "tenant quota freed" );
+
+    // Drain priority 1; loop ends on u0 (untagged queue joined priority 2 first)
+    while ( popAck( q )[0] == 'b' );
+
+    // Weighted tenants: vip gets two pops per turn
+    check( popAck( q ) == "v0", "tenant v0" );
+    check( popAck( q ) == "v1", "tenant v1" );
+    check( popAck( q ) == "u1", "tenant u1" );
+    check( popAck( q ) == "v2", "tenant v2" );
+    check( popAck( q ) == "v3", "tenant v3" );
+    check( popAck( q ) == "u2", "tenant u2" );
+}
+
+// Tenant limit includes the untagged tenant
+void testTenantLimit() {
+    Queue::Config_t config;
+    Queue::MsgOpts_t opts;
+    size_t i;
+
+    config.capacity = Queue::MAX_TENANTS + 1;
+    config.monitor_period = 10;
+
+    for ( i = 0; i < Queue::MAX_TENANTS; i++ ) {
+        config.tenants["t" + to_string( i )] = Queue::TenantConfig_t();
+    }
+
+    try {
+        Queue q( config, &logger );
+        check( false, "tenant limit config" );
+    } catch ( exception & e ) {
+    }
+
+    config.tenants.clear();
+
+    Queue q( config, &logger );
+
+    for ( i = 1; i < Queue::MAX_TENANTS; i++ ) {
+        opts.tenant = "t" + to_string( i );
+        q.push( opts.tenant, 0, 0, opts );
+    }
+
+    opts.tenant = "extra";
+    check( pushFails( q, "extra", 0, opts ), "tenant limit" );
+}
+
+int main( int argc, char ** argv ) {
+    cout << "ORDER TESTING\n";
+
+    testOrder();
+
+    cout << "AGING TESTING\n";
+
+    testAging();
+
+    cout << "AUTO-TUNE TESTING\n";
+
+    testAutoTune();
+
+    cout << "WEIGHTED DISPATCH TESTING\n";
+
+    testWeighted();
+
+    cout << "DEADLINE DISPATCH TESTING\n";
+
+    testHeap();
+    testDeadline();
+    testOverdue();
+
+    cout << "TENANT TESTING\n";
+
+    testTenants();
+    testTenantLimit();
+
+    cout << "PASSED\n";
+
+    return 0;
+}
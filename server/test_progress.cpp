@@ -0,0 +1,188 @@
+#include <iostream>
+#include <string>
+#include <thread>
+#include <chrono>
+#include "Queue.hpp"
+#include "TestUtil.hpp"
+
+using namespace std;
+using namespace MonQueue;
+
+bool ackFails( Queue & q, const string & a_id, const string & a_token ) {
+    try {
+        q.ack( a_id, a_token );
+    } catch ( exception & e ) {
+        return true;
+    }
+    return false;
+}
+
+int main( int argc, char ** argv ) {
+    size_t  act, failed, free;
+    Queue   q( 3, 100, 200, 2, 30000, 10, &logger );
+    string  id, token;
+
+    cout << "HEARTBEAT TESTING\n";
+
+    // Heartbeats keep a long task alive well beyond the ACK timeout
+    q.push( "touch", 0 );
+    {
+        const Queue::Msg_t & msg = q.pop();
+        id = msg.id;
+        token = msg.token;
+    }
+
+    for ( int i = 0; i < 10; i++ ) {
+        this_thread::sleep_for( chrono::milliseconds( 100 ));
+        q.touch( id, token );
+    }
+
+    q.ack( id, token );
+
+    // Explicit extension longer than ACK timeout
+    q.push( "extend", 0 );
+    {
+        const Queue::Msg_t & msg = q.pop();
+        id = msg.id;
+        token = msg.token;
+    }
+
+    q.touch( id, token, 1000 );
+    this_thread::sleep_for( chrono::milliseconds( 600 ));
+    q.ack( id, token );
+
+    // Without heartbeats, message is retried and old token is rejected
+    q.push( "hang", 0 );
+    {
+        const Queue::Msg_t & msg = q.pop();
+        id = msg.id;
+        token = msg.token;
+    }
+
+    this_thread::sleep_for( chrono::milliseconds( 400 ));
+
+    bool threw = false;
+    try {
+        q.touch( id, token );
+    } catch ( exception & e ) {
+        threw = true;
+    }
+    check( threw, "touch after timeout rejected" );
+    check( ackFails( q, id, token ), "ack after timeout rejected" );
+
+    {
+        const Queue::Msg_t & msg = q.pop();
+        check( msg.id == "hang", "retried message" );
+        q.ack( msg.id, msg.token );
+    }
+
+    q.getCounts( act, failed, free );
+    check( act == 0 && failed == 0, "counts" );
+
+    cout << "PER-MESSAGE TIMEOUT TESTING\n";
+
+    // Long per-message timeout outlives queue default
+    Queue::MsgOpts_t opts;
+    opts.ack_timeout = 1000;
+    q.push( "slow", 0, 0, opts );
+    {
+        const Queue::Msg_t & msg = q.pop();
+        id = msg.id;
+        token = msg.token;
+    }
+
+    this_thread::sleep_for( chrono::milliseconds( 500 ));
+    q.ack( id, token );
+
+    // Short per-message timeout with single retry fails quickly
+    opts.ack_timeout = 50;
+    opts.max_retries = 1;
+    q.push( "fast", 0, 0, opts );
+    {
+        const Queue::Msg_t & msg = q.pop();
+        id = msg.id;
+        token = msg.token;
+    }
+
+    this_thread::sleep_for( chrono::milliseconds( 150 ));
+    check( ackFails( q, id, token ), "short timeout expired" );
+
+    q.getCounts( act, failed, free );
+    check( act == 0 && failed == 1, "single retry failed message" );
+    q.eraseFailed( q.getFailed() );
+
+    cout << "CHECKPOINT TESTING\n";
+
+    q.push( "resume", 0 );
+    {
+        const Queue::Msg_t & msg = q.pop();
+        check( msg.checkpoint.empty(), "no initial checkpoint" );
+        q.checkpoint( msg.id, msg.token, "step 1" );
+        q.checkpoint( msg.id, msg.token, "step 2" );
+    }
+
+    // Consumer "dies", retry must carry last checkpoint
+    this_thread::sleep_for( chrono::milliseconds( 400 ));
+    {
+        const Queue::Msg_t & msg = q.pop();
+        check( msg.id == "resume" && msg.checkpoint == "step 2", "checkpoint delivered on retry" );
+        q.ack( msg.id, msg.token, true );
+    }
+
+    // ACK with requeue discards checkpoint
+    {
+        const Queue::Msg_t & msg = q.pop();
+        check( msg.id == "resume" && msg.checkpoint.empty(), "checkpoint cleared by ack" );
+
+        threw = false;
+        try {
+            q.checkpoint( msg.id, msg.token, string( Queue::MAX_CHECKPOINT_SIZE + 1, 'x' ));
+        } catch ( exception & e ) {
+            threw = true;
+        }
+        check( threw, "oversize checkpoint rejected" );
+
+        q.ack( msg.id, msg.token );
+    }
+
+    cout << "CONTINUATION TESTING\n";
+
+    Queue::PushMsgList_t next( 2 );
+    next[0].id = "step";
+    next[1].id = "branch";
+    next[1].priority = 1;
+
+    q.push( "step", 0 );
+    q.push( "other", 0 );
+    {
+        const Queue::Msg_t & msg = q.pop();
+        check( msg.id == "step", "first step" );
+        id = msg.id;
+        token = msg.token;
+    }
+
+    // Duplicate follow-up ID must reject whole operation
+    next[1].id = "other";
+    threw = false;
+    try {
+        q.ackAndPush( id, token, next );
+    } catch ( exception & e ) {
+        threw = true;
+    }
+    check( threw, "duplicate follow-up rejected" );
+
+    // Original message is still running, retry with valid follow-ups
+    next[1].id = "branch";
+    q.ackAndPush( id, token, next );
+
+    q.getCounts( act, failed, free );
+    check( act == 3 && failed == 0, "counts after ack and push" );
+
+    for ( int i = 0; i < 3; i++ ) {
+        const Queue::Msg_t & msg = q.pop();
+        check( i < 2 || msg.id == "branch", "follow-up priority order" );
+        q.ack( msg.id, msg.token );
+    }
+
+    cout << "PASSED\n";
+}
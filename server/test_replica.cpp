@@ -0,0 +1,247 @@
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <chrono>
+#include <unistd.h>
+#include <cstring>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include "Queue.hpp"
+#include "TestUtil.hpp"
+#include "Replication.hpp"
+
+using namespace std;
+using namespace MonQueue;
+
+void waitSynced( ReplicationSender & a_sender ) {
+    bool connected = false;
+    size_t records;
+    uint64_t lag = 1;
+
+    for ( size_t i = 0; i < 2000 && !( connected && lag == 0 ); i++ ) {
+        this_thread::sleep_for( chrono::milliseconds( 5 ));
+        a_sender.getStats( connected, records, lag );
+    }
+
+    check( connected && lag == 0, "standby caught up" );
+}
+
+// Standby: applies replicated state, then is promoted and serves the primary's leases
+void runStandby( int a_port_fd, int a_lease_fd ) {
+    Queue q( testConfig( 200000 ), &logger ), bulk( testConfig( 200000 ), &logger );
+
+    q.setStandby( true );
+    bulk.setStandby( true );
+
+    ReplicationReceiver receiver( "127.0.0.1", 0, [&]( const string & a_name, const QueueOptions_t & ) {
+        return a_name == "bulk" ? &bulk : &q;
+    }, &logger );
+    uint16_t port = receiver.getPort();
+
+    receiver.start();
+    check( write( a_port_fd, &port, sizeof( port )) == sizeof( port ), "port sent" );
+
+    // Leases held by consumers of the primary, sent once the standby has caught up
+    string leases;
+    char buf[256];
+    ssize_t rd;
+
+    while (( rd = read( a_lease_fd, buf, sizeof( buf ))) > 0 ) {
+        leases.append( buf, rd );
+    }
+
+    bool connected;
+    size_t records, syncs, act, failed, free;
+
+    receiver.getStats( connected, records, syncs );
+    check( syncs == 2 && records > 0, "synced and streamed" );
+
+    // Primary is gone; take over
+    receiver.stop();
+    q.setStandby( false );
+    bulk.setStandby( false );
+
+    q.getCounts( act, failed, free );
+    check( act == 9 && failed == 1, "counts replicated" );
+    check( q.getFailed().size() == 1 && q.getFailed()[0] == "t", "failed set replicated" );
+
+    bulk.getCounts( act, failed, free );
+    check( act == 100000, "late queue replicated" );
+
+    istringstream in( leases );
+    string id, token, r1_token;
+
+    while ( in >> id >> token ) {
+        if ( id == "r1" ) {
+            r1_token = token;
+        } else {
+            q.ack( id, token );
+        }
+    }
+
+    check( r1_token.size(), "lease of synced message" );
+
+    try {
+        q.ack( "r1", "bad" );
+        check( false, "invalid token rejected" );
+    } catch ( runtime_error & e ) {
+    }
+
+    check( popAck( q ) == "f" && popAck( q ) == "q", "requeued messages" );
+    check( popAck( q ) == "d", "prerequisite released by ACK after promotion" );
+    check( popAck( q ) == "s1" && popAck( q ) == "b", "queue order" );
+    check( popAck( q ) == "g1" && popAck( q ) == "g2", "group order" );
+
+    // Lease deadline carried over; retry delivers the checkpoint
+    Queue::Msg_t m = q.pop();
+
+    check( m.id == "r1" && m.checkpoint == "cp1", "checkpoint replicated" );
+    check( m.token != r1_token, "timed out lease replaced" );
+
+    // Only the rejected second connection is reported
+    check( errors == 1, "no other standby errors" );
+}
+
+void runPrimary( uint16_t a_port, int a_lease_fd ) {
+    Queue q( testConfig( 200000 ), &logger ), bulk( testConfig( 200000 ), &logger );
+    // Limit is below the size of the bulk queue's state
+    ReplicationSender sender( "127.0.0.1", a_port, &logger, 4 << 20 );
+    Queue::MsgOpts_t opts, timeout_opts;
+
+    timeout_opts.ack_timeout = 20;
+    timeout_opts.max_retries = 1;
+
+    // State before the standby connects arrives in the initial sync
+    opts.ack_timeout = 2000;
+    q.push( "r1", 0, 0, opts );
+    q.push( "s1", 1 );
+    q.push( "s2", 0 );
+
+    Queue::Msg_t r1 = q.pop();
+
+    check( r1.id == "r1", "leased before sync" );
+    q.checkpoint( r1.id, r1.token, "cp1" );
+
+    sender.addQueue( "", QueueOptions_t(), q );
+    sender.start();
+    waitSynced( sender );
+
+    // Another connection is rejected without disturbing the stream
+    int fd = socket( AF_INET, SOCK_STREAM, 0 );
+    struct sockaddr_in addr;
+    char c;
+
+    memset( &addr, 0, sizeof( addr ));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons( a_port );
+    addr.sin_addr.s_addr = htonl( INADDR_LOOPBACK );
+
+    check( connect( fd, (struct sockaddr *)&addr, sizeof( addr )) == 0 && recv( fd, &c, 1, 0 ) == 0, "second primary rejected" );
+    close( fd );
+
+    // Transitions streamed after the sync
+    q.push( "a", 0 );
+    q.push( "b", 1 );
+
+    opts = Queue::MsgOpts_t();
+    opts.group = "g";
+    q.push( "g1", 1, 0, opts );
+    q.push( "g2", 1, 0, opts );
+
+    opts = Queue::MsgOpts_t();
+    opts.depends.push_back( "a" );
+    q.push( "d", 0, 0, opts );
+
+    check( popAck( q ) == "s2", "completed" );
+
+    Queue::Msg_t a = q.pop();
+
+    check( a.id == "a", "leased after sync" );
+    q.touch( a.id, a.token, 60000 );
+
+    q.push( "t", 0, 0, timeout_opts );
+    q.push( "f", 0, 0, timeout_opts );
+    check( q.pop().id == "t" && q.pop().id == "f", "leases to time out" );
+
+    this_thread::sleep_for( chrono::milliseconds( 100 ));
+    check( q.requeueFailed( Queue::MsgIdList_t( 1, "f" )).size() == 1, "failed message requeued" );
+
+    q.push( "q", 0 );
+
+    Queue::Msg_t m = q.pop();
+
+    check( m.id == "f", "requeued failed message" );
+    q.ack( m.id, m.token, true );
+
+    // Requeued behind "f" since its ACK with requeue came later
+    m = q.pop();
+    check( m.id == "q", "requeue order" );
+    q.ack( m.id, m.token, true );
+
+    // Queue added while connected is synced on its own
+    for ( size_t i = 0; i < 50000; i++ ) {
+        bulk.push( "m" + to_string( i ), i % 2 );
+    }
+
+    sender.addQueue( "bulk", QueueOptions_t(), bulk );
+
+    auto start = chrono::steady_clock::now();
+
+    for ( size_t i = 50000; i < 100000; i++ ) {
+        bulk.push( "m" + to_string( i ), i % 2 );
+    }
+
+    waitSynced( sender );
+
+    double secs = chrono::duration<double>( chrono::steady_clock::now() - start ).count();
+
+    cout << "Replicated 50000 pushes in " << (size_t)( secs * 1000 ) << " msec (" << (size_t)( 50000 / secs ) << " msg/sec)\n";
+
+    check( errors == 0, "no primary errors" );
+
+    string leases = r1.id + " " + r1.token + "\n" + a.id + " " + a.token + "\n";
+
+    check( write( a_lease_fd, leases.data(), leases.size() ) == (ssize_t)leases.size(), "leases sent" );
+    close( a_lease_fd );
+
+    // Standby disconnecting is reported from here on
+    errors = 0;
+}
+
+int main( int argc, char ** argv ) {
+    int port_pipe[2], lease_pipe[2];
+
+    check( pipe( port_pipe ) == 0 && pipe( lease_pipe ) == 0, "pipes" );
+
+    // Fork before any threads are started
+    pid_t pid = fork();
+
+    check( pid >= 0, "fork" );
+
+    if ( pid == 0 ) {
+        close( port_pipe[0] );
+        close( lease_pipe[1] );
+        runStandby( port_pipe[1], lease_pipe[0] );
+        _exit( 0 );
+    }
+
+    close( port_pipe[1] );
+    close( lease_pipe[0] );
+
+    uint16_t port;
+
+    check( read( port_pipe[0], &port, sizeof( port )) == sizeof( port ), "standby port" );
+
+    runPrimary( port, lease_pipe[1] );
+
+    int status;
+
+    waitpid( pid, &status, 0 );
+    check( WIFEXITED( status ) && WEXITSTATUS( status ) == 0, "standby checks passed" );
+
+    cout << "PASSED" << endl;
+
+    return 0;
+}
@@ -0,0 +1,189 @@
+#include <iostream>
+#include <string>
+#include <thread>
+#include <chrono>
+#include <cstdio>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include "Queue.hpp"
+#include "TestUtil.hpp"
+
+using namespace std;
+using namespace MonQueue;
+
+Queue::Config_t snapConfig( const string & a_path, bool a_wal ) {
+    Queue::Config_t config = testConfig( 200000 );
+
+    config.expire_to_failed = true;
+    config.snapshot_path = a_path + ".snap";
+    config.snapshot_interval = 0;
+    config.snapshot_threads = 4;
+
+    if ( a_wal ) {
+        config.wal_path = a_path + ".wal";
+        config.wal_sync_interval = 5;
+    }
+
+    return config;
+}
+
+void removeFiles( const string & a_path ) {
+    remove(( a_path + ".snap" ).c_str() );
+    remove(( a_path + ".wal" ).c_str() );
+}
+
+// Snapshot plus log tail survive a crash (child exits without cleanup)
+void testCrash( const string & a_path ) {
+    size_t act, failed, free;
+    pid_t pid = fork();
+
+    check( pid >= 0, "fork" );
+
+    if ( pid == 0 ) {
+        Queue q( snapConfig( a_path, true ), &logger );
+        Queue::MsgOpts_t opts;
+
+        for ( size_t i = 0; i < 1000; i++ ) {
+            q.push( "m" + to_string( i ), 1 );
+        }
+
+        q.push( "a", 0 );
+        q.snapshot();
+
+        // Logged after the snapshot
+        q.push( "b", 0 );
+        popAck( q );
+
+        opts.ttl = 20;
+        q.push( "e", 0, 0, opts );
+
+        // Allow for log rotation and a few group commits
+        this_thread::sleep_for( chrono::milliseconds( 500 ));
+        _exit( 0 );
+    }
+
+    int status;
+
+    waitpid( pid, &status, 0 );
+    check( WIFEXITED( status ) && WEXITSTATUS( status ) == 0, "child completed" );
+
+    // Log holds only records after the snapshot
+    check( fileSize( a_path + ".wal" ) < 1000, "log truncated" );
+
+    {
+        Queue q( snapConfig( a_path, true ), &logger );
+
+        q.getCounts( act, failed, free );
+        check( act == 1001 && failed == 1, "state recovered" );
+
+        check( popAck( q ) == "b", "pushed after snapshot" );
+        check( popAck( q ) == "m0", "pushed before snapshot" );
+
+        Queue::MsgIdList_t ids = q.getFailed();
+        check( ids.size() == 1 && ids[0] == "e", "failed after snapshot" );
+    }
+
+    removeFiles( a_path );
+}
+
+void testRestore( const string & a_path ) {
+    size_t act, failed, free, count, msec;
+    Queue::MsgOpts_t opts;
+    auto delay_start = chrono::steady_clock::now();
+
+    {
+        Queue q( snapConfig( a_path, false ), &logger );
+
+        q.push( "a", 1 );
+        q.push( "b", 0 );
+        q.push( "c", 1 );
+        q.push( "d", 1, 300 );
+
+        opts.ttl = 20;
+        q.push( "e", 1, 0, opts );
+
+        // Message timed out once keeps its retry count
+        opts = Queue::MsgOpts_t();
+        opts.ack_timeout = 20;
+        opts.max_retries = 2;
+        q.push( "r", 0, 0, opts );
+
+        check( q.pop().id == "b", "running message" );
+        check( q.pop().id == "r", "timed out message" );
+
+        this_thread::sleep_for( chrono::milliseconds( 100 ));
+
+        q.snapshot();
+        q.getSnapshotStats( count, msec );
+        check( count == 1, "snapshot written" );
+    }
+
+    {
+        Queue q( snapConfig( a_path, false ), &logger );
+
+        q.getCounts( act, failed, free );
+        check( act == 5 && failed == 1, "state restored" );
+        check( q.getFailed()[0] == "e", "failed message restored" );
+
+        // Running message first, then queue order
+        check( q.pop().id == "b", "running restored as queued" );
+        check( q.pop().id == "r", "priority order" );
+        check( popAck( q ) == "a" && popAck( q ) == "c", "queue order" );
+
+        this_thread::sleep_for( chrono::milliseconds( 100 ));
+
+        q.getCounts( act, failed, free );
+        check( failed == 2, "retry count restored" );
+
+        check( popAck( q ) == "d", "delayed message" );
+        check( chrono::steady_clock::now() - delay_start >= chrono::milliseconds( 290 ), "delay kept" );
+    }
+
+    removeFiles( a_path );
+}
+
+void testLarge( const string & a_path ) {
+    size_t act, failed, free;
+    Queue::MsgOpts_t opts;
+
+    opts.tenant = "t";
+    opts.msg_class = "c";
+
+    {
+        Queue q( snapConfig( a_path, false ), &logger );
+
+        for ( size_t i = 0; i < 100000; i++ ) {
+            q.push( "m" + to_string( i ), i % 2, 0, opts );
+        }
+    }
+
+    // Written on shutdown
+    {
+        Queue q( snapConfig( a_path, false ), &logger );
+
+        q.getCounts( act, failed, free );
+        check( act == 100000, "all messages restored" );
+
+        for ( size_t i = 0; i < 100000; i += 2 ) {
+            check( popAck( q ) == "m" + to_string( i ), "order across chunks" );
+        }
+    }
+
+    removeFiles( a_path );
+}
+
+int main( int argc, char ** argv ) {
+    string path = string( "/tmp/test_snapshot." ) + to_string( getpid() );
+
+    // Fork before any threads are started
+    testCrash( path );
+    testRestore( path );
+    testLarge( path );
+
+    check( errors == 0, "no errors reported" );
+
+    cout << "PASSED" << endl;
+
+    return 0;
+}
@@ -0,0 +1,106 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <chrono>
+#include <atomic>
+#include "Queue.hpp"
+#include "TestUtil.hpp"
+
+using namespace std;
+using namespace MonQueue;
+
+typedef TimerService::timestamp_t timestamp_t;
+
+void testTimerService() {
+    TimerService timers;
+    atomic<int> periodic( 0 ), woken( 0 );
+    timestamp_t now = chrono::system_clock::now();
+
+    // Periodic task
+    TimerService::TaskId_t p = timers.addTask( [&periodic]( const timestamp_t & a_now ) {
+        periodic++;
+        return a_now + chrono::milliseconds( 10 );
+    }, now );
+
+    // Task that sleeps until woken
+    TimerService::TaskId_t w = timers.addTask( [&woken]( const timestamp_t & ) {
+        woken++;
+        return timestamp_t::max();
+    }, timestamp_t::max() );
+
+    this_thread::sleep_for( chrono::milliseconds( 100 ));
+
+    check( periodic >= 5 && periodic <= 11, "timer periodic" );
+    check( woken == 0, "timer idle" );
+
+    timers.wakeTask( w, chrono::system_clock::now() + chrono::milliseconds( 20 ));
+    timers.wakeTask( w, chrono::system_clock::now() + chrono::hours( 1 ));
+    this_thread::sleep_for( chrono::milliseconds( 50 ));
+
+    check( woken == 1, "timer wake" );
+
+    // Removed tasks no longer run
+    timers.removeTask( p );
+    int count = periodic;
+    this_thread::sleep_for( chrono::milliseconds( 50 ));
+
+    check( periodic == count, "timer remove" );
+    check( timers.getTaskCount() == 1, "timer task count" );
+
+    timers.removeTask( w );
+}
+
+void testSharedQueues() {
+    TimerService timers;
+    vector<unique_ptr<Queue>> queues;
+    Queue::Config_t config;
+    size_t i;
+
+    config.ack_timeout = 50;
+    config.monitor_period = 10;
+
+    for ( i = 0; i < 200; i++ ) {
+        queues.emplace_back( new Queue( config, &logger, &timers ));
+    }
+
+    check( timers.getTaskCount() == 400, "shared task count" );
+
+    // Delayed messages are released, and expired messages retried, in every queue
+    for ( i = 0; i < queues.size(); i++ ) {
+        queues[i]->push( "delayed", 0, 20 + i % 50 );
+        queues[i]->push( "expire", 1 );
+        check( queues[i]->pop().id == "expire", "shared pop" );
+    }
+
+    this_thread::sleep_for( chrono::milliseconds( 200 ));
+
+    for ( i = 0; i < queues.size(); i++ ) {
+        Queue::Msg_t msg = queues[i]->pop();
+        check( msg.id == "delayed", "shared delayed" );
+        queues[i]->ack( msg.id, msg.token );
+
+        msg = queues[i]->pop();
+        check( msg.id == "expire", "shared retry" );
+        queues[i]->ack( msg.id, msg.token );
+    }
+
+    queues.clear();
+
+    check( timers.getTaskCount() == 0, "shared task removal" );
+}
+
+int main( int argc, char ** argv ) {
+    cout << "TIMER SERVICE TESTING\n";
+
+    testTimerService();
+
+    cout << "SHARED QUEUE TESTING\n";
+
+    testSharedQueues();
+
+    cout << "PASSED\n";
+
+    return 0;
+}
@@ -0,0 +1,239 @@
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <chrono>
+#include <atomic>
+#include <cstdio>
+#include <csignal>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+#include "Queue.hpp"
+#include "TestUtil.hpp"
+
+using namespace std;
+using namespace MonQueue;
+
+Queue::Config_t walConfig( const string & a_path ) {
+    Queue::Config_t config = testConfig( 200, 1000 );
+
+    config.expire_to_failed = true;
+    config.wal_path = a_path;
+    config.wal_sync_interval = 5;
+
+    return config;
+}
+
+void testRecovery( const string & a_path ) {
+    size_t act, failed, free, records, syncs;
+    Queue::MsgOpts_t opts;
+
+    {
+        Queue q( walConfig( a_path ), &logger );
+
+        q.push( "a", 1 );
+        q.push( "b", 1 );
+        q.push( "c", 0 );
+        q.push( "d", 1, 300 );
+        q.push( "f", 1 );
+
+        opts.ttl = 20;
+        q.push( "e", 1, 0, opts );
+
+        check( popAck( q ) == "c" && popAck( q ) == "a", "completed messages" );
+
+        // Running message is restored as queued, requeued keeps new priority
+        check( q.pop().id == "b", "running message" );
+
+        Queue::Msg_t m = q.pop();
+
+        check( m.id == "f", "requeued message" );
+        q.ack( m.id, m.token, true );
+
+        this_thread::sleep_for( chrono::milliseconds( 50 ));
+
+        q.getWalStats( records, syncs );
+        check( records == 10 && syncs > 0, "transitions logged" );
+    }
+
+    auto delay_start = chrono::steady_clock::now();
+
+    {
+        Queue q( walConfig( a_path ), &logger );
+
+        q.getCounts( act, failed, free );
+        check( act == 3 && failed == 1, "state recovered" );
+
+        Queue::MsgIdList_t ids = q.getFailed();
+        check( ids.size() == 1 && ids[0] == "e", "failed message recovered" );
+
+        check( popAck( q ) == "b" && popAck( q ) == "f", "queue order recovered" );
+        check( popAck( q ) == "d", "delayed message recovered" );
+        check( chrono::steady_clock::now() - delay_start >= chrono::milliseconds( 150 ), "delay kept" );
+
+        q.requeueAllFailed();
+        check( popAck( q ) == "e", "failed message requeued" );
+    }
+
+    size_t size = fileSize( a_path );
+
+    {
+        Queue q( walConfig( a_path ), &logger );
+
+        q.getCounts( act, failed, free );
+        check( act == 0 && failed == 0, "all messages completed" );
+    }
+
+    // Compacted on recovery
+    check( fileSize( a_path ) < size / 4, "log compacted" );
+}
+
+void testTornTail( const string & a_path ) {
+    size_t act, failed, free;
+
+    {
+        Queue q( walConfig( a_path ), &logger );
+
+        for ( size_t i = 0; i < 100; i++ ) {
+            q.push( "m" + to_string( i ), 0 );
+        }
+    }
+
+    size_t size = fileSize( a_path );
+
+    // Simulate a crash mid-write: truncated last record, then garbage
+    check( truncate( a_path.c_str(), size - 3 ) == 0, "truncate log" );
+
+    {
+        ofstream out( a_path, ios::app | ios::binary );
+        out << "garbage";
+    }
+
+    errors = 0;
+
+    {
+        Queue q( walConfig( a_path ), &logger );
+
+        q.getCounts( act, failed, free );
+        check( act == 99 && errors == 1, "recovered up to torn record" );
+
+        for ( size_t i = 0; i < 99; i++ ) {
+            check( popAck( q ) == "m" + to_string( i ), "recovered order" );
+        }
+
+        q.push( "n", 0 );
+    }
+
+    {
+        Queue q( walConfig( a_path ), &logger );
+
+        q.getCounts( act, failed, free );
+        check( act == 1 && errors == 1, "log usable after torn tail" );
+    }
+}
+
+void testAckAndPush( const string & a_path ) {
+    size_t act, failed, free;
+    Queue q( walConfig( a_path ), &logger );
+    Queue::PushMsgList_t next( 2 );
+
+    q.push( "a", 0 );
+
+    Queue::Msg_t m = q.pop();
+
+    // Second follow-up does not fit the log: nothing is applied
+    next[0].id = "b";
+    next[1].id = "c";
+    next[1].opts.group = string( 70000, 'g' );
+
+    try {
+        q.ackAndPush( m.id, m.token, next );
+        check( false, "oversized follow-up rejected" );
+    } catch ( length_error & e ) {
+    }
+
+    q.getCounts( act, failed, free );
+    check( act == 1, "follow-ups not pushed" );
+
+    next[1].opts.group.clear();
+    q.ackAndPush( m.id, m.token, next );
+    check( popAck( q ) == "b" && popAck( q ) == "c", "ACK still valid" );
+}
+
+void testWriteFailure( const string & a_path ) {
+    WriteAheadLog::Record_t rec;
+    size_t records, syncs;
+    struct rlimit limit, saved;
+
+    errors = 0;
+
+    {
+        WriteAheadLog wal( a_path, 5, 1 << 20, &logger, 4096 );
+
+        wal.recover();
+        wal.start();
+
+        // Writes beyond the file size limit fail (EFBIG)
+        signal( SIGXFSZ, SIG_IGN );
+        check( getrlimit( RLIMIT_FSIZE, &saved ) == 0, "get file size limit" );
+        limit = saved;
+        limit.rlim_cur = fileSize( a_path ) + 100;
+        check( setrlimit( RLIMIT_FSIZE, &limit ) == 0, "set file size limit" );
+
+        for ( size_t i = 0; i < 10; i++ ) {
+            rec.id = "m" + to_string( i );
+            wal.append( rec );
+        }
+
+        this_thread::sleep_for( chrono::milliseconds( 50 ));
+        wal.getStats( records, syncs );
+        check( records == 10 && syncs == 0 && errors == 1, "failed commit reported once" );
+
+        // Appends wait once the pending limit is reached
+        atomic<bool> done( false );
+        thread appender( [&]() {
+            rec.id = string( 4000, 'x' );
+            wal.append( rec );
+            rec.id = "last";
+            wal.append( rec );
+            done = true;
+        });
+
+        this_thread::sleep_for( chrono::milliseconds( 50 ));
+        check( !done, "append held back" );
+
+        check( setrlimit( RLIMIT_FSIZE, &saved ) == 0, "restore file size limit" );
+        appender.join();
+
+        wal.getStats( records, syncs );
+        check( records == 12 && syncs > 0 && errors == 2, "commit retried" );
+    }
+
+    // Failed records kept, once, in order
+    WriteAheadLog wal( a_path, 5, 1 << 20, &logger );
+    vector<WriteAheadLog::Record_t> state = wal.recover();
+
+    check( state.size() == 12 && state[0].id == "m0" && state[9].id == "m9" && state[11].id == "last", "retried records recovered" );
+    check( errors == 2, "no torn records" );
+}
+
+int main( int argc, char ** argv ) {
+    string path = string( "/tmp/test_wal." ) + to_string( getpid() );
+
+    testRecovery( path );
+    remove( path.c_str() );
+
+    testTornTail( path );
+    remove( path.c_str() );
+
+    testAckAndPush( path );
+    remove( path.c_str() );
+
+    testWriteFailure( path );
+    remove( path.c_str() );
+
+    cout << "PASSED" << endl;
+
+    return 0;
+}